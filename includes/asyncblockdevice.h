@@ -0,0 +1,124 @@
+//
+//  asyncblockdevice.h
+//  myfs
+//
+
+#ifndef asyncblockdevice_h
+#define asyncblockdevice_h
+
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <sys/uio.h>
+
+#include "blockdevice.h"
+
+/// @brief Block device with asynchronous, batched I/O.
+///
+/// Requests are queued with queueRead()/queueWrite(), handed to the kernel with submit() and waited for with
+/// complete(). If the kernel supports io_uring, all queued requests are submitted with a single io_uring_enter() call;
+/// otherwise a pool of worker threads executes them with pread/pwrite. readVec() and writeVec() use this mechanism, so
+/// every run of a block list is in flight at the same time.
+///
+/// The queue/submit/complete interface is meant for a single caller at a time. readVec() and writeVec() serialize
+/// themselves and may be called from several threads.
+class AsyncBlockDevice : public BlockDevice {
+public:
+    enum Engine {
+        ENGINE_AUTO,    ///< io_uring if available, thread pool otherwise
+        ENGINE_URING,   ///< io_uring only, fall back to the thread pool if setup fails
+        ENGINE_THREADS  ///< thread pool with pread/pwrite
+    };
+
+    /// @brief Create a new asynchronous block device.
+    ///
+    /// \param blockSize Block size.
+    /// \param engine Preferred I/O engine.
+    /// \param queueDepth Number of io_uring submission queue entries.
+    /// \param nrThreads Number of worker threads for the thread pool engine.
+    AsyncBlockDevice(uint32_t blockSize, Engine engine = ENGINE_AUTO, unsigned queueDepth = 64, unsigned nrThreads = 4);
+    virtual ~AsyncBlockDevice();
+
+    /// @brief Return the engine actually in use (ENGINE_URING or ENGINE_THREADS).
+    Engine getEngine() const;
+
+    /// @brief Queue a read of count consecutive blocks into buffer.
+    ///
+    /// The buffer must stay valid until complete() returned.
+    /// \return 0 on success, -ERRNO on failure.
+    int queueRead(uint32_t firstBlockNo, uint32_t count, char *buffer);
+
+    /// @brief Queue a write of count consecutive blocks from buffer.
+    ///
+    /// The buffer must stay valid until complete() returned.
+    /// \return 0 on success, -ERRNO on failure.
+    int queueWrite(uint32_t firstBlockNo, uint32_t count, const char *buffer);
+
+    /// @brief Submit all queued requests.
+    ///
+    /// \return Number of requests submitted, -ERRNO on failure.
+    int submit();
+
+    /// @brief Wait until all submitted requests are completed.
+    ///
+    /// Requests that are still queued are submitted first. Short transfers are finished synchronously.
+    /// \return 0 if all requests succeeded, the first -ERRNO otherwise.
+    int complete();
+
+    virtual int readVec(uint32_t count, const uint32_t *blockNos, char **buffers);
+    virtual int writeVec(uint32_t count, const uint32_t *blockNos, const char **buffers);
+
+private:
+    struct Request {
+        bool doWrite;
+        off_t pos;
+        std::vector<struct iovec> iov;
+        int result;
+    };
+
+    Engine engine;
+
+    // requests of the current batch, references stay valid until complete()
+    std::deque<Request> batch;
+    size_t nextToSubmit;
+    unsigned inflight;
+    int firstError;
+    std::mutex vecLock;
+
+    // io_uring engine
+    int ringFd;
+    unsigned ringEntries;
+    void *sqRing;
+    size_t sqRingSize;
+    void *cqRing;
+    size_t cqRingSize;
+    struct io_uring_sqe *sqes;
+    size_t sqesSize;
+    unsigned *sqHead, *sqTail, *sqMask, *sqArray;
+    unsigned *cqHead, *cqTail, *cqMask;
+    struct io_uring_cqe *cqes;
+
+    bool setupUring(unsigned queueDepth);
+    void teardownUring();
+    int submitUring();
+    int reapUring(bool wait);
+
+    // thread pool engine
+    std::vector<std::thread> workers;
+    std::deque<Request *> work;
+    std::mutex workLock;
+    std::condition_variable workCond;
+    std::condition_variable doneCond;
+    bool stopping;
+
+    void setupThreads(unsigned nrThreads);
+    void worker();
+
+    int queue(bool doWrite, off_t pos, std::vector<struct iovec> &iov);
+    int queueVec(uint32_t count, const uint32_t *blockNos, char *const *buffers, bool doWrite);
+    void finish(Request &req, long res);
+};
+
+#endif /* asyncblockdevice_h */
@@ -0,0 +1,178 @@
+//
+//  blockcache.h
+//  myfs
+//
+
+#ifndef blockcache_h
+#define blockcache_h
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "blockdevice.h"
+
+/// @brief Block cache in front of a block device.
+///
+/// The cache keeps a fixed number of blocks in memory and uses a segmented LRU replacement policy: new blocks enter a
+/// probationary segment and are promoted to a protected segment when they are accessed again, so a single large scan
+/// does not flush frequently used blocks. A cache with capacity 0 passes all requests to the device.
+///
+/// By default, writes are passed through to the device and update the cache. In write-back mode, written blocks are
+/// only marked dirty. A background thread writes them to the device, sorted by block number so that consecutive blocks
+/// are written with one call, whenever the flush interval expires or more than half of the allowed dirty bytes are
+/// buffered. A writer that exceeds the dirty limit flushes synchronously.
+///
+/// prefetch() reads blocks ahead of their use. They enter the probationary segment as if they had not been accessed
+/// yet, so the first real access does not promote them and a prefetched scan stays as evictable as a plain one.
+///
+/// All methods are thread-safe. The device is not accessed while the cache lock is held.
+class BlockCache {
+public:
+    struct Stats {
+        uint64_t hits;
+        uint64_t misses;
+        uint64_t evictions;
+        uint64_t flushedBlocks;
+        uint64_t blocksRead;        // blocks read from the device
+        uint64_t blocksWritten;     // blocks written to the device
+        uint64_t prefetched;        // blocks read by prefetch()
+        uint64_t prefetchHits;      // prefetched blocks read before they were evicted
+    };
+
+    /// @brief Create a new block cache.
+    ///
+    /// \param device Block device the cache reads from and writes to. The device is not owned by the cache.
+    /// \param blockSize Block size of the device.
+    /// \param capacity Number of blocks the cache can hold.
+    BlockCache(BlockDevice *device, uint32_t blockSize, uint32_t capacity);
+    ~BlockCache();
+
+    /// @brief Switch the cache to write-back mode and start the flusher thread.
+    ///
+    /// \param maxDirtyBytes Upper bound for dirty data, at most half of the cache is used.
+    /// \param flushIntervalMs Dirty blocks are written at least this often.
+    void enableWriteBack(uint64_t maxDirtyBytes, unsigned flushIntervalMs);
+
+    /// @brief Write all dirty blocks to the device.
+    /// \return 0 on success, -ERRNO on failure.
+    int flush();
+
+    /// @brief Read a block, from the cache if possible.
+    /// \return 0 on success, -ERRNO on failure.
+    int read(uint32_t blockNo, char *buffer);
+
+    /// @brief Write a block through the cache.
+    /// \return 0 on success, -ERRNO on failure.
+    int write(uint32_t blockNo, const char *buffer);
+
+    /// @brief Read a run of consecutive blocks, see BlockDevice::readBlocks().
+    int readBlocks(uint32_t firstBlockNo, uint32_t count, char *buffer);
+
+    /// @brief Write a run of consecutive blocks, see BlockDevice::writeBlocks().
+    int writeBlocks(uint32_t firstBlockNo, uint32_t count, const char *buffer);
+
+    /// @brief Read a list of blocks, see BlockDevice::readVec().
+    ///
+    /// Blocks found in the cache are copied, all missing blocks are read from the device with a single readVec() call.
+    int readVec(uint32_t count, const uint32_t *blockNos, char **buffers);
+
+    /// @brief Write a list of blocks, see BlockDevice::writeVec().
+    int writeVec(uint32_t count, const uint32_t *blockNos, const char **buffers);
+
+    /// @brief Read blocks into the cache that are expected to be read soon.
+    ///
+    /// Blocks already in the cache are skipped, the others are read from the device with a single readVec() call.
+    /// Does nothing if the cache has capacity 0.
+    /// \return 0 on success, -ERRNO on failure.
+    int prefetch(uint32_t count, const uint32_t *blockNos);
+
+    /// @brief Remove a block from the cache, e.g. after it was written to the device directly.
+    ///
+    /// Dirty data of the block is discarded.
+    void invalidate(uint32_t blockNo);
+
+    /// @brief Write dirty blocks of a run of consecutive blocks to the device.
+    ///
+    /// Used before the caller accesses the device directly. When the call returns, no older copy of the blocks is
+    /// pending in the cache. With discard, the blocks are also removed from the cache, e.g. because the caller is about
+    /// to overwrite them on the device.
+    /// \return 0 on success, -ERRNO on failure.
+    int writeOut(uint32_t firstBlockNo, uint32_t count, bool discard);
+
+    /// @brief Return hit, miss and eviction counters.
+    Stats getStats();
+
+    uint32_t getCapacity() const;
+
+private:
+    enum Segment : uint8_t {
+        SEG_FREE,
+        SEG_PROBATION,
+        SEG_PROTECTED
+    };
+
+    struct Entry {
+        uint32_t blockNo;
+        uint32_t prev;
+        uint32_t next;
+        Segment segment;
+        bool dirty;
+        bool writeBack;     // being written by flush(), must not be evicted
+        bool prefetched;    // read by prefetch() and not accessed since
+    };
+
+    struct List {
+        uint32_t head;
+        uint32_t tail;
+        uint32_t size;
+    };
+
+    BlockDevice *device;
+    uint32_t blockSize;
+    uint32_t capacity;
+    uint32_t protectedCapacity;
+
+    std::mutex lock;
+    std::vector<char> data;
+    std::vector<Entry> entries;
+    std::unordered_map<uint32_t, uint32_t> slots;
+    std::vector<uint32_t> freeSlots;
+    List probation;
+    List protectedList;
+
+    // incremented by every write, used to detect writes during an unlocked device read
+    uint64_t writeGeneration;
+
+    Stats stats;
+    // device transfers happen without the cache lock
+    std::atomic<uint64_t> blocksRead;
+    std::atomic<uint64_t> blocksWritten;
+
+    // write-back mode
+    bool writeBackMode;
+    uint32_t maxDirtyBlocks;
+    uint32_t dirtyBlocks;
+    std::chrono::milliseconds flushInterval;
+    std::mutex flushLock;
+    std::condition_variable flushCond;
+    std::thread flusher;
+    bool stopping;
+
+    void flusherLoop();
+
+    char *slotData(uint32_t slot);
+    List &listOf(Segment segment);
+    void unlink(uint32_t slot);
+    void pushFront(Segment segment, uint32_t slot);
+    void touch(uint32_t slot);
+    uint32_t allocateSlot();
+    uint32_t store(uint32_t blockNo, const char *buffer);
+};
+
+#endif /* blockcache_h */
@@ -13,6 +13,9 @@
 
 #include <stdio.h>
 #include <cstdint>
+#include <sys/types.h>
+
+struct iovec;
 
 #define BD_BLOCK_SIZE 512
 
@@ -21,10 +24,12 @@
 /// This class emulates access to a generic block device (e.g. a hard disc or USB drive partition) using the
 /// local file system.
 class BlockDevice {
-private:
+protected:
     uint32_t blockSize;
     int contFile;
     // uint32_t size;
+
+    int transfer(struct iovec *iov, int iovcnt, off_t pos, bool doWrite);
     
 public:
     /// @brief Create a new block device.
@@ -32,13 +37,14 @@ public:
     /// Create a block device object with a given block size.
     /// \param blockSize Block size.
     BlockDevice(uint32_t blockSize);
+    virtual ~BlockDevice();
 
     /// @brief Open an existing container file.
     ///
     /// This methods opens an existing container file and attaches it to the block device object.
     /// \param path Path of the container file.
     /// \return 0 on success, -ERRNO on failure.
-    int open(const char* path);
+    virtual int open(const char* path);
 
     /// @brief Create a new container file.
     ///
@@ -47,13 +53,13 @@ public:
     ///
     /// \param path Path of the container file.
     /// \return 0 on success, -ERRNO on failure.
-    int create(const char* path);
+    virtual int create(const char* path);
 
     /// @brief Close a container file.
     ///
     /// This method closes a container file.
     /// \return 0 on success, -ERRNO on failure.
-    int close();
+    virtual int close();
 
     /// @brief Read a block.
     ///
@@ -62,7 +68,7 @@ public:
     /// \param [in] blockNo Number of the block to read.
     /// \param [out] buffer Buffer for storing the content of the block.
     /// \return 0 on success, -ERRNO on failure.
-    int read(uint32_t blockNo, char *buffer);
+    virtual int read(uint32_t blockNo, char *buffer);
 
     /// @brief Write a block
     ///
@@ -71,7 +77,72 @@ public:
     /// \param [in] blockNo Number of the block to write.
     /// \param [out] buffer Buffer storing the content to write.
     /// \return 0 on success, -ERRNO on failure.
-    int write(uint32_t blockNo, char *buffer);
+    virtual int write(uint32_t blockNo, char *buffer);
+
+    /// @brief Read a run of consecutive blocks.
+    ///
+    /// This method reads count blocks starting with block firstBlockNo using a single positional read. Note that the
+    /// size of the buffer must be at least count blocks. Blocks beyond the end of the container file are read as zeros.
+    /// \param [in] firstBlockNo Number of the first block to read.
+    /// \param [in] count Number of blocks to read.
+    /// \param [out] buffer Buffer for storing the content of the blocks.
+    /// \return 0 on success, -ERRNO on failure.
+    virtual int readBlocks(uint32_t firstBlockNo, uint32_t count, char *buffer);
+
+    /// @brief Write a run of consecutive blocks.
+    ///
+    /// This method writes count blocks starting with block firstBlockNo using a single positional write. Note that the
+    /// size of the buffer must be at least count blocks.
+    /// \param [in] firstBlockNo Number of the first block to write.
+    /// \param [in] count Number of blocks to write.
+    /// \param [in] buffer Buffer storing the content to write.
+    /// \return 0 on success, -ERRNO on failure.
+    virtual int writeBlocks(uint32_t firstBlockNo, uint32_t count, const char *buffer);
+
+    /// @brief Read a list of blocks (scatter).
+    ///
+    /// This method reads the blocks blockNos[0..count-1] into buffers[0..count-1]. Block numbers that follow each other
+    /// are merged into a single vectored read, so reading a mostly contiguous block chain costs one syscall per run.
+    /// \param [in] count Number of blocks to read.
+    /// \param [in] blockNos Numbers of the blocks to read.
+    /// \param [out] buffers One buffer of at least one block per entry in blockNos.
+    /// \return 0 on success, -ERRNO on failure.
+    virtual int readVec(uint32_t count, const uint32_t *blockNos, char **buffers);
+
+    /// @brief Write a list of blocks (gather).
+    ///
+    /// This method writes buffers[0..count-1] to the blocks blockNos[0..count-1]. Block numbers that follow each other
+    /// are merged into a single vectored write.
+    /// \param [in] count Number of blocks to write.
+    /// \param [in] blockNos Numbers of the blocks to write.
+    /// \param [in] buffers One buffer of at least one block per entry in blockNos.
+    /// \return 0 on success, -ERRNO on failure.
+    virtual int writeVec(uint32_t count, const uint32_t *blockNos, const char **buffers);
+
+    /// @brief Flush written blocks to stable storage.
+    ///
+    /// \return 0 on success, -ERRNO on failure.
+    virtual int sync();
+
+    /// @brief Change the block size.
+    ///
+    /// Used once the block size of a container is known, e.g. from its superblock. Must not be called while I/O is in
+    /// progress.
+    /// \param blockSize New block size, a multiple of 512.
+    void setBlockSize(uint32_t blockSize);
+
+    /// @brief Return the block size.
+    uint32_t getBlockSize() const;
+
+    /// @brief Return the file descriptor of the container file.
+    ///
+    /// Lets FUSE splice data directly between /dev/fuse and the container. Data written this way bypasses any block
+    /// cache in front of the device.
+    /// \return File descriptor, -1 if no container file is open.
+    int getFd() const;
+
+private:
+    int transferVec(uint32_t count, const uint32_t *blockNos, char *const *buffers, bool doWrite);
 };
 
 #endif /* blockdevice_h */
@@ -0,0 +1,23 @@
+//
+//  byteorder.h
+//  myfs
+//
+
+#ifndef byteorder_h
+#define byteorder_h
+
+#include <cstdint>
+#include <endian.h>
+
+// Byte order of the on-disk structures, which are little endian. Each field is converted on its own, so on little
+// endian hosts these compile to nothing.
+inline uint16_t fromDisk(uint16_t v) { return le16toh(v); }
+inline uint32_t fromDisk(uint32_t v) { return le32toh(v); }
+inline uint64_t fromDisk(uint64_t v) { return le64toh(v); }
+inline int32_t fromDisk(int32_t v) { return (int32_t) le32toh((uint32_t) v); }
+inline uint16_t toDisk(uint16_t v) { return htole16(v); }
+inline uint32_t toDisk(uint32_t v) { return htole32(v); }
+inline uint64_t toDisk(uint64_t v) { return htole64(v); }
+inline int32_t toDisk(int32_t v) { return (int32_t) htole32((uint32_t) v); }
+
+#endif /* byteorder_h */
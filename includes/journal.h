@@ -0,0 +1,193 @@
+//
+//  journal.h
+//  myfs
+//
+
+#ifndef journal_h
+#define journal_h
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "blockcache.h"
+#include "blockdevice.h"
+
+// Magic numbers of the header, descriptor and commit blocks
+#define JOURNAL_MAGIC 0x4c4e524a5346594dULL     // "MYFSJRNL"
+#define JOURNAL_DESCRIPTOR_MAGIC 0x4353444aU    // "JDSC"
+#define JOURNAL_COMMIT_MAGIC 0x4d4d434aU        // "JCMM"
+#define JOURNAL_VERSION 1
+
+/// @brief Write-ahead journal for metadata blocks.
+///
+/// Metadata blocks are not written to their home location right away. The file system passes images of modified
+/// blocks to log(), where they are collected in the running transaction. commit() writes the running transaction as a
+/// whole to a circular log in a reserved region of the device, so many operations share one sequential write (group
+/// commit); a background thread commits at least every commit interval. Committed images are written to their home
+/// locations by checkpoint() only when the log runs out of space or the file system is unmounted. After a crash,
+/// recover() writes all committed transactions again, so the metadata reflects the last commit and never half an
+/// operation.
+///
+/// Operations that pass blocks to log() more than once hold a JournalHandle, which keeps their blocks in one
+/// transaction.
+///
+/// Block 0 of the region is the header, the other blocks form the log. A transaction consists of descriptor blocks,
+/// each followed by the images of the blocks it lists, and a commit block with a checksum over all of them. Log blocks
+/// are written to the device directly, home locations through the block cache.
+///
+/// All methods are thread-safe. Lock order: handle, commitLock, lock.
+class Journal {
+public:
+    struct Stats {
+        uint64_t commits;
+        uint64_t blocksWritten;     // log blocks written, including descriptor and commit blocks
+        uint64_t checkpoints;
+    };
+
+    /// @brief Create a journal object for a region of the device.
+    ///
+    /// \param cache Block cache used for the home locations, not owned by the journal.
+    /// \param device Device the log is written to, not owned by the journal.
+    /// \param blockSize Block size of the device.
+    /// \param start First block of the region.
+    /// \param length Number of blocks in the region, including the header.
+    Journal(BlockCache *cache, BlockDevice *device, uint32_t blockSize, uint32_t start, uint32_t length);
+    ~Journal();
+
+    /// @brief Return the smallest region whose log holds a transaction of the given number of images.
+    ///
+    /// \param blockSize Block size of the device.
+    /// \param maxImages Number of distinct blocks a transaction may contain.
+    /// \return Number of blocks in the region, including the header.
+    static uint32_t minLength(uint32_t blockSize, uint32_t maxImages);
+
+    /// @brief Write an empty journal to the region.
+    /// \return 0 on success, -ERRNO on failure.
+    int format();
+
+    /// @brief Replay all committed transactions found in the log.
+    ///
+    /// Must be called once before the metadata is read from the device.
+    /// \return Number of transactions replayed, -ENOENT if the region holds no journal, other -ERRNO on failure.
+    int recover();
+
+    /// @brief Start the thread committing the running transaction periodically.
+    void start(unsigned commitIntervalMs);
+
+    /// @brief Add block images to the running transaction, replacing earlier images of the same blocks.
+    ///
+    /// All blocks of one call end up in the same transaction.
+    void log(uint32_t count, const uint32_t *blockNos, const char **buffers);
+
+    /// @brief Write the running transaction to the log.
+    /// \param sync Flush the device afterwards, so the transaction survives a power failure.
+    /// \return 0 on success, -ERRNO on failure.
+    int commit(bool sync);
+
+    /// @brief Write all committed images to their home locations and free the log.
+    /// \return 0 on success, -ERRNO on failure.
+    int checkpoint();
+
+    /// @brief Return the sequence number of the running transaction.
+    uint64_t getRunningSequence();
+
+    /// @brief Return the sequence number of the last transaction written to the log.
+    uint64_t getCommittedSequence();
+
+    Stats getStats();
+
+private:
+    friend class JournalHandle;
+
+    // On-disk records at the start of their block, little endian; the block numbers of a descriptor follow it
+    struct Header {
+        uint64_t magic;
+        uint32_t version;
+        uint32_t length;
+        uint64_t sequence;  // first transaction to replay
+        uint32_t tail;      // log position of its first block
+    };
+
+    struct Descriptor {
+        uint32_t magic;
+        uint32_t count;     // block numbers following the descriptor
+        uint64_t sequence;
+    };
+
+    struct Commit {
+        uint32_t magic;
+        uint32_t count;     // images in the transaction
+        uint64_t sequence;
+        uint32_t checksum;
+    };
+
+    typedef std::map<uint32_t, std::vector<char>> Images;
+
+    BlockCache *cache;
+    BlockDevice *device;
+    uint32_t blockSize;
+    uint32_t regionStart;
+    uint32_t logSize;       // blocks in the log, without the header
+    uint32_t tagsPerBlock;  // block numbers per descriptor
+
+    // protected by lock
+    std::mutex lock;
+    std::condition_variable idle;
+    Images running;
+    uint64_t runningSequence;
+    int active;             // open handles
+    bool swapping;          // a commit waits for the handles to close
+    Stats stats;
+
+    // protected by commitLock
+    std::mutex commitLock;
+    Images committed;       // images not yet written to their home locations
+    uint32_t head;          // next free log position
+    uint32_t tail;          // first log position not yet checkpointed
+    uint64_t tailSequence;
+    std::atomic<uint64_t> committedSequence;
+
+    // commit thread
+    std::chrono::milliseconds commitInterval;
+    std::condition_variable commitCond;
+    std::thread committer;
+    bool stopping;
+
+    void begin();
+    void end();
+    void commitLoop();
+    int checkpointLocked();
+    int writeHeader();
+    int writeHome(const Images &images);
+    uint32_t logBlock(uint32_t pos) const;
+    uint32_t logUsed() const;
+    static uint32_t checksum(uint32_t hash, const char *data, size_t size);
+    static void decode(const char *ptr, Header &header);
+    static void decode(const char *ptr, Descriptor &descriptor);
+    static void decode(const char *ptr, Commit &commit);
+    static void encode(const Header &header, char *ptr);
+    static void encode(const Descriptor &descriptor, char *ptr);
+    static void encode(const Commit &commit, char *ptr);
+};
+
+/// @brief Keeps all blocks an operation logs in the same transaction, from construction to destruction.
+///
+/// Must be created before any lock of the file system is taken, because it waits while a commit closes the running
+/// transaction. Handles nest within a thread; a null journal makes the handle a no-op.
+class JournalHandle {
+public:
+    explicit JournalHandle(Journal *journal);
+    ~JournalHandle();
+
+private:
+    Journal *journal;
+    static thread_local int depth;
+};
+
+#endif /* journal_h */
@@ -0,0 +1,216 @@
+//
+//  logger.h
+//  myfs
+//
+
+#ifndef logger_h
+#define logger_h
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Log levels, selected with the mount option loglevel=
+enum LogLevel {
+    LOG_NONE = 0,   // nothing is logged
+    LOG_INFO,       // messages written with LOG() and LOGF()
+    LOG_DEBUG       // additionally each method call and return value (LOGM(), RETURN()), the default
+};
+
+#define LOG_RECORD_SIZE 256         // bytes per record, longer strings are truncated
+#define LOG_RING_SLOTS 1024         // records buffered per thread, must be a power of two
+#define LOG_MAX_ARGS 8              // arguments per record
+#define LOG_DRAIN_INTERVAL_MS 20    // the drain thread looks for new records at least this often
+
+/// @brief Asynchronous logger.
+///
+/// Each thread that logs gets its own single-producer/single-consumer ring of fixed-size binary records. Logging a
+/// message only copies the format string pointer and the arguments into the ring; no lock is taken and no system call
+/// is made. A background thread drains all rings, orders the records by time, formats them and writes them to the log
+/// file. If the ring of a thread is full, the record is dropped and counted rather than blocking the caller.
+///
+/// Format strings, function and file names must be string literals, since only pointers to them are stored. String
+/// arguments are copied. Arguments must be integers, floating point numbers, strings or pointers.
+class Logger {
+public:
+    Logger();
+    ~Logger();
+
+    Logger(const Logger &) = delete;
+    Logger &operator=(const Logger &) = delete;
+
+    /// @brief Start writing records to a file. Records logged before are dropped.
+    ///
+    /// \param file Log file, not closed by the logger.
+    /// \param level Records above this level are not logged.
+    void start(FILE *file, int level);
+
+    /// @brief Write all pending records and stop the drain thread. Later records are dropped.
+    void stop();
+
+    /// @brief Write all records logged so far to the log file.
+    void flush();
+
+    /// @brief Parse a log level given as mount option.
+    /// \return Log level, -1 if the string is not a valid level.
+    static int parseLevel(const char *str);
+
+    bool enabled(int level) const {
+        return level <= this->level.load(std::memory_order_relaxed);
+    }
+
+    /// @brief Log the call of a method.
+    void logMethod(const char *file, int line, const char *func) {
+        Record *r = beginRecord(KIND_METHOD);
+        if (r != nullptr) {
+            r->fmt = file;
+            r->func = func;
+            r->value = line;
+            commitRecord();
+        }
+    }
+
+    /// @brief Log the return value of a method.
+    void logReturn(const char *func, long long value) {
+        Record *r = beginRecord(KIND_RETURN);
+        if (r != nullptr) {
+            r->func = func;
+            r->value = value;
+            commitRecord();
+        }
+    }
+
+    /// @brief Log a message in printf format.
+    template<typename... Args>
+    void log(const char *fmt, Args... args) {
+        static_assert(sizeof...(Args) <= LOG_MAX_ARGS, "too many log arguments");
+        Record *r = beginRecord(KIND_FORMAT);
+        if (r != nullptr) {
+            r->fmt = fmt;
+            size_t strPos = 0;
+            encode(r, strPos, args...);
+            commitRecord();
+        }
+    }
+
+    /// @brief Return the number of records dropped because a ring was full.
+    uint64_t getDropped();
+
+private:
+    enum RecordKind : uint8_t {
+        KIND_METHOD,
+        KIND_RETURN,
+        KIND_FORMAT
+    };
+
+    enum ArgType : uint8_t {
+        ARG_INT,
+        ARG_UINT,
+        ARG_DOUBLE,
+        ARG_STRING,     // copied into Record::strings, the value is the offset
+        ARG_POINTER
+    };
+
+    union Arg {
+        long long i;
+        unsigned long long u;
+        double d;
+        const void *p;
+    };
+
+    struct RecordHeader {
+        uint64_t time;          // ns since an arbitrary epoch, orders the records of different threads
+        const char *fmt;        // format string, file name for KIND_METHOD
+        const char *func;
+        long long value;        // line for KIND_METHOD, return value for KIND_RETURN
+        RecordKind kind;
+        uint8_t nargs;
+        ArgType types[LOG_MAX_ARGS];
+        Arg args[LOG_MAX_ARGS];
+    };
+
+    struct Record : RecordHeader {
+        char strings[LOG_RECORD_SIZE - sizeof(RecordHeader)];
+    };
+
+    /// Written by one thread, drained by the drain thread. head and tail are kept in separate cache lines.
+    struct Ring {
+        std::thread::id owner;
+        std::atomic<uint32_t> head;     // next slot to write, only changed by the owner
+        char pad1[64];
+        std::atomic<uint32_t> tail;     // next slot to drain, only changed by the drain thread
+        char pad2[64];
+        std::atomic<uint64_t> dropped;
+        Record slots[LOG_RING_SLOTS];
+    };
+
+    std::atomic<int> level;
+    uint64_t serial;            // identifies the logger in the per-thread ring cache
+
+    // protects rings, taken by threads logging for the first time and by the drain thread
+    std::mutex ringsLock;
+    std::vector<Ring *> rings;
+
+    // serializes draining
+    std::mutex drainLock;
+    FILE *file;
+    std::vector<std::pair<uint64_t, const Record *>> batch;
+    std::string line;
+
+    std::mutex threadLock;
+    std::condition_variable wakeup;
+    std::thread drainThread;
+    bool stopping;
+
+    Ring *getRing();
+    void drainLoop();
+    void drain();
+    void formatRecord(const Record *r);
+
+    Record *beginRecord(RecordKind kind);
+    void commitRecord();
+
+    static void encode(Record *r, size_t &strPos) {
+    }
+
+    template<typename T, typename... Rest>
+    static void encode(Record *r, size_t &strPos, T arg, Rest... rest) {
+        encodeArg(r, strPos, arg);
+        encode(r, strPos, rest...);
+    }
+
+    static void encodeArg(Record *r, size_t &strPos, int v) { setArg(r, ARG_INT).i = v; }
+    static void encodeArg(Record *r, size_t &strPos, long v) { setArg(r, ARG_INT).i = v; }
+    static void encodeArg(Record *r, size_t &strPos, long long v) { setArg(r, ARG_INT).i = v; }
+    static void encodeArg(Record *r, size_t &strPos, unsigned v) { setArg(r, ARG_UINT).u = v; }
+    static void encodeArg(Record *r, size_t &strPos, unsigned long v) { setArg(r, ARG_UINT).u = v; }
+    static void encodeArg(Record *r, size_t &strPos, unsigned long long v) { setArg(r, ARG_UINT).u = v; }
+    static void encodeArg(Record *r, size_t &strPos, double v) { setArg(r, ARG_DOUBLE).d = v; }
+    static void encodeArg(Record *r, size_t &strPos, const void *v) { setArg(r, ARG_POINTER).p = v; }
+    static void encodeArg(Record *r, size_t &strPos, const char *v) {
+        // Copy the string, truncated to the space left in the record. Once the space is used up, further strings
+        // share the last byte and are empty.
+        if (v == nullptr) {
+            v = "(null)";
+        }
+        size_t len = strnlen(v, sizeof(r->strings) - strPos - 1);
+        memcpy(r->strings + strPos, v, len);
+        r->strings[strPos + len] = '\0';
+        setArg(r, ARG_STRING).u = strPos;
+        strPos = strPos + len + 1 < sizeof(r->strings) ? strPos + len + 1 : sizeof(r->strings) - 1;
+    }
+    static void encodeArg(Record *r, size_t &strPos, char *v) { encodeArg(r, strPos, (const char *) v); }
+
+    static Arg &setArg(Record *r, ArgType type) {
+        r->types[r->nargs] = type;
+        return r->args[r->nargs++];
+    }
+};
+
+#endif /* logger_h */
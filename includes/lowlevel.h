@@ -0,0 +1,70 @@
+//
+//  lowlevel.h
+//  myfs
+//
+
+#ifndef lowlevel_h
+#define lowlevel_h
+
+#include <fuse_lowlevel.h>
+#include <fuse_opt.h>
+
+#include "myfs-info.h"
+
+// fixed inode of the statistics file, see MyFS::statsGetattr()
+#define STATS_INO (FUSE_ROOT_ID + 1)
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/// @brief Mount the file system selected with setInstance() through the FUSE low-level API and serve requests until
+/// it is unmounted.
+/// \param [in] args Command line arguments left over after parsing the MyFS options.
+/// \param [in] info Mount options passed to MyFS::setup().
+/// \param [in] timeout Seconds the kernel may cache attributes and directory entries.
+/// \param [in] keepCache Keep cached file data in the kernel when a file is opened.
+/// \return 0 on success, 1 on failure.
+int lowlevel_main(struct fuse_args *args, struct MyFsInfo *info, double timeout, int keepCache);
+
+#ifdef __cplusplus
+}
+
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+
+#include "nameindex.h"
+
+/// @brief Inode numbers handed out to the kernel by the low-level front end.
+///
+/// Each inode refers to a file by the id returned from MyFS::fuseLookupId() and counts the lookups the kernel has not
+/// yet forgotten. The name is only needed for lookups and for operations that MyFS still implements by path. Inode
+/// numbers are never reused, so a stale inode of a deleted file cannot reach a new file. Not thread-safe.
+class InodeTable {
+public:
+    struct Inode {
+        int64_t id;         // file id, -1 once the file was deleted
+        std::string name;   // file name without "/", empty once the file was deleted
+        uint64_t nlookup;   // lookups not yet forgotten by the kernel
+    };
+
+    InodeTable();
+
+    fuse_ino_t lookup(const char *name, int64_t id);
+    void forget(fuse_ino_t ino, uint64_t nlookup);
+    Inode *find(fuse_ino_t ino);
+    fuse_ino_t findName(const char *name);
+    void remove(const char *name);
+    void rename(const char *name, const char *newName);
+    size_t size() const;
+
+private:
+    std::unordered_map<fuse_ino_t, Inode> inodes;
+    NameIndex<fuse_ino_t> names;    // keys point to the names stored in inodes
+    fuse_ino_t nextIno;
+};
+
+#endif
+
+#endif /* lowlevel_h */
@@ -15,12 +15,14 @@ fprintf(stderr, str "\n");\
 exit(-1);\
 } while(0)
 
+// The macros log through this->logger, see logger.h. Arguments are formatted by the drain thread of the logger.
+
 #ifdef DEBUG
 #define LOGF(fmt, ...) \
-do { fprintf(this->logFile, "\t" fmt "\n", __VA_ARGS__); } while (0)
+do { if (this->logger.enabled(LOG_INFO)) { this->logger.log(fmt, __VA_ARGS__); } } while (0)
 
 #define LOG(text) \
-do { fprintf(this->logFile, "\t" text "\n"); } while (0)
+do { if (this->logger.enabled(LOG_INFO)) { this->logger.log(text); } } while (0)
 #else
 #define LOGF(fmt, ...)
 #define LOG(text)
@@ -28,15 +30,15 @@ do { fprintf(this->logFile, "\t" text "\n"); } while (0)
 
 #ifdef DEBUG_METHODS
 #define LOGM() \
-do { fprintf(this->logFile, "%s:%d:%s()\n", __FILE__, \
-__LINE__, __func__); } while (0)
+do { if (this->logger.enabled(LOG_DEBUG)) { this->logger.logMethod(__FILE__, __LINE__, __func__); } } while (0)
 #else
 #define LOGM()
 #endif
 
+// ret is evaluated once
 #ifdef DEBUG_RETURN_VALUES
 #define RETURN(ret) \
-fprintf(this->logFile, "%s() returned %d\n", __func__, ret); return ret;
+{ auto ret_ = (ret); if (this->logger.enabled(LOG_DEBUG)) { this->logger.logReturn(__func__, ret_); } return ret_; }
 #else
 #define RETURN(ret) return ret;
 #endif
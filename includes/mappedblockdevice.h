@@ -0,0 +1,60 @@
+//
+//  mappedblockdevice.h
+//  myfs
+//
+
+#ifndef mappedblockdevice_h
+#define mappedblockdevice_h
+
+#include <sys/types.h>
+
+#include "blockdevice.h"
+#include "rwlock.h"
+
+/// @brief Block device that maps the container file into memory.
+///
+/// Reads and writes are plain memcpy() calls on a shared mapping of the container, so no block access costs a system
+/// call and the kernel page cache does the readahead. sync() writes the mapping back with msync().
+///
+/// Only the part of the mapping below the end of the container file is touched. Writes behind the end grow the file
+/// with ftruncate() and, if needed, the mapping with mremap(); reads behind the end yield zeros. Data written through
+/// getFd() is visible through the mapping, since both share the page cache.
+///
+/// All methods are thread-safe. Block transfers share mapLock, growing the file or the mapping holds it exclusively,
+/// because mremap() may move the mapping.
+class MappedBlockDevice : public BlockDevice {
+public:
+    /// @brief Create a new memory-mapped block device.
+    ///
+    /// \param blockSize Block size.
+    MappedBlockDevice(uint32_t blockSize);
+    virtual ~MappedBlockDevice();
+
+    virtual int open(const char *path);
+    virtual int create(const char *path);
+    virtual int close();
+
+    virtual int readBlocks(uint32_t firstBlockNo, uint32_t count, char *buffer);
+    virtual int writeBlocks(uint32_t firstBlockNo, uint32_t count, const char *buffer);
+    virtual int readVec(uint32_t count, const uint32_t *blockNos, char **buffers);
+    virtual int writeVec(uint32_t count, const uint32_t *blockNos, const char **buffers);
+
+    /// @brief Write the mapping back with msync() and flush the container file.
+    ///
+    /// \return 0 on success, -ERRNO on failure.
+    virtual int sync();
+
+private:
+    // protected by mapLock
+    RWLock mapLock;
+    char *map;
+    size_t mapSize;
+    off_t fileSize;
+
+    int attach(int ret);
+    void copyOut(off_t pos, size_t size, char *buffer);
+    int lockRange(off_t end, bool doWrite);
+    int grow(off_t end, bool doWrite);
+};
+
+#endif /* mappedblockdevice_h */
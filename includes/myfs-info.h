@@ -11,9 +11,27 @@
 #ifndef myfs_info_h
 #define myfs_info_h
 
+// Access time update policy (mount options relatime, strictatime, noatime)
+enum {
+    ATIME_RELATIME = 0, // update only if atime is older than mtime/ctime or a day old (default)
+    ATIME_STRICT,       // update on every read
+    ATIME_NONE          // never update
+};
+
 struct MyFsInfo {
     char *logFile;
     char *contFile;
+    char *ioEngine;     // "sync" (default), "uring", "threads", "auto" or "mmap"
+    char *cacheSize;    // size of the block cache, e.g. "16M"
+    int writeBack;      // buffer written blocks in the block cache
+    char *maxDirty;     // upper bound for buffered dirty data in write-back mode, e.g. "1M"
+    int atimeMode;      // one of ATIME_RELATIME, ATIME_STRICT, ATIME_NONE
+    char *maxWrite;     // largest write request accepted from the kernel, e.g. "128K"
+    char *readAhead;    // kernel readahead window, e.g. "128K"
+    char *logLevel;     // "none", "info" or "debug" (default), see logger.h
+    char *containerSize; // size of a new container file, e.g. "1G"
+    char *blockSize;    // block size of a new container file, e.g. "4K"
+    int multiThreaded;  // requests are served by several threads
 };
 
 #endif /* myfs_info_h */
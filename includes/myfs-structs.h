@@ -9,25 +9,84 @@
 #ifndef myfs_structs_h
 #define myfs_structs_h
 
+#include <cstdint>
 #include <string>
 #include <array>
+#include <vector>
 
 // FS Constants
+// Block size of version 1 containers and default for new containers (mount option blocksize). Version 2 containers
+// store their block size in the superblock, a power of two between MIN_BLOCK_SIZE and MAX_BLOCK_SIZE.
 const int BLOCK_SIZE = 512;
+const int MIN_BLOCK_SIZE = 512;
+const int MAX_BLOCK_SIZE = 64 * 1024;
 
-// BLT Constants
+// Default size of the block cache in bytes (mount option cachesize)
+const long long DEFAULT_CACHE_SIZE = 4 * 1024 * 1024;
+
+// Write-back mode: default bound for dirty data (mount option maxdirty) and interval of the background flusher
+const long long DEFAULT_MAX_DIRTY = 1024 * 1024;
+const unsigned WRITEBACK_INTERVAL_MS = 1000;
+
+// Requests negotiated with the kernel in fuseInit(): default size of write requests (mount option maxwrite) and of
+// the readahead window (mount option readahead). Without big writes, the kernel splits writes into single pages.
+const long long DEFAULT_MAX_WRITE = 128 * 1024;
+const long long DEFAULT_READAHEAD = 128 * 1024;
+
+// read_buf/write_buf requests of at least this size are passed to FUSE as buffers of the container file, so the
+// kernel can splice them; smaller requests are copied through memory and the block cache
+const size_t ZERO_COPY_MIN_SIZE = 16 * 1024;
+
+// Readahead of MyOnDiskFS for sequential reads of an open file: the window starts at twice the request, doubles with
+// every sequential read up to MAX_READAHEAD bytes (at most a quarter of the block cache) and is halved by random reads.
+// Prefetches are done by a worker thread; if more than READAHEAD_QUEUE_LENGTH are pending, new ones are dropped.
+const long long MAX_READAHEAD = 1024 * 1024;
+const unsigned READAHEAD_QUEUE_LENGTH = 16;
+
+// Timestamp-only FAT changes are written lazily: by a background thread at the latest after this many seconds, or
+// earlier with other FAT changes and on flush/fsync/unmount
+const int FAT_SYNC_INTERVAL_S = 5;
+
+// relatime: access times older than this are updated even if the file was not changed since the last access
+const int RELATIME_INTERVAL_S = 24 * 60 * 60;
+
+// Format version 2: block 0 holds a superBlock, followed by FAT, BLT and journal, all sized at format time from the
+// size of the container (mount option containersize). Block numbers are 32 bit.
+const uint64_t SUPERBLOCK_MAGIC = 0x3242535346594d00ULL;    // "\0MYFSSB2", never the start of a version 1 FAT
+const uint32_t FORMAT_VERSION_1 = 1;
+const uint32_t FORMAT_VERSION_2 = 2;
+const long long DEFAULT_CONTAINER_SIZE = 32 * 1024 * 1024;
+const long long MIN_CONTAINER_SIZE = 2 * 1024 * 1024;
+const long long BYTES_PER_FAT_ENTRY = 64 * 1024;            // one FAT entry per 64 KiB of container
+const uint32_t MIN_FAT_ENTRIES = 64;
+const uint32_t MAX_FAT_ENTRIES = 1 << 20;
+const int FAT_ENTRY_SIZE_V2 = 72;                           // bytes per FAT entry on disk
+const int BLT_ENTRY_SIZE_V2 = 4;                            // bytes per BLT entry on disk
+
+// Format version 1: fixed layout without superblock, FAT in blocks 0-7, BLT in blocks 8-263, 16 bit block numbers
 const int TOTAL_BLT_ENTRIES = 0x10000;
 const int BLT_BLOCKS = 256;
 const int BLT_ENTRIES_PER_BLOCK = 256;
-
-const unsigned short BLT_FREE = 0x0000; // Free Block
-const unsigned short BLT_EOF = 0x0001;  // End of File
-const unsigned short BLT_RSV = 0x0002;  // Reserved
-
-// FAT Constants
 const int TOTAL_FAT_ENTRIES = 64;
 const int FAT_BLOCKS = 8;
 const int FAT_ENTRIES_PER_BLOCK = 8;
+const int FAT_ENTRY_SIZE_V1 = 64;
+const int BLT_ENTRY_SIZE_V1 = 2;
+
+// Special BLT entries, other values are the number of the next block of the file
+const uint32_t BLT_FREE = 0x0000; // Free Block
+const uint32_t BLT_EOF = 0x0001;  // End of File
+const uint32_t BLT_RSV = 0x0002;  // Reserved
+
+// Metadata journal, reserved in the BLT. Version 1 containers have it in their last blocks if they were created with
+// one; containers without it are still mounted, with FAT and BLT written in place. Version 2 containers keep the
+// journal size of JOURNAL_BLOCKS blocks of 512 bytes, but use at least MIN_JOURNAL_BLOCKS blocks and enough to log a
+// transaction touching every FAT and BLT block.
+const int JOURNAL_BLOCKS = 1024;
+const int MIN_JOURNAL_BLOCKS = 64;
+const int JOURNAL_START = TOTAL_BLT_ENTRIES - JOURNAL_BLOCKS;
+const unsigned JOURNAL_COMMIT_INTERVAL_MS = 1000;
+
 const int MAX_NAME_LENGTH = 32;
 
 struct myFsFile {
@@ -38,7 +97,7 @@ struct myFsFile {
     int accessTime; // letzter Zugriff
     int modTime;    // letzte Veränderung
     int changeTime; // letzte Statusänderung
-    char *data;     // Pointer auf Daten-anfang
+    std::vector<char *> pages; // Seiten mit den Daten, je MEM_PAGE_SIZE Bytes aus dem PagePool
     off_t size;        // Dateigröße, in bytes
     blkcnt_t nrBlocks; // Number of 512B blocks allocated
 };
@@ -51,9 +110,57 @@ struct fatEntry {
     int accessTime;                     // 4 Byte
     int modTime;                        // 4 Byte
     int changeTime;                     // 4 Byte
-    unsigned short startBlock;          // 2 Byte
-    unsigned short nrBlocks;            // 2 Byte
-    off_t size;                         // 4 Byte
+    uint32_t startBlock;                // 2 Byte in version 1, 4 Byte in version 2
+    uint32_t nrBlocks;                  // 2 Byte in version 1, 4 Byte in version 2
+    off_t size;                         // 4 Byte in version 1, 8 Byte in version 2
+};
+
+/// @brief FAT entry as stored in version 1 containers, little endian.
+struct __attribute__((packed)) diskFatEntryV1 {
+    char filename[MAX_NAME_LENGTH];
+    uint32_t uid;
+    uint32_t groupId;
+    uint32_t mode;
+    int32_t accessTime;
+    int32_t modTime;
+    int32_t changeTime;
+    uint16_t startBlock;
+    uint16_t nrBlocks;
+    uint32_t size;
+};
+static_assert(sizeof(diskFatEntryV1) == FAT_ENTRY_SIZE_V1, "version 1 FAT entries are 64 bytes on disk");
+
+/// @brief FAT entry as stored in version 2 containers, little endian.
+struct __attribute__((packed)) diskFatEntryV2 {
+    char filename[MAX_NAME_LENGTH];
+    uint32_t uid;
+    uint32_t groupId;
+    uint32_t mode;
+    int32_t accessTime;
+    int32_t modTime;
+    int32_t changeTime;
+    uint32_t startBlock;
+    uint32_t nrBlocks;
+    uint64_t size;
+};
+static_assert(sizeof(diskFatEntryV2) == FAT_ENTRY_SIZE_V2, "version 2 FAT entries are 72 bytes on disk");
+
+/// @brief Superblock of format version 2 in block 0, describes the layout of the container. Stored little endian.
+///
+/// Version 1 containers have no superblock, their fixed layout is described by a superBlock built when mounting.
+struct superBlock {
+    uint64_t magic;
+    uint32_t version;
+    uint32_t blockSize;
+    uint32_t totalBlocks;               // blocks in the container, including all metadata
+    uint32_t fatStart;                  // first block of the FAT
+    uint32_t fatBlocks;
+    uint32_t fatEntries;                // number of files the container can hold
+    uint32_t bltStart;                  // first block of the BLT, with one entry per block of the container
+    uint32_t bltBlocks;
+    uint32_t journalStart;              // first block of the journal
+    uint32_t journalBlocks;             // 0 if the container has no journal
 };
+static_assert(sizeof(superBlock) == 48, "the superblock has no padding");
 
 #endif /* myfs_structs_h */
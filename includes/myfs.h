@@ -11,14 +11,19 @@
 
 #include <fuse.h>
 #include <cmath>
+#include <string>
 
 #include "blockdevice.h"
+#include "logger.h"
 #include "myfs-structs.h"
+#include "myfs-info.h"
+#include "stats.h"
 
 class MyFS {
 protected:
     static MyFS *_instance;
     FILE *logFile;
+    Logger logger;
 
     BlockDevice *blockDevice;
     
@@ -48,6 +53,8 @@ public:
     virtual int fuseOpen(const char *path, struct fuse_file_info *fileInfo);
     virtual int fuseRead(const char *path, char *buf, size_t size, off_t offset, struct fuse_file_info *fileInfo);
     virtual int fuseWrite(const char *path, const char *buf, size_t size, off_t offset, struct fuse_file_info *fileInfo);
+    virtual int fuseReadBuf(const char *path, struct fuse_bufvec **bufp, size_t size, off_t offset, struct fuse_file_info *fileInfo);
+    virtual int fuseWriteBuf(const char *path, struct fuse_bufvec *buf, off_t offset, struct fuse_file_info *fileInfo);
     virtual int fuseStatfs(const char *path, struct statvfs *statInfo);
     virtual int fuseFlush(const char *path, struct fuse_file_info *fileInfo);
     virtual int fuseRelease(const char *path, struct fuse_file_info *fileInfo);
@@ -71,6 +78,30 @@ public:
     virtual void fuseDestroy();
     
     // TODO: [PART 2] You may add methods of your file system here
+
+    // --- Methods called by the low-level front end (lowlevel.cpp) ---
+    // A file id names a file independent of its path until the file is deleted
+    virtual int setup(MyFsInfo *info);
+    int startLogging(MyFsInfo *info);
+    virtual int64_t fuseLookupId(const char *path);
+    virtual int fuseGetattrId(int64_t id, struct stat *statbuf);
+    virtual int fuseReadId(int64_t id, char *buf, size_t size, off_t offset, struct fuse_file_info *fileInfo);
+    virtual int fuseWriteId(int64_t id, const char *buf, size_t size, off_t offset, struct fuse_file_info *fileInfo);
+
+    // --- Statistics file STATS_FILE_NAME, served by the front ends (wrap.cpp, lowlevel.cpp) ---
+    // Counters of all operations, updated by the front ends
+    OpStats opStats;
+
+    static bool isStatsFile(const char *path);
+    virtual void formatStats(std::string &out);
+    int statsGetattr(struct stat *statbuf);
+    int statsOpen(struct fuse_file_info *fileInfo);
+    int statsRead(char *buf, size_t size, off_t offset, struct fuse_file_info *fileInfo);
+    int statsReadBuf(struct fuse_bufvec **bufp, size_t size, off_t offset, struct fuse_file_info *fileInfo);
+    int statsRelease(struct fuse_file_info *fileInfo);
+
+    static long long parseSize(const char *str);
+    void negotiateConnection(struct fuse_conn_info *conn, MyFsInfo *info);
     
 };
 
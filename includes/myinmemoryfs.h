@@ -9,11 +9,24 @@
 #include <fuse.h>
 #include <cmath>
 #include <list>
+#include <unordered_map>
 
 
 #include "myfs.h"
 #include "blockdevice.h"
 #include "myfs-structs.h"
+#include "myfs-info.h"
+#include "nameindex.h"
+#include "pagepool.h"
+#include "rwlock.h"
+
+/// @brief File of the in-memory file system.
+///
+/// The lock protects attributes and data of the file.
+struct MemFile : public myFsFile {
+    int64_t id;     // see fuseLookupId()
+    RWLock lock;
+};
 
 /// @brief In-memory implementation of a simple file system.
 class MyInMemoryFS : public MyFS {
@@ -25,7 +38,20 @@ public:
 
     // TODO: [PART 1] Add attributes of your file system here
 
-    std::list<myFsFile> files = {};
+    std::list<MemFile> files = {};
+
+    // file name -> list entry, keys point to the names stored in files
+    NameIndex<std::list<MemFile>::iterator> fileIndex;
+
+    // file id -> file, ids are never reused
+    std::unordered_map<int64_t, MemFile *> fileIds;
+    int64_t nextFileId;
+
+    // protects files, fileIndex, fileIds and file names, taken before the lock of a file
+    RWLock tableLock;
+
+    // pages holding the data of all files
+    PagePool pagePool;
 
     MyInMemoryFS();
     ~MyInMemoryFS();
@@ -49,11 +75,23 @@ public:
     virtual int fuseReaddir(const char *path, void *buf, fuse_fill_dir_t filler, off_t offset, struct fuse_file_info *fileInfo);
     virtual int fuseTruncate(const char *path, off_t offset, struct fuse_file_info *fileInfo);
     virtual void fuseDestroy();
+    virtual int64_t fuseLookupId(const char *path);
+    virtual int fuseGetattrId(int64_t id, struct stat *statbuf);
+    virtual int fuseReadId(int64_t id, char *buf, size_t size, off_t offset, struct fuse_file_info *fileInfo);
+    virtual int fuseWriteId(int64_t id, const char *buf, size_t size, off_t offset, struct fuse_file_info *fileInfo);
 
     // TODO: Add methods of your file system here
 
+    virtual int setup(MyFsInfo *info);
     int findFile(const char *path, myFsFile **file);
+    MemFile *lockFile(const char *path, bool exclusive);
+    MemFile *lockFileId(int64_t id, bool exclusive);
+    void statFile(MemFile *file, struct stat *statbuf);
+    int readFile(MemFile *file, char *buf, size_t size, off_t offset);
+    int writeFile(MemFile *file, const char *buf, size_t size, off_t offset);
     int resizeFile(myFsFile *file, off_t newsize);
+    void releasePages(myFsFile *file);
+    virtual void formatStats(std::string &out);
 };
 
 #endif //MYFS_MYINMEMORYFS_H
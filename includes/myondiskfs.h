@@ -6,24 +6,129 @@
 #ifndef MYFS_MYONDISKFS_H
 #define MYFS_MYONDISKFS_H
 
+#include <atomic>
+#include <condition_variable>
+#include <deque>
 #include <list>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <thread>
+#include <vector>
 #include "myfs.h"
+#include "myfs-info.h"
+#include "blockcache.h"
+#include "journal.h"
+#include "nameindex.h"
+#include "rwlock.h"
 #include <stdio.h>
 #include <time.h>
 
+/// @brief State of an open file, fuse_file_info::fh points to it.
+struct OpenFile {
+    std::atomic<int> index;     // FAT index, -1 after the file was deleted
+
+    // sequential readahead, see MyOnDiskFS::readahead()
+    std::mutex readaheadLock;
+    off_t nextOffset = 0;       // start of the next read if the file is read sequentially
+    uint32_t window = 0;        // readahead window in blocks
+    uint32_t prefetchedEnd = 0; // first block of the file not yet prefetched
+};
+
 /// @brief On-disk implementation of a simple file system.
 class MyOnDiskFS : public MyFS {
 protected:
     // BlockDevice blockDevice;
+    BlockCache *blockCache;
 
 public:
     static MyOnDiskFS *Instance();
 
     // TODO: [PART 1] Add attributes of your file system here
-    fatEntry fat[64];
-    unsigned short blt[0x10000];
+    // layout of the container, from the superblock or the fixed layout of version 1 containers
+    superBlock layout;
+    uint32_t fatEntrySize;          // bytes per FAT entry on disk
+    uint32_t fatEntriesPerBlock;
+    uint32_t bltEntrySize;          // bytes per BLT entry on disk
+    uint32_t bltEntriesPerBlock;
+
+    // FAT and BLT, sized by resizeTables() according to the layout
+    std::vector<fatEntry> fat;
+    std::vector<uint32_t> blt;
     std::list<myFsFile> files = {};
 
+    // metadata journal, nullptr for containers created without one
+    Journal *journal;
+
+    // file name -> FAT index, keys point to the names in fat[], and unused FAT indices (lowest index last)
+    NameIndex<int> fileIndex;
+    std::vector<int> freeFatEntries;
+
+    // logical -> physical block numbers of all blocks per FAT entry
+    std::vector<std::vector<uint32_t>> blockMaps;
+
+    // incremented when the file in a FAT entry is deleted, part of the ids returned by fuseLookupId()
+    std::vector<uint32_t> fatGeneration;
+
+    // files opened with fuseOpen() and not yet released
+    std::vector<OpenFile *> openFiles;
+
+    // free blocks: bit set if the BLT entry is BLT_FREE, number of free blocks and start of the next search, see
+    // allocateExtent()
+    std::vector<uint64_t> freeBitmap;
+    uint32_t freeBlockCount;
+    uint32_t allocCursor;
+
+    // blocks freed with a journal and the transaction freeing them, not yet in the free block bitmap
+    std::vector<std::pair<uint64_t, uint32_t>> pendingFrees;
+
+    // FAT and BLT blocks modified since the last writeFat()/writeBlt(), relative to the start of the table
+    std::set<uint32_t> fatDirty;
+    std::set<uint32_t> bltDirty;
+
+    // serialized FAT blocks and their block numbers, reused by readFat()/writeFat()
+    std::vector<char> fatBuffer;
+    std::vector<uint32_t> fatBlockNos;
+    std::vector<const char *> fatBuffers;
+
+    // readahead worker, prefetches lists of container blocks into the block cache
+    std::thread readaheadThread;
+    std::mutex readaheadQueueLock;
+    std::condition_variable readaheadCond;
+    std::deque<std::vector<uint32_t>> readaheadQueue;
+    bool readaheadStopping;
+    uint32_t maxReadaheadBlocks;    // 0 if readahead is disabled
+
+    // writes timestamp-only FAT changes every FAT_SYNC_INTERVAL_S seconds, see writeFatLazy()
+    std::thread fatSyncThread;
+    std::mutex fatSyncStopLock;
+    std::condition_variable fatSyncCond;
+    bool fatSyncStopping;
+
+    // requests are served by several threads, see fuseReadBuf()
+    bool multiThreaded;
+
+    // access time policy (ATIME_*) and time of the last FAT write, for lazy timestamp updates
+    int atimeMode;
+    time_t lastFatWrite;
+
+    // metadata statistics: blocks written by writeFat()/writeBlt() and number of calls that wrote anything
+    std::atomic<uint64_t> metaBlocksWritten;
+    std::atomic<uint64_t> metaUpdates;
+
+    // Locks, always taken in this order:
+    // JournalHandle one journal transaction per operation, see Journal
+    // metaLock      fileIndex, freeFatEntries and file names (write lock to create, delete or rename files)
+    // fileLocks[i]  size and blocks of file i (write lock to change them)
+    // allocLock     BLT, free block bitmap, pending frees, block maps and bltDirty
+    // fatLock       FAT entries and fatDirty; size and blocks may also be read with the file lock
+    // openFilesLock openFiles
+    RWLock metaLock;
+    std::unique_ptr<RWLock[]> fileLocks;
+    std::mutex allocLock;
+    std::mutex fatLock;
+    std::mutex openFilesLock;
+
 
     MyOnDiskFS();
     ~MyOnDiskFS();
@@ -39,22 +144,62 @@ public:
     virtual int fuseChmod(const char *path, mode_t mode);
     virtual int fuseChown(const char *path, uid_t uid, gid_t gid);
     virtual int fuseTruncate(const char *path, off_t newSize);
+    virtual int fuseStatfs(const char *path, struct statvfs *statInfo);
     virtual int fuseOpen(const char *path, struct fuse_file_info *fileInfo);
     virtual int fuseRead(const char *path, char *buf, size_t size, off_t offset, struct fuse_file_info *fileInfo);
     virtual int fuseWrite(const char *path, const char *buf, size_t size, off_t offset, struct fuse_file_info *fileInfo);
+    virtual int fuseReadBuf(const char *path, struct fuse_bufvec **bufp, size_t size, off_t offset, struct fuse_file_info *fileInfo);
+    virtual int fuseWriteBuf(const char *path, struct fuse_bufvec *buf, off_t offset, struct fuse_file_info *fileInfo);
+    virtual int64_t fuseLookupId(const char *path);
+    virtual int fuseGetattrId(int64_t id, struct stat *statbuf);
+    virtual int fuseReadId(int64_t id, char *buf, size_t size, off_t offset, struct fuse_file_info *fileInfo);
+    virtual int fuseWriteId(int64_t id, const char *buf, size_t size, off_t offset, struct fuse_file_info *fileInfo);
+    virtual int fuseFlush(const char *path, struct fuse_file_info *fileInfo);
     virtual int fuseRelease(const char *path, struct fuse_file_info *fileInfo);
+    virtual int fuseFsync(const char *path, int datasync, struct fuse_file_info *fileInfo);
     virtual void* fuseInit(struct fuse_conn_info *conn);
     virtual int fuseReaddir(const char *path, void *buf, fuse_fill_dir_t filler, off_t offset, struct fuse_file_info *fileInfo);
     virtual int fuseTruncate(const char *path, off_t offset, struct fuse_file_info *fileInfo);
     virtual void fuseDestroy();
 
     // TODO: Add methods of your file system here
+    int readSuperBlock();
+    int formatContainer(long long size, uint32_t blockSize);
+    void resizeTables();
     virtual int readFat();
     virtual int writeFat();
+    void decodeFatBlock(uint32_t b, const char *block);
+    void encodeFatBlock(uint32_t b, char *block);
     virtual int readBlt();
     virtual int writeBlt();
+    void markFatDirty(int index);
+    int writeFatLazy();
+    void fatSyncLoop();
+    void stopFatSync();
+    void readahead(int index, struct fuse_file_info *fileInfo, off_t offset, size_t size);
+    void readaheadLoop();
+    void stopReadahead();
+    void touchAccessTime(int index);
+    void touchModTime(int index);
+    int getContainerBufvec(int index, off_t offset, size_t size, bool discard, struct fuse_bufvec **bufp);
+    void setBltEntry(uint32_t block, uint32_t value);
+    void releasePendingFrees();
     virtual int getFileIndex(const char *path);
-    virtual int findFreeBlock(unsigned short &freeBlock);
+    void buildFileIndex();
+    const uint32_t *getBlockMap(int index);
+    int truncateFile(int index, off_t newSize);
+    virtual int setup(MyFsInfo *info);
+    virtual void formatStats(std::string &out);
+    int lockFile(const char *path, struct fuse_file_info *fileInfo, bool exclusive);
+    int lockFileId(int64_t id, bool exclusive);
+    void statFile(int index, struct stat *statbuf);
+    int readFile(int index, char *buf, size_t size, off_t offset);
+    int writeFile(int index, const char *buf, size_t size, off_t offset);
+    void removeFile(int index);
+    void buildBlockMaps();
+    void buildFreeBitmap();
+    int allocateExtent(uint32_t goal, uint32_t wanted, uint32_t &start, uint32_t &length);
+    uint32_t freeRunLength(uint32_t start, uint32_t max);
 };
 
 #endif //MYFS_MYONDISKFS_H
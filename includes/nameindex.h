@@ -0,0 +1,152 @@
+//
+//  nameindex.h
+//  myfs
+//
+
+#ifndef nameindex_h
+#define nameindex_h
+
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+/// @brief Hash index from file names to values.
+///
+/// Open addressing with linear probing over a power-of-two table, hashed with FNV-1a. The index does not copy the
+/// names: the caller keeps each inserted string alive and unchanged until it is erased (e.g. the name stored in a FAT
+/// entry). Lookups, inserts and deletes take O(1) on average, independent of the number of files.
+template <typename V>
+class NameIndex {
+public:
+    explicit NameIndex(uint32_t expectedSize = 16) : used(0), count(0) {
+        uint32_t capacity = 16;
+        while (capacity < expectedSize * 2) {
+            capacity *= 2;
+        }
+        slots.resize(capacity);
+    }
+
+    /// @brief Find the value stored for a name.
+    /// \return Pointer to the value, nullptr if the name is not in the index.
+    V *find(const char *name) {
+        int64_t pos = lookup(name, hash(name));
+        return pos < 0 ? nullptr : &slots[pos].value;
+    }
+
+    /// @brief Add a name to the index.
+    ///
+    /// \param name Name, must stay valid until it is erased.
+    /// \param value Value stored for the name.
+    /// \return false if the name is already in the index.
+    bool insert(const char *name, const V &value) {
+        uint32_t h = hash(name);
+        if (lookup(name, h) >= 0) {
+            return false;
+        }
+        if ((used + 1) * 2 > slots.size()) {
+            rehash();
+        }
+
+        uint32_t mask = slots.size() - 1;
+        uint32_t pos = h & mask;
+        while (slots[pos].state == SLOT_USED) {
+            pos = (pos + 1) & mask;
+        }
+        if (slots[pos].state == SLOT_EMPTY) {
+            used++;
+        }
+        slots[pos].state = SLOT_USED;
+        slots[pos].hash = h;
+        slots[pos].key = name;
+        slots[pos].value = value;
+        count++;
+        return true;
+    }
+
+    /// @brief Remove a name from the index.
+    /// \return false if the name is not in the index.
+    bool erase(const char *name) {
+        int64_t pos = lookup(name, hash(name));
+        if (pos < 0) {
+            return false;
+        }
+        slots[pos].state = SLOT_DELETED;
+        slots[pos].key = nullptr;
+        count--;
+        return true;
+    }
+
+    /// @brief Remove all names.
+    void clear() {
+        for (Slot &s: slots) {
+            s.state = SLOT_EMPTY;
+            s.key = nullptr;
+        }
+        used = 0;
+        count = 0;
+    }
+
+    /// @brief Return the number of names in the index.
+    uint32_t size() const {
+        return count;
+    }
+
+private:
+    enum SlotState : uint8_t {
+        SLOT_EMPTY,
+        SLOT_USED,
+        SLOT_DELETED
+    };
+
+    struct Slot {
+        const char *key = nullptr;
+        uint32_t hash = 0;
+        SlotState state = SLOT_EMPTY;
+        V value = V();
+    };
+
+    std::vector<Slot> slots;
+    uint32_t used;      // used and deleted slots, bounds the probe length
+    uint32_t count;     // used slots
+
+    static uint32_t hash(const char *name) {
+        uint32_t h = 2166136261u;
+        for (const unsigned char *p = (const unsigned char *) name; *p != 0; p++) {
+            h = (h ^ *p) * 16777619u;
+        }
+        return h;
+    }
+
+    int64_t lookup(const char *name, uint32_t h) const {
+        uint32_t mask = slots.size() - 1;
+        for (uint32_t pos = h & mask;; pos = (pos + 1) & mask) {
+            const Slot &s = slots[pos];
+            if (s.state == SLOT_EMPTY) {
+                return -1;
+            }
+            if (s.state == SLOT_USED && s.hash == h && strcmp(s.key, name) == 0) {
+                return pos;
+            }
+        }
+    }
+
+    /// @brief Drop deleted slots and grow the table if it is more than a quarter full.
+    void rehash() {
+        uint32_t capacity = slots.size();
+        if ((count + 1) * 4 > capacity) {
+            capacity *= 2;
+        }
+
+        std::vector<Slot> old(capacity);
+        old.swap(slots);
+        used = 0;
+        count = 0;
+        for (const Slot &s: old) {
+            if (s.state == SLOT_USED) {
+                insert(s.key, s.value);
+            }
+        }
+    }
+};
+
+#endif /* nameindex_h */
@@ -0,0 +1,51 @@
+//
+//  pagepool.h
+//  myfs
+//
+
+#ifndef pagepool_h
+#define pagepool_h
+
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <vector>
+
+// Size of the pages holding the data of the in-memory file system
+#define MEM_PAGE_SIZE 4096
+
+// Pages allocated from the system at once
+#define MEM_PAGES_PER_ARENA 256
+
+/// @brief Pool of fixed-size memory pages.
+///
+/// Pages are cut from arenas of MEM_PAGES_PER_ARENA pages. Released pages go to a free list and are handed out again
+/// before a new arena is allocated, so the memory of deleted or truncated files is reused by all files without
+/// fragmenting the heap. Arenas are only returned to the system when the pool is destroyed. All methods are
+/// thread-safe.
+class PagePool {
+public:
+    PagePool();
+    ~PagePool();
+
+    /// @brief Get a page filled with zeros.
+    /// \return The page, nullptr if no memory is left.
+    char *allocate();
+
+    /// @brief Return a page to the pool.
+    void release(char *page);
+
+    /// @brief Return the number of pages handed out and not released.
+    size_t getUsed();
+
+    /// @brief Return the number of released pages waiting to be reused.
+    size_t getFree();
+
+private:
+    std::mutex lock;
+    std::vector<char *> arenas;
+    std::vector<char *> freePages;
+    size_t used;
+};
+
+#endif /* pagepool_h */
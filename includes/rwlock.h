@@ -0,0 +1,110 @@
+//
+//  rwlock.h
+//  myfs
+//
+
+#ifndef rwlock_h
+#define rwlock_h
+
+#include <mutex>
+#include <pthread.h>
+
+/// @brief Reader/writer lock.
+///
+/// Thin wrapper around pthread_rwlock_t, since std::shared_mutex is not available in C++11. Writers are preferred, so
+/// a steady stream of readers cannot starve a writer.
+class RWLock {
+public:
+    RWLock() {
+        pthread_rwlockattr_t attr;
+        pthread_rwlockattr_init(&attr);
+#ifdef PTHREAD_RWLOCK_PREFER_WRITER_NONRECURSIVE_NP
+        pthread_rwlockattr_setkind_np(&attr, PTHREAD_RWLOCK_PREFER_WRITER_NONRECURSIVE_NP);
+#endif
+        pthread_rwlock_init(&lock, &attr);
+        pthread_rwlockattr_destroy(&attr);
+    }
+
+    ~RWLock() {
+        pthread_rwlock_destroy(&lock);
+    }
+
+    RWLock(const RWLock &) = delete;
+    RWLock &operator=(const RWLock &) = delete;
+
+    void lockRead() {
+        pthread_rwlock_rdlock(&lock);
+    }
+
+    void lockWrite() {
+        pthread_rwlock_wrlock(&lock);
+    }
+
+    void unlock() {
+        pthread_rwlock_unlock(&lock);
+    }
+
+private:
+    pthread_rwlock_t lock;
+};
+
+/// @brief Holds a read lock until it is released or goes out of scope.
+class ReadGuard {
+public:
+    explicit ReadGuard(RWLock &lock) : lock(&lock) {
+        lock.lockRead();
+    }
+
+    /// @brief Take over a lock that is already read-locked by the caller.
+    ReadGuard(RWLock &lock, std::adopt_lock_t) : lock(&lock) {
+    }
+
+    ~ReadGuard() {
+        unlock();
+    }
+
+    ReadGuard(const ReadGuard &) = delete;
+    ReadGuard &operator=(const ReadGuard &) = delete;
+
+    /// @brief Release the lock early, e.g. after a lock further down the hierarchy was taken.
+    void unlock() {
+        if (lock != nullptr) {
+            lock->unlock();
+            lock = nullptr;
+        }
+    }
+
+private:
+    RWLock *lock;
+};
+
+/// @brief Holds a write lock until it is released or goes out of scope.
+class WriteGuard {
+public:
+    explicit WriteGuard(RWLock &lock) : lock(&lock) {
+        lock.lockWrite();
+    }
+
+    /// @brief Take over a lock that is already write-locked by the caller.
+    WriteGuard(RWLock &lock, std::adopt_lock_t) : lock(&lock) {
+    }
+
+    ~WriteGuard() {
+        unlock();
+    }
+
+    WriteGuard(const WriteGuard &) = delete;
+    WriteGuard &operator=(const WriteGuard &) = delete;
+
+    void unlock() {
+        if (lock != nullptr) {
+            lock->unlock();
+            lock = nullptr;
+        }
+    }
+
+private:
+    RWLock *lock;
+};
+
+#endif /* rwlock_h */
@@ -0,0 +1,146 @@
+//
+//  stats.h
+//  myfs
+//
+
+#ifndef stats_h
+#define stats_h
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <string>
+
+// File system operations counted by OpStats, one per entry point of the front ends
+enum StatsOp {
+    OP_GETATTR,
+    OP_READLINK,
+    OP_MKNOD,
+    OP_MKDIR,
+    OP_UNLINK,
+    OP_RMDIR,
+    OP_SYMLINK,
+    OP_RENAME,
+    OP_LINK,
+    OP_CHMOD,
+    OP_CHOWN,
+    OP_TRUNCATE,
+    OP_UTIME,
+    OP_OPEN,
+    OP_READ,
+    OP_WRITE,
+    OP_READ_BUF,
+    OP_WRITE_BUF,
+    OP_STATFS,
+    OP_FLUSH,
+    OP_RELEASE,
+    OP_FSYNC,
+    OP_SETXATTR,
+    OP_GETXATTR,
+    OP_LISTXATTR,
+    OP_REMOVEXATTR,
+    OP_OPENDIR,
+    OP_READDIR,
+    OP_RELEASEDIR,
+    OP_FSYNCDIR,
+    OP_FTRUNCATE,
+    OP_CREATE,
+    OP_LOOKUP,
+    OP_FORGET,
+    OP_SETATTR,
+    OP_COUNT
+};
+
+// Name of the read-only file with the statistics in the root directory
+#define STATS_FILE_NAME ".myfs-stats"
+
+/// @brief Latency histogram with bounded relative error, in the style of HdrHistogram.
+///
+/// Values are sorted into 16 linear sub-buckets per power of two, so each bucket covers at most 1/16 of its lower
+/// bound. Recording is wait-free: one relaxed atomic increment per counter.
+class LatencyHistogram {
+public:
+    LatencyHistogram();
+
+    void record(uint64_t ns);
+
+    /// @brief Return the number of recorded values.
+    uint64_t getCount() const;
+
+    /// @brief Return the sum of all recorded values.
+    uint64_t getSum() const;
+
+    /// @brief Return the largest recorded value.
+    uint64_t getMax() const;
+
+    /// @brief Return an upper bound for the given quantile of the recorded values, 0 if nothing was recorded.
+    /// \param q Quantile between 0 and 1.
+    uint64_t getQuantile(double q) const;
+
+    static const int SUB_BUCKET_BITS = 4;
+    static const int SUB_BUCKETS = 1 << SUB_BUCKET_BITS;
+    static const int BUCKETS = (64 - SUB_BUCKET_BITS + 1) * SUB_BUCKETS;
+
+    static int bucketOf(uint64_t value);
+    static uint64_t bucketUpperBound(int bucket);
+
+private:
+    std::atomic<uint64_t> counts[BUCKETS];
+    std::atomic<uint64_t> count;
+    std::atomic<uint64_t> sum;
+    std::atomic<uint64_t> max;
+};
+
+/// @brief Counters of all file system operations.
+class OpStats {
+public:
+    OpStats();
+
+    /// @brief Count a finished operation.
+    /// \param op Operation, see StatsOp.
+    /// \param ns Time the operation took.
+    /// \param ret Return value, negative values count as errors.
+    /// \param bytes Bytes transferred by the operation.
+    void record(int op, uint64_t ns, int ret, uint64_t bytes);
+
+    /// @brief Append all counters and histograms in the Prometheus text format.
+    void format(std::string &out) const;
+
+    const LatencyHistogram &getHistogram(int op) const;
+    uint64_t getErrors(int op) const;
+    uint64_t getBytes(int op) const;
+
+    static const char *opName(int op);
+
+private:
+    LatencyHistogram latency[OP_COUNT];
+    std::atomic<uint64_t> errors[OP_COUNT];
+    std::atomic<uint64_t> bytes[OP_COUNT];
+};
+
+/// @brief Measures the time of one operation from construction to done().
+class OpTimer {
+public:
+    OpTimer(OpStats &stats, int op) : stats(stats), op(op), start(std::chrono::steady_clock::now()) {
+    }
+
+    /// @brief Record the operation.
+    /// \return ret, so the caller can return the result of done().
+    int done(int ret, uint64_t bytes = 0) {
+        std::chrono::nanoseconds elapsed = std::chrono::steady_clock::now() - start;
+        stats.record(op, elapsed.count(), ret, bytes);
+        return ret;
+    }
+
+private:
+    OpStats &stats;
+    int op;
+    std::chrono::steady_clock::time_point start;
+};
+
+/// @brief Append one line in the Prometheus text format, e.g. myfs_cache_hits_total 42.
+/// \param labels Labels without braces, e.g. op="read", may be empty.
+void appendMetric(std::string &out, const char *name, const char *labels, uint64_t value);
+void appendMetric(std::string &out, const char *name, const char *labels, double value);
+
+#endif /* stats_h */
@@ -0,0 +1,384 @@
+//
+//  asyncblockdevice.cpp
+//  myfs
+//
+
+#include <algorithm>
+#include <climits>
+#include <cstring>
+#include <errno.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+#ifdef HAVE_IO_URING
+#include <linux/io_uring.h>
+#endif
+
+#include "asyncblockdevice.h"
+
+AsyncBlockDevice::AsyncBlockDevice(uint32_t blockSize, Engine engine, unsigned queueDepth, unsigned nrThreads)
+        : BlockDevice(blockSize), nextToSubmit(0), inflight(0), firstError(0), ringFd(-1), ringEntries(0),
+          sqRing(MAP_FAILED), sqRingSize(0), cqRing(MAP_FAILED), cqRingSize(0), sqes(nullptr), sqesSize(0),
+          stopping(false) {
+
+    if (engine != ENGINE_THREADS && setupUring(queueDepth)) {
+        this->engine = ENGINE_URING;
+    } else {
+        this->engine = ENGINE_THREADS;
+        setupThreads(nrThreads);
+    }
+}
+
+AsyncBlockDevice::~AsyncBlockDevice() {
+    complete();
+
+    if (engine == ENGINE_URING) {
+        teardownUring();
+    } else {
+        {
+            std::lock_guard<std::mutex> guard(workLock);
+            stopping = true;
+        }
+        workCond.notify_all();
+        for (auto &t: workers) {
+            t.join();
+        }
+    }
+}
+
+AsyncBlockDevice::Engine AsyncBlockDevice::getEngine() const {
+    return engine;
+}
+
+int AsyncBlockDevice::queueRead(uint32_t firstBlockNo, uint32_t count, char *buffer) {
+    std::vector<struct iovec> iov(1);
+    iov[0].iov_base = buffer;
+    iov[0].iov_len = (size_t) count * this->blockSize;
+
+    return queue(false, (off_t) firstBlockNo * this->blockSize, iov);
+}
+
+int AsyncBlockDevice::queueWrite(uint32_t firstBlockNo, uint32_t count, const char *buffer) {
+    std::vector<struct iovec> iov(1);
+    iov[0].iov_base = const_cast<char *>(buffer);
+    iov[0].iov_len = (size_t) count * this->blockSize;
+
+    return queue(true, (off_t) firstBlockNo * this->blockSize, iov);
+}
+
+int AsyncBlockDevice::queue(bool doWrite, off_t pos, std::vector<struct iovec> &iov) {
+    batch.push_back(Request());
+    Request &req = batch.back();
+    req.doWrite = doWrite;
+    req.pos = pos;
+    req.iov.swap(iov);
+    req.result = 0;
+    return 0;
+}
+
+// Queue one request per run of consecutive block numbers
+int AsyncBlockDevice::queueVec(uint32_t count, const uint32_t *blockNos, char *const *buffers, bool doWrite) {
+    uint32_t i = 0;
+    while (i < count) {
+        uint32_t runStart = i;
+        std::vector<struct iovec> iov;
+        do {
+            struct iovec v;
+            v.iov_base = buffers[i];
+            v.iov_len = this->blockSize;
+            iov.push_back(v);
+            i++;
+        } while (i < count && iov.size() < IOV_MAX && blockNos[i] == blockNos[i - 1] + 1);
+
+        int ret = queue(doWrite, (off_t) blockNos[runStart] * this->blockSize, iov);
+        if (ret < 0)
+            return ret;
+    }
+    return 0;
+}
+
+int AsyncBlockDevice::submit() {
+    if (engine == ENGINE_URING)
+        return submitUring();
+
+    int submitted = 0;
+    {
+        std::lock_guard<std::mutex> guard(workLock);
+        while (nextToSubmit < batch.size()) {
+            work.push_back(&batch[nextToSubmit++]);
+            inflight++;
+            submitted++;
+        }
+    }
+    workCond.notify_all();
+    return submitted;
+}
+
+int AsyncBlockDevice::complete() {
+    if (engine == ENGINE_URING) {
+        while (nextToSubmit < batch.size() || inflight > 0) {
+            if (nextToSubmit < batch.size()) {
+                int ret = submitUring();
+                // Give up on the rest of the batch, but wait for the requests the kernel already has
+                if (ret < 0)
+                    nextToSubmit = batch.size();
+            }
+            int ret = reapUring(true);
+            if (ret < 0 && ret != -EINTR) {
+                if (firstError == 0)
+                    firstError = ret;
+                break;
+            }
+        }
+    } else {
+        submit();
+        std::unique_lock<std::mutex> lock(workLock);
+        doneCond.wait(lock, [this] { return inflight == 0; });
+    }
+
+    int ret = firstError;
+    batch.clear();
+    nextToSubmit = 0;
+    firstError = 0;
+    return ret;
+}
+
+// this method returns 0 if successful, -errno otherwise
+int AsyncBlockDevice::readVec(uint32_t count, const uint32_t *blockNos, char **buffers) {
+    std::lock_guard<std::mutex> guard(vecLock);
+    int ret = queueVec(count, blockNos, buffers, false);
+    int ret2 = complete();
+    return ret < 0 ? ret : ret2;
+}
+
+// this method returns 0 if successful, -errno otherwise
+int AsyncBlockDevice::writeVec(uint32_t count, const uint32_t *blockNos, const char **buffers) {
+    std::lock_guard<std::mutex> guard(vecLock);
+    int ret = queueVec(count, blockNos, const_cast<char *const *>(buffers), true);
+    int ret2 = complete();
+    return ret < 0 ? ret : ret2;
+}
+
+// Record the result of an asynchronous request. Short transfers are finished synchronously.
+void AsyncBlockDevice::finish(Request &req, long res) {
+    if (res >= 0) {
+        struct iovec *iov = req.iov.data();
+        int iovcnt = req.iov.size();
+        off_t pos = req.pos + res;
+        while (iovcnt > 0 && (size_t) res >= iov->iov_len) {
+            res -= iov->iov_len;
+            iov++;
+            iovcnt--;
+        }
+        if (iovcnt > 0) {
+            iov->iov_base = (char *) iov->iov_base + res;
+            iov->iov_len -= res;
+            res = transfer(iov, iovcnt, pos, req.doWrite);
+        } else {
+            res = 0;
+        }
+    }
+
+    req.result = (int) res;
+    if (res < 0 && firstError == 0)
+        firstError = (int) res;
+}
+
+// ---------------------------------------------------------------------------------------------------------------------
+// io_uring engine (raw system calls, no liburing needed)
+// ---------------------------------------------------------------------------------------------------------------------
+
+#if defined(HAVE_IO_URING) && defined(__NR_io_uring_setup)
+
+bool AsyncBlockDevice::setupUring(unsigned queueDepth) {
+    struct io_uring_params p;
+    memset(&p, 0, sizeof(p));
+
+    ringFd = (int) syscall(__NR_io_uring_setup, queueDepth, &p);
+    if (ringFd < 0)
+        return false;
+
+    ringEntries = p.sq_entries;
+    sqRingSize = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    cqRingSize = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    if (p.features & IORING_FEAT_SINGLE_MMAP) {
+        sqRingSize = std::max(sqRingSize, cqRingSize);
+        cqRingSize = sqRingSize;
+    }
+
+    sqRing = mmap(nullptr, sqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringFd, IORING_OFF_SQ_RING);
+    if (sqRing == MAP_FAILED) {
+        teardownUring();
+        return false;
+    }
+    if (p.features & IORING_FEAT_SINGLE_MMAP) {
+        cqRing = sqRing;
+    } else {
+        cqRing = mmap(nullptr, cqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringFd,
+                      IORING_OFF_CQ_RING);
+        if (cqRing == MAP_FAILED) {
+            teardownUring();
+            return false;
+        }
+    }
+
+    sqesSize = p.sq_entries * sizeof(struct io_uring_sqe);
+    void *ptr = mmap(nullptr, sqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringFd, IORING_OFF_SQES);
+    if (ptr == MAP_FAILED) {
+        teardownUring();
+        return false;
+    }
+    sqes = (struct io_uring_sqe *) ptr;
+
+    char *sq = (char *) sqRing;
+    sqHead = (unsigned *) (sq + p.sq_off.head);
+    sqTail = (unsigned *) (sq + p.sq_off.tail);
+    sqMask = (unsigned *) (sq + p.sq_off.ring_mask);
+    sqArray = (unsigned *) (sq + p.sq_off.array);
+
+    char *cq = (char *) cqRing;
+    cqHead = (unsigned *) (cq + p.cq_off.head);
+    cqTail = (unsigned *) (cq + p.cq_off.tail);
+    cqMask = (unsigned *) (cq + p.cq_off.ring_mask);
+    cqes = (struct io_uring_cqe *) (cq + p.cq_off.cqes);
+
+    return true;
+}
+
+void AsyncBlockDevice::teardownUring() {
+    if (sqes != nullptr)
+        munmap(sqes, sqesSize);
+    if (cqRing != MAP_FAILED && cqRing != sqRing)
+        munmap(cqRing, cqRingSize);
+    if (sqRing != MAP_FAILED)
+        munmap(sqRing, sqRingSize);
+    if (ringFd >= 0)
+        ::close(ringFd);
+
+    sqes = nullptr;
+    sqRing = cqRing = MAP_FAILED;
+    ringFd = -1;
+}
+
+// Put as many queued requests into the submission queue as possible and hand them to the kernel with one call
+int AsyncBlockDevice::submitUring() {
+    unsigned tail = *sqTail;
+    unsigned head = __atomic_load_n(sqHead, __ATOMIC_ACQUIRE);
+    unsigned toSubmit = 0;
+
+    // never have more requests in flight than the completion queue can hold
+    while (nextToSubmit < batch.size() && tail - head < ringEntries && inflight < ringEntries) {
+        Request &req = batch[nextToSubmit++];
+        unsigned idx = tail & *sqMask;
+
+        struct io_uring_sqe *sqe = &sqes[idx];
+        memset(sqe, 0, sizeof(*sqe));
+        sqe->opcode = req.doWrite ? IORING_OP_WRITEV : IORING_OP_READV;
+        sqe->fd = this->contFile;
+        sqe->addr = (uint64_t) (uintptr_t) req.iov.data();
+        sqe->len = req.iov.size();
+        sqe->off = req.pos;
+        sqe->user_data = (uint64_t) (uintptr_t) &req;
+
+        sqArray[idx] = idx;
+        tail++;
+        toSubmit++;
+        inflight++;
+    }
+    __atomic_store_n(sqTail, tail, __ATOMIC_RELEASE);
+
+    int submitted = 0;
+    while (toSubmit > 0) {
+        int ret = (int) syscall(__NR_io_uring_enter, ringFd, toSubmit, 0, 0, nullptr, 0);
+        if (ret < 0) {
+            if (errno == EINTR || errno == EAGAIN)
+                continue;
+            ret = -errno;
+
+            // The kernel did not consume the last entries, take them back so they are not counted as in flight. Their
+            // requests are lost, complete() reports the error.
+            __atomic_store_n(sqTail, tail - toSubmit, __ATOMIC_RELEASE);
+            inflight -= toSubmit;
+            if (firstError == 0)
+                firstError = ret;
+            return ret;
+        }
+        toSubmit -= ret;
+        submitted += ret;
+    }
+    return submitted;
+}
+
+// Process all available completions, optionally waiting for at least one
+int AsyncBlockDevice::reapUring(bool wait) {
+    unsigned head = *cqHead;
+
+    if (wait && inflight > 0 && head == __atomic_load_n(cqTail, __ATOMIC_ACQUIRE)) {
+        int ret = (int) syscall(__NR_io_uring_enter, ringFd, 0, 1, IORING_ENTER_GETEVENTS, nullptr, 0);
+        if (ret < 0)
+            return -errno;
+    }
+
+    while (head != __atomic_load_n(cqTail, __ATOMIC_ACQUIRE)) {
+        struct io_uring_cqe *cqe = &cqes[head & *cqMask];
+        finish(*(Request *) (uintptr_t) cqe->user_data, cqe->res);
+        inflight--;
+        head++;
+    }
+    __atomic_store_n(cqHead, head, __ATOMIC_RELEASE);
+
+    return 0;
+}
+
+#else
+
+bool AsyncBlockDevice::setupUring(unsigned queueDepth) {
+    return false;
+}
+
+void AsyncBlockDevice::teardownUring() {
+}
+
+int AsyncBlockDevice::submitUring() {
+    return -ENOSYS;
+}
+
+int AsyncBlockDevice::reapUring(bool wait) {
+    return -ENOSYS;
+}
+
+#endif
+
+// ---------------------------------------------------------------------------------------------------------------------
+// Thread pool engine
+// ---------------------------------------------------------------------------------------------------------------------
+
+void AsyncBlockDevice::setupThreads(unsigned nrThreads) {
+    for (unsigned i = 0; i < std::max(nrThreads, 1u); i++) {
+        workers.push_back(std::thread(&AsyncBlockDevice::worker, this));
+    }
+}
+
+void AsyncBlockDevice::worker() {
+    std::unique_lock<std::mutex> lock(workLock);
+    while (true) {
+        workCond.wait(lock, [this] { return stopping || !work.empty(); });
+        if (work.empty())
+            return;
+
+        Request *req = work.front();
+        work.pop_front();
+
+        lock.unlock();
+        int ret = transfer(req->iov.data(), req->iov.size(), req->pos, req->doWrite);
+        lock.lock();
+
+        req->result = ret;
+        if (ret < 0 && firstError == 0)
+            firstError = ret;
+        if (--inflight == 0)
+            doneCond.notify_all();
+    }
+}
@@ -0,0 +1,540 @@
+//
+//  blockcache.cpp
+//  myfs
+//
+
+#include <algorithm>
+#include <cstring>
+
+#include "blockcache.h"
+
+static const uint32_t NIL = UINT32_MAX;
+
+BlockCache::BlockCache(BlockDevice *device, uint32_t blockSize, uint32_t capacity)
+        : device(device), blockSize(blockSize), capacity(capacity), data((size_t) capacity * blockSize),
+          entries(capacity), writeGeneration(0), writeBackMode(false), maxDirtyBlocks(0), dirtyBlocks(0),
+          flushInterval(0), stopping(false) {
+
+    // up to 80% of the cache may be used by blocks that have been accessed more than once
+    protectedCapacity = capacity - capacity / 5;
+
+    probation = {NIL, NIL, 0};
+    protectedList = {NIL, NIL, 0};
+    stats = {0, 0, 0, 0, 0, 0, 0, 0};
+    blocksRead = 0;
+    blocksWritten = 0;
+
+    slots.reserve(capacity);
+    freeSlots.reserve(capacity);
+    for (uint32_t i = capacity; i > 0; i--) {
+        entries[i - 1].segment = SEG_FREE;
+        freeSlots.push_back(i - 1);
+    }
+}
+
+BlockCache::~BlockCache() {
+    if (flusher.joinable()) {
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            stopping = true;
+        }
+        flushCond.notify_all();
+        flusher.join();
+    }
+
+    flush();
+}
+
+void BlockCache::enableWriteBack(uint64_t maxDirtyBytes, unsigned flushIntervalMs) {
+    if (capacity == 0 || writeBackMode)
+        return;
+
+    // keep at least half of the cache clean, so eviction never has to wait for a write
+    maxDirtyBlocks = (uint32_t) std::min<uint64_t>(maxDirtyBytes / blockSize, capacity / 2);
+    maxDirtyBlocks = std::max(maxDirtyBlocks, 1u);
+    flushInterval = std::chrono::milliseconds(flushIntervalMs);
+    writeBackMode = true;
+
+    flusher = std::thread(&BlockCache::flusherLoop, this);
+}
+
+// Background thread writing dirty blocks periodically or when signalled by a writer
+void BlockCache::flusherLoop() {
+    std::unique_lock<std::mutex> guard(lock);
+    while (!stopping) {
+        flushCond.wait_for(guard, flushInterval);
+        if (stopping || dirtyBlocks == 0)
+            continue;
+
+        guard.unlock();
+        flush();
+        guard.lock();
+    }
+}
+
+// this method returns 0 if successful, -errno otherwise
+int BlockCache::flush() {
+    std::lock_guard<std::mutex> flushGuard(flushLock);
+
+    // Take a snapshot of all dirty blocks, sorted by block number
+    std::vector<std::pair<uint32_t, uint32_t>> dirty;
+    std::vector<char> snapshot;
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        if (dirtyBlocks == 0)
+            return 0;
+
+        dirty.reserve(dirtyBlocks);
+        for (uint32_t slot = 0; slot < capacity; slot++) {
+            if (entries[slot].segment != SEG_FREE && entries[slot].dirty) {
+                dirty.push_back(std::make_pair(entries[slot].blockNo, slot));
+            }
+        }
+        std::sort(dirty.begin(), dirty.end());
+
+        snapshot.resize(dirty.size() * blockSize);
+        for (size_t i = 0; i < dirty.size(); i++) {
+            Entry &e = entries[dirty[i].second];
+            memcpy(snapshot.data() + i * blockSize, slotData(dirty[i].second), blockSize);
+            e.dirty = false;
+            e.writeBack = true;
+        }
+        dirtyBlocks = 0;
+    }
+
+    // Consecutive blocks are merged into one write by the device
+    std::vector<uint32_t> blockNos(dirty.size());
+    std::vector<const char *> buffers(dirty.size());
+    for (size_t i = 0; i < dirty.size(); i++) {
+        blockNos[i] = dirty[i].first;
+        buffers[i] = snapshot.data() + i * blockSize;
+    }
+    int ret = device->writeVec(blockNos.size(), blockNos.data(), buffers.data());
+    blocksWritten += blockNos.size();
+
+    std::lock_guard<std::mutex> guard(lock);
+    for (size_t i = 0; i < blockNos.size(); i++) {
+        auto it = slots.find(blockNos[i]);
+        if (it == slots.end())
+            continue;
+
+        Entry &e = entries[it->second];
+        e.writeBack = false;
+        if (ret < 0 && !e.dirty) {
+            // keep the data, maybe the next flush succeeds
+            e.dirty = true;
+            dirtyBlocks++;
+        }
+    }
+    if (ret >= 0)
+        stats.flushedBlocks += blockNos.size();
+
+    return ret;
+}
+
+uint32_t BlockCache::getCapacity() const {
+    return capacity;
+}
+
+BlockCache::Stats BlockCache::getStats() {
+    std::lock_guard<std::mutex> guard(lock);
+    Stats s = stats;
+    s.blocksRead = blocksRead;
+    s.blocksWritten = blocksWritten;
+    return s;
+}
+
+// this method returns 0 if successful, -errno otherwise
+int BlockCache::read(uint32_t blockNo, char *buffer) {
+    return readVec(1, &blockNo, &buffer);
+}
+
+// this method returns 0 if successful, -errno otherwise
+int BlockCache::write(uint32_t blockNo, const char *buffer) {
+    return writeVec(1, &blockNo, &buffer);
+}
+
+// this method returns 0 if successful, -errno otherwise
+int BlockCache::readBlocks(uint32_t firstBlockNo, uint32_t count, char *buffer) {
+    if (capacity == 0) {
+        blocksRead += count;
+        return device->readBlocks(firstBlockNo, count, buffer);
+    }
+
+    std::vector<uint32_t> blockNos(count);
+    std::vector<char *> buffers(count);
+    for (uint32_t i = 0; i < count; i++) {
+        blockNos[i] = firstBlockNo + i;
+        buffers[i] = buffer + (size_t) i * blockSize;
+    }
+    return readVec(count, blockNos.data(), buffers.data());
+}
+
+// this method returns 0 if successful, -errno otherwise
+int BlockCache::writeBlocks(uint32_t firstBlockNo, uint32_t count, const char *buffer) {
+    if (capacity == 0) {
+        blocksWritten += count;
+        return device->writeBlocks(firstBlockNo, count, buffer);
+    }
+
+    std::vector<uint32_t> blockNos(count);
+    std::vector<const char *> buffers(count);
+    for (uint32_t i = 0; i < count; i++) {
+        blockNos[i] = firstBlockNo + i;
+        buffers[i] = buffer + (size_t) i * blockSize;
+    }
+    return writeVec(count, blockNos.data(), buffers.data());
+}
+
+// this method returns 0 if successful, -errno otherwise
+int BlockCache::readVec(uint32_t count, const uint32_t *blockNos, char **buffers) {
+    std::vector<uint32_t> missBlockNos;
+    std::vector<char *> missBuffers;
+    uint64_t generation;
+
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        for (uint32_t i = 0; i < count; i++) {
+            auto it = slots.find(blockNos[i]);
+            if (it != slots.end()) {
+                memcpy(buffers[i], slotData(it->second), blockSize);
+                if (entries[it->second].prefetched)
+                    stats.prefetchHits++;
+                touch(it->second);
+                stats.hits++;
+            } else {
+                missBlockNos.push_back(blockNos[i]);
+                missBuffers.push_back(buffers[i]);
+                stats.misses++;
+            }
+        }
+        generation = writeGeneration;
+    }
+
+    if (missBlockNos.empty())
+        return 0;
+
+    int ret = device->readVec(missBlockNos.size(), missBlockNos.data(), missBuffers.data());
+    blocksRead += missBlockNos.size();
+    if (ret < 0 || capacity == 0)
+        return ret;
+
+    std::lock_guard<std::mutex> guard(lock);
+
+    // a write during the device read may have made the data we read stale
+    if (generation == writeGeneration) {
+        for (size_t i = 0; i < missBlockNos.size(); i++) {
+            if (slots.find(missBlockNos[i]) == slots.end()) {
+                store(missBlockNos[i], missBuffers[i]);
+            }
+        }
+    }
+
+    return 0;
+}
+
+// this method returns 0 if successful, -errno otherwise
+int BlockCache::prefetch(uint32_t count, const uint32_t *blockNos) {
+    if (capacity == 0)
+        return 0;
+
+    std::vector<uint32_t> missBlockNos;
+    uint64_t generation;
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        for (uint32_t i = 0; i < count; i++) {
+            if (slots.find(blockNos[i]) == slots.end())
+                missBlockNos.push_back(blockNos[i]);
+        }
+        generation = writeGeneration;
+    }
+
+    if (missBlockNos.empty())
+        return 0;
+
+    std::vector<char> buffer(missBlockNos.size() * blockSize);
+    std::vector<char *> buffers(missBlockNos.size());
+    for (size_t i = 0; i < missBlockNos.size(); i++) {
+        buffers[i] = buffer.data() + i * blockSize;
+    }
+
+    int ret = device->readVec(missBlockNos.size(), missBlockNos.data(), buffers.data());
+    blocksRead += missBlockNos.size();
+    if (ret < 0)
+        return ret;
+
+    std::lock_guard<std::mutex> guard(lock);
+
+    // a write during the device read may have made the data we read stale
+    if (generation == writeGeneration) {
+        for (size_t i = 0; i < missBlockNos.size(); i++) {
+            if (slots.find(missBlockNos[i]) == slots.end()) {
+                uint32_t slot = store(missBlockNos[i], buffers[i]);
+                if (slot != NIL) {
+                    entries[slot].prefetched = true;
+                    stats.prefetched++;
+                }
+            }
+        }
+    }
+
+    return 0;
+}
+
+// this method returns 0 if successful, -errno otherwise
+int BlockCache::writeVec(uint32_t count, const uint32_t *blockNos, const char **buffers) {
+    if (writeBackMode) {
+        bool wakeFlusher, mustFlush;
+        std::vector<uint32_t> uncachedBlockNos;
+        std::vector<const char *> uncachedBuffers;
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            writeGeneration++;
+            for (uint32_t i = 0; i < count; i++) {
+                uint32_t slot;
+                auto it = slots.find(blockNos[i]);
+                if (it != slots.end()) {
+                    slot = it->second;
+                    memcpy(slotData(slot), buffers[i], blockSize);
+                    touch(slot);
+                } else {
+                    slot = store(blockNos[i], buffers[i]);
+                }
+                if (slot == NIL) {
+                    // no clean block to evict, write this one through once the lock is released
+                    uncachedBlockNos.push_back(blockNos[i]);
+                    uncachedBuffers.push_back(buffers[i]);
+                } else if (!entries[slot].dirty) {
+                    entries[slot].dirty = true;
+                    dirtyBlocks++;
+                }
+            }
+            wakeFlusher = dirtyBlocks > maxDirtyBlocks / 2;
+            mustFlush = dirtyBlocks > maxDirtyBlocks;
+        }
+
+        if (wakeFlusher)
+            flushCond.notify_one();
+
+        if (!uncachedBlockNos.empty()) {
+            int ret = device->writeVec(uncachedBlockNos.size(), uncachedBlockNos.data(), uncachedBuffers.data());
+            blocksWritten += uncachedBlockNos.size();
+            if (ret < 0)
+                return ret;
+        }
+
+        // throttle writers that produce dirty data faster than it is flushed
+        return mustFlush ? flush() : 0;
+    }
+
+    if (capacity > 0) {
+        std::lock_guard<std::mutex> guard(lock);
+        writeGeneration++;
+        for (uint32_t i = 0; i < count; i++) {
+            auto it = slots.find(blockNos[i]);
+            if (it != slots.end()) {
+                memcpy(slotData(it->second), buffers[i], blockSize);
+                touch(it->second);
+            } else {
+                store(blockNos[i], buffers[i]);
+            }
+        }
+    }
+
+    int ret = device->writeVec(count, blockNos, buffers);
+    blocksWritten += count;
+    if (ret < 0) {
+        // the device content is unknown now, do not serve these blocks from the cache
+        for (uint32_t i = 0; i < count; i++) {
+            invalidate(blockNos[i]);
+        }
+    }
+    return ret;
+}
+
+void BlockCache::invalidate(uint32_t blockNo) {
+    std::lock_guard<std::mutex> guard(lock);
+    writeGeneration++;
+
+    auto it = slots.find(blockNo);
+    if (it == slots.end())
+        return;
+
+    uint32_t slot = it->second;
+    if (entries[slot].dirty)
+        dirtyBlocks--;
+    unlink(slot);
+    entries[slot].segment = SEG_FREE;
+    entries[slot].dirty = false;
+    slots.erase(it);
+    freeSlots.push_back(slot);
+}
+
+// this method returns 0 if successful, -errno otherwise
+int BlockCache::writeOut(uint32_t firstBlockNo, uint32_t count, bool discard) {
+    if (capacity == 0)
+        return 0;
+
+    // a running flush may hold a snapshot of these blocks, wait for it and keep the flusher away until we are done
+    std::lock_guard<std::mutex> flushGuard(flushLock);
+
+    std::vector<uint32_t> blockNos;
+    std::vector<char> snapshot;
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        if (discard)
+            writeGeneration++;
+
+        for (uint32_t blockNo = firstBlockNo; blockNo < firstBlockNo + count; blockNo++) {
+            auto it = slots.find(blockNo);
+            if (it == slots.end())
+                continue;
+
+            uint32_t slot = it->second;
+            if (entries[slot].dirty) {
+                snapshot.insert(snapshot.end(), slotData(slot), slotData(slot) + blockSize);
+                blockNos.push_back(blockNo);
+                entries[slot].dirty = false;
+                dirtyBlocks--;
+            }
+            if (discard) {
+                unlink(slot);
+                entries[slot].segment = SEG_FREE;
+                slots.erase(it);
+                freeSlots.push_back(slot);
+            }
+        }
+    }
+
+    if (blockNos.empty())
+        return 0;
+
+    std::vector<const char *> buffers(blockNos.size());
+    for (size_t i = 0; i < blockNos.size(); i++) {
+        buffers[i] = snapshot.data() + i * blockSize;
+    }
+    int ret = device->writeVec(blockNos.size(), blockNos.data(), buffers.data());
+    blocksWritten += blockNos.size();
+
+    std::lock_guard<std::mutex> guard(lock);
+    if (ret < 0) {
+        // keep the data of blocks still cached, maybe the next flush succeeds
+        for (uint32_t blockNo: blockNos) {
+            auto it = slots.find(blockNo);
+            if (it != slots.end() && !entries[it->second].dirty) {
+                entries[it->second].dirty = true;
+                dirtyBlocks++;
+            }
+        }
+    } else {
+        stats.flushedBlocks += blockNos.size();
+    }
+
+    return ret;
+}
+
+char *BlockCache::slotData(uint32_t slot) {
+    return data.data() + (size_t) slot * blockSize;
+}
+
+BlockCache::List &BlockCache::listOf(Segment segment) {
+    return segment == SEG_PROTECTED ? protectedList : probation;
+}
+
+void BlockCache::unlink(uint32_t slot) {
+    Entry &e = entries[slot];
+    List &list = listOf(e.segment);
+
+    if (e.prev != NIL)
+        entries[e.prev].next = e.next;
+    else
+        list.head = e.next;
+
+    if (e.next != NIL)
+        entries[e.next].prev = e.prev;
+    else
+        list.tail = e.prev;
+
+    list.size--;
+}
+
+void BlockCache::pushFront(Segment segment, uint32_t slot) {
+    Entry &e = entries[slot];
+    List &list = listOf(segment);
+
+    e.segment = segment;
+    e.prev = NIL;
+    e.next = list.head;
+    if (list.head != NIL)
+        entries[list.head].prev = slot;
+    else
+        list.tail = slot;
+    list.head = slot;
+    list.size++;
+}
+
+// Move an accessed block to the front of the protected segment, demoting the least recently used protected block
+// to the probationary segment if necessary
+void BlockCache::touch(uint32_t slot) {
+    // the first access of a prefetched block counts as its first use
+    if (protectedCapacity == 0 || entries[slot].prefetched) {
+        entries[slot].prefetched = false;
+        unlink(slot);
+        pushFront(SEG_PROBATION, slot);
+        return;
+    }
+
+    unlink(slot);
+    pushFront(SEG_PROTECTED, slot);
+
+    if (protectedList.size > protectedCapacity) {
+        uint32_t demoted = protectedList.tail;
+        unlink(demoted);
+        pushFront(SEG_PROBATION, demoted);
+    }
+}
+
+// Return a free slot, evicting the least recently used clean block if the cache is full. Returns NIL if all blocks are
+// dirty or being written: dirty blocks are only written by flush() and writeOut(), never under the cache lock.
+uint32_t BlockCache::allocateSlot() {
+    if (!freeSlots.empty()) {
+        uint32_t slot = freeSlots.back();
+        freeSlots.pop_back();
+        return slot;
+    }
+
+    uint32_t victim = NIL;
+    for (uint32_t slot = probation.tail; slot != NIL && victim == NIL; slot = entries[slot].prev) {
+        if (!entries[slot].dirty && !entries[slot].writeBack)
+            victim = slot;
+    }
+    for (uint32_t slot = protectedList.tail; slot != NIL && victim == NIL; slot = entries[slot].prev) {
+        if (!entries[slot].dirty && !entries[slot].writeBack)
+            victim = slot;
+    }
+
+    if (victim == NIL)
+        return NIL;
+
+    unlink(victim);
+    slots.erase(entries[victim].blockNo);
+    stats.evictions++;
+    return victim;
+}
+
+// Insert a block that is not yet cached into the probationary segment, returns NIL if there is no room
+uint32_t BlockCache::store(uint32_t blockNo, const char *buffer) {
+    uint32_t slot = allocateSlot();
+    if (slot == NIL)
+        return NIL;
+
+    Entry &e = entries[slot];
+    e.blockNo = blockNo;
+    e.dirty = false;
+    e.writeBack = false;
+    e.prefetched = false;
+    memcpy(slotData(slot), buffer, blockSize);
+    pushFront(SEG_PROBATION, slot);
+    slots[blockNo] = slot;
+    return slot;
+}
@@ -10,10 +10,13 @@
 
 #include <cstdlib>
 #include <cassert>
+#include <climits>
+#include <cstring>
 #include <errno.h>
 #include <fcntl.h>
 #include <unistd.h>
 #include <sys/stat.h>
+#include <sys/uio.h>
 #include <sys/types.h>
 #include "macros.h"
 
@@ -24,6 +27,10 @@
 BlockDevice::BlockDevice(uint32_t blockSize) {
     assert(blockSize % 512 == 0);
     this->blockSize= blockSize;
+    this->contFile= -1;
+}
+
+BlockDevice::~BlockDevice() {
 }
 
 int BlockDevice::create(const char *path) {
@@ -85,15 +92,7 @@ int BlockDevice::read(uint32_t blockNo, char *buffer) {
 #ifdef DEBUG
     fprintf(stderr, "BlockDevice: Reading block %d\n", blockNo);
 #endif
-    off_t pos = (off_t) blockNo * this->blockSize;
-    if (lseek (this->contFile, pos, SEEK_SET) != pos)
-        return -errno;
-    
-    int size = (this->blockSize);
-    if (::read (this->contFile, buffer, size) != size)
-        return -errno;
-
-    return 0;
+    return readBlocks(blockNo, 1, buffer);
 }
 
 // this method returns 0 if successful, -errno otherwise
@@ -101,14 +100,131 @@ int BlockDevice::write(uint32_t blockNo, char *buffer) {
 #ifdef DEBUG
     fprintf(stderr, "BlockDevice: Writing block %d\n", blockNo);
 #endif
-    off_t pos = (off_t) blockNo * this->blockSize;
-    if (lseek (this->contFile, pos, SEEK_SET) != pos)
-        return -errno;
+    return writeBlocks(blockNo, 1, buffer);
+}
+
+// this method returns 0 if successful, -errno otherwise
+int BlockDevice::readBlocks(uint32_t firstBlockNo, uint32_t count, char *buffer) {
+#ifdef DEBUG
+    fprintf(stderr, "BlockDevice: Reading %d blocks starting at %d\n", count, firstBlockNo);
+#endif
+    struct iovec iov;
+    iov.iov_base = buffer;
+    iov.iov_len = (size_t) count * this->blockSize;
+
+    return transfer(&iov, 1, (off_t) firstBlockNo * this->blockSize, false);
+}
 
-    int __size = (this->blockSize);
-    if (::write (this->contFile, buffer, __size) != __size)
+// this method returns 0 if successful, -errno otherwise
+int BlockDevice::writeBlocks(uint32_t firstBlockNo, uint32_t count, const char *buffer) {
+#ifdef DEBUG
+    fprintf(stderr, "BlockDevice: Writing %d blocks starting at %d\n", count, firstBlockNo);
+#endif
+    struct iovec iov;
+    iov.iov_base = const_cast<char *>(buffer);
+    iov.iov_len = (size_t) count * this->blockSize;
+
+    return transfer(&iov, 1, (off_t) firstBlockNo * this->blockSize, true);
+}
+
+// this method returns 0 if successful, -errno otherwise
+int BlockDevice::readVec(uint32_t count, const uint32_t *blockNos, char **buffers) {
+    return transferVec(count, blockNos, buffers, false);
+}
+
+// this method returns 0 if successful, -errno otherwise
+int BlockDevice::writeVec(uint32_t count, const uint32_t *blockNos, const char **buffers) {
+    return transferVec(count, blockNos, const_cast<char *const *>(buffers), true);
+}
+
+// this method returns 0 if successful, -errno otherwise
+int BlockDevice::sync() {
+    if (::fdatasync(this->contFile) < 0)
         return -errno;
 
     return 0;
 }
 
+void BlockDevice::setBlockSize(uint32_t blockSize) {
+    assert(blockSize % 512 == 0);
+    this->blockSize= blockSize;
+}
+
+uint32_t BlockDevice::getBlockSize() const {
+    return this->blockSize;
+}
+
+int BlockDevice::getFd() const {
+    return this->contFile;
+}
+
+// Split the block list into runs of consecutive block numbers and transfer each run with one vectored call.
+int BlockDevice::transferVec(uint32_t count, const uint32_t *blockNos, char *const *buffers, bool doWrite) {
+    struct iovec iov[IOV_MAX];
+
+    uint32_t i = 0;
+    while (i < count) {
+        uint32_t runStart = i;
+        int iovcnt = 0;
+        do {
+            iov[iovcnt].iov_base = buffers[i];
+            iov[iovcnt].iov_len = this->blockSize;
+            iovcnt++;
+            i++;
+        } while (i < count && iovcnt < IOV_MAX && blockNos[i] == blockNos[i - 1] + 1);
+
+#ifdef DEBUG
+        fprintf(stderr, "BlockDevice: %s %d blocks starting at %d\n", doWrite ? "Writing" : "Reading", iovcnt,
+                blockNos[runStart]);
+#endif
+        int ret = transfer(iov, iovcnt, (off_t) blockNos[runStart] * this->blockSize, doWrite);
+        if (ret < 0)
+            return ret;
+    }
+
+    return 0;
+}
+
+// Transfer all iovecs, continuing after short reads/writes. Reading past the end of the container yields zeros.
+// Note that iov is modified.
+int BlockDevice::transfer(struct iovec *iov, int iovcnt, off_t pos, bool doWrite) {
+    while (iovcnt > 0) {
+        ssize_t done;
+        if (iovcnt == 1) {
+            done = doWrite ? ::pwrite(this->contFile, iov->iov_base, iov->iov_len, pos)
+                           : ::pread(this->contFile, iov->iov_base, iov->iov_len, pos);
+        } else {
+            done = doWrite ? ::pwritev(this->contFile, iov, iovcnt, pos)
+                           : ::preadv(this->contFile, iov, iovcnt, pos);
+        }
+
+        if (done < 0) {
+            if (errno == EINTR)
+                continue;
+            return -errno;
+        }
+
+        if (done == 0) {
+            if (doWrite)
+                return -EIO;
+
+            // end of container file, remaining blocks have never been written
+            for (int i = 0; i < iovcnt; i++)
+                memset(iov[i].iov_base, 0, iov[i].iov_len);
+            return 0;
+        }
+
+        pos += done;
+        while (iovcnt > 0 && (size_t) done >= iov->iov_len) {
+            done -= iov->iov_len;
+            iov++;
+            iovcnt--;
+        }
+        if (iovcnt > 0) {
+            iov->iov_base = (char *) iov->iov_base + done;
+            iov->iov_len -= done;
+        }
+    }
+
+    return 0;
+}
@@ -0,0 +1,482 @@
+//
+//  journal.cpp
+//  myfs
+//
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+
+#include "byteorder.h"
+#include "journal.h"
+
+// Start value of the FNV-1a checksum
+static const uint32_t CHECKSUM_SEED = 2166136261u;
+
+thread_local int JournalHandle::depth = 0;
+
+Journal::Journal(BlockCache *cache, BlockDevice *device, uint32_t blockSize, uint32_t start, uint32_t length)
+        : cache(cache), device(device), blockSize(blockSize), regionStart(start), logSize(length - 1),
+          tagsPerBlock((blockSize - sizeof(Descriptor)) / sizeof(uint32_t)), runningSequence(1), active(0),
+          swapping(false), stats(), head(0), tail(0), tailSequence(1), committedSequence(0),
+          commitInterval(0), stopping(false) {
+}
+
+// Header, descriptors, images and the commit block, plus one block, since a full log cannot be told from an empty one
+uint32_t Journal::minLength(uint32_t blockSize, uint32_t maxImages) {
+    uint32_t tags = (blockSize - sizeof(Descriptor)) / sizeof(uint32_t);
+    return 1 + (maxImages + tags - 1) / tags + maxImages + 1 + 1;
+}
+
+Journal::~Journal() {
+    if (committer.joinable()) {
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            stopping = true;
+        }
+        commitCond.notify_all();
+        committer.join();
+    }
+}
+
+int Journal::format() {
+    std::lock_guard<std::mutex> commitGuard(commitLock);
+
+    head = tail = 0;
+    tailSequence = 1;
+    runningSequence = 1;
+    committedSequence = 0;
+
+    // A stale block at the start of the log must not look like a transaction
+    std::vector<char> zero(blockSize, 0);
+    int ret = device->write(logBlock(0), zero.data());
+    if (ret >= 0) {
+        ret = writeHeader();
+    }
+    if (ret >= 0) {
+        ret = device->sync();
+    }
+    return ret < 0 ? ret : 0;
+}
+
+/// Transactions are replayed in sequence order, starting at the tail recorded in the header. The first block that is
+/// not the expected descriptor or commit block, or a commit block with a wrong checksum, ends the log: that
+/// transaction was not committed completely and is ignored.
+int Journal::recover() {
+    std::lock_guard<std::mutex> commitGuard(commitLock);
+
+    std::vector<char> buf(blockSize);
+    int ret = device->read(regionStart, buf.data());
+    if (ret < 0) {
+        return ret;
+    }
+    Header header;
+    decode(buf.data(), header);
+    if (header.magic != JOURNAL_MAGIC || header.version != JOURNAL_VERSION || header.length != logSize + 1 ||
+        header.tail >= logSize) {
+        return -ENOENT;
+    }
+
+    uint32_t pos = header.tail;
+    uint64_t sequence = header.sequence;
+    uint32_t scanned = 0;
+    int replayed = 0;
+    Images images;
+
+    for (;;) {
+        Images txn;
+        uint32_t hash = CHECKSUM_SEED;
+        uint32_t tags = 0;
+        uint32_t p = pos;
+        uint32_t blocks = 0;
+        bool complete = false;
+
+        while (scanned + blocks < logSize) {
+            ret = device->read(logBlock(p), buf.data());
+            if (ret < 0) {
+                return ret;
+            }
+            p = (p + 1) % logSize;
+            blocks++;
+
+            Descriptor descriptor;
+            decode(buf.data(), descriptor);
+            if (descriptor.magic == JOURNAL_DESCRIPTOR_MAGIC && descriptor.sequence == sequence &&
+                descriptor.count <= tagsPerBlock && scanned + blocks + descriptor.count < logSize) {
+                hash = checksum(hash, buf.data(), blockSize);
+                std::vector<uint32_t> blockNos(descriptor.count);
+                memcpy(blockNos.data(), buf.data() + sizeof(descriptor), descriptor.count * sizeof(uint32_t));
+
+                for (uint32_t tag: blockNos) {
+                    uint32_t blockNo = fromDisk(tag);
+                    std::vector<char> image(blockSize);
+                    ret = device->read(logBlock(p), image.data());
+                    if (ret < 0) {
+                        return ret;
+                    }
+                    p = (p + 1) % logSize;
+                    blocks++;
+                    hash = checksum(hash, image.data(), blockSize);
+                    txn[blockNo] = std::move(image);
+                }
+                tags += descriptor.count;
+                continue;
+            }
+
+            Commit commit;
+            decode(buf.data(), commit);
+            complete = commit.magic == JOURNAL_COMMIT_MAGIC && commit.sequence == sequence && commit.count == tags &&
+                    tags > 0 && commit.checksum == hash;
+            break;
+        }
+        if (!complete) {
+            break;
+        }
+
+        for (auto &entry: txn) {
+            images[entry.first] = std::move(entry.second);
+        }
+        pos = p;
+        scanned += blocks;
+        sequence++;
+        replayed++;
+    }
+
+    if (replayed > 0) {
+        ret = writeHome(images);
+        if (ret >= 0) {
+            ret = cache->flush();
+        }
+        if (ret >= 0) {
+            ret = device->sync();
+        }
+        if (ret < 0) {
+            return ret;
+        }
+    }
+
+    // Continue behind the replayed transactions, they are not replayed again
+    head = tail = pos;
+    tailSequence = sequence;
+    runningSequence = sequence;
+    committedSequence = sequence - 1;
+    ret = writeHeader();
+    if (ret >= 0) {
+        ret = device->sync();
+    }
+    return ret < 0 ? ret : replayed;
+}
+
+void Journal::start(unsigned commitIntervalMs) {
+    if (committer.joinable()) {
+        return;
+    }
+    commitInterval = std::chrono::milliseconds(commitIntervalMs);
+    committer = std::thread(&Journal::commitLoop, this);
+}
+
+// Background thread committing the running transaction and checkpointing once half of the log is used
+void Journal::commitLoop() {
+    std::unique_lock<std::mutex> guard(lock);
+    while (!stopping) {
+        commitCond.wait_for(guard, commitInterval);
+        if (stopping)
+            continue;
+
+        guard.unlock();
+        commit(true);
+        {
+            std::lock_guard<std::mutex> commitGuard(commitLock);
+            if (logUsed() > logSize / 2) {
+                checkpointLocked();
+            }
+        }
+        guard.lock();
+    }
+}
+
+void Journal::log(uint32_t count, const uint32_t *blockNos, const char **buffers) {
+    std::lock_guard<std::mutex> guard(lock);
+    for (uint32_t i = 0; i < count; i++) {
+        running[blockNos[i]].assign(buffers[i], buffers[i] + blockSize);
+    }
+}
+
+int Journal::commit(bool sync) {
+    std::lock_guard<std::mutex> commitGuard(commitLock);
+
+    // Close the running transaction once no operation is half done
+    Images txn;
+    uint64_t sequence;
+    {
+        std::unique_lock<std::mutex> guard(lock);
+        if (running.empty()) {
+            return 0;
+        }
+        swapping = true;
+        idle.wait(guard, [this] { return active == 0; });
+        txn.swap(running);
+        sequence = runningSequence++;
+        swapping = false;
+    }
+    idle.notify_all();
+
+    uint32_t count = txn.size();
+    uint32_t nrDescriptors = (count + tagsPerBlock - 1) / tagsPerBlock;
+    uint32_t needed = nrDescriptors + count + 1;
+
+    int ret = 0;
+    if (needed >= logSize) {
+        // Does not fit into the log at all, which only happens on containers formatted with a journal too small for
+        // their metadata: empty the log and write the images in place without protection
+        ret = checkpointLocked();
+        if (ret >= 0) {
+            ret = writeHome(txn);
+        }
+        if (ret >= 0) {
+            ret = cache->flush();
+        }
+        if (ret >= 0) {
+            committedSequence = sequence;
+            tailSequence = sequence + 1;
+            ret = writeHeader();
+        }
+        if (ret >= 0 && sync) {
+            ret = device->sync();
+        }
+        if (ret >= 0) {
+            return 0;
+        }
+    } else if (logUsed() + needed >= logSize) {
+        ret = checkpointLocked();
+    }
+
+    std::vector<char> area((size_t) needed * blockSize, 0);
+    std::vector<uint32_t> blockNos(needed);
+    std::vector<const char *> buffers(needed);
+    if (ret >= 0) {
+        uint32_t n = 0;
+        auto it = txn.begin();
+        for (uint32_t d = 0; d < nrDescriptors; d++) {
+            char *block = area.data() + (size_t) n++ * blockSize;
+            Descriptor descriptor = {JOURNAL_DESCRIPTOR_MAGIC, std::min(tagsPerBlock, count - d * tagsPerBlock),
+                                     sequence};
+            encode(descriptor, block);
+            for (uint32_t t = 0; t < descriptor.count; t++, it++) {
+                uint32_t tag = toDisk(it->first);
+                memcpy(block + sizeof(descriptor) + t * sizeof(uint32_t), &tag, sizeof(uint32_t));
+                memcpy(area.data() + (size_t) n++ * blockSize, it->second.data(), blockSize);
+            }
+        }
+
+        Commit commit = {JOURNAL_COMMIT_MAGIC, count, sequence,
+                         checksum(CHECKSUM_SEED, area.data(), (size_t) n * blockSize)};
+        encode(commit, area.data() + (size_t) n * blockSize);
+
+        for (uint32_t i = 0; i < needed; i++) {
+            blockNos[i] = logBlock((head + i) % logSize);
+            buffers[i] = area.data() + (size_t) i * blockSize;
+        }
+        ret = device->writeVec(needed, blockNos.data(), buffers.data());
+    }
+    if (ret >= 0 && sync) {
+        ret = device->sync();
+    }
+
+    if (ret < 0) {
+        // Keep the images for the next commit, newer images logged meanwhile win
+        std::lock_guard<std::mutex> guard(lock);
+        for (auto &entry: txn) {
+            running.insert(std::move(entry));
+        }
+        return ret;
+    }
+
+    head = (head + needed) % logSize;
+    for (auto &entry: txn) {
+        committed[entry.first] = std::move(entry.second);
+    }
+    committedSequence = sequence;
+
+    std::lock_guard<std::mutex> guard(lock);
+    stats.commits++;
+    stats.blocksWritten += needed;
+    return 0;
+}
+
+int Journal::checkpoint() {
+    std::lock_guard<std::mutex> commitGuard(commitLock);
+    return checkpointLocked();
+}
+
+/// Must be called with commitLock held. The log is flushed before the home locations change, and the home locations
+/// before the header frees the log, so a crash at any point leaves either the old or the new images replayable.
+int Journal::checkpointLocked() {
+    if (committed.empty()) {
+        return 0;
+    }
+
+    int ret = device->sync();
+    if (ret >= 0) {
+        ret = writeHome(committed);
+    }
+    if (ret >= 0) {
+        ret = cache->flush();
+    }
+    if (ret >= 0) {
+        ret = device->sync();
+    }
+    if (ret < 0) {
+        return ret;
+    }
+
+    uint32_t oldTail = tail;
+    uint64_t oldSequence = tailSequence;
+    tail = head;
+    tailSequence = committedSequence + 1;
+    ret = writeHeader();
+    if (ret >= 0) {
+        ret = device->sync();
+    }
+    if (ret < 0) {
+        tail = oldTail;
+        tailSequence = oldSequence;
+        return ret;
+    }
+
+    committed.clear();
+    std::lock_guard<std::mutex> guard(lock);
+    stats.checkpoints++;
+    return 0;
+}
+
+uint64_t Journal::getRunningSequence() {
+    std::lock_guard<std::mutex> guard(lock);
+    return runningSequence;
+}
+
+uint64_t Journal::getCommittedSequence() {
+    return committedSequence;
+}
+
+Journal::Stats Journal::getStats() {
+    std::lock_guard<std::mutex> guard(lock);
+    return stats;
+}
+
+void Journal::begin() {
+    std::unique_lock<std::mutex> guard(lock);
+    idle.wait(guard, [this] { return !swapping; });
+    active++;
+}
+
+void Journal::end() {
+    std::lock_guard<std::mutex> guard(lock);
+    if (--active == 0) {
+        idle.notify_all();
+    }
+}
+
+int Journal::writeHeader() {
+    std::vector<char> buf(blockSize, 0);
+    Header header = {JOURNAL_MAGIC, JOURNAL_VERSION, logSize + 1, tailSequence, tail};
+    encode(header, buf.data());
+    return device->write(regionStart, buf.data());
+}
+
+int Journal::writeHome(const Images &images) {
+    std::vector<uint32_t> blockNos;
+    std::vector<const char *> buffers;
+    blockNos.reserve(images.size());
+    buffers.reserve(images.size());
+    for (const auto &entry: images) {
+        blockNos.push_back(entry.first);
+        buffers.push_back(entry.second.data());
+    }
+    return cache->writeVec(blockNos.size(), blockNos.data(), buffers.data());
+}
+
+uint32_t Journal::logBlock(uint32_t pos) const {
+    return regionStart + 1 + pos;
+}
+
+uint32_t Journal::logUsed() const {
+    return (head + logSize - tail) % logSize;
+}
+
+// FNV-1a, continued from hash
+uint32_t Journal::checksum(uint32_t hash, const char *data, size_t size) {
+    for (size_t i = 0; i < size; i++) {
+        hash ^= (uint8_t) data[i];
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+void Journal::decode(const char *ptr, Header &header) {
+    memcpy(&header, ptr, sizeof(header));
+    header.magic = fromDisk(header.magic);
+    header.version = fromDisk(header.version);
+    header.length = fromDisk(header.length);
+    header.sequence = fromDisk(header.sequence);
+    header.tail = fromDisk(header.tail);
+}
+
+void Journal::decode(const char *ptr, Descriptor &descriptor) {
+    memcpy(&descriptor, ptr, sizeof(descriptor));
+    descriptor.magic = fromDisk(descriptor.magic);
+    descriptor.count = fromDisk(descriptor.count);
+    descriptor.sequence = fromDisk(descriptor.sequence);
+}
+
+void Journal::decode(const char *ptr, Commit &commit) {
+    memcpy(&commit, ptr, sizeof(commit));
+    commit.magic = fromDisk(commit.magic);
+    commit.count = fromDisk(commit.count);
+    commit.sequence = fromDisk(commit.sequence);
+    commit.checksum = fromDisk(commit.checksum);
+}
+
+// The records are zeroed first, so their padding is written as zeros
+void Journal::encode(const Header &header, char *ptr) {
+    Header d;
+    memset(&d, 0, sizeof(d));
+    d.magic = toDisk(header.magic);
+    d.version = toDisk(header.version);
+    d.length = toDisk(header.length);
+    d.sequence = toDisk(header.sequence);
+    d.tail = toDisk(header.tail);
+    memcpy(ptr, &d, sizeof(d));
+}
+
+void Journal::encode(const Descriptor &descriptor, char *ptr) {
+    Descriptor d;
+    memset(&d, 0, sizeof(d));
+    d.magic = toDisk(descriptor.magic);
+    d.count = toDisk(descriptor.count);
+    d.sequence = toDisk(descriptor.sequence);
+    memcpy(ptr, &d, sizeof(d));
+}
+
+void Journal::encode(const Commit &commit, char *ptr) {
+    Commit d;
+    memset(&d, 0, sizeof(d));
+    d.magic = toDisk(commit.magic);
+    d.count = toDisk(commit.count);
+    d.sequence = toDisk(commit.sequence);
+    d.checksum = toDisk(commit.checksum);
+    memcpy(ptr, &d, sizeof(d));
+}
+
+JournalHandle::JournalHandle(Journal *journal) : journal(depth++ == 0 ? journal : nullptr) {
+    if (this->journal != nullptr) {
+        this->journal->begin();
+    }
+}
+
+JournalHandle::~JournalHandle() {
+    if (journal != nullptr) {
+        journal->end();
+    }
+    depth--;
+}
@@ -0,0 +1,273 @@
+//
+//  logger.cpp
+//  myfs
+//
+
+#include <algorithm>
+#include <chrono>
+#include <strings.h>
+
+#include "logger.h"
+
+// Serial numbers of loggers, so a new logger at the address of a deleted one does not match a stale cache entry
+static std::atomic<uint64_t> nextSerial(1);
+
+// Ring of the calling thread for the logger it used last
+static thread_local uint64_t cachedSerial = 0;
+static thread_local void *cachedRing = nullptr;
+
+Logger::Logger() : level(LOG_NONE), serial(nextSerial++), file(nullptr), stopping(false) {
+}
+
+Logger::~Logger() {
+    stop();
+    for (Ring *ring: rings) {
+        delete ring;
+    }
+}
+
+void Logger::start(FILE *file, int level) {
+    stop();
+
+    {
+        std::lock_guard<std::mutex> drainGuard(drainLock);
+        this->file = file;
+    }
+    {
+        std::lock_guard<std::mutex> threadGuard(threadLock);
+        stopping = false;
+    }
+    // Drop records of an earlier run
+    drain();
+
+    this->level.store(level, std::memory_order_relaxed);
+    drainThread = std::thread(&Logger::drainLoop, this);
+}
+
+void Logger::stop() {
+    level.store(LOG_NONE, std::memory_order_relaxed);
+
+    if (drainThread.joinable()) {
+        {
+            std::lock_guard<std::mutex> threadGuard(threadLock);
+            stopping = true;
+        }
+        wakeup.notify_one();
+        drainThread.join();
+    }
+    drain();
+
+    std::lock_guard<std::mutex> drainGuard(drainLock);
+    file = nullptr;
+}
+
+void Logger::flush() {
+    drain();
+}
+
+int Logger::parseLevel(const char *str) {
+    if (strcasecmp(str, "none") == 0) {
+        return LOG_NONE;
+    } else if (strcasecmp(str, "info") == 0) {
+        return LOG_INFO;
+    } else if (strcasecmp(str, "debug") == 0) {
+        return LOG_DEBUG;
+    }
+    return -1;
+}
+
+uint64_t Logger::getDropped() {
+    std::lock_guard<std::mutex> ringsGuard(ringsLock);
+    uint64_t dropped = 0;
+    for (Ring *ring: rings) {
+        dropped += ring->dropped.load(std::memory_order_relaxed);
+    }
+    return dropped;
+}
+
+/// @brief Return the ring of the calling thread, creating it when the thread logs for the first time.
+Logger::Ring *Logger::getRing() {
+    if (cachedSerial == serial) {
+        return (Ring *) cachedRing;
+    }
+
+    std::lock_guard<std::mutex> ringsGuard(ringsLock);
+    Ring *ring = nullptr;
+    for (Ring *r: rings) {
+        if (r->owner == std::this_thread::get_id()) {
+            ring = r;
+            break;
+        }
+    }
+    if (ring == nullptr) {
+        ring = new Ring();
+        ring->owner = std::this_thread::get_id();
+        ring->head.store(0, std::memory_order_relaxed);
+        ring->tail.store(0, std::memory_order_relaxed);
+        ring->dropped.store(0, std::memory_order_relaxed);
+        rings.push_back(ring);
+    }
+
+    cachedSerial = serial;
+    cachedRing = ring;
+    return ring;
+}
+
+/// @brief Reserve the next slot in the ring of the calling thread.
+/// \return Record to fill in and pass to commitRecord(), nullptr if the ring is full.
+Logger::Record *Logger::beginRecord(RecordKind kind) {
+    Ring *ring = getRing();
+    uint32_t head = ring->head.load(std::memory_order_relaxed);
+    if (head - ring->tail.load(std::memory_order_acquire) >= LOG_RING_SLOTS) {
+        ring->dropped.fetch_add(1, std::memory_order_relaxed);
+        return nullptr;
+    }
+
+    Record *r = &ring->slots[head & (LOG_RING_SLOTS - 1)];
+    r->time = std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count();
+    r->kind = kind;
+    r->nargs = 0;
+    return r;
+}
+
+/// @brief Hand the record reserved by beginRecord() to the drain thread.
+void Logger::commitRecord() {
+    Ring *ring = (Ring *) cachedRing;
+    ring->head.store(ring->head.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+}
+
+void Logger::drainLoop() {
+    std::unique_lock<std::mutex> threadGuard(threadLock);
+    while (!stopping) {
+        wakeup.wait_for(threadGuard, std::chrono::milliseconds(LOG_DRAIN_INTERVAL_MS));
+        threadGuard.unlock();
+        drain();
+        threadGuard.lock();
+    }
+}
+
+/// @brief Format and write all records in the rings, ordered by time.
+void Logger::drain() {
+    std::lock_guard<std::mutex> drainGuard(drainLock);
+
+    std::vector<std::pair<Ring *, uint32_t>> heads;
+    {
+        std::lock_guard<std::mutex> ringsGuard(ringsLock);
+        for (Ring *ring: rings) {
+            heads.push_back(std::make_pair(ring, ring->head.load(std::memory_order_acquire)));
+        }
+    }
+
+    batch.clear();
+    for (auto &h: heads) {
+        Ring *ring = h.first;
+        for (uint32_t pos = ring->tail.load(std::memory_order_relaxed); pos != h.second; pos++) {
+            const Record *r = &ring->slots[pos & (LOG_RING_SLOTS - 1)];
+            batch.push_back(std::make_pair(r->time, r));
+        }
+    }
+
+    if (file != nullptr && !batch.empty()) {
+        std::stable_sort(batch.begin(), batch.end(),
+                         [](const std::pair<uint64_t, const Record *> &a, const std::pair<uint64_t, const Record *> &b) {
+                             return a.first < b.first;
+                         });
+        for (auto &entry: batch) {
+            formatRecord(entry.second);
+            fwrite(line.data(), 1, line.size(), file);
+        }
+        fflush(file);
+    }
+
+    // Release the slots only after they were formatted
+    for (auto &h: heads) {
+        h.first->tail.store(h.second, std::memory_order_release);
+    }
+}
+
+/// @brief Format a record into line.
+void Logger::formatRecord(const Record *r) {
+    char buf[LOG_RECORD_SIZE + 64];
+
+    switch (r->kind) {
+        case KIND_METHOD:
+            snprintf(buf, sizeof(buf), "%s:%lld:%s()\n", r->fmt, r->value, r->func);
+            line = buf;
+            return;
+        case KIND_RETURN:
+            snprintf(buf, sizeof(buf), "%s() returned %lld\n", r->func, r->value);
+            line = buf;
+            return;
+        case KIND_FORMAT:
+            break;
+    }
+
+    // Format one conversion at a time with the type recorded for its argument
+    line = "\t";
+    int arg = 0;
+    for (const char *p = r->fmt; *p != '\0'; p++) {
+        if (*p != '%') {
+            line += *p;
+            continue;
+        }
+        if (p[1] == '%') {
+            line += '%';
+            p++;
+            continue;
+        }
+
+        // Flags, width and precision are kept, length modifiers are replaced to match the recorded type
+        std::string spec = "%";
+        for (p++; *p != '\0' && strchr("-+ #0123456789.", *p) != nullptr; p++) {
+            spec += *p;
+        }
+        while (*p != '\0' && strchr("hljztLq", *p) != nullptr) {
+            p++;
+        }
+        if (*p == '\0') {
+            break;
+        }
+        char conv = *p;
+
+        if (arg >= r->nargs) {
+            line += "<missing>";
+            continue;
+        }
+        const Arg &a = r->args[arg];
+        int len = -1;
+        switch (r->types[arg++]) {
+            case ARG_INT:
+            case ARG_UINT:
+                if (conv == 'c') {
+                    spec += conv;
+                    len = snprintf(buf, sizeof(buf), spec.c_str(), (int) a.i);
+                } else if (strchr("diouxX", conv) != nullptr) {
+                    spec += "ll";
+                    spec += conv;
+                    len = snprintf(buf, sizeof(buf), spec.c_str(), a.i);
+                }
+                break;
+            case ARG_DOUBLE:
+                if (strchr("fFeEgGaA", conv) != nullptr) {
+                    spec += conv;
+                    len = snprintf(buf, sizeof(buf), spec.c_str(), a.d);
+                }
+                break;
+            case ARG_STRING:
+                if (conv == 's') {
+                    spec += conv;
+                    len = snprintf(buf, sizeof(buf), spec.c_str(), r->strings + a.u);
+                }
+                break;
+            case ARG_POINTER:
+                if (conv == 'p') {
+                    spec += conv;
+                    len = snprintf(buf, sizeof(buf), spec.c_str(), a.p);
+                }
+                break;
+        }
+        line += len < 0 ? "<bad format>" : std::string(buf, std::min((size_t) len, sizeof(buf) - 1));
+    }
+    line += '\n';
+}
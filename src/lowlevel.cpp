@@ -0,0 +1,684 @@
+//
+//  lowlevel.cpp
+//  myfs
+//
+
+// Front end for the FUSE low-level API. The kernel addresses files by inode numbers instead of paths, so the hot
+// paths (getattr, read, write) skip the path resolution of the high-level API. For documentation of the low-level
+// methods see https://libfuse.github.io/doxygen/structfuse__lowlevel__ops.html
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "lowlevel.h"
+#include "myfs.h"
+
+// inode number reported by readdir for names that were not looked up yet, the kernel ignores it
+#define UNKNOWN_INO 0xffffffff
+
+/// @brief State of a mounted file system, passed to all low-level methods as user data.
+struct LowLevelState {
+    MyFsInfo *info;
+    double timeout;
+    int keepCache;
+
+    // protects inodes; namespace operations hold it while they call the file system, so the name of an inode cannot
+    // change underneath them
+    std::mutex lock;
+    InodeTable inodes;
+};
+
+InodeTable::InodeTable() : nextIno(STATS_INO + 1) {
+}
+
+/// @brief Add a lookup reference to the inode of a file, creating the inode if needed.
+/// \param [in] name Name of the file without "/".
+/// \param [in] id Id of the file returned by MyFS::fuseLookupId().
+/// \return Inode number of the file.
+fuse_ino_t InodeTable::lookup(const char *name, int64_t id) {
+    fuse_ino_t *known = names.find(name);
+    if (known != nullptr) {
+        Inode &inode = inodes[*known];
+        if (inode.id == id) {
+            inode.nlookup++;
+            return *known;
+        }
+        // The name was reused behind our back, the old inode stays until the kernel forgets it
+        remove(name);
+    }
+
+    fuse_ino_t ino = nextIno++;
+    Inode &inode = inodes[ino];
+    inode.id = id;
+    inode.name = name;
+    inode.nlookup = 1;
+    names.insert(inode.name.c_str(), ino);
+    return ino;
+}
+
+/// @brief Drop lookup references, see fuse_lowlevel_ops::forget. The inode is removed with its last reference.
+void InodeTable::forget(fuse_ino_t ino, uint64_t nlookup) {
+    auto it = inodes.find(ino);
+    if (it == inodes.end()) {
+        return;
+    }
+    Inode &inode = it->second;
+    inode.nlookup -= nlookup < inode.nlookup ? nlookup : inode.nlookup;
+    if (inode.nlookup == 0) {
+        if (inode.id >= 0) {
+            names.erase(inode.name.c_str());
+        }
+        inodes.erase(it);
+    }
+}
+
+/// @brief Find an inode.
+/// \return Pointer to the inode, valid until the table is changed, nullptr if the kernel already forgot it.
+InodeTable::Inode *InodeTable::find(fuse_ino_t ino) {
+    auto it = inodes.find(ino);
+    return it == inodes.end() ? nullptr : &it->second;
+}
+
+/// @brief Find the inode of a file name.
+/// \return Inode number, 0 if the name is not known.
+fuse_ino_t InodeTable::findName(const char *name) {
+    fuse_ino_t *ino = names.find(name);
+    return ino == nullptr ? 0 : *ino;
+}
+
+/// @brief Detach the inode of a deleted file from its name. The inode lives on until the kernel forgets it.
+void InodeTable::remove(const char *name) {
+    fuse_ino_t *ino = names.find(name);
+    if (ino == nullptr) {
+        return;
+    }
+    Inode &inode = inodes[*ino];
+    names.erase(name);
+    inode.id = -1;
+    inode.name.clear();
+}
+
+/// @brief Move the inode of a file to a new name, replacing the inode of an existing file with that name.
+void InodeTable::rename(const char *name, const char *newName) {
+    remove(newName);
+
+    fuse_ino_t *known = names.find(name);
+    if (known == nullptr) {
+        return;
+    }
+    fuse_ino_t ino = *known;
+    names.erase(name);
+    Inode &inode = inodes[ino];
+    inode.name = newName;
+    names.insert(inode.name.c_str(), ino);
+}
+
+/// @brief Return the number of inodes the kernel still references.
+size_t InodeTable::size() const {
+    return inodes.size();
+}
+
+static LowLevelState *getState(fuse_req_t req) {
+    return (LowLevelState *) fuse_req_userdata(req);
+}
+
+static std::string pathOf(const char *name) {
+    return std::string("/") + name;
+}
+
+static bool isStatsName(fuse_ino_t parent, const char *name) {
+    return parent == FUSE_ROOT_ID && strcmp(name, STATS_FILE_NAME) == 0;
+}
+
+/// @brief Record an operation and reply with an error code, 0 for success.
+static void replyErr(fuse_req_t req, OpTimer &timer, int err) {
+    timer.done(-err);
+    fuse_reply_err(req, err);
+}
+
+/// @brief Look up the file id of an inode.
+/// \return File id, -ENOENT if the file was deleted or the inode is unknown.
+static int64_t getFileId(LowLevelState *state, fuse_ino_t ino) {
+    std::lock_guard<std::mutex> guard(state->lock);
+    InodeTable::Inode *inode = state->inodes.find(ino);
+    return inode == nullptr || inode->id < 0 ? -ENOENT : inode->id;
+}
+
+/// @brief Look up the path of an inode. Must be called with state->lock held.
+/// \return Path of the file, empty if the file was deleted or the inode is unknown.
+static std::string getPath(LowLevelState *state, fuse_ino_t ino) {
+    InodeTable::Inode *inode = state->inodes.find(ino);
+    return inode == nullptr || inode->id < 0 ? std::string() : pathOf(inode->name.c_str());
+}
+
+/// @brief Look up a file by name and reply with its inode. Must be called with state->lock held.
+static void replyEntry(fuse_req_t req, OpTimer &timer, LowLevelState *state, const char *name) {
+    MyFS *fs = MyFS::Instance();
+
+    int64_t id = fs->fuseLookupId(pathOf(name).c_str());
+    if (id < 0) {
+        replyErr(req, timer, (int) -id);
+        return;
+    }
+
+    struct fuse_entry_param entry;
+    memset(&entry, 0, sizeof(entry));
+    int ret = fs->fuseGetattrId(id, &entry.attr);
+    if (ret < 0) {
+        replyErr(req, timer, -ret);
+        return;
+    }
+
+    entry.ino = state->inodes.lookup(name, id);
+    entry.attr.st_ino = entry.ino;
+    entry.attr_timeout = state->timeout;
+    entry.entry_timeout = state->timeout;
+    timer.done(0);
+    if (fuse_reply_entry(req, &entry) != 0) {
+        // The kernel did not get the reference
+        state->inodes.forget(entry.ino, 1);
+    }
+}
+
+static void ll_init(void *userdata, struct fuse_conn_info *conn) {
+    LowLevelState *state = (LowLevelState *) userdata;
+    if (MyFS::Instance()->setup(state->info) == 0) {
+        MyFS::Instance()->negotiateConnection(conn, state->info);
+    }
+}
+
+static void ll_destroy(void *userdata) {
+    MyFS::Instance()->fuseDestroy();
+}
+
+static void ll_lookup(fuse_req_t req, fuse_ino_t parent, const char *name) {
+    OpTimer timer(MyFS::Instance()->opStats, OP_LOOKUP);
+    if (parent != FUSE_ROOT_ID) {
+        replyErr(req, timer, ENOTDIR);
+        return;
+    }
+
+    LowLevelState *state = getState(req);
+    if (isStatsName(parent, name)) {
+        // The statistics file has a fixed inode that is never forgotten
+        struct fuse_entry_param entry;
+        memset(&entry, 0, sizeof(entry));
+        MyFS::Instance()->statsGetattr(&entry.attr);
+        entry.ino = entry.attr.st_ino = STATS_INO;
+        timer.done(0);
+        fuse_reply_entry(req, &entry);
+        return;
+    }
+
+    std::lock_guard<std::mutex> guard(state->lock);
+    replyEntry(req, timer, state, name);
+}
+
+static void ll_forget(fuse_req_t req, fuse_ino_t ino, unsigned long nlookup) {
+    OpTimer timer(MyFS::Instance()->opStats, OP_FORGET);
+    LowLevelState *state = getState(req);
+    {
+        std::lock_guard<std::mutex> guard(state->lock);
+        state->inodes.forget(ino, nlookup);
+    }
+    timer.done(0);
+    fuse_reply_none(req);
+}
+
+static void ll_forget_multi(fuse_req_t req, size_t count, struct fuse_forget_data *forgets) {
+    OpTimer timer(MyFS::Instance()->opStats, OP_FORGET);
+    LowLevelState *state = getState(req);
+    {
+        std::lock_guard<std::mutex> guard(state->lock);
+        for (size_t i = 0; i < count; i++) {
+            state->inodes.forget(forgets[i].ino, forgets[i].nlookup);
+        }
+    }
+    timer.done(0);
+    fuse_reply_none(req);
+}
+
+static void ll_getattr(fuse_req_t req, fuse_ino_t ino, struct fuse_file_info *fi) {
+    LowLevelState *state = getState(req);
+    MyFS *fs = MyFS::Instance();
+    OpTimer timer(fs->opStats, OP_GETATTR);
+
+    struct stat st;
+    memset(&st, 0, sizeof(st));
+    int ret;
+    if (ino == FUSE_ROOT_ID) {
+        ret = fs->fuseGetattr("/", &st);
+    } else if (ino == STATS_INO) {
+        ret = fs->statsGetattr(&st);
+    } else {
+        int64_t id = getFileId(state, ino);
+        ret = id < 0 ? (int) id : fs->fuseGetattrId(id, &st);
+    }
+
+    if (ret < 0) {
+        replyErr(req, timer, -ret);
+        return;
+    }
+    st.st_ino = ino;
+    timer.done(0);
+    fuse_reply_attr(req, &st, state->timeout);
+}
+
+static void ll_setattr(fuse_req_t req, fuse_ino_t ino, struct stat *attr, int toSet, struct fuse_file_info *fi) {
+    LowLevelState *state = getState(req);
+    MyFS *fs = MyFS::Instance();
+    OpTimer timer(fs->opStats, OP_SETATTR);
+    if (ino == STATS_INO) {
+        replyErr(req, timer, EACCES);
+        return;
+    }
+
+    std::lock_guard<std::mutex> guard(state->lock);
+    InodeTable::Inode *inode = state->inodes.find(ino);
+    if (inode == nullptr || inode->id < 0) {
+        replyErr(req, timer, ENOENT);
+        return;
+    }
+    std::string path = pathOf(inode->name.c_str());
+    int64_t id = inode->id;
+
+    struct stat st;
+    int ret = fs->fuseGetattrId(id, &st);
+    if (ret >= 0 && (toSet & FUSE_SET_ATTR_MODE)) {
+        ret = fs->fuseChmod(path.c_str(), attr->st_mode);
+    }
+    if (ret >= 0 && (toSet & (FUSE_SET_ATTR_UID | FUSE_SET_ATTR_GID))) {
+        ret = fs->fuseChown(path.c_str(), (toSet & FUSE_SET_ATTR_UID) ? attr->st_uid : st.st_uid,
+                            (toSet & FUSE_SET_ATTR_GID) ? attr->st_gid : st.st_gid);
+    }
+    if (ret >= 0 && (toSet & FUSE_SET_ATTR_SIZE)) {
+        ret = fi != nullptr ? fs->fuseTruncate(path.c_str(), attr->st_size, fi)
+                            : fs->fuseTruncate(path.c_str(), attr->st_size);
+    }
+    if (ret >= 0 && (toSet & (FUSE_SET_ATTR_ATIME | FUSE_SET_ATTR_MTIME))) {
+        time_t now = time(nullptr);
+        struct utimbuf times;
+        times.actime = (toSet & FUSE_SET_ATTR_ATIME_NOW) ? now :
+                       (toSet & FUSE_SET_ATTR_ATIME) ? attr->st_atime : st.st_atime;
+        times.modtime = (toSet & FUSE_SET_ATTR_MTIME_NOW) ? now :
+                        (toSet & FUSE_SET_ATTR_MTIME) ? attr->st_mtime : st.st_mtime;
+        ret = fs->fuseUtime(path.c_str(), &times);
+    }
+    if (ret >= 0) {
+        ret = fs->fuseGetattrId(id, &st);
+    }
+
+    if (ret < 0) {
+        replyErr(req, timer, -ret);
+        return;
+    }
+    st.st_ino = ino;
+    timer.done(0);
+    fuse_reply_attr(req, &st, state->timeout);
+}
+
+static void ll_mknod(fuse_req_t req, fuse_ino_t parent, const char *name, mode_t mode, dev_t rdev) {
+    OpTimer timer(MyFS::Instance()->opStats, OP_MKNOD);
+    if (parent != FUSE_ROOT_ID) {
+        replyErr(req, timer, ENOTDIR);
+        return;
+    }
+    if (isStatsName(parent, name)) {
+        replyErr(req, timer, EEXIST);
+        return;
+    }
+
+    LowLevelState *state = getState(req);
+    std::lock_guard<std::mutex> guard(state->lock);
+    int ret = MyFS::Instance()->fuseMknod(pathOf(name).c_str(), mode, rdev);
+    if (ret < 0) {
+        replyErr(req, timer, -ret);
+        return;
+    }
+    replyEntry(req, timer, state, name);
+}
+
+static void ll_create(fuse_req_t req, fuse_ino_t parent, const char *name, mode_t mode, struct fuse_file_info *fi) {
+    LowLevelState *state = getState(req);
+    MyFS *fs = MyFS::Instance();
+    OpTimer timer(fs->opStats, OP_CREATE);
+    if (parent != FUSE_ROOT_ID) {
+        replyErr(req, timer, ENOTDIR);
+        return;
+    }
+    if (isStatsName(parent, name)) {
+        replyErr(req, timer, EEXIST);
+        return;
+    }
+
+    std::string path = pathOf(name);
+    std::lock_guard<std::mutex> guard(state->lock);
+    int ret = fs->fuseMknod(path.c_str(), mode, 0);
+    if (ret >= 0) {
+        ret = fs->fuseOpen(path.c_str(), fi);
+    }
+    int64_t id = ret < 0 ? ret : fs->fuseLookupId(path.c_str());
+    if (id < 0) {
+        replyErr(req, timer, (int) -id);
+        return;
+    }
+
+    struct fuse_entry_param entry;
+    memset(&entry, 0, sizeof(entry));
+    fs->fuseGetattrId(id, &entry.attr);
+    entry.ino = state->inodes.lookup(name, id);
+    entry.attr.st_ino = entry.ino;
+    entry.attr_timeout = state->timeout;
+    entry.entry_timeout = state->timeout;
+    fi->keep_cache = state->keepCache;
+    timer.done(0);
+    if (fuse_reply_create(req, &entry, fi) != 0) {
+        // Interrupted, the kernel neither got the reference nor the open file
+        state->inodes.forget(entry.ino, 1);
+        fs->fuseRelease(path.c_str(), fi);
+    }
+}
+
+static void ll_unlink(fuse_req_t req, fuse_ino_t parent, const char *name) {
+    OpTimer timer(MyFS::Instance()->opStats, OP_UNLINK);
+    if (parent != FUSE_ROOT_ID) {
+        replyErr(req, timer, ENOTDIR);
+        return;
+    }
+    if (isStatsName(parent, name)) {
+        replyErr(req, timer, EACCES);
+        return;
+    }
+
+    LowLevelState *state = getState(req);
+    std::lock_guard<std::mutex> guard(state->lock);
+    int ret = MyFS::Instance()->fuseUnlink(pathOf(name).c_str());
+    if (ret >= 0) {
+        state->inodes.remove(name);
+    }
+    replyErr(req, timer, ret < 0 ? -ret : 0);
+}
+
+static void ll_rename(fuse_req_t req, fuse_ino_t parent, const char *name, fuse_ino_t newParent,
+                      const char *newName) {
+    OpTimer timer(MyFS::Instance()->opStats, OP_RENAME);
+    if (parent != FUSE_ROOT_ID || newParent != FUSE_ROOT_ID) {
+        replyErr(req, timer, ENOTDIR);
+        return;
+    }
+    if (isStatsName(parent, name) || isStatsName(newParent, newName)) {
+        replyErr(req, timer, EACCES);
+        return;
+    }
+
+    LowLevelState *state = getState(req);
+    std::lock_guard<std::mutex> guard(state->lock);
+    int ret = MyFS::Instance()->fuseRename(pathOf(name).c_str(), pathOf(newName).c_str());
+    if (ret >= 0) {
+        state->inodes.rename(name, newName);
+    }
+    replyErr(req, timer, ret < 0 ? -ret : 0);
+}
+
+static void ll_open(fuse_req_t req, fuse_ino_t ino, struct fuse_file_info *fi) {
+    LowLevelState *state = getState(req);
+    MyFS *fs = MyFS::Instance();
+    OpTimer timer(fs->opStats, OP_OPEN);
+    if (ino == STATS_INO) {
+        int ret = fs->statsOpen(fi);
+        if (ret < 0) {
+            replyErr(req, timer, -ret);
+        } else {
+            timer.done(0);
+            if (fuse_reply_open(req, fi) != 0) {
+                fs->statsRelease(fi);
+            }
+        }
+        return;
+    }
+
+    std::lock_guard<std::mutex> guard(state->lock);
+    std::string path = getPath(state, ino);
+    int ret = path.empty() ? -ENOENT : fs->fuseOpen(path.c_str(), fi);
+    if (ret < 0) {
+        replyErr(req, timer, -ret);
+        return;
+    }
+    fi->keep_cache = state->keepCache;
+    timer.done(0);
+    if (fuse_reply_open(req, fi) != 0) {
+        fs->fuseRelease(path.c_str(), fi);
+    }
+}
+
+static void ll_read(fuse_req_t req, fuse_ino_t ino, size_t size, off_t off, struct fuse_file_info *fi) {
+    // Reused between requests of the same thread
+    static thread_local std::vector<char> buf;
+
+    MyFS *fs = MyFS::Instance();
+    OpTimer timer(fs->opStats, OP_READ);
+    int64_t id = ino == STATS_INO ? 0 : getFileId(getState(req), ino);
+    if (id < 0) {
+        replyErr(req, timer, (int) -id);
+        return;
+    }
+
+    if (buf.size() < size) {
+        buf.resize(size);
+    }
+    int ret = ino == STATS_INO ? fs->statsRead(buf.data(), size, off, fi)
+                               : fs->fuseReadId(id, buf.data(), size, off, fi);
+    if (ret < 0) {
+        replyErr(req, timer, -ret);
+        return;
+    }
+    timer.done(ret, ret);
+    fuse_reply_buf(req, buf.data(), ret);
+}
+
+static void ll_write(fuse_req_t req, fuse_ino_t ino, const char *buf, size_t size, off_t off,
+                     struct fuse_file_info *fi) {
+    MyFS *fs = MyFS::Instance();
+    OpTimer timer(fs->opStats, OP_WRITE);
+    int64_t id = ino == STATS_INO ? -EACCES : getFileId(getState(req), ino);
+    int ret = id < 0 ? (int) id : fs->fuseWriteId(id, buf, size, off, fi);
+    if (ret < 0) {
+        replyErr(req, timer, -ret);
+        return;
+    }
+    timer.done(ret, ret);
+    fuse_reply_write(req, ret);
+}
+
+static void ll_flush(fuse_req_t req, fuse_ino_t ino, struct fuse_file_info *fi) {
+    LowLevelState *state = getState(req);
+    OpTimer timer(MyFS::Instance()->opStats, OP_FLUSH);
+    if (ino == STATS_INO) {
+        replyErr(req, timer, 0);
+        return;
+    }
+
+    std::string path;
+    {
+        std::lock_guard<std::mutex> guard(state->lock);
+        path = getPath(state, ino);
+    }
+    int ret = MyFS::Instance()->fuseFlush(path.empty() ? NULL : path.c_str(), fi);
+    replyErr(req, timer, ret < 0 ? -ret : 0);
+}
+
+static void ll_release(fuse_req_t req, fuse_ino_t ino, struct fuse_file_info *fi) {
+    LowLevelState *state = getState(req);
+    MyFS *fs = MyFS::Instance();
+    OpTimer timer(fs->opStats, OP_RELEASE);
+    if (ino == STATS_INO) {
+        replyErr(req, timer, -fs->statsRelease(fi));
+        return;
+    }
+
+    std::string path;
+    {
+        std::lock_guard<std::mutex> guard(state->lock);
+        path = getPath(state, ino);
+    }
+    // A file unlinked while open has no path any more. Like FUSE with nullpath_ok, pass NULL then, fi->fh is still freed.
+    fs->fuseRelease(path.empty() ? NULL : path.c_str(), fi);
+    replyErr(req, timer, 0);
+}
+
+static void ll_fsync(fuse_req_t req, fuse_ino_t ino, int datasync, struct fuse_file_info *fi) {
+    LowLevelState *state = getState(req);
+    OpTimer timer(MyFS::Instance()->opStats, OP_FSYNC);
+    if (ino == STATS_INO) {
+        replyErr(req, timer, 0);
+        return;
+    }
+
+    std::string path;
+    {
+        std::lock_guard<std::mutex> guard(state->lock);
+        path = getPath(state, ino);
+    }
+    int ret = MyFS::Instance()->fuseFsync(path.empty() ? NULL : path.c_str(), datasync, fi);
+    replyErr(req, timer, ret < 0 ? -ret : 0);
+}
+
+static int collectEntry(void *buf, const char *name, const struct stat *stbuf, off_t off) {
+    ((std::vector<std::string> *) buf)->push_back(name);
+    return 0;
+}
+
+static void ll_opendir(fuse_req_t req, fuse_ino_t ino, struct fuse_file_info *fi) {
+    OpTimer timer(MyFS::Instance()->opStats, OP_OPENDIR);
+    if (ino != FUSE_ROOT_ID) {
+        replyErr(req, timer, ENOTDIR);
+        return;
+    }
+
+    // Take a snapshot of the directory, so readdir returns consistent offsets while files come and go
+    std::vector<std::string> *entries = new std::vector<std::string>();
+    int ret = MyFS::Instance()->fuseReaddir("/", entries, collectEntry, 0, fi);
+    if (ret < 0) {
+        delete entries;
+        replyErr(req, timer, -ret);
+        return;
+    }
+    entries->push_back(STATS_FILE_NAME);
+    fi->fh = (uint64_t) entries;
+    timer.done(0);
+    if (fuse_reply_open(req, fi) != 0) {
+        delete entries;
+    }
+}
+
+static void ll_readdir(fuse_req_t req, fuse_ino_t ino, size_t size, off_t off, struct fuse_file_info *fi) {
+    LowLevelState *state = getState(req);
+    OpTimer timer(MyFS::Instance()->opStats, OP_READDIR);
+    std::vector<std::string> *entries = (std::vector<std::string> *) fi->fh;
+    std::vector<char> buf(size);
+    size_t used = 0;
+
+    std::lock_guard<std::mutex> guard(state->lock);
+    for (size_t i = off; i < entries->size(); i++) {
+        const std::string &name = (*entries)[i];
+        bool isDir = name == "." || name == "..";
+
+        struct stat st;
+        memset(&st, 0, sizeof(st));
+        st.st_mode = isDir ? S_IFDIR : S_IFREG;
+        st.st_ino = isDir ? FUSE_ROOT_ID :
+                    name == STATS_FILE_NAME ? STATS_INO : state->inodes.findName(name.c_str());
+        if (st.st_ino == 0) {
+            st.st_ino = UNKNOWN_INO;
+        }
+
+        size_t len = fuse_add_direntry(req, buf.data() + used, size - used, name.c_str(), &st, i + 1);
+        if (len > size - used) {
+            break;
+        }
+        used += len;
+    }
+    timer.done(0);
+    fuse_reply_buf(req, buf.data(), used);
+}
+
+static void ll_releasedir(fuse_req_t req, fuse_ino_t ino, struct fuse_file_info *fi) {
+    OpTimer timer(MyFS::Instance()->opStats, OP_RELEASEDIR);
+    delete (std::vector<std::string> *) fi->fh;
+    replyErr(req, timer, 0);
+}
+
+static void ll_statfs(fuse_req_t req, fuse_ino_t ino) {
+    OpTimer timer(MyFS::Instance()->opStats, OP_STATFS);
+    struct statvfs st;
+    memset(&st, 0, sizeof(st));
+    int ret = MyFS::Instance()->fuseStatfs("/", &st);
+    if (ret < 0) {
+        replyErr(req, timer, -ret);
+        return;
+    }
+    timer.done(0);
+    fuse_reply_statfs(req, &st);
+}
+
+int lowlevel_main(struct fuse_args *args, struct MyFsInfo *info, double timeout, int keepCache) {
+    struct fuse_lowlevel_ops ops;
+    memset(&ops, 0, sizeof(ops));
+    ops.init = ll_init;
+    ops.destroy = ll_destroy;
+    ops.lookup = ll_lookup;
+    ops.forget = ll_forget;
+    ops.forget_multi = ll_forget_multi;
+    ops.getattr = ll_getattr;
+    ops.setattr = ll_setattr;
+    ops.mknod = ll_mknod;
+    ops.create = ll_create;
+    ops.unlink = ll_unlink;
+    ops.rename = ll_rename;
+    ops.open = ll_open;
+    ops.read = ll_read;
+    ops.write = ll_write;
+    ops.flush = ll_flush;
+    ops.release = ll_release;
+    ops.fsync = ll_fsync;
+    ops.opendir = ll_opendir;
+    ops.readdir = ll_readdir;
+    ops.releasedir = ll_releasedir;
+    ops.statfs = ll_statfs;
+
+    LowLevelState state;
+    state.info = info;
+    state.timeout = timeout;
+    state.keepCache = keepCache;
+
+    char *mountpoint = nullptr;
+    int multithreaded, foreground;
+    if (fuse_parse_cmdline(args, &mountpoint, &multithreaded, &foreground) == -1) {
+        return 1;
+    }
+
+    int err = -1;
+    struct fuse_chan *ch = fuse_mount(mountpoint, args);
+    if (ch != nullptr) {
+        struct fuse_session *se = fuse_lowlevel_new(args, &ops, sizeof(ops), &state);
+        if (se != nullptr) {
+            if (fuse_set_signal_handlers(se) != -1) {
+                fuse_session_add_chan(se, ch);
+                if (fuse_daemonize(foreground) != -1) {
+                    err = multithreaded ? fuse_session_loop_mt(se) : fuse_session_loop(se);
+                }
+                fuse_remove_signal_handlers(se);
+                fuse_session_remove_chan(ch);
+            }
+            fuse_session_destroy(se);
+        }
+        fuse_unmount(mountpoint, ch);
+    }
+    free(mountpoint);
+
+    return err ? 1 : 0;
+}
@@ -0,0 +1,200 @@
+//
+//  mappedblockdevice.cpp
+//  myfs
+//
+
+#include <algorithm>
+#include <cstring>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "mappedblockdevice.h"
+
+MappedBlockDevice::MappedBlockDevice(uint32_t blockSize) : BlockDevice(blockSize), map(nullptr), mapSize(0),
+                                                            fileSize(0) {
+}
+
+MappedBlockDevice::~MappedBlockDevice() {
+    if (map != nullptr) {
+        munmap(map, mapSize);
+    }
+}
+
+int MappedBlockDevice::open(const char *path) {
+    return attach(BlockDevice::open(path));
+}
+
+int MappedBlockDevice::create(const char *path) {
+    return attach(BlockDevice::create(path));
+}
+
+int MappedBlockDevice::close() {
+    mapLock.lockWrite();
+    if (map != nullptr) {
+        munmap(map, mapSize);
+        map = nullptr;
+        mapSize = 0;
+        fileSize = 0;
+    }
+    mapLock.unlock();
+
+    return BlockDevice::close();
+}
+
+// Map the container file just opened or created
+int MappedBlockDevice::attach(int ret) {
+    if (ret < 0)
+        return ret;
+
+    return grow(0, false);
+}
+
+// this method returns 0 if successful, -errno otherwise
+int MappedBlockDevice::readBlocks(uint32_t firstBlockNo, uint32_t count, char *buffer) {
+    off_t pos = (off_t) firstBlockNo * this->blockSize;
+    size_t size = (size_t) count * this->blockSize;
+
+    int ret = lockRange(pos + size, false);
+    if (ret < 0)
+        return ret;
+
+    copyOut(pos, size, buffer);
+
+    mapLock.unlock();
+    return 0;
+}
+
+// this method returns 0 if successful, -errno otherwise
+int MappedBlockDevice::writeBlocks(uint32_t firstBlockNo, uint32_t count, const char *buffer) {
+    off_t pos = (off_t) firstBlockNo * this->blockSize;
+    size_t size = (size_t) count * this->blockSize;
+
+    int ret = lockRange(pos + size, true);
+    if (ret < 0)
+        return ret;
+
+    memcpy(map + pos, buffer, size);
+
+    mapLock.unlock();
+    return 0;
+}
+
+// this method returns 0 if successful, -errno otherwise
+int MappedBlockDevice::readVec(uint32_t count, const uint32_t *blockNos, char **buffers) {
+    if (count == 0)
+        return 0;
+
+    off_t end = (off_t) (*std::max_element(blockNos, blockNos + count) + 1) * this->blockSize;
+    int ret = lockRange(end, false);
+    if (ret < 0)
+        return ret;
+
+    for (uint32_t i = 0; i < count; i++) {
+        copyOut((off_t) blockNos[i] * this->blockSize, this->blockSize, buffers[i]);
+    }
+
+    mapLock.unlock();
+    return 0;
+}
+
+// this method returns 0 if successful, -errno otherwise
+int MappedBlockDevice::writeVec(uint32_t count, const uint32_t *blockNos, const char **buffers) {
+    if (count == 0)
+        return 0;
+
+    // Grow the container once for the whole list
+    off_t end = (off_t) (*std::max_element(blockNos, blockNos + count) + 1) * this->blockSize;
+    int ret = lockRange(end, true);
+    if (ret < 0)
+        return ret;
+
+    for (uint32_t i = 0; i < count; i++) {
+        memcpy(map + (off_t) blockNos[i] * this->blockSize, buffers[i], this->blockSize);
+    }
+
+    mapLock.unlock();
+    return 0;
+}
+
+// this method returns 0 if successful, -errno otherwise
+int MappedBlockDevice::sync() {
+    int ret = 0;
+
+    mapLock.lockRead();
+    if (map == nullptr) {
+        ret = BlockDevice::sync();
+    } else if (msync(map, fileSize, MS_SYNC) < 0) {
+        ret = -errno;
+    }
+    mapLock.unlock();
+
+    return ret;
+}
+
+// Copy from the mapping, which must be read-locked. Blocks behind the end of the container have never been written.
+void MappedBlockDevice::copyOut(off_t pos, size_t size, char *buffer) {
+    size_t avail = pos >= fileSize ? 0 : std::min(size, (size_t) (fileSize - pos));
+    memcpy(buffer, map + pos, avail);
+    memset(buffer + avail, 0, size - avail);
+}
+
+// Read-lock the mapping, making sure it covers the range up to end. Writes grow the container file if necessary,
+// reads only pick up data written through the file descriptor. On success, the caller must unlock mapLock.
+int MappedBlockDevice::lockRange(off_t end, bool doWrite) {
+    mapLock.lockRead();
+    if (end <= fileSize)
+        return 0;
+    mapLock.unlock();
+
+    int ret = grow(end, doWrite);
+    if (ret < 0)
+        return ret;
+
+    mapLock.lockRead();
+    return 0;
+}
+
+// Update the size of the container file, extend it to end if doWrite is set, and map all of it. The mapping grows at
+// least by doubling, so a container filled block by block is remapped only a few times.
+int MappedBlockDevice::grow(off_t end, bool doWrite) {
+    int ret = 0;
+
+    mapLock.lockWrite();
+
+    struct stat st;
+    off_t newSize = fileSize;
+    if (fstat(this->contFile, &st) < 0) {
+        ret = -errno;
+    } else {
+        newSize = std::max(newSize, st.st_size);
+        if (doWrite && end > newSize) {
+            if (ftruncate(this->contFile, end) < 0) {
+                ret = -errno;
+            } else {
+                newSize = end;
+            }
+        }
+    }
+
+    if (ret == 0 && (size_t) newSize > mapSize) {
+        size_t newMapSize = std::max((size_t) newSize, 2 * mapSize);
+        void *m = map == nullptr ? mmap(nullptr, newMapSize, PROT_READ | PROT_WRITE, MAP_SHARED, this->contFile, 0)
+                                 : mremap(map, mapSize, newMapSize, MREMAP_MAYMOVE);
+        if (m == MAP_FAILED) {
+            ret = -errno;
+        } else {
+            map = (char *) m;
+            mapSize = newMapSize;
+        }
+    }
+
+    // Never touch the mapping behind the end of the file, that raises SIGBUS
+    if (ret == 0) {
+        fileSize = newSize;
+    }
+
+    mapLock.unlock();
+    return ret;
+}
@@ -9,6 +9,7 @@
 // DO NOT EDIT THIS FILE!!!
 
 #include "wrap.h"
+#include "lowlevel.h"
 
 #include <fuse.h>
 #include <stdio.h>
@@ -23,12 +24,31 @@ struct fuse_operations myfs_oper;
 struct myfs_config {
     char *containerFileName;
     char *logFileName;
+    char *ioEngine;
+    char *cacheSize;
+    int writeBack;
+    char *maxDirty;
+    int multiThreaded;
+    int atimeMode;
+    char *maxWrite;
+    char *readAhead;
+    int kernelCache;
+    int lowLevel;
+    char *logLevel;
+    char *containerSize;
+    char *blockSize;
 };
 enum {
     KEY_HELP,
     KEY_VERSION,
 };
 
+// attribute and entry timeout in seconds with and without -o kernelcache
+#define KERNEL_CACHE_TIMEOUT 60
+#define DEFAULT_TIMEOUT 1
+#define STR_(x) #x
+#define STR(x) STR_(x)
+
 #define MYFS_OPT(t, p, v) { t, offsetof(struct myfs_config, p), v }
 
 static struct fuse_opt myfs_opts[] = {
@@ -36,6 +56,21 @@ static struct fuse_opt myfs_opts[] = {
         MYFS_OPT("containerfile=%s",  containerFileName, 0),
         MYFS_OPT("-l %s",             logFileName, 0),
         MYFS_OPT("logfile=%s",        logFileName, 0),
+        MYFS_OPT("ioengine=%s",       ioEngine, 0),
+        MYFS_OPT("cachesize=%s",      cacheSize, 0),
+        MYFS_OPT("writeback",         writeBack, 1),
+        MYFS_OPT("maxdirty=%s",       maxDirty, 0),
+        MYFS_OPT("multithreaded",     multiThreaded, 1),
+        MYFS_OPT("relatime",          atimeMode, ATIME_RELATIME),
+        MYFS_OPT("strictatime",       atimeMode, ATIME_STRICT),
+        MYFS_OPT("noatime",           atimeMode, ATIME_NONE),
+        MYFS_OPT("maxwrite=%s",       maxWrite, 0),
+        MYFS_OPT("readahead=%s",      readAhead, 0),
+        MYFS_OPT("kernelcache",       kernelCache, 1),
+        MYFS_OPT("lowlevel",          lowLevel, 1),
+        MYFS_OPT("loglevel=%s",       logLevel, 0),
+        MYFS_OPT("containersize=%s",  containerSize, 0),
+        MYFS_OPT("blocksize=%s",      blockSize, 0),
 
         FUSE_OPT_KEY("-V",             KEY_VERSION),
         FUSE_OPT_KEY("--version",      KEY_VERSION),
@@ -56,7 +91,22 @@ static int myfs_opt_proc(void *data, const char *arg, int key, struct fuse_args
                     "    -o containerfile=FILE\n"
                     "    -c FILE            same as '-o containerfile=FILE'\n"
                     "    -o logfile=FILE\n"
-                    "    -l FILE            same as '-o logfile=FILE'\n");
+                    "    -l FILE            same as '-o logfile=FILE'\n"
+                    "    -o ioengine=ENGINE block I/O engine: sync (default), uring, threads, auto or mmap\n"
+                    "    -o cachesize=SIZE  size of the block cache, suffix K, M or G (default 4M, 0 disables)\n"
+                    "    -o writeback       buffer writes in the block cache and flush them in the background\n"
+                    "    -o maxdirty=SIZE   upper bound for buffered writes in write-back mode (default 1M)\n"
+                    "    -o multithreaded   serve requests with several threads instead of one\n"
+                    "    -o relatime        update access times only if older than the last change (default)\n"
+                    "    -o strictatime     update access times on every read\n"
+                    "    -o noatime         never update access times\n"
+                    "    -o maxwrite=SIZE   largest write request accepted from the kernel (default 128K)\n"
+                    "    -o readahead=SIZE  kernel readahead window (default 128K)\n"
+                    "    -o kernelcache     keep file data and attributes in the kernel cache between opens\n"
+                    "    -o lowlevel        address files by inode number (FUSE low-level API)\n"
+                    "    -o loglevel=LEVEL  log messages: none, info or debug (default, also method calls)\n"
+                    "    -o containersize=SIZE size of a new container file, suffix K, M or G (default 32M)\n"
+                    "    -o blocksize=SIZE  block size of a new container file, 512 to 64K (default 512)\n");
             exit(1);
 
         case KEY_VERSION:
@@ -88,6 +138,8 @@ int main(int argc, char *argv[]) {
     myfs_oper.open = wrap_open;
     myfs_oper.read = wrap_read;
     myfs_oper.write = wrap_write;
+    myfs_oper.read_buf = wrap_read_buf;
+    myfs_oper.write_buf = wrap_write_buf;
     myfs_oper.statfs = wrap_statfs;
     myfs_oper.flush = wrap_flush;
     myfs_oper.release = wrap_release;
@@ -175,14 +227,39 @@ int main(int argc, char *argv[]) {
     // container & log file name will be passed to fuse functions
     FsInfo->contFile= containerFileName;
     FsInfo->logFile= logFileName;
+    FsInfo->ioEngine= conf.ioEngine;
+    FsInfo->cacheSize= conf.cacheSize;
+    FsInfo->writeBack= conf.writeBack;
+    FsInfo->maxDirty= conf.maxDirty;
+    FsInfo->atimeMode= conf.atimeMode;
+    FsInfo->maxWrite= conf.maxWrite;
+    FsInfo->readAhead= conf.readAhead;
+    FsInfo->logLevel= conf.logLevel;
+    FsInfo->containerSize= conf.containerSize;
+    FsInfo->blockSize= conf.blockSize;
+    FsInfo->multiThreaded= conf.multiThreaded;
 
-    // add additoinal "-s"
-    fuse_opt_add_arg(&args, "-s");
+    // all changes go through this process, so the kernel may keep cached pages and attributes; options given
+    // explicitly by the user come later and take precedence
+    if (conf.kernelCache && !conf.lowLevel) {
+        fuse_opt_insert_arg(&args, 1, "-okernel_cache,attr_timeout=" STR(KERNEL_CACHE_TIMEOUT)
+                                      ",entry_timeout=" STR(KERNEL_CACHE_TIMEOUT));
+    }
 
-    // call fuse initialization method
-    fuse_stat = fuse_main(args.argc, args.argv, &myfs_oper, FsInfo);
+    // add additoinal "-s" unless requests should be served in parallel
+    if (!conf.multiThreaded) {
+        fuse_opt_add_arg(&args, "-s");
+    }
 
-    fprintf(stderr, "fuse_main returned %d\n", fuse_stat);
+    // call fuse initialization method
+    if (conf.lowLevel) {
+        fuse_stat = lowlevel_main(&args, FsInfo, conf.kernelCache ? KERNEL_CACHE_TIMEOUT : DEFAULT_TIMEOUT,
+                                  conf.kernelCache);
+        fprintf(stderr, "lowlevel_main returned %d\n", fuse_stat);
+    } else {
+        fuse_stat = fuse_main(args.argc, args.argv, &myfs_oper, FsInfo);
+        fprintf(stderr, "fuse_main returned %d\n", fuse_stat);
+    }
 
     // cleanup
     free(FsInfo);
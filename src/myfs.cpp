@@ -22,6 +22,8 @@
 #include <string.h>
 #include <errno.h>
 #include <cstdlib>
+#include <fcntl.h>
+#include <algorithm>
 
 #include "macros.h"
 #include "myfs.h"
@@ -30,6 +32,287 @@
 
 // TODO: [PART 2] You may move some helper messages here
 
+/// @brief Parse a size given as mount option.
+///
+/// The number may be followed by one of the suffixes K, M or G.
+/// \param [in] str Size string, e.g. "512K".
+/// \return Size in bytes, -1 if the string is not a valid size.
+long long MyFS::parseSize(const char *str) {
+    char *end;
+    long long size = strtoll(str, &end, 10);
+    if (end == str || size < 0) {
+        return -1;
+    }
+
+    switch (*end) {
+        case 'g': case 'G': size *= 1024;
+        case 'm': case 'M': size *= 1024;
+        case 'k': case 'K': size *= 1024; end++;
+        default: break;
+    }
+
+    return *end == '\0' ? size : -1;
+}
+
+/// @brief Read from a file into a buffer vector.
+///
+/// Default implementation for file systems that cannot hand out buffers of their storage: the data is read into a
+/// newly allocated memory buffer with fuseRead(). FUSE frees the buffer vector and the buffer.
+/// \param [in] path Name of the file, starting with "/".
+/// \param [out] bufp Buffer vector with the data read, may be shorter than size at the end of the file.
+/// \param [in] size Number of bytes to read.
+/// \param [in] offset Starting position in the file.
+/// \param [in] fileInfo File handle for the file set by fuseOpen.
+/// \return 0 on success, -ERRNO on failure.
+int MyFS::fuseReadBuf(const char *path, struct fuse_bufvec **bufp, size_t size, off_t offset,
+                      struct fuse_file_info *fileInfo) {
+    struct fuse_bufvec *buf = (struct fuse_bufvec *) malloc(sizeof(struct fuse_bufvec));
+    char *mem = (char *) malloc(size > 0 ? size : 1);
+    if (buf == NULL || mem == NULL) {
+        free(buf);
+        free(mem);
+        return -ENOMEM;
+    }
+
+    int ret = fuseRead(path, mem, size, offset, fileInfo);
+    if (ret < 0) {
+        free(buf);
+        free(mem);
+        return ret;
+    }
+
+    memset(buf, 0, sizeof(struct fuse_bufvec));
+    buf->count = 1;
+    buf->buf[0].size = ret;
+    buf->buf[0].mem = mem;
+    buf->buf[0].fd = -1;
+    *bufp = buf;
+    return 0;
+}
+
+/// @brief Write the content of a buffer vector to a file.
+///
+/// Default implementation for file systems that cannot write to their storage from a buffer vector: the data is
+/// copied into a memory buffer and written with fuseWrite().
+/// \param [in] path Name of the file, starting with "/".
+/// \param [in] buf Buffer vector with the data to write, may be backed by memory or a file descriptor.
+/// \param [in] offset Starting position in the file.
+/// \param [in] fileInfo File handle for the file set by fuseOpen.
+/// \return Number of bytes written on success, -ERRNO on failure.
+int MyFS::fuseWriteBuf(const char *path, struct fuse_bufvec *buf, off_t offset, struct fuse_file_info *fileInfo) {
+    size_t size = fuse_buf_size(buf);
+    char *mem = (char *) malloc(size > 0 ? size : 1);
+    if (mem == NULL) {
+        return -ENOMEM;
+    }
+
+    struct fuse_bufvec dst;
+    memset(&dst, 0, sizeof(dst));
+    dst.count = 1;
+    dst.buf[0].size = size;
+    dst.buf[0].mem = mem;
+    dst.buf[0].fd = -1;
+
+    ssize_t copied = fuse_buf_copy(&dst, buf, (enum fuse_buf_copy_flags) 0);
+    int ret = copied < 0 ? (int) copied : fuseWrite(path, mem, copied, offset, fileInfo);
+    free(mem);
+    return ret;
+}
+
+/// @brief Check if a path names the statistics file.
+bool MyFS::isStatsFile(const char *path) {
+    return path[0] == '/' && strcmp(path + 1, STATS_FILE_NAME) == 0;
+}
+
+/// @brief Append the statistics of the file system in the Prometheus text format.
+///
+/// File systems with more counters override this method and call it first.
+/// \param [out] out Text the statistics are appended to.
+void MyFS::formatStats(std::string &out) {
+    opStats.format(out);
+
+    out += "# HELP myfs_log_dropped_total Log records dropped because a log buffer was full.\n"
+           "# TYPE myfs_log_dropped_total counter\n";
+    appendMetric(out, "myfs_log_dropped_total", "", logger.getDropped());
+}
+
+/// @brief Get the meta data of the statistics file.
+///
+/// The size is the size of the statistics right now; they are read with direct I/O, so a larger size at open is no
+/// problem.
+/// \param [out] statbuf Meta data of the file.
+/// \return 0.
+int MyFS::statsGetattr(struct stat *statbuf) {
+    std::string text;
+    formatStats(text);
+
+    memset(statbuf, 0, sizeof(struct stat));
+    statbuf->st_mode = S_IFREG | 0444;
+    statbuf->st_nlink = 1;
+    statbuf->st_uid = getuid();
+    statbuf->st_gid = getgid();
+    statbuf->st_size = text.size();
+    statbuf->st_blocks = (text.size() + 511) / 512;
+    statbuf->st_atime = statbuf->st_mtime = statbuf->st_ctime = time(NULL);
+    return 0;
+}
+
+/// @brief Open the statistics file.
+///
+/// Takes a snapshot of the statistics, so all reads of one open file see the same text.
+/// \param [in,out] fileInfo Open flags, the snapshot is stored in fileInfo->fh.
+/// \return 0 on success, -EACCES if the file is opened for writing.
+int MyFS::statsOpen(struct fuse_file_info *fileInfo) {
+    if ((fileInfo->flags & O_ACCMODE) != O_RDONLY) {
+        return -EACCES;
+    }
+
+    std::string *text = new std::string();
+    formatStats(*text);
+    fileInfo->fh = (uint64_t) text;
+    fileInfo->direct_io = 1;
+    return 0;
+}
+
+/// @brief Read from the snapshot of an open statistics file.
+/// \return Number of bytes read.
+int MyFS::statsRead(char *buf, size_t size, off_t offset, struct fuse_file_info *fileInfo) {
+    std::string *text = (std::string *) fileInfo->fh;
+    if (offset >= (off_t) text->size()) {
+        return 0;
+    }
+    size_t n = std::min(size, text->size() - offset);
+    memcpy(buf, text->data() + offset, n);
+    return n;
+}
+
+/// @brief Read from the snapshot of an open statistics file into a buffer vector.
+/// \return 0.
+int MyFS::statsReadBuf(struct fuse_bufvec **bufp, size_t size, off_t offset, struct fuse_file_info *fileInfo) {
+    struct fuse_bufvec *buf = (struct fuse_bufvec *) malloc(sizeof(struct fuse_bufvec));
+    char *mem = (char *) malloc(size > 0 ? size : 1);
+    if (buf == NULL || mem == NULL) {
+        free(buf);
+        free(mem);
+        return -ENOMEM;
+    }
+
+    memset(buf, 0, sizeof(struct fuse_bufvec));
+    buf->count = 1;
+    buf->buf[0].size = statsRead(mem, size, offset, fileInfo);
+    buf->buf[0].mem = mem;
+    buf->buf[0].fd = -1;
+    *bufp = buf;
+    return 0;
+}
+
+/// @brief Release the snapshot of an open statistics file.
+/// \return 0.
+int MyFS::statsRelease(struct fuse_file_info *fileInfo) {
+    delete (std::string *) fileInfo->fh;
+    fileInfo->fh = 0;
+    return 0;
+}
+
+/// @brief Set up the file system without FUSE, e.g. for the low-level front end or tests.
+///
+/// \param [in] info Mount options.
+/// \return 0 on success, -ERRNO on failure.
+int MyFS::setup(MyFsInfo *info) {
+    return 0;
+}
+
+/// @brief Open the log file and start the logger.
+///
+/// \param [in] info Mount options, uses the log file name and the log level.
+/// \return 0 on success, -EIO if the log file cannot be opened.
+int MyFS::startLogging(MyFsInfo *info) {
+    this->logFile = fopen(info->logFile, "w+");
+    if (this->logFile == NULL) {
+        fprintf(stderr, "ERROR: Cannot open logfile %s\n", info->logFile);
+        return -EIO;
+    }
+
+    int level = info->logLevel != NULL ? Logger::parseLevel(info->logLevel) : LOG_DEBUG;
+    this->logger.start(this->logFile, level < 0 ? LOG_DEBUG : level);
+    if (level < 0) {
+        LOGF("ERROR: Invalid log level %s, using debug", info->logLevel);
+    }
+    return 0;
+}
+
+/// @brief Look up the id of a file for the low-level front end.
+///
+/// Ids let the front end access files without resolving their names again. An id stays valid until the file is
+/// deleted and is never used for a different file.
+/// \param [in] path Name of the file, starting with "/".
+/// \return Id of the file, -ERRNO on failure.
+int64_t MyFS::fuseLookupId(const char *path) {
+    return -ENOSYS;
+}
+
+/// @brief Get meta data of a file given by its id, see fuseGetattr().
+int MyFS::fuseGetattrId(int64_t id, struct stat *statbuf) {
+    return -ENOSYS;
+}
+
+/// @brief Read from a file given by its id, see fuseRead().
+int MyFS::fuseReadId(int64_t id, char *buf, size_t size, off_t offset, struct fuse_file_info *fileInfo) {
+    return -ENOSYS;
+}
+
+/// @brief Write to a file given by its id, see fuseWrite().
+int MyFS::fuseWriteId(int64_t id, const char *buf, size_t size, off_t offset, struct fuse_file_info *fileInfo) {
+    return -ENOSYS;
+}
+
+/// @brief Negotiate request sizes and capabilities with the kernel.
+///
+/// Called from fuseInit() once the log file is open. Enables big writes, so the kernel sends writes of up to maxwrite
+/// bytes instead of single pages, splicing for fuseReadBuf() and fuseWriteBuf(), asynchronous reads and the requested
+/// readahead window. Values are capped by what the
+/// kernel offers.
+/// \param [in,out] conn Connection parameters offered by the kernel, changed to the wanted values.
+/// \param [in] info Mount options.
+void MyFS::negotiateConnection(struct fuse_conn_info *conn, MyFsInfo *info) {
+    if (conn == NULL) {
+        return;
+    }
+
+    long long maxWrite = DEFAULT_MAX_WRITE;
+    if (info->maxWrite != NULL && (maxWrite = parseSize(info->maxWrite)) < BLOCK_SIZE) {
+        LOGF("ERROR: Invalid maximum write size %s, using default", info->maxWrite);
+        maxWrite = DEFAULT_MAX_WRITE;
+    }
+    long long readAhead = DEFAULT_READAHEAD;
+    if (info->readAhead != NULL && (readAhead = parseSize(info->readAhead)) < 0) {
+        LOGF("ERROR: Invalid readahead size %s, using default", info->readAhead);
+        readAhead = DEFAULT_READAHEAD;
+    }
+
+    if (conn->capable & FUSE_CAP_BIG_WRITES) {
+        conn->want |= FUSE_CAP_BIG_WRITES;
+        conn->max_write = (unsigned) maxWrite;
+    }
+    if (conn->capable & FUSE_CAP_SPLICE_READ) {
+        conn->want |= FUSE_CAP_SPLICE_READ;
+    }
+    if (conn->capable & FUSE_CAP_SPLICE_WRITE) {
+        conn->want |= FUSE_CAP_SPLICE_WRITE | (conn->capable & FUSE_CAP_SPLICE_MOVE);
+    }
+    if (conn->capable & FUSE_CAP_ASYNC_READ) {
+        conn->want |= FUSE_CAP_ASYNC_READ;
+        conn->async_read = 1;
+    }
+    if ((unsigned long long) readAhead < conn->max_readahead) {
+        conn->max_readahead = (unsigned) readAhead;
+    }
+
+    LOGF("FUSE protocol %u.%u: big writes %s, max_write %u, async_read %u, max_readahead %u", conn->proto_major,
+         conn->proto_minor, (conn->want & FUSE_CAP_BIG_WRITES) ? "on" : "off", conn->max_write, conn->async_read,
+         conn->max_readahead);
+}
+
 // DO NOT EDIT ANYTHING BELOW THIS LINE!!!
 
 MyFS::MyFS() {
@@ -111,7 +394,7 @@ int MyFS::fuseReaddir(const char *path, void *buf, fuse_fill_dir_t filler, off_t
 }
 
 void* MyFS::fuseInit(struct fuse_conn_info *conn) {
-    RETURN(0);
+    return nullptr;
 }
 
 int MyFS::fuseReadlink(const char *path, char *link, size_t size) {
@@ -30,7 +30,6 @@
 #define DEBUG_RETURN_VALUES
 
 #define NAME_LENGTH 255
-#define BLOCK_SIZE 512
 #define NUM_DIR_ENTRIES 64
 #define NUM_OPEN_FILES 64
 
@@ -47,7 +46,7 @@
 ///
 /// You may add your own constructor code here.
 MyInMemoryFS::MyInMemoryFS() : MyFS() {
-
+    this->nextFileId = 0;
 }
 
 /// @brief Destructor of the in-memory file system class.
@@ -71,6 +70,15 @@ MyInMemoryFS::~MyInMemoryFS() {
 int MyInMemoryFS::fuseMknod(const char *path, mode_t mode, dev_t dev) {
     LOGM();
 
+    WriteGuard tableGuard(tableLock);
+
+    if (fileIndex.find(path + 1) != nullptr) {
+        RETURN(-EEXIST);
+    }
+    if (strlen(path + 1) > NAME_LENGTH) {
+        RETURN(-ENAMETOOLONG);
+    }
+
     myFsFile file{
             std::string(path + 1),
             0,
@@ -79,12 +87,16 @@ int MyInMemoryFS::fuseMknod(const char *path, mode_t mode, dev_t dev) {
             0,
             0,
             0,
-            nullptr,
+            {},
             0,
             0
     };
 
-    files.push_back(file);
+    auto it = files.emplace(files.end());
+    static_cast<myFsFile &>(*it) = file;
+    it->id = nextFileId++;
+    fileIndex.insert(it->name.c_str(), it);
+    fileIds[it->id] = &(*it);
 
     RETURN(0);
 }
@@ -98,19 +110,26 @@ int MyInMemoryFS::fuseMknod(const char *path, mode_t mode, dev_t dev) {
 int MyInMemoryFS::fuseUnlink(const char *path) {
     LOGM();
 
-    auto p = std::string(path + 1);
-    for (auto i = files.begin(); i != files.end(); i++) {
-        if (i->name == p) {
-            // release allocated memory
-            if (i->data) {
-                free(i->data);
-            }
-            files.erase(i);
-            RETURN(0);
-        }
+    WriteGuard tableGuard(tableLock);
+
+    auto *entry = fileIndex.find(path + 1);
+    if (entry == nullptr) {
+        RETURN(-ENOENT);
     }
 
-    RETURN(-ENOENT);
+    auto i = *entry;
+    fileIndex.erase(path + 1);
+
+    // Wait until running operations on the file are finished, nobody can find it anymore
+    i->lock.lockWrite();
+    i->lock.unlock();
+
+    // release allocated memory
+    releasePages(&(*i));
+    fileIds.erase(i->id);
+    files.erase(i);
+
+    RETURN(0);
 }
 
 /// @brief Rename a file.
@@ -125,17 +144,38 @@ int MyInMemoryFS::fuseUnlink(const char *path) {
 int MyInMemoryFS::fuseRename(const char *path, const char *newpath) {
     LOGM();
 
-    //search if the new path already exists
-    myFsFile *file;
-    int ret = findFile(newpath, &file);
-    if (ret == 0) { /*TODO: REMOVE FILE*/; } //remove file if already existing
+    WriteGuard tableGuard(tableLock);
 
-    if (ret) {
-        RETURN(ret);
-    } else {
-        file->name = std::string(newpath + 1);
+    auto *entry = fileIndex.find(path + 1);
+    if (entry == nullptr) {
+        RETURN(-ENOENT);
+    }
+    auto i = *entry;
+
+    if (strlen(newpath + 1) > NAME_LENGTH) {
+        RETURN(-ENAMETOOLONG);
     }
 
+    //remove file if already existing
+    auto *existing = fileIndex.find(newpath + 1);
+    if (existing != nullptr) {
+        if (*existing == i) {
+            RETURN(0);
+        }
+        auto old = *existing;
+        fileIndex.erase(newpath + 1);
+        old->lock.lockWrite();
+        old->lock.unlock();
+        releasePages(&(*old));
+        fileIds.erase(old->id);
+        files.erase(old);
+    }
+
+    // the index references the name, so remove the entry before changing it
+    fileIndex.erase(path + 1);
+    i->name = std::string(newpath + 1);
+    fileIndex.insert(i->name.c_str(), i);
+
     RETURN(0);
 }
 
@@ -154,18 +194,12 @@ int MyInMemoryFS::fuseGetattr(const char *path, struct stat *statbuf) {
         RETURN(0);
     }
 
-    myFsFile *file;
-    int ret = findFile(path, &file);
+    MemFile *file = lockFile(path, false);
     // If file not found return ERRNO
-    if (ret) { RETURN(ret); }
+    if (file == nullptr) { RETURN(-ENOENT); }
+    ReadGuard fileGuard(file->lock, std::adopt_lock);
 
-    statbuf->st_uid = file->userId;
-    statbuf->st_gid = file->groupId;
-    statbuf->st_atime = file->accessTime;
-    statbuf->st_mtime = file->modTime;
-    statbuf->st_mode = file->mode;
-    statbuf->st_nlink = 1; // weil wir eine Datei sind und kein Verzeichnis
-    statbuf->st_size = file->size;
+    statFile(file, statbuf);
 
     RETURN(0);
 }
@@ -180,9 +214,9 @@ int MyInMemoryFS::fuseGetattr(const char *path, struct stat *statbuf) {
 int MyInMemoryFS::fuseChmod(const char *path, mode_t mode) {
     LOGM();
 
-    myFsFile *file;
-    int ret = findFile(path, &file);
-    if (ret) { RETURN(ret); } // If file not found return ERRNO
+    MemFile *file = lockFile(path, true);
+    if (file == nullptr) { RETURN(-ENOENT); } // If file not found return ERRNO
+    WriteGuard fileGuard(file->lock, std::adopt_lock);
 
     // Change mode of file
     file->mode = mode;
@@ -200,9 +234,9 @@ int MyInMemoryFS::fuseChmod(const char *path, mode_t mode) {
 int MyInMemoryFS::fuseChown(const char *path, uid_t uid, gid_t gid) {
     LOGM();
 
-    myFsFile *file;
-    int ret = findFile(path, &file);
-    if (ret) { RETURN(ret); } // If file not found return ERRNO
+    MemFile *file = lockFile(path, true);
+    if (file == nullptr) { RETURN(-ENOENT); } // If file not found return ERRNO
+    WriteGuard fileGuard(file->lock, std::adopt_lock);
 
     // Change user- and groupId
     file->userId = uid;
@@ -222,6 +256,8 @@ int MyInMemoryFS::fuseChown(const char *path, uid_t uid, gid_t gid) {
 int MyInMemoryFS::fuseOpen(const char *path, struct fuse_file_info *fileInfo) {
     LOGM();
 
+    ReadGuard tableGuard(tableLock);
+
     myFsFile *file;
     int ret = findFile(path, &file);
     if (ret) {
@@ -252,26 +288,15 @@ int MyInMemoryFS::fuseRead(const char *path, char *buf, size_t size, off_t offse
     LOGM();
 
     // Find file
-    myFsFile *file;
-    int ret = findFile(path, &file);
-    if (ret) {
+    MemFile *file = lockFile(path, false);
+    if (file == nullptr) {
         // file not found
         RETURN(-ENOENT);
     }
+    ReadGuard fileGuard(file->lock, std::adopt_lock);
 
-    // Check if offset in range
-    if (offset > file->size) {
-        RETURN(-EINVAL)
-    }
-
-    // Check if we can read the whole request or just until end of file
-    off_t size2read = std::min(file->size - offset, (off_t) size);
-
-    // Fill buffer with read data
-    memcpy(buf, file->data + offset, size2read);
-
-    // Return nr of Bytes read.
-    RETURN(size2read)
+    int ret = readFile(file, buf, size, offset);
+    RETURN(ret);
 }
 
 /// @brief Write to a file.
@@ -294,35 +319,32 @@ MyInMemoryFS::fuseWrite(const char *path, const char *buf, size_t size, off_t of
     LOGM();
 
     // Get file
-    myFsFile *file;
-    int ret = findFile(path, &file);
+    MemFile *file = lockFile(path, true);
 
     // Check if file exists
-    if (ret) {
+    if (file == nullptr) {
         RETURN(-EBADF);
     }
+    WriteGuard fileGuard(file->lock, std::adopt_lock);
 
-    // If offset + size of new data extends our file data, realloc file.data
-    ret = resizeFile(file, std::max(offset + (off_t) size, file->size));
-
-    // Check if resizeFile failed
-    if (ret) {
-        RETURN(-ENOSPC);
-    }
-
-    memcpy(file->data + offset, buf, size);
-    RETURN(size);
+    int ret = writeFile(file, buf, size, offset);
+    RETURN(ret);
 }
 
 /// @brief Close a file.
 ///
 /// In Part 1 this includes decrementing the open file count.
-/// \param [in] path Name of the file, starting with "/".
+/// \param [in] path Name of the file, starting with "/", or NULL if the file was deleted while open.
 /// \param [in] fileInfo Can be ignored in Part 1 .
 /// \return 0 on success, -ERRNO on failure.
 int MyInMemoryFS::fuseRelease(const char *path, struct fuse_file_info *fileInfo) {
     LOGM();
 
+    if (path == NULL) {
+        RETURN(0);
+    }
+
+    ReadGuard tableGuard(tableLock);
 
     myFsFile *file;
     int ret = findFile(path, &file);
@@ -345,14 +367,14 @@ int MyInMemoryFS::fuseTruncate(const char *path, off_t newSize) {
     LOGM();
 
     // Get File
-    myFsFile *file;
-    int ret = findFile(path, &file);
-    if (ret) {
+    MemFile *file = lockFile(path, true);
+    if (file == nullptr) {
         RETURN(-ENOENT);
     }
+    WriteGuard fileGuard(file->lock, std::adopt_lock);
 
     // Try resize file
-    ret = resizeFile(file, newSize);
+    int ret = resizeFile(file, newSize);
     if (ret) {
         RETURN(-EIO);
     }
@@ -397,8 +419,9 @@ int MyInMemoryFS::fuseReaddir(const char *path, void *buf, fuse_fill_dir_t fille
 
     // If the user is trying to show the files/directories of the root directory show the following
     if (strcmp(path, "/") == 0) {
+        ReadGuard tableGuard(tableLock);
 
-        std::list<myFsFile>::iterator it;
+        std::list<MemFile>::iterator it;
         for (it = files.begin(); it != files.end(); ++it) {
             //TODO: Fill "stat" with file data instead of sending "nullptr"
             filler(buf, it->name.c_str(), nullptr, 0);
@@ -412,28 +435,97 @@ int MyInMemoryFS::fuseReaddir(const char *path, void *buf, fuse_fill_dir_t fille
 /// Initialize a file system.
 ///
 /// This function is called when the file system is mounted. You may add some initializing code here.
-/// \param [in] conn Can be ignored.
+/// \param [in,out] conn Connection parameters offered by the kernel, see negotiateConnection().
 /// \return 0.
 void *MyInMemoryFS::fuseInit(struct fuse_conn_info *conn) {
-    // Open logfile
-    this->logFile = fopen(((MyFsInfo *) fuse_get_context()->private_data)->logFile, "w+");
-    if (this->logFile == NULL) {
-        fprintf(stderr, "ERROR: Cannot open logfile %s\n", ((MyFsInfo *) fuse_get_context()->private_data)->logFile);
-    } else {
-        // turn of logfile buffering
-        setvbuf(this->logFile, NULL, _IOLBF, 0);
+    MyFsInfo *info = (MyFsInfo *) fuse_get_context()->private_data;
+    if (setup(info) == 0) {
+        negotiateConnection(conn, info);
+    }
+
+    return 0;
+}
 
+/// @brief Open the log file.
+///
+/// Does the work of fuseInit(). Tests can call it directly to use the file system without FUSE.
+/// \param [in] info Mount options.
+/// \return 0 on success, -ERRNO on failure.
+int MyInMemoryFS::setup(MyFsInfo *info) {
+    // Open logfile
+    if (startLogging(info) == 0) {
         LOG("Starting logging...\n");
 
         LOG("Using in-memory mode");
 
         // TODO: [PART 1] Implement your initialization methods here
 
+        return 0;
     }
 
+    return -EIO;
+}
+
+/// @brief Look up the id of a file.
+///
+/// Ids are numbered in creation order and never reused.
+/// \param [in] path Name of the file, starting with "/".
+/// \return Id of the file, -ERRNO on failure.
+int64_t MyInMemoryFS::fuseLookupId(const char *path) {
+    LOGM();
+
+    ReadGuard tableGuard(tableLock);
+    auto *entry = fileIndex.find(path + 1);
+    if (entry == nullptr) {
+        return -ENOENT;
+    }
+    return (*entry)->id;
+}
+
+/// @brief Get file meta data, see fuseGetattr().
+/// \param [in] id Id of the file returned by fuseLookupId().
+/// \param [out] statbuf Meta data of the file.
+/// \return 0 on success, -ERRNO on failure.
+int MyInMemoryFS::fuseGetattrId(int64_t id, struct stat *statbuf) {
+    LOGM();
+
+    MemFile *file = lockFileId(id, false);
+    if (file == nullptr) { RETURN(-ENOENT); }
+    ReadGuard fileGuard(file->lock, std::adopt_lock);
+
+    statFile(file, statbuf);
     RETURN(0);
 }
 
+/// @brief Read from a file, see fuseRead().
+/// \param [in] id Id of the file returned by fuseLookupId().
+/// \return Number of bytes read, -ERRNO on failure.
+int MyInMemoryFS::fuseReadId(int64_t id, char *buf, size_t size, off_t offset, struct fuse_file_info *fileInfo) {
+    LOGM();
+
+    MemFile *file = lockFileId(id, false);
+    if (file == nullptr) { RETURN(-ENOENT); }
+    ReadGuard fileGuard(file->lock, std::adopt_lock);
+
+    int ret = readFile(file, buf, size, offset);
+    RETURN(ret);
+}
+
+/// @brief Write to a file, see fuseWrite().
+/// \param [in] id Id of the file returned by fuseLookupId().
+/// \return Number of bytes written, -ERRNO on failure.
+int MyInMemoryFS::fuseWriteId(int64_t id, const char *buf, size_t size, off_t offset,
+                              struct fuse_file_info *fileInfo) {
+    LOGM();
+
+    MemFile *file = lockFileId(id, true);
+    if (file == nullptr) { RETURN(-ENOENT); }
+    WriteGuard fileGuard(file->lock, std::adopt_lock);
+
+    int ret = writeFile(file, buf, size, offset);
+    RETURN(ret);
+}
+
 /// @brief Clean up a file system.
 ///
 /// This function is called when the file system is unmounted. You may add some cleanup code here.
@@ -441,65 +533,205 @@ void MyInMemoryFS::fuseDestroy() {
     LOGM();
 
 
+    WriteGuard tableGuard(tableLock);
+
     // For each file in our fs
     for (auto i = files.begin(); i != files.end(); i++) {
 
         // free memory
-        if (i->data) {
-            free(i->data);
-        }
+        releasePages(&(*i));
+    }
+
+    // remove files
+    fileIndex.clear();
+    fileIds.clear();
+    files.clear();
+
+    logger.flush();
+}
+
+/// @brief Find and lock a file.
+///
+/// The file is looked up with tableLock held, which is released once the file is locked.
+/// \param [in] path Name of the file, starting with "/".
+/// \param [in] exclusive Lock the file for writing instead of reading.
+/// \return The file, locked until the caller unlocks file->lock, nullptr if it does not exist.
+MemFile *MyInMemoryFS::lockFile(const char *path, bool exclusive) {
+    ReadGuard tableGuard(tableLock);
+
+    auto *entry = fileIndex.find(path + 1);
+    if (entry == nullptr) {
+        return nullptr;
+    }
+
+    MemFile *file = &(**entry);
+    exclusive ? file->lock.lockWrite() : file->lock.lockRead();
+    return file;
+}
+
+/// @brief Find and lock a file given by its id.
+///
+/// \param [in] id Id returned by fuseLookupId().
+/// \param [in] exclusive Lock the file for writing instead of reading.
+/// \return The file, locked until the caller unlocks file->lock, nullptr if it was deleted.
+MemFile *MyInMemoryFS::lockFileId(int64_t id, bool exclusive) {
+    ReadGuard tableGuard(tableLock);
+
+    auto it = fileIds.find(id);
+    if (it == fileIds.end()) {
+        return nullptr;
+    }
+
+    MemFile *file = it->second;
+    exclusive ? file->lock.lockWrite() : file->lock.lockRead();
+    return file;
+}
+
+/// @brief Fill the meta data of a file.
+///
+/// Must be called with the lock of the file held.
+/// \param [in] file The file.
+/// \param [out] statbuf Meta data of the file.
+void MyInMemoryFS::statFile(MemFile *file, struct stat *statbuf) {
+    statbuf->st_uid = file->userId;
+    statbuf->st_gid = file->groupId;
+    statbuf->st_atime = file->accessTime;
+    statbuf->st_mtime = file->modTime;
+    statbuf->st_mode = file->mode;
+    statbuf->st_nlink = 1; // weil wir eine Datei sind und kein Verzeichnis
+    statbuf->st_size = file->size;
+}
+
+/// @brief Read from a file, see fuseRead().
+///
+/// Must be called with the lock of the file held.
+/// \return Number of bytes read, -ERRNO on failure.
+int MyInMemoryFS::readFile(MemFile *file, char *buf, size_t size, off_t offset) {
+    // Nothing to read at or beyond end of file
+    if (offset >= file->size) {
+        return 0;
+    }
 
-        // remove file
-        files.erase(i);
+    // Check if we can read the whole request or just until end of file
+    off_t size2read = std::min(file->size - offset, (off_t) size);
+
+    // Fill buffer with read data, page by page
+    off_t done = 0;
+    while (done < size2read) {
+        off_t pos = offset + done;
+        off_t inPage = pos % MEM_PAGE_SIZE;
+        off_t n = std::min(size2read - done, (off_t) MEM_PAGE_SIZE - inPage);
+        memcpy(buf + done, file->pages[pos / MEM_PAGE_SIZE] + inPage, n);
+        done += n;
     }
 
+    // Return nr of Bytes read.
+    return size2read;
+}
+
+/// @brief Write to a file, see fuseWrite().
+///
+/// Must be called with the lock of the file held for writing.
+/// \return Number of bytes written, -ERRNO on failure.
+int MyInMemoryFS::writeFile(MemFile *file, const char *buf, size_t size, off_t offset) {
+    // If offset + size of new data extends our file data, add pages
+    int ret = resizeFile(file, std::max(offset + (off_t) size, file->size));
+
+    // Check if resizeFile failed
+    if (ret) {
+        return -ENOSPC;
+    }
+
+    size_t done = 0;
+    while (done < size) {
+        off_t pos = offset + done;
+        off_t inPage = pos % MEM_PAGE_SIZE;
+        size_t n = std::min(size - done, (size_t) (MEM_PAGE_SIZE - inPage));
+        memcpy(file->pages[pos / MEM_PAGE_SIZE] + inPage, buf + done, n);
+        done += n;
+    }
+    return size;
 }
 
 /// @brief Find File in Filesystem
 ///
-/// Search and return file from filesystem.
+/// Search and return file from filesystem. Must be called with tableLock held.
 /// \param [in] path Name of the file, starting with "/".
 /// \param [in,out] file Reference of file
 /// \return 0 on success, -ERRNO on failure.
 int MyInMemoryFS::findFile(const char *path, myFsFile **file) {
     LOGF("--> Trying to find %s", path);
-    bool found = false;
 
-    auto p = std::string(path + 1);
-
-    // Suche in der liste nach datei mit dem namen pth
-    for (auto i = files.begin(); i != files.end(); i++) {
-        if (i->name == p) {
-            *file = &(*i);
-            return 0;
-        }
+    // Suche im Index nach datei mit dem namen path, ohne temporären string
+    auto *entry = fileIndex.find(path + 1);
+    if (entry == nullptr) {
+        return -ENOENT;
     }
-    return -ENOENT;
+    *file = &(**entry);
+    return 0;
 
 }
 
+/// @brief Change the size of a file.
+///
+/// Pages are added or released at the end of the file, existing data never moves. Bytes beyond the end of the file
+/// are kept zero, so a file extended by truncate or by writing past its end reads zeros in the gap. Must be called
+/// with the lock of the file held for writing.
+/// \param [in] file The file.
+/// \param [in] newsize New size in bytes.
+/// \return 0 on success, -ERRNO on failure.
 int MyInMemoryFS::resizeFile(myFsFile *file, off_t newsize) {
+    size_t nrPages = (newsize + MEM_PAGE_SIZE - 1) / MEM_PAGE_SIZE;
 
-    // Always round up to next BLOCK_SIZE
-    blkcnt_t newblkcnt = (newsize + BLOCK_SIZE - 1) / BLOCK_SIZE;
+    // Clear the rest of the last page, it may become part of the file again later
+    if (newsize < file->size && newsize % MEM_PAGE_SIZE != 0) {
+        off_t inPage = newsize % MEM_PAGE_SIZE;
+        memset(file->pages[newsize / MEM_PAGE_SIZE] + inPage, 0, MEM_PAGE_SIZE - inPage);
+    }
 
-    // if no change in blocksize is necessary, just change file.size
-    if (newblkcnt == file->nrBlocks) {
-        file->size = newsize;
-        return 0;
+    while (file->pages.size() > nrPages) {
+        pagePool.release(file->pages.back());
+        file->pages.pop_back();
     }
 
-    // Try to realloc file.data
-    char *tmp = (char *) realloc(file->data, newblkcnt * BLOCK_SIZE);
-    if (tmp == nullptr) {
-        return -ENOMEM;
+    size_t oldPages = file->pages.size();
+    while (file->pages.size() < nrPages) {
+        char *page = pagePool.allocate();
+        if (page == nullptr) {
+            // Keep the file as it was
+            while (file->pages.size() > oldPages) {
+                pagePool.release(file->pages.back());
+                file->pages.pop_back();
+            }
+            return -ENOMEM;
+        }
+        file->pages.push_back(page);
     }
 
-    // Write back file data
-    file->data = tmp;
     file->size = newsize;
-    file->nrBlocks = newblkcnt;
-    RETURN(0);
+    file->nrBlocks = (blkcnt_t) nrPages * (MEM_PAGE_SIZE / 512);
+    return 0;
+}
+
+/// @brief Return all pages of a file to the page pool.
+/// \param [in] file The file, not reachable by other threads anymore.
+void MyInMemoryFS::releasePages(myFsFile *file) {
+    for (char *page: file->pages) {
+        pagePool.release(page);
+    }
+    file->pages.clear();
+    file->size = 0;
+    file->nrBlocks = 0;
+}
+
+/// @brief Append the counters of the page pool to the statistics, see MyFS::formatStats().
+void MyInMemoryFS::formatStats(std::string &out) {
+    MyFS::formatStats(out);
+
+    out += "# TYPE myfs_memory_used_pages gauge\n";
+    appendMetric(out, "myfs_memory_used_pages", "", (uint64_t) pagePool.getUsed());
+    out += "# TYPE myfs_memory_free_pages gauge\n";
+    appendMetric(out, "myfs_memory_free_pages", "", (uint64_t) pagePool.getFree());
 }
 
 // DO NOT EDIT ANYTHING BELOW THIS LINE!!!
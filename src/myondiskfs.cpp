@@ -16,11 +16,19 @@
 #include <unistd.h>
 #include <string.h>
 #include <errno.h>
+#include <sys/stat.h>
+#include <algorithm>
+#include <chrono>
 
 #include "macros.h"
 #include "myfs.h"
 #include "myfs-info.h"
 #include "blockdevice.h"
+#include "asyncblockdevice.h"
+#include "mappedblockdevice.h"
+#include "blockcache.h"
+#include "byteorder.h"
+#include "journal.h"
 
 /// @brief Constructor of the on-disk file system class.
 ///
@@ -28,6 +36,31 @@
 MyOnDiskFS::MyOnDiskFS() : MyFS() {
     // create a block device object
     this->blockDevice = new BlockDevice(BLOCK_SIZE);
+
+    // the block cache is created in fuseInit() once the block device is chosen
+    this->blockCache = nullptr;
+    this->journal = nullptr;
+
+    // FAT, BLT and the structures derived from them are sized by resizeTables() once the layout is known
+    memset(&this->layout, 0, sizeof(this->layout));
+    this->fatEntrySize = 0;
+    this->fatEntriesPerBlock = 0;
+    this->bltEntrySize = 0;
+    this->bltEntriesPerBlock = 0;
+
+    this->freeBlockCount = 0;
+    this->allocCursor = 0;
+
+    this->readaheadStopping = false;
+    this->maxReadaheadBlocks = 0;
+    this->fatSyncStopping = false;
+
+    this->multiThreaded = false;
+    this->atimeMode = ATIME_RELATIME;
+    this->lastFatWrite = 0;
+
+    this->metaBlocksWritten = 0;
+    this->metaUpdates = 0;
 }
 
 /// @brief Destructor of the on-disk file system class.
@@ -35,7 +68,18 @@ MyOnDiskFS::MyOnDiskFS() : MyFS() {
 /// You may add your own destructor code here.
 MyOnDiskFS::~MyOnDiskFS() {
 
-    // free block device object
+    // the readahead and FAT sync threads use the block cache
+    stopReadahead();
+    stopFatSync();
+
+    // free handles that were not released
+    for (OpenFile *file: openFiles) {
+        delete file;
+    }
+
+    // free journal, block cache and block device object; the journal thread uses the cache
+    delete this->journal;
+    delete this->blockCache;
     delete this->blockDevice;
 }
 
@@ -50,35 +94,28 @@ MyOnDiskFS::~MyOnDiskFS() {
 int MyOnDiskFS::fuseMknod(const char *path, mode_t mode, dev_t dev) {
     LOGM();
 
+    WriteGuard metaGuard(metaLock);
+
     // Find file
     int index = getFileIndex(path);
     if (index >= 0) { RETURN(-EEXIST) }
-    // Index should be -ENOENT from here
 
-    char emptyFatEntry[MAX_NAME_LENGTH];
-    for (char &i: emptyFatEntry) { i = 0; }
-
-    // Find free slot in FAT
-    for (int i = 0; i < 64; i++) {
-        if (memcmp(fat[i].filename, emptyFatEntry, 32) == 0) {
-            index = i;
-            break;
-        }
+    // Check if new name too long
+    int length = strlen(path);
+    if (length > MAX_NAME_LENGTH) {
+        RETURN(-ENAMETOOLONG)
     }
 
-    if (index < 0) {
+    // Take free slot in FAT
+    if (freeFatEntries.empty()) {
         RETURN(-ENOSPC);
     }
+    index = freeFatEntries.back();
+    freeFatEntries.pop_back();
 
     // If we've come this far, we can create the entry.
     fatEntry newFile{};
 
-    // Check if new name too long
-    int length = strlen(path);
-    if (length > MAX_NAME_LENGTH) {
-        RETURN(-ENAMETOOLONG)
-    }
-
     memcpy(newFile.filename, path + 1, length);
     newFile.uid = getuid();
     newFile.groupId = getgid();
@@ -91,7 +128,10 @@ int MyOnDiskFS::fuseMknod(const char *path, mode_t mode, dev_t dev) {
     newFile.size = 0;
 
     // Add entry to FAT
+    std::lock_guard<std::mutex> fatGuard(fatLock);
     fat[index] = newFile;
+    fileIndex.insert(fat[index].filename, index);
+    markFatDirty(index);
     writeFat();
     RETURN(0);
 }
@@ -105,45 +145,16 @@ int MyOnDiskFS::fuseMknod(const char *path, mode_t mode, dev_t dev) {
 int MyOnDiskFS::fuseUnlink(const char *path) {
     LOGM();
 
+    JournalHandle handle(journal);
+    WriteGuard metaGuard(metaLock);
+
     // Find file
     int index = getFileIndex(path);
     if (index < 0) { RETURN(index) }
 
-    // Get number of block-list of file
-    int nrBlocks = fat[index].nrBlocks;
-
-    if (nrBlocks > 0) {
-        unsigned short blockList[nrBlocks];
-
-        // Create blockList
-        blockList[0] = fat[index].startBlock;
-        for (int i = 1; i < nrBlocks; ++i) {
-            blockList[i] = blt[blockList[i - 1]];
-        }
-
-        // Set blocks as free in BLT
-        for (auto b: blockList) {
-            blt[b] = BLT_FREE;
-        }
-        writeBlt();
-    }
-
-    // Create empty fatEntry
-    fatEntry empty = fatEntry();
-    for (char &i: empty.filename) { i = 0; }
-    empty.uid = getuid();
-    empty.groupId = getgid();
-    empty.mode = 0;
-    empty.accessTime = 0;
-    empty.modTime = 0;
-    empty.changeTime = 0;
-    empty.startBlock = 0;
-    empty.nrBlocks = 0;
-    empty.size = 0;
-
-    // Delete FAT Entry
-    fat[index] = empty;
-    writeFat();
+    // Wait until running operations on the file are finished
+    WriteGuard fileGuard(fileLocks[index]);
+    removeFile(index);
 
     RETURN(0);
 }
@@ -160,26 +171,38 @@ int MyOnDiskFS::fuseUnlink(const char *path) {
 int MyOnDiskFS::fuseRename(const char *path, const char *newpath) {
     LOGM();
 
+    JournalHandle handle(journal);
+    WriteGuard metaGuard(metaLock);
+
     // Find file
     int index = getFileIndex(path);
     if (index < 0) { RETURN(index) }
 
-    // Check if "newpath" exists
-    if (getFileIndex(newpath) >= 0) {
-        fuseUnlink(newpath);
-    }
-
     // Check if new name too long
     int length = strlen(newpath);
     if (length > MAX_NAME_LENGTH) {
         RETURN(-ENAMETOOLONG)
     }
 
+    // Check if "newpath" exists
+    int newIndex = getFileIndex(newpath);
+    if (newIndex == index) {
+        RETURN(0);
+    }
+    if (newIndex >= 0) {
+        WriteGuard fileGuard(fileLocks[newIndex]);
+        removeFile(newIndex);
+    }
+
+    std::lock_guard<std::mutex> fatGuard(fatLock);
+    fileIndex.erase(fat[index].filename);
     memcpy(fat[index].filename, newpath + 1, length);
+    fileIndex.insert(fat[index].filename, index);
 
     int systemTime = time(0);
     fat[index].modTime = systemTime;
     fat[index].changeTime = systemTime;
+    markFatDirty(index);
     writeFat();
 
     RETURN(0);
@@ -201,24 +224,13 @@ int MyOnDiskFS::fuseGetattr(const char *path, struct stat *statbuf) {
         RETURN(0);
     }
 
+    ReadGuard metaGuard(metaLock);
+
     // Find file
     int index = getFileIndex(path);
     if (index < 0) { RETURN(index) }
 
-    // Fill statbuf with relevant data
-    statbuf->st_uid = fat[index].uid;
-    statbuf->st_gid = fat[index].groupId;
-    statbuf->st_atime = fat[index].accessTime;
-    statbuf->st_mtime = fat[index].modTime;
-    statbuf->st_mode = fat[index].mode;
-    statbuf->st_nlink = 1; // weil wir eine Datei sind und kein Verzeichnis
-    statbuf->st_size = fat[index].size;
-
-
-    int systemTime = time(0);
-    fat[index].accessTime = systemTime;
-    fat[index].changeTime = systemTime;
-    writeFat();
+    statFile(index, statbuf);
 
     RETURN(0);
 }
@@ -233,15 +245,20 @@ int MyOnDiskFS::fuseGetattr(const char *path, struct stat *statbuf) {
 int MyOnDiskFS::fuseChmod(const char *path, mode_t mode) {
     LOGM();
 
+    ReadGuard metaGuard(metaLock);
+
     // Find file
     int index = getFileIndex(path);
     if (index < 0) { RETURN(index) }
 
+    std::lock_guard<std::mutex> fatGuard(fatLock);
     int systemTime = time(0);
     fat[index].mode = mode;
     fat[index].modTime = systemTime;
     fat[index].changeTime = systemTime;
 
+    markFatDirty(index);
+
     writeFat();
     RETURN(0);
 }
@@ -257,20 +274,57 @@ int MyOnDiskFS::fuseChmod(const char *path, mode_t mode) {
 int MyOnDiskFS::fuseChown(const char *path, uid_t uid, gid_t gid) {
     LOGM();
 
+    ReadGuard metaGuard(metaLock);
+
     // Find file
     int index = getFileIndex(path);
     if (index < 0) { RETURN(index) }
 
+    std::lock_guard<std::mutex> fatGuard(fatLock);
     int systemTime = time(0);
     fat[index].uid = uid;
     fat[index].groupId = gid;
     fat[index].modTime = systemTime;
     fat[index].changeTime = systemTime;
 
+    markFatDirty(index);
+
     writeFat();
     RETURN(0)
 }
 
+/// @brief Get file system statistics.
+///
+/// Free space is taken from the free block counter, so no scan of the BLT is needed.
+/// \param [in] path Any path in the file system.
+/// \param [out] statInfo File system statistics, for details type "man 3 statvfs" in a terminal.
+/// \return 0 on success, -ERRNO on failure.
+int MyOnDiskFS::fuseStatfs(const char *path, struct statvfs *statInfo) {
+    LOGM();
+
+    memset(statInfo, 0, sizeof(struct statvfs));
+    statInfo->f_bsize = layout.blockSize;
+    statInfo->f_frsize = layout.blockSize;
+    statInfo->f_blocks = layout.totalBlocks - (layout.fatStart + layout.fatBlocks + layout.bltBlocks) -
+                         (journal != nullptr ? layout.journalBlocks : 0);
+    statInfo->f_files = layout.fatEntries;
+    statInfo->f_namemax = MAX_NAME_LENGTH - 1;
+
+    {
+        ReadGuard metaGuard(metaLock);
+        statInfo->f_ffree = freeFatEntries.size();
+        statInfo->f_favail = freeFatEntries.size();
+    }
+    {
+        std::lock_guard<std::mutex> allocGuard(allocLock);
+        // Blocks waiting for their transaction to commit are free as well
+        statInfo->f_bfree = freeBlockCount + pendingFrees.size();
+        statInfo->f_bavail = freeBlockCount + pendingFrees.size();
+    }
+
+    RETURN(0);
+}
+
 /// @brief Open a file.
 ///
 /// Open a file for reading or writing. This includes checking the permissions of the current user and incrementing the
@@ -282,20 +336,26 @@ int MyOnDiskFS::fuseChown(const char *path, uid_t uid, gid_t gid) {
 int MyOnDiskFS::fuseOpen(const char *path, struct fuse_file_info *fileInfo) {
     LOGM();
 
+    ReadGuard metaGuard(metaLock);
+
     // Find file
     int index = getFileIndex(path);
     if (index < 0) { RETURN(index) }
 
+    std::lock_guard<std::mutex> fatGuard(fatLock);
+
     //check if the user has permissions to access the file
     if (!(fat[index].uid == getuid() || fat[index].groupId == getgid())) {
         RETURN(-ENOENT);
     }
 
-    fileInfo->fh = index;
-
-    int systemTime = time(0);
-    fat[index].accessTime = systemTime;
-    writeFat();
+    OpenFile *file = new OpenFile();
+    file->index = index;
+    {
+        std::lock_guard<std::mutex> openFilesGuard(openFilesLock);
+        openFiles.push_back(file);
+    }
+    fileInfo->fh = (uint64_t) file;
 
     RETURN(0)
 }
@@ -320,61 +380,16 @@ int MyOnDiskFS::fuseOpen(const char *path, struct fuse_file_info *fileInfo) {
 int MyOnDiskFS::fuseRead(const char *path, char *buf, size_t size, off_t offset, struct fuse_file_info *fileInfo) {
     LOGM();
 
-    // Find file
-    int index = getFileIndex(path);
+    // Find and lock file
+    int index = lockFile(path, fileInfo, false);
     if (index < 0) { RETURN(index) }
+    ReadGuard fileGuard(fileLocks[index], std::adopt_lock);
 
-    // Create blockList
-    unsigned short blockList[fat[index].nrBlocks];
-    blockList[0] = fat[index].startBlock;
-    for (int i = 1; i < fat[index].nrBlocks; ++i) {
-        blockList[i] = blt[blockList[i - 1]];
-    }
-
-    // Read to Block(s)
-    char *buffer = new char[BLOCK_SIZE];
-    int currentPos, currentBlock, currentBlockOffset, bytesToRead, currentBufPos;
-    currentPos = offset;
-    currentBufPos = 0;
-
-    // While not at the end
-    while (currentBufPos < size) {
-
-        // Get parameters
-        currentBlock = (int) currentPos / BLOCK_SIZE;
-        currentBlockOffset = currentPos % BLOCK_SIZE;
-        bytesToRead = BLOCK_SIZE - currentBlockOffset;
-
-        // Make sure we don't read more that the file
-        if (currentPos + bytesToRead > fat[index].size) {
-            LOG("Tried to read more than file...");
-            bytesToRead = fat[index].size - currentPos;
-            if (bytesToRead == 0) {
-                // Reached end of file. No more reading happening
-                RETURN(currentBufPos);
-            }
-        }
-
-        // Make sure we don't read more than we need
-        if (currentPos + bytesToRead > offset + size) {
-            LOG("Tried to read more than needed...");
-            bytesToRead = offset + size - currentPos;
-        }
-
-        // Read data in case we write on block only partially
-        blockDevice->read(blockList[currentBlock], buffer);
-        memcpy(buf + currentBufPos, buffer, bytesToRead);
-
-        currentPos += bytesToRead;
-        currentBufPos += bytesToRead;
+    int ret = readFile(index, buf, size, offset);
+    if (ret > 0) {
+        readahead(index, fileInfo, offset, ret);
     }
-
-
-    int systemTime = time(0);
-    fat[index].accessTime = systemTime;
-    writeFat();
-
-    RETURN(currentBufPos);
+    RETURN(ret);
 }
 
 /// @brief Write to a file.
@@ -396,168 +411,296 @@ int
 MyOnDiskFS::fuseWrite(const char *path, const char *buf, size_t size, off_t offset, struct fuse_file_info *fileInfo) {
     LOGM();
 
-    // Find file
-    int index = getFileIndex(path);
+    JournalHandle handle(journal);
+
+    // Find and lock file
+    int index = lockFile(path, fileInfo, true);
     if (index < 0) { RETURN(index) }
+    WriteGuard fileGuard(fileLocks[index], std::adopt_lock);
 
-    // Enlarge file if necessary
-    if (size + offset > fat[index].size) {
-        fuseTruncate(path, size + offset);
+    int ret = writeFile(index, buf, size, offset);
+    RETURN(ret);
+}
+
+/// @brief Read from a file into buffers of the container file.
+///
+/// Large requests are answered with file descriptor buffers pointing into the container, so the kernel can splice the
+/// data to /dev/fuse without copying it through user space. Small requests use fuseRead() and the block cache.
+/// FUSE reads the data after the file lock is released. With several threads, another request could free the blocks
+/// in the meantime and a third could give them to another file, so fd buffers are only used if requests are served by
+/// a single thread.
+/// \param [in] path Name of the file, starting with "/".
+/// \param [out] bufp Buffer vector describing the data, shorter than size at the end of the file.
+/// \param [in] size Number of bytes to read.
+/// \param [in] offset Starting position in the file.
+/// \param [in] fileInfo File handle for the file set by fuseOpen.
+/// \return 0 on success, -ERRNO on failure.
+int MyOnDiskFS::fuseReadBuf(const char *path, struct fuse_bufvec **bufp, size_t size, off_t offset,
+                            struct fuse_file_info *fileInfo) {
+    LOGM();
+
+    if (size < ZERO_COPY_MIN_SIZE || multiThreaded) {
+        int ret = MyFS::fuseReadBuf(path, bufp, size, offset, fileInfo);
+        RETURN(ret);
+    }
+
+    // Find and lock file
+    int index = lockFile(path, fileInfo, false);
+    if (index < 0) { RETURN(index) }
+    ReadGuard fileGuard(fileLocks[index], std::adopt_lock);
+
+    // Make sure we don't read more than the file
+    if (offset >= fat[index].size) {
+        size = 0;
+    } else if (offset + (off_t) size > fat[index].size) {
+        size = fat[index].size - offset;
+    }
+
+    int ret = getContainerBufvec(index, offset, size, false, bufp);
+    if (ret < 0) { RETURN(ret) }
+
+    // Blocks behind the end of the container were never written and read as zeros, but FUSE would stop at the end
+    off_t containerEnd = 0;
+    for (size_t i = 0; i < (*bufp)->count; i++) {
+        containerEnd = std::max(containerEnd, (*bufp)->buf[i].pos + (off_t) (*bufp)->buf[i].size);
+    }
+    struct stat st;
+    if (fstat(blockDevice->getFd(), &st) < 0 || containerEnd > st.st_size) {
+        free(*bufp);
+        fileGuard.unlock();
+        ret = MyFS::fuseReadBuf(path, bufp, size, offset, fileInfo);
+        RETURN(ret);
     }
 
-    // Create blockList for easy lookup
-    unsigned short blockList[fat[index].nrBlocks];
-    blockList[0] = fat[index].startBlock;
-    for (int i = 1; i < fat[index].nrBlocks; ++i) {
-        blockList[i] = blt[blockList[i - 1]];
+    std::lock_guard<std::mutex> fatGuard(fatLock);
+    touchAccessTime(index);
+
+    RETURN(0);
+}
+
+/// @brief Write the content of a buffer vector to a file.
+///
+/// Large requests are copied by FUSE directly into the container file, which lets the kernel splice data that arrives
+/// in a pipe. The affected blocks are removed from the block cache before and after the copy. Small requests use
+/// fuseWrite() and the block cache.
+/// \param [in] path Name of the file, starting with "/".
+/// \param [in] buf Buffer vector with the data to write, may be backed by memory or a file descriptor.
+/// \param [in] offset Starting position in the file.
+/// \param [in] fileInfo File handle for the file set by fuseOpen.
+/// \return Number of bytes written on success, -ERRNO on failure.
+int MyOnDiskFS::fuseWriteBuf(const char *path, struct fuse_bufvec *buf, off_t offset, struct fuse_file_info *fileInfo) {
+    LOGM();
+
+    size_t size = fuse_buf_size(buf);
+    if (size < ZERO_COPY_MIN_SIZE) {
+        int ret = MyFS::fuseWriteBuf(path, buf, offset, fileInfo);
+        RETURN(ret);
     }
 
-    // Write to Block(s)
-    char *buffer = new char[BLOCK_SIZE];
-    int currentPos, currentBufPos, currentBlock, currentBlockOffset, bytesToWrite;
-    currentPos = offset;
-    currentBufPos = 0;
+    JournalHandle handle(journal);
 
-    // While not at the end of the file:
-    while (currentBufPos < size) {
+    // Find and lock file
+    int index = lockFile(path, fileInfo, true);
+    if (index < 0) { RETURN(index) }
+    WriteGuard fileGuard(fileLocks[index], std::adopt_lock);
 
-        // Get parameters
-        currentBlock = (int) currentPos / BLOCK_SIZE;
-        currentBlockOffset = currentPos % BLOCK_SIZE;
-        bytesToWrite = BLOCK_SIZE - currentBlockOffset;
+    // Enlarge file if necessary
+    off_t oldSize = fat[index].size;
+    if (offset + (off_t) size > oldSize) {
+        int ret = truncateFile(index, offset + size);
+        if (ret < 0) { RETURN(ret) }
+    }
 
-        // Make sure we don't write more than is stored in @buf
-        if (currentPos + bytesToWrite > offset + size) {
-            bytesToWrite = offset + size - currentPos;
+    struct fuse_bufvec *dst;
+    int ret = getContainerBufvec(index, offset, size, true, &dst);
+    if (ret < 0) {
+        if (fat[index].size > oldSize) {
+            truncateFile(index, oldSize);
         }
+        RETURN(ret)
+    }
 
-        // Read data in case we write on block only partially
-        blockDevice->read(blockList[currentBlock], buffer);
-        memcpy(buffer + currentBlockOffset, buf + currentBufPos, bytesToWrite);
-        blockDevice->write(blockList[currentBlock], buffer);
+    ssize_t written = fuse_buf_copy(dst, buf, (enum fuse_buf_copy_flags) 0);
+    free(dst);
 
-        currentPos += bytesToWrite;
-        currentBufPos += bytesToWrite;
+    // A read that missed the cache while FUSE copied may have cached the old content again. Dropping the blocks also
+    // changes the write generation of the cache, so reads still in flight do not cache what they read.
+    const uint32_t *blockList = getBlockMap(index);
+    for (int64_t b = offset / layout.blockSize; b <= (int64_t) ((offset + size - 1) / layout.blockSize); b++) {
+        blockCache->invalidate(blockList[b]);
     }
 
-    if (fat[index].size < offset + size) {
-        fat[index].size = offset + size;
+    // Do not leave the file enlarged beyond the data actually copied
+    off_t end = offset + std::max(written, (ssize_t) 0);
+    if (written < (ssize_t) size && fat[index].size > std::max(oldSize, end)) {
+        ret = truncateFile(index, std::max(oldSize, end));
+        if (ret < 0 && written >= 0) { RETURN(ret) }
     }
 
+    if (written < 0) { RETURN((int) written) }
 
-    int systemTime = time(0);
-    fat[index].modTime = systemTime;
-    fat[index].changeTime = systemTime;
-    writeFat();
+    std::lock_guard<std::mutex> fatGuard(fatLock);
+    touchModTime(index);
 
-    RETURN((int) size);
+    RETURN((int) written);
 }
 
-/// @brief Close a file.
+/// @brief Look up the id of a file.
 ///
+/// The id combines the FAT index with a generation counter that changes when the file is deleted, so an id never
+/// reaches a file created later in the same FAT entry.
 /// \param [in] path Name of the file, starting with "/".
-/// \param [in] File handel for the file set by fuseOpen.
-/// \return 0 on success, -ERRNO on failure.
-int MyOnDiskFS::fuseRelease(const char *path, struct fuse_file_info *fileInfo) {
+/// \return Id of the file, -ERRNO on failure.
+int64_t MyOnDiskFS::fuseLookupId(const char *path) {
     LOGM();
-    RETURN(0);
+
+    ReadGuard metaGuard(metaLock);
+    int index = getFileIndex(path);
+    if (index < 0) {
+        return index;
+    }
+    return ((int64_t) fatGeneration[index] << 32) | index;
 }
 
-/// @brief Truncate a file.
-///
-/// Set the size of a file to the new size. If the new size is smaller than the old size, spare bytes are removed. If
-/// the new size is larger than the old size, the new bytes may be random.
-/// You do not have to check file permissions, but can assume that it is always ok to access the file.
-/// \param [in] path Name of the file, starting with "/".
-/// \param [in] newSize New size of the file.
+/// @brief Get file meta data, see fuseGetattr().
+/// \param [in] id Id of the file returned by fuseLookupId().
+/// \param [out] statbuf Meta data of the file.
 /// \return 0 on success, -ERRNO on failure.
-int MyOnDiskFS::fuseTruncate(const char *path, off_t newSize) {
+int MyOnDiskFS::fuseGetattrId(int64_t id, struct stat *statbuf) {
     LOGM();
 
-    // Find file
-    int index = getFileIndex(path);
+    int index = lockFileId(id, false);
     if (index < 0) { RETURN(index) }
+    ReadGuard fileGuard(fileLocks[index], std::adopt_lock);
 
-    // CASE: We don't need to change size at all
-    if (newSize == fat[index].size) {
-        RETURN(0);
-    }
-
-    // Get number of Blocks needed
-    auto nrBlocks = (newSize + BLOCK_SIZE - 1) / BLOCK_SIZE;
+    statFile(index, statbuf);
+    RETURN(0);
+}
 
-    // CASE: Need to shrink size
-    if (newSize < fat[index].size) {
+/// @brief Read from a file, see fuseRead().
+/// \param [in] id Id of the file returned by fuseLookupId().
+/// \return Number of bytes read, -ERRNO on failure.
+int MyOnDiskFS::fuseReadId(int64_t id, char *buf, size_t size, off_t offset, struct fuse_file_info *fileInfo) {
+    LOGM();
 
-        // Check if we can free some blocks
-        if (fat[index].nrBlocks > nrBlocks) {
+    int index = lockFileId(id, false);
+    if (index < 0) { RETURN(index) }
+    ReadGuard fileGuard(fileLocks[index], std::adopt_lock);
 
-            // Create blockList for easy lookup
-            unsigned short blockList[fat[index].nrBlocks];
-            blockList[0] = fat[index].startBlock;
-            for (int i = 1; i < fat[index].nrBlocks; ++i) {
-                blockList[i] = blt[blockList[i - 1]];
-            }
+    int ret = readFile(index, buf, size, offset);
+    if (ret > 0) {
+        readahead(index, fileInfo, offset, ret);
+    }
+    RETURN(ret);
+}
 
-            // Set new EOF block
-            blt[blockList[nrBlocks - 1]] = BLT_EOF;
+/// @brief Write to a file, see fuseWrite().
+/// \param [in] id Id of the file returned by fuseLookupId().
+/// \return Number of bytes written, -ERRNO on failure.
+int MyOnDiskFS::fuseWriteId(int64_t id, const char *buf, size_t size, off_t offset, struct fuse_file_info *fileInfo) {
+    LOGM();
 
-            // Free remaining blocks
-            for (int i = nrBlocks; i < fat[index].nrBlocks; ++i) {
-                blt[blockList[i]] = BLT_FREE;
-            }
+    JournalHandle handle(journal);
+    int index = lockFileId(id, true);
+    if (index < 0) { RETURN(index) }
+    WriteGuard fileGuard(fileLocks[index], std::adopt_lock);
 
-            // Save changes to BLT (FAT changes saved later)
-            fat[index].nrBlocks = nrBlocks;
-            writeBlt();
-        }
-    }
+    int ret = writeFile(index, buf, size, offset);
+    RETURN(ret);
+}
 
-    // CASE: Need to enlarge file
-    if (newSize > fat[index].size) {
+/// @brief Flush cached data of a file.
+///
+/// Called on each close of a file descriptor. Writes pending timestamp updates to the FAT, all dirty blocks buffered
+/// in write-back mode to the container file and commits the metadata journal, without waiting for stable storage.
+/// \param [in] path Name of the file, starting with "/".
+/// \param [in] fileInfo File handle for the file set by fuseOpen.
+/// \return 0 on success, -ERRNO on failure.
+int MyOnDiskFS::fuseFlush(const char *path, struct fuse_file_info *fileInfo) {
+    LOGM();
 
-        // Check if we need more blocks
-        if (nrBlocks > fat[index].nrBlocks) {
+    int ret;
+    {
+        std::lock_guard<std::mutex> fatGuard(fatLock);
+        ret = writeFat();
+    }
+    if (ret >= 0) {
+        ret = blockCache->flush();
+    }
+    if (ret >= 0 && journal != nullptr) {
+        ret = journal->commit(false);
+    }
+    RETURN(ret);
+}
 
-            // catch if file has no startBlock yet
-            if (fat[index].nrBlocks == 0) {
-                findFreeBlock(fat[index].startBlock);
-                blt[fat[index].startBlock] = BLT_EOF;
-                fat[index].nrBlocks = 1;    // Since we just allocated the first one
-            }
+/// @brief Synchronize file contents.
+///
+/// Writes pending timestamp updates, all dirty blocks buffered in write-back mode, commits the metadata journal and
+/// flushes the container file to stable storage. The journal is committed even with datasync, because it also holds
+/// the size of the file.
+/// \param [in] path Name of the file, starting with "/".
+/// \param [in] datasync If non-zero, only the user data should be flushed, not the meta data.
+/// \param [in] fileInfo File handle for the file set by fuseOpen.
+/// \return 0 on success, -ERRNO on failure.
+int MyOnDiskFS::fuseFsync(const char *path, int datasync, struct fuse_file_info *fileInfo) {
+    LOGM();
 
-            // Address "iterator"
-            unsigned short currentAddress = fat[index].startBlock;
+    int ret = 0;
+    if (!datasync) {
+        std::lock_guard<std::mutex> fatGuard(fatLock);
+        ret = writeFat();
+    }
+    if (ret >= 0) {
+        ret = blockCache->flush();
+    }
+    if (ret >= 0 && journal != nullptr) {
+        ret = journal->commit(false);
+    }
+    if (ret >= 0) {
+        ret = blockDevice->sync();
+    }
+    RETURN(ret);
+}
 
-            // Go to end of blockList
-            while (blt[currentAddress] != BLT_EOF) {
-                currentAddress = blt[currentAddress];
-            }
+/// @brief Close a file.
+///
+/// \param [in] path Name of the file, starting with "/", or NULL if the file was deleted while open.
+/// \param [in] File handel for the file set by fuseOpen.
+/// \return 0 on success, -ERRNO on failure.
+int MyOnDiskFS::fuseRelease(const char *path, struct fuse_file_info *fileInfo) {
+    LOGM();
 
-            // Allocate new blocks
-            unsigned short freeBlock;
-            for (int i = 0; i < nrBlocks - fat[index].nrBlocks; i++) {
-                findFreeBlock(freeBlock);
+    OpenFile *file = (OpenFile *) fileInfo->fh;
+    if (file != nullptr) {
+        std::lock_guard<std::mutex> openFilesGuard(openFilesLock);
+        openFiles.erase(std::find(openFiles.begin(), openFiles.end(), file));
+        delete file;
+        fileInfo->fh = 0;
+    }
 
-                blt[currentAddress] = freeBlock;        // Set last EOF to new free block
-                currentAddress = blt[currentAddress];   // Get new EOF
-                blt[currentAddress] = BLT_EOF;          // Set current EOF
-            }
+    RETURN(0);
+}
 
-            // Save changes to BLT (FAT changes saved later)
-            fat[index].nrBlocks = nrBlocks;
-            writeBlt();
-        }
-    }
+/// @brief Truncate a file.
+///
+/// Set the size of a file to the new size. If the new size is smaller than the old size, spare bytes are removed. If
+/// the new size is larger than the old size, the new bytes may be random.
+/// You do not have to check file permissions, but can assume that it is always ok to access the file.
+/// \param [in] path Name of the file, starting with "/".
+/// \param [in] newSize New size of the file.
+/// \return 0 on success, -ERRNO on failure.
+int MyOnDiskFS::fuseTruncate(const char *path, off_t newSize) {
+    LOGM();
 
-    fat[index].size = newSize;
+    JournalHandle handle(journal);
 
-    int systemTime = time(0);
-    fat[index].modTime = systemTime;
-    fat[index].changeTime = systemTime;
-    writeFat();
+    // Find and lock file
+    int index = lockFile(path, nullptr, true);
+    if (index < 0) { RETURN(index) }
+    WriteGuard fileGuard(fileLocks[index], std::adopt_lock);
 
-    RETURN(0);
+    int ret = truncateFile(index, newSize);
+    RETURN(ret);
 }
 
 /// @brief Truncate a file.
@@ -573,8 +716,14 @@ int MyOnDiskFS::fuseTruncate(const char *path, off_t newSize) {
 int MyOnDiskFS::fuseTruncate(const char *path, off_t newSize, struct fuse_file_info *fileInfo) {
     LOGM();
 
-    // ¯\_(ツ)_/¯
-    int ret = fuseTruncate(path, newSize);
+    JournalHandle handle(journal);
+
+    // Find and lock file
+    int index = lockFile(path, fileInfo, true);
+    if (index < 0) { RETURN(index) }
+    WriteGuard fileGuard(fileLocks[index], std::adopt_lock);
+
+    int ret = truncateFile(index, newSize);
     RETURN(ret);
 }
 
@@ -597,13 +746,14 @@ int MyOnDiskFS::fuseReaddir(const char *path, void *buf, fuse_fill_dir_t filler,
 
     // If the user is trying to show the files/directories of the root directory show the following
     if (strcmp(path, "/") == 0) {
+        ReadGuard metaGuard(metaLock);
 
         char emptyFileName[32];
         for (char &i: emptyFileName) {
             i = 0;
         }
 
-        for (int i = 0; i < TOTAL_FAT_ENTRIES; i++) {
+        for (uint32_t i = 0; i < layout.fatEntries; i++) {
             if (memcmp(fat[i].filename, emptyFileName, 32) != 0) {
                 filler(buf, fat[i].filename, nullptr, 0);
             }
@@ -617,78 +767,165 @@ int MyOnDiskFS::fuseReaddir(const char *path, void *buf, fuse_fill_dir_t filler,
 /// Initialize a file system.
 ///
 /// This function is called when the file system is mounted. You may add some initializing code here.
-/// \param [in] conn Can be ignored.
+/// \param [in,out] conn Connection parameters offered by the kernel, see negotiateConnection().
 /// \return 0.
 void *MyOnDiskFS::fuseInit(struct fuse_conn_info *conn) {
-    // Open logfile
-    this->logFile = fopen(((MyFsInfo *) fuse_get_context()->private_data)->logFile, "w+");
-    if (this->logFile == NULL) {
-        fprintf(stderr, "ERROR: Cannot open logfile %s\n", ((MyFsInfo *) fuse_get_context()->private_data)->logFile);
-    } else {
-        // turn of logfile buffering
-        setvbuf(this->logFile, NULL, _IOLBF, 0);
+    MyFsInfo *info = (MyFsInfo *) fuse_get_context()->private_data;
+    if (setup(info) == 0) {
+        negotiateConnection(conn, info);
+    }
+
+    return EXIT_SUCCESS;
+}
 
+/// @brief Open the log file and the container file.
+///
+/// Does the work of fuseInit(). Tests can call it directly to use the file system without FUSE.
+/// \param [in] info Mount options.
+/// \return 0 on success, -ERRNO on failure.
+int MyOnDiskFS::setup(MyFsInfo *info) {
+    // Open logfile
+    if (startLogging(info) == 0) {
         LOG("Starting logging...\n");
 
         LOG("Using on-disk mode");
 
-        LOGF("Container file name: %s", ((MyFsInfo *) fuse_get_context()->private_data)->contFile);
+        LOGF("Container file name: %s", info->contFile);
 
-        int ret = this->blockDevice->open(((MyFsInfo *) fuse_get_context()->private_data)->contFile);
+        // Replace synchronous block device by a memory-mapped or asynchronous one if requested
+        char *ioEngine = info->ioEngine;
+        if (ioEngine != NULL && strcmp(ioEngine, "mmap") == 0) {
+            LOG("Using memory-mapped container file");
+
+            delete this->blockDevice;
+            this->blockDevice = new MappedBlockDevice(BLOCK_SIZE);
+
+        } else if (ioEngine != NULL && strcmp(ioEngine, "sync") != 0) {
+            AsyncBlockDevice::Engine engine = AsyncBlockDevice::ENGINE_AUTO;
+            if (strcmp(ioEngine, "uring") == 0) {
+                engine = AsyncBlockDevice::ENGINE_URING;
+            } else if (strcmp(ioEngine, "threads") == 0) {
+                engine = AsyncBlockDevice::ENGINE_THREADS;
+            }
+
+            AsyncBlockDevice *asyncDevice = new AsyncBlockDevice(BLOCK_SIZE, engine);
+            LOGF("Using asynchronous I/O engine %s",
+                 asyncDevice->getEngine() == AsyncBlockDevice::ENGINE_URING ? "io_uring" : "thread pool");
+
+            delete this->blockDevice;
+            this->blockDevice = asyncDevice;
+        }
+
+        this->atimeMode = info->atimeMode;
+        this->multiThreaded = info->multiThreaded != 0;
+
+        // The block size must be known before the block cache is created. Existing containers store it in their
+        // superblock, new ones get the requested block size.
+        int ret = this->blockDevice->open(info->contFile);
+        bool create = ret == -ENOENT;
+        long long size = DEFAULT_CONTAINER_SIZE;
+        long long blockSize = BLOCK_SIZE;
 
         if (ret >= 0) {
             LOG("Container file exists, reading...");
-            readFat();
-            readBlt();
+            ret = readSuperBlock();
+            blockSize = layout.blockSize;
 
-        } else if (ret == -ENOENT) {
+        } else if (create) {
             LOG("Container file does not exist, creating a new one...");
 
-            ret = this->blockDevice->create(((MyFsInfo *) fuse_get_context()->private_data)->contFile);
-
-            if (ret >= 0) {
+            if (info->containerSize != NULL && (size = parseSize(info->containerSize)) < 0) {
+                LOGF("ERROR: Invalid container size %s, using default", info->containerSize);
+                size = DEFAULT_CONTAINER_SIZE;
+            }
+            if (info->blockSize != NULL && ((blockSize = parseSize(info->blockSize)) < MIN_BLOCK_SIZE ||
+                                            blockSize > MAX_BLOCK_SIZE || (blockSize & (blockSize - 1)) != 0)) {
+                LOGF("ERROR: Invalid block size %s, using default", info->blockSize);
+                blockSize = BLOCK_SIZE;
+            }
 
-                LOG("Creating FAT");
+            ret = this->blockDevice->create(info->contFile);
+        }
 
-                // Create empty fatEntry
-                fatEntry empty = fatEntry();
-                for (char &i: empty.filename) {
-                    i = 0;
+        if (ret >= 0) {
+            this->blockDevice->setBlockSize(blockSize);
+            LOGF("Block size: %lld bytes", blockSize);
+
+            // Put block cache in front of the block device
+            long long cacheSize = DEFAULT_CACHE_SIZE;
+            char *cacheSizeOption = info->cacheSize;
+            if (cacheSizeOption != NULL && (cacheSize = parseSize(cacheSizeOption)) < 0) {
+                LOGF("ERROR: Invalid cache size %s, using default", cacheSizeOption);
+                cacheSize = DEFAULT_CACHE_SIZE;
+            }
+            this->blockCache = new BlockCache(this->blockDevice, blockSize, cacheSize / blockSize);
+            LOGF("Block cache size: %u blocks", this->blockCache->getCapacity());
+
+            if (info->writeBack) {
+                long long maxDirty = DEFAULT_MAX_DIRTY;
+                char *maxDirtyOption = info->maxDirty;
+                if (maxDirtyOption != NULL && (maxDirty = parseSize(maxDirtyOption)) < 0) {
+                    LOGF("ERROR: Invalid dirty limit %s, using default", maxDirtyOption);
+                    maxDirty = DEFAULT_MAX_DIRTY;
                 }
-                empty.uid = getuid();
-                empty.groupId = getgid();
-                empty.mode = 0;
-                empty.accessTime = 0;
-                empty.modTime = 0;
-                empty.changeTime = 0;
-                empty.startBlock = 0;
-                empty.nrBlocks = 0;
-                empty.size = 0;
-
-                // Set all FAT entries to empty
-                for (fatEntry &i: fat) {
-                    i = empty;
+                this->blockCache->enableWriteBack(maxDirty, WRITEBACK_INTERVAL_MS);
+                LOGF("Using write-back mode, at most %lld dirty bytes", maxDirty);
+            }
+        }
+
+        if (ret >= 0 && create) {
+            ret = formatContainer(size, blockSize);
+
+        } else if (ret >= 0) {
+            // Version 1 containers created with a journal have its blocks reserved
+            if (layout.version == FORMAT_VERSION_1) {
+                ret = readBlt();
+                if (ret >= 0 && blt[JOURNAL_START] == BLT_RSV) {
+                    layout.journalBlocks = JOURNAL_BLOCKS;
                 }
-                writeFat();
-
-                LOG("Creating BLT");
-                for (int i = 0; i < TOTAL_BLT_ENTRIES; i++) {
-                    if (i < FAT_BLOCKS + BLT_BLOCKS) {
-                        blt[i] = BLT_RSV; // Blocks used for FAT and BLT are reserved
-                    } else {
-                        blt[i] = BLT_FREE; // All other Blocks are free
-                    }
+            }
+
+            if (ret >= 0 && layout.journalBlocks > 0) {
+                // Replay the journal before reading the metadata
+                journal = new Journal(blockCache, blockDevice, blockSize, layout.journalStart, layout.journalBlocks);
+                int replayed = journal->recover();
+                if (replayed < 0) {
+                    LOGF("No metadata journal found (%d), writing metadata in place", replayed);
+                    delete journal;
+                    journal = nullptr;
+                } else {
+                    LOGF("Metadata journal: %d transactions replayed", replayed);
                 }
-                writeBlt();
+            }
+
+            if (ret >= 0) {
+                readFat();
+                readBlt();
+                buildBlockMaps();
             }
         }
 
+        if (ret >= 0 && journal != nullptr) {
+            journal->start(JOURNAL_COMMIT_INTERVAL_MS);
+        }
+
+        if (ret >= 0) {
+            maxReadaheadBlocks = std::min(MAX_READAHEAD / layout.blockSize,
+                                          (long long) blockCache->getCapacity() / 4);
+            if (maxReadaheadBlocks > 0) {
+                readaheadThread = std::thread(&MyOnDiskFS::readaheadLoop, this);
+                LOGF("Readahead: up to %u blocks", maxReadaheadBlocks);
+            }
+            fatSyncThread = std::thread(&MyOnDiskFS::fatSyncLoop, this);
+        }
+
         if (ret < 0) {
             LOGF("ERROR: Access to container file failed with error %d", ret);
         }
+        return ret < 0 ? ret : 0;
     }
 
-    return EXIT_SUCCESS;
+    return -EIO;
 }
 
 /// @brief Clean up a file system.
@@ -697,216 +934,1295 @@ void *MyOnDiskFS::fuseInit(struct fuse_conn_info *conn) {
 void MyOnDiskFS::fuseDestroy() {
     LOGM();
 
-    writeFat();
-    writeBlt();
+    stopReadahead();
+    stopFatSync();
+
+    {
+        std::lock_guard<std::mutex> allocGuard(allocLock);
+        writeBlt();
+    }
+    {
+        std::lock_guard<std::mutex> fatGuard(fatLock);
+        writeFat();
+    }
+
+    // Leave all metadata in place, so the container can be used without replaying the journal
+    if (journal != nullptr) {
+        journal->commit(false);
+        journal->checkpoint();
+    }
+
+    blockCache->flush();
+    blockDevice->sync();
+
+    LOGF("Metadata: %llu blocks (%llu bytes) written in %llu updates", (unsigned long long) metaBlocksWritten,
+         (unsigned long long) metaBlocksWritten * layout.blockSize, (unsigned long long) metaUpdates);
+
+    BlockCache::Stats stats = blockCache->getStats();
+    LOGF("Block cache: %llu hits, %llu misses, %llu evictions, %llu blocks flushed", (unsigned long long) stats.hits,
+         (unsigned long long) stats.misses, (unsigned long long) stats.evictions,
+         (unsigned long long) stats.flushedBlocks);
+    LOGF("Readahead: %llu blocks prefetched, %llu of them used", (unsigned long long) stats.prefetched,
+         (unsigned long long) stats.prefetchHits);
+
+    logger.flush();
 }
 
-/// @brief Read FAT from container file and update local FAT
+/// @brief Append the statistics of the file system, including block cache, device and metadata counters.
+/// \param [out] out Text the statistics are appended to.
+void MyOnDiskFS::formatStats(std::string &out) {
+    MyFS::formatStats(out);
+
+    BlockCache::Stats stats = blockCache->getStats();
+    uint32_t freeBlocks;
+    {
+        std::lock_guard<std::mutex> allocGuard(allocLock);
+        freeBlocks = freeBlockCount + pendingFrees.size();
+    }
+
+    out += "# TYPE myfs_cache_hits_total counter\n";
+    appendMetric(out, "myfs_cache_hits_total", "", stats.hits);
+    out += "# TYPE myfs_cache_misses_total counter\n";
+    appendMetric(out, "myfs_cache_misses_total", "", stats.misses);
+    out += "# TYPE myfs_cache_evictions_total counter\n";
+    appendMetric(out, "myfs_cache_evictions_total", "", stats.evictions);
+    out += "# TYPE myfs_cache_flushed_blocks_total counter\n";
+    appendMetric(out, "myfs_cache_flushed_blocks_total", "", stats.flushedBlocks);
+    out += "# TYPE myfs_cache_prefetched_blocks_total counter\n";
+    appendMetric(out, "myfs_cache_prefetched_blocks_total", "", stats.prefetched);
+    out += "# TYPE myfs_cache_prefetch_hits_total counter\n";
+    appendMetric(out, "myfs_cache_prefetch_hits_total", "", stats.prefetchHits);
+    out += "# TYPE myfs_device_read_blocks_total counter\n";
+    appendMetric(out, "myfs_device_read_blocks_total", "", stats.blocksRead);
+    out += "# TYPE myfs_device_written_blocks_total counter\n";
+    appendMetric(out, "myfs_device_written_blocks_total", "", stats.blocksWritten);
+    out += "# TYPE myfs_meta_updates_total counter\n";
+    appendMetric(out, "myfs_meta_updates_total", "", (uint64_t) metaUpdates);
+    out += "# TYPE myfs_meta_written_blocks_total counter\n";
+    appendMetric(out, "myfs_meta_written_blocks_total", "", (uint64_t) metaBlocksWritten);
+    out += "# TYPE myfs_free_blocks gauge\n";
+    appendMetric(out, "myfs_free_blocks", "", (uint64_t) freeBlocks);
+
+    if (journal != nullptr) {
+        Journal::Stats journalStats = journal->getStats();
+        out += "# TYPE myfs_journal_commits_total counter\n";
+        appendMetric(out, "myfs_journal_commits_total", "", journalStats.commits);
+        out += "# TYPE myfs_journal_written_blocks_total counter\n";
+        appendMetric(out, "myfs_journal_written_blocks_total", "", journalStats.blocksWritten);
+        out += "# TYPE myfs_journal_checkpoints_total counter\n";
+        appendMetric(out, "myfs_journal_checkpoints_total", "", journalStats.checkpoints);
+    }
+}
+
+// Convert the superblock from its on-disk form at the start of block 0
+static void decodeSuperBlock(const char *ptr, superBlock &sb) {
+    memcpy(&sb, ptr, sizeof(sb));
+    sb.magic = fromDisk(sb.magic);
+    sb.version = fromDisk(sb.version);
+    sb.blockSize = fromDisk(sb.blockSize);
+    sb.totalBlocks = fromDisk(sb.totalBlocks);
+    sb.fatStart = fromDisk(sb.fatStart);
+    sb.fatBlocks = fromDisk(sb.fatBlocks);
+    sb.fatEntries = fromDisk(sb.fatEntries);
+    sb.bltStart = fromDisk(sb.bltStart);
+    sb.bltBlocks = fromDisk(sb.bltBlocks);
+    sb.journalStart = fromDisk(sb.journalStart);
+    sb.journalBlocks = fromDisk(sb.journalBlocks);
+}
+
+// Convert the superblock to its on-disk form at the start of block 0
+static void encodeSuperBlock(const superBlock &sb, char *ptr) {
+    superBlock d;
+    d.magic = toDisk(sb.magic);
+    d.version = toDisk(sb.version);
+    d.blockSize = toDisk(sb.blockSize);
+    d.totalBlocks = toDisk(sb.totalBlocks);
+    d.fatStart = toDisk(sb.fatStart);
+    d.fatBlocks = toDisk(sb.fatBlocks);
+    d.fatEntries = toDisk(sb.fatEntries);
+    d.bltStart = toDisk(sb.bltStart);
+    d.bltBlocks = toDisk(sb.bltBlocks);
+    d.journalStart = toDisk(sb.journalStart);
+    d.journalBlocks = toDisk(sb.journalBlocks);
+    memcpy(ptr, &d, sizeof(d));
+}
+
+/// @brief Read the layout of the container and size the tables accordingly, see resizeTables().
 ///
-/// \return ERRNO on failure, 0 on success
-int MyOnDiskFS::readFat() {
+/// Version 2 containers describe their layout in the superblock. Containers without superblock have the fixed layout
+/// of version 1; whether they have a journal is only known after reading the BLT. The superblock is read from the
+/// block device directly before the block size is known, so the device must still use blocks of MIN_BLOCK_SIZE.
+/// \return 0 on success, -ERRNO on failure.
+int MyOnDiskFS::readSuperBlock() {
     LOGM();
 
-    char *buffer = new char[BLOCK_SIZE];
-    char *ptr;
-    fatEntry e{};
+    char block[MIN_BLOCK_SIZE];
+    int ret = blockDevice->read(0, block);
+    if (ret < 0) {
+        return ret;
+    }
 
-    for (int blockNo = 0; blockNo < FAT_BLOCKS; blockNo++) {
+    superBlock sb;
+    decodeSuperBlock(block, sb);
+    if (sb.magic == SUPERBLOCK_MAGIC) {
+        // FAT, BLT and journal follow the superblock in this order and lie within the container
+        if (sb.version != FORMAT_VERSION_2 || sb.blockSize < MIN_BLOCK_SIZE || sb.blockSize > MAX_BLOCK_SIZE ||
+            (sb.blockSize & (sb.blockSize - 1)) != 0 || sb.fatStart != 1 ||
+            (uint64_t) sb.fatBlocks * (sb.blockSize / FAT_ENTRY_SIZE_V2) < sb.fatEntries ||
+            sb.bltStart < (uint64_t) sb.fatStart + sb.fatBlocks ||
+            (uint64_t) sb.bltBlocks * (sb.blockSize / BLT_ENTRY_SIZE_V2) < sb.totalBlocks ||
+            sb.journalStart < (uint64_t) sb.bltStart + sb.bltBlocks ||
+            (uint64_t) sb.journalStart + sb.journalBlocks > sb.totalBlocks) {
+            LOG("ERROR: Invalid superblock");
+            return -EINVAL;
+        }
+        layout = sb;
+        resizeTables();
+    } else {
+        memset(&layout, 0, sizeof(layout));
+        layout.version = FORMAT_VERSION_1;
+        layout.blockSize = BLOCK_SIZE;
+        layout.totalBlocks = TOTAL_BLT_ENTRIES;
+        layout.fatStart = 0;
+        layout.fatBlocks = FAT_BLOCKS;
+        layout.fatEntries = TOTAL_FAT_ENTRIES;
+        layout.bltStart = FAT_BLOCKS;
+        layout.bltBlocks = BLT_BLOCKS;
+        layout.journalStart = JOURNAL_START;
+        resizeTables();
+    }
 
-        // (Re)set Pointer to the same already allocated buffer
-        ptr = buffer;
-        blockDevice->read(blockNo, ptr);
+    LOGF("Format version %u: %u blocks of %u bytes, %u FAT entries", layout.version, layout.totalBlocks,
+         layout.blockSize, layout.fatEntries);
+    return 0;
+}
 
-        for (int i = 0; i < FAT_ENTRIES_PER_BLOCK; i++) {
+/// @brief Write an empty file system of format version 2 to a new container.
+///
+/// The number of FAT entries and the size of the BLT are derived from the size of the container. The container file
+/// is only extended to its size: free BLT entries and empty FAT entries are zero, so just the superblock, the BLT
+/// blocks with reserved entries and the journal are written.
+/// \param size Size of the container in bytes.
+/// \param blockSize Block size, a power of two between MIN_BLOCK_SIZE and MAX_BLOCK_SIZE.
+/// \return 0 on success, -ERRNO on failure.
+int MyOnDiskFS::formatContainer(long long size, uint32_t blockSize) {
+    LOGM();
 
-            // Read filename
-            memcpy(e.filename, ptr, MAX_NAME_LENGTH);
-            ptr += 32;
+    if (size < MIN_CONTAINER_SIZE) {
+        LOGF("ERROR: Container size %lld is below the minimum of %lld bytes", size, MIN_CONTAINER_SIZE);
+        return -EINVAL;
+    }
+    if (size / blockSize > UINT32_MAX) {
+        LOGF("ERROR: Container size %lld exceeds the maximum of %u blocks", size, UINT32_MAX);
+        return -EFBIG;
+    }
 
-            // Read uid
-            memcpy(&e.uid, ptr, 4);
-            ptr += 4;
+    uint32_t fatPerBlock = blockSize / FAT_ENTRY_SIZE_V2;
+    uint32_t bltPerBlock = blockSize / BLT_ENTRY_SIZE_V2;
+
+    superBlock sb;
+    memset(&sb, 0, sizeof(sb));
+    sb.magic = SUPERBLOCK_MAGIC;
+    sb.version = FORMAT_VERSION_2;
+    sb.blockSize = blockSize;
+    sb.totalBlocks = size / blockSize;
+    sb.fatEntries = std::min<long long>(std::max<long long>(size / BYTES_PER_FAT_ENTRY, MIN_FAT_ENTRIES),
+                                        MAX_FAT_ENTRIES);
+    sb.fatStart = 1;
+    sb.fatBlocks = (sb.fatEntries + fatPerBlock - 1) / fatPerBlock;
+    sb.bltStart = sb.fatStart + sb.fatBlocks;
+    sb.bltBlocks = ((uint64_t) sb.totalBlocks + bltPerBlock - 1) / bltPerBlock;
+    sb.journalStart = sb.bltStart + sb.bltBlocks;
+    // Every transaction must fit into the log, even one touching all of FAT and BLT
+    sb.journalBlocks = std::max<uint32_t>(JOURNAL_BLOCKS * BLOCK_SIZE / blockSize, MIN_JOURNAL_BLOCKS);
+    sb.journalBlocks = std::max(sb.journalBlocks, Journal::minLength(blockSize, sb.fatBlocks + sb.bltBlocks));
+    if ((uint64_t) sb.journalStart + sb.journalBlocks >= sb.totalBlocks) {
+        LOGF("ERROR: Container size %lld leaves no room for data", size);
+        return -EINVAL;
+    }
 
-            // Read gid
-            memcpy(&e.groupId, ptr, 4);
-            ptr += 4;
+    layout = sb;
+    resizeTables();
 
-            // Read mode
-            memcpy(&e.mode, ptr, 4);
-            ptr += 4;
+    if (ftruncate(blockDevice->getFd(), (off_t) sb.totalBlocks * blockSize) < 0) {
+        return -errno;
+    }
 
-            // Read access Time
-            memcpy(&e.accessTime, ptr, 4);
-            ptr += 4;
+    std::vector<char> block(blockSize, 0);
+    encodeSuperBlock(sb, block.data());
+    int ret = blockCache->write(0, block.data());
+    if (ret < 0) {
+        return ret;
+    }
+
+    LOG("Creating FAT");
+    buildFileIndex();
+
+    LOG("Creating BLT");
+    // Blocks used for superblock, FAT, BLT and journal are reserved, all other blocks are free
+    for (uint32_t i = 0; i < sb.journalStart + sb.journalBlocks; i++) {
+        blt[i] = BLT_RSV;
+        bltDirty.insert(i / bltEntriesPerBlock);
+    }
+    buildFreeBitmap();
+    ret = writeBlt();
+    if (ret < 0) {
+        return ret;
+    }
+
+    LOG("Creating journal");
+    journal = new Journal(blockCache, blockDevice, blockSize, sb.journalStart, sb.journalBlocks);
+    return journal->format();
+}
+
+/// @brief Size FAT, BLT and the structures derived from them according to the layout.
+///
+/// All entries are empty or free afterwards.
+void MyOnDiskFS::resizeTables() {
+    bool version1 = layout.version == FORMAT_VERSION_1;
+    fatEntrySize = version1 ? FAT_ENTRY_SIZE_V1 : FAT_ENTRY_SIZE_V2;
+    fatEntriesPerBlock = layout.blockSize / fatEntrySize;
+    bltEntrySize = version1 ? BLT_ENTRY_SIZE_V1 : BLT_ENTRY_SIZE_V2;
+    bltEntriesPerBlock = layout.blockSize / bltEntrySize;
+
+    fat.assign(layout.fatEntries, fatEntry());
+    fatGeneration.assign(layout.fatEntries, 0);
+    blockMaps.assign(layout.fatEntries, std::vector<uint32_t>());
+    fileLocks.reset(new RWLock[layout.fatEntries]);
+
+    // The BLT fills whole blocks, entries behind the last block of the container are never used
+    blt.assign((size_t) layout.bltBlocks * bltEntriesPerBlock, BLT_FREE);
+    freeBitmap.assign(((size_t) layout.totalBlocks + 63) / 64, 0);
+
+    fatDirty.clear();
+    bltDirty.clear();
+}
 
-            // Read mod time
-            memcpy(&e.modTime, ptr, 4);
-            ptr += 4;
+// Convert a FAT entry from its on-disk form D, which is copied from the block as a whole
+template<typename D>
+static void decodeFatEntry(const char *ptr, fatEntry &e) {
+    D d;
+    memcpy(&d, ptr, sizeof(D));
+
+    memcpy(e.filename, d.filename, MAX_NAME_LENGTH);
+    e.uid = fromDisk(d.uid);
+    e.groupId = fromDisk(d.groupId);
+    e.mode = fromDisk(d.mode);
+    e.accessTime = fromDisk(d.accessTime);
+    e.modTime = fromDisk(d.modTime);
+    e.changeTime = fromDisk(d.changeTime);
+    e.startBlock = fromDisk(d.startBlock);
+    e.nrBlocks = fromDisk(d.nrBlocks);
+    e.size = (off_t) fromDisk(d.size);
+}
 
-            // Read change time
-            memcpy(&e.changeTime, ptr, 4);
-            ptr += 4;
+// Convert a FAT entry to its on-disk form D, truncating block numbers and size to the width of D
+template<typename D>
+static void encodeFatEntry(const fatEntry &e, char *ptr) {
+    D d;
+
+    memcpy(d.filename, e.filename, MAX_NAME_LENGTH);
+    d.uid = toDisk((uint32_t) e.uid);
+    d.groupId = toDisk((uint32_t) e.groupId);
+    d.mode = toDisk((uint32_t) e.mode);
+    d.accessTime = toDisk((int32_t) e.accessTime);
+    d.modTime = toDisk((int32_t) e.modTime);
+    d.changeTime = toDisk((int32_t) e.changeTime);
+    d.startBlock = toDisk((decltype(d.startBlock)) e.startBlock);
+    d.nrBlocks = toDisk((decltype(d.nrBlocks)) e.nrBlocks);
+    d.size = toDisk((decltype(d.size)) e.size);
+
+    memcpy(ptr, &d, sizeof(D));
+}
 
-            // Read startBlock
-            memcpy(&e.startBlock, ptr, 2);
-            ptr += 2;
+/// @brief Read FAT from container file and update local FAT
+///
+/// \return ERRNO on failure, 0 on success
+int MyOnDiskFS::readFat() {
+    LOGM();
 
-            // Read nrBlocks
-            memcpy(&e.nrBlocks, ptr, 2);
-            ptr += 2;
+    // Read the FAT in runs of up to 64 blocks, so the buffer stays small for large containers
+    const uint32_t runBlocks = std::min(layout.fatBlocks, 64U);
+    if (fatBuffer.size() < (size_t) runBlocks * layout.blockSize) {
+        fatBuffer.resize((size_t) runBlocks * layout.blockSize);
+    }
 
-            // Read size
-            memcpy(&e.size, ptr, 4);
-            ptr += 4;
+    for (uint32_t first = 0; first < layout.fatBlocks; first += runBlocks) {
+        uint32_t count = std::min(runBlocks, layout.fatBlocks - first);
+        int ret = blockCache->readBlocks(layout.fatStart + first, count, fatBuffer.data());
+        if (ret < 0) {
+            return ret;
+        }
 
-            // Set current entry
-            fat[(blockNo * FAT_ENTRIES_PER_BLOCK) + i] = e;
+        for (uint32_t b = 0; b < count; b++) {
+            decodeFatBlock(first + b, fatBuffer.data() + (size_t) b * layout.blockSize);
         }
     }
-    delete[] buffer;
+    fatDirty.clear();
+    buildFileIndex();
     return EXIT_SUCCESS;
 }
 
-/// @brief Write current Fat to Containerfile
+/// @brief Write modified FAT blocks to Containerfile
 ///
+/// Only blocks marked with markFatDirty() are serialized and written. Must be called with fatLock held.
 /// \return ERRNO on failure, 0 on success
 int MyOnDiskFS::writeFat() {
     LOGM();
 
-    char *buffer = new char[BLOCK_SIZE];
-    char *ptr;
+    if (fatDirty.empty()) {
+        return EXIT_SUCCESS;
+    }
 
-    fatEntry e{};
+    uint32_t count = fatDirty.size();
+    if (fatBuffer.size() < (size_t) count * layout.blockSize) {
+        fatBuffer.resize((size_t) count * layout.blockSize);
+    }
+    fatBlockNos.resize(count);
+    fatBuffers.resize(count);
+
+    uint32_t i = 0;
+    for (uint32_t b: fatDirty) {
+        char *block = fatBuffer.data() + (size_t) i * layout.blockSize;
+        encodeFatBlock(b, block);
+        fatBlockNos[i] = layout.fatStart + b;
+        fatBuffers[i] = block;
+        i++;
+    }
 
-    for (int blockNumber = 0; blockNumber < FAT_BLOCKS; blockNumber++) {
+    // Write all modified blocks at once, or add them to the running transaction of the journal. Both copy the blocks,
+    // so the buffer can be used again right away.
+    if (journal != nullptr) {
+        journal->log(count, fatBlockNos.data(), fatBuffers.data());
+    } else {
+        int ret = blockCache->writeVec(count, fatBlockNos.data(), fatBuffers.data());
+        if (ret < 0) {
+            return ret;
+        }
+    }
 
-        // (Re)set Pointer to the same already allocated buffer
-        ptr = buffer;
+    LOGF("FAT: %u blocks written", count);
+    metaBlocksWritten += count;
+    metaUpdates++;
+    fatDirty.clear();
+    lastFatWrite = time(0);
+    return EXIT_SUCCESS;
+}
 
-        for (int i = 0; i < FAT_ENTRIES_PER_BLOCK; i++) {
+/// @brief Update the FAT entries of FAT block b from its content.
+///
+/// \param [in] b Number of the block, relative to the start of the FAT.
+/// \param [in] block Content of the block. Entries do not span blocks.
+void MyOnDiskFS::decodeFatBlock(uint32_t b, const char *block) {
+    uint32_t first = b * fatEntriesPerBlock;
+    uint32_t end = std::min(first + fatEntriesPerBlock, layout.fatEntries);
+
+    for (uint32_t i = first; i < end; i++) {
+        const char *ptr = block + (size_t) (i - first) * fatEntrySize;
+        if (layout.version == FORMAT_VERSION_1) {
+            decodeFatEntry<diskFatEntryV1>(ptr, fat[i]);
+        } else {
+            decodeFatEntry<diskFatEntryV2>(ptr, fat[i]);
+        }
+    }
+}
 
-            // Get current Entry
-            e = fat[(blockNumber * FAT_ENTRIES_PER_BLOCK) + i];
+/// @brief Serialize the FAT entries of FAT block b.
+///
+/// \param [in] b Number of the block, relative to the start of the FAT.
+/// \param [out] block Buffer of one block. Space behind the last entry is zeroed.
+void MyOnDiskFS::encodeFatBlock(uint32_t b, char *block) {
+    uint32_t first = b * fatEntriesPerBlock;
+    uint32_t end = std::min(first + fatEntriesPerBlock, layout.fatEntries);
+
+    for (uint32_t i = first; i < end; i++) {
+        char *ptr = block + (size_t) (i - first) * fatEntrySize;
+        if (layout.version == FORMAT_VERSION_1) {
+            encodeFatEntry<diskFatEntryV1>(fat[i], ptr);
+        } else {
+            encodeFatEntry<diskFatEntryV2>(fat[i], ptr);
+        }
+    }
 
-            // Write Filename
-            memcpy(ptr, e.filename, MAX_NAME_LENGTH);
-            ptr += MAX_NAME_LENGTH;
+    size_t used = (size_t) (end - first) * fatEntrySize;
+    memset(block + used, 0, layout.blockSize - used);
+}
 
-            // Write UID
-            memcpy(ptr, &e.uid, 4);
-            ptr += 4;
+/// @brief Write modified FAT blocks only if the last write is a while ago.
+///
+/// Used for changes that may be lost in a crash, i.e., timestamps. They are written with the next writeFat(), or by
+/// fatSyncLoop() at the latest after FAT_SYNC_INTERVAL_S seconds. Must be called with fatLock held.
+/// \return ERRNO on failure, 0 on success
+int MyOnDiskFS::writeFatLazy() {
+    if (fatDirty.empty() || time(0) - lastFatWrite < FAT_SYNC_INTERVAL_S) {
+        return EXIT_SUCCESS;
+    }
+    return writeFat();
+}
 
-            // Write GID
-            memcpy(ptr, &e.groupId, 4);
-            ptr += 4;
+/// @brief Body of the FAT sync thread, writes blocks left dirty by writeFatLazy() every FAT_SYNC_INTERVAL_S seconds.
+void MyOnDiskFS::fatSyncLoop() {
+    std::unique_lock<std::mutex> lock(fatSyncStopLock);
+    while (!fatSyncCond.wait_for(lock, std::chrono::seconds(FAT_SYNC_INTERVAL_S), [this] { return fatSyncStopping; })) {
+        lock.unlock();
+        {
+            std::lock_guard<std::mutex> fatGuard(fatLock);
+            int ret = writeFat();
+            if (ret < 0) {
+                LOGF("FAT sync failed with error %d", ret);
+            }
+        }
+        lock.lock();
+    }
+}
 
-            // Write Mode
-            memcpy(ptr, &e.mode, 4);
-            ptr += 4;
+/// @brief Stop the FAT sync thread. Blocks it left dirty are written by the caller.
+void MyOnDiskFS::stopFatSync() {
+    {
+        std::lock_guard<std::mutex> stopGuard(fatSyncStopLock);
+        fatSyncStopping = true;
+    }
+    fatSyncCond.notify_one();
 
-            // Write access time
-            memcpy(ptr, &e.accessTime, 4);
-            ptr += 4;
+    if (fatSyncThread.joinable()) {
+        fatSyncThread.join();
+    }
+}
 
-            // Write mode time
-            memcpy(ptr, &e.modTime, 4);
-            ptr += 4;
+/// @brief Read BLT from container file and update local BLT
+///
+/// \return ERRNO on failure, 0 on success
+int MyOnDiskFS::readBlt() {
+    LOGM();
+
+    int ret;
+    if (layout.version == FORMAT_VERSION_1) {
+        // Widen the 16 bit entries of version 1
+        std::vector<uint16_t> entries(blt.size());
+        ret = blockCache->readBlocks(layout.bltStart, layout.bltBlocks, (char *) entries.data());
+        for (size_t i = 0; i < entries.size(); i++) {
+            blt[i] = fromDisk(entries[i]);
+        }
+    } else {
+        ret = blockCache->readBlocks(layout.bltStart, layout.bltBlocks, (char *) blt.data());
+        for (uint32_t &entry: blt) {
+            entry = fromDisk(entry);
+        }
+    }
+    if (ret < 0) {
+        return ret;
+    }
 
-            // Write change time
-            memcpy(ptr, &e.changeTime, 4);
-            ptr += 4;
+    bltDirty.clear();
+    buildFreeBitmap();
+    return EXIT_SUCCESS;
+}
 
-            // Write startBlock
-            memcpy(ptr, &e.startBlock, 2);
-            ptr += 2;
+/// @brief Write modified BLT blocks to Containerfile
+///
+/// Only blocks modified with setBltEntry() are written. Must be called with allocLock held.
+/// \return ERRNO on failure, 0 on success
+int MyOnDiskFS::writeBlt() {
+    LOGM();
 
-            // Write nrBlocks
-            memcpy(ptr, &e.nrBlocks, 2);
-            ptr += 2;
+    if (bltDirty.empty()) {
+        return EXIT_SUCCESS;
+    }
 
-            // Write size
-            memcpy(ptr, &e.size, 4);
-            ptr += 4;
+    std::vector<uint32_t> blockNos(bltDirty.size());
+    std::vector<const char *> buffers(bltDirty.size());
+    std::vector<char> encoded(bltDirty.size() * layout.blockSize);
+    uint32_t count = 0;
+
+    for (uint32_t b: bltDirty) {
+        const uint32_t *entries = blt.data() + (size_t) b * bltEntriesPerBlock;
+        char *ptr = encoded.data() + (size_t) count * layout.blockSize;
+        blockNos[count] = layout.bltStart + b;
+        if (layout.version == FORMAT_VERSION_1) {
+            // Version 1 stores 16 bit entries
+            uint16_t *n = (uint16_t *) ptr;
+            for (uint32_t i = 0; i < bltEntriesPerBlock; i++) {
+                n[i] = toDisk((uint16_t) entries[i]);
+            }
+        } else {
+            uint32_t *n = (uint32_t *) ptr;
+            for (uint32_t i = 0; i < bltEntriesPerBlock; i++) {
+                n[i] = toDisk(entries[i]);
+            }
         }
+        buffers[count] = ptr;
+        count++;
+    }
 
-        blockDevice->write(blockNumber, buffer);
+    // Write all modified blocks at once, consecutive blocks are merged by the block device
+    if (journal != nullptr) {
+        journal->log(count, blockNos.data(), buffers.data());
+    } else {
+        int ret = blockCache->writeVec(count, blockNos.data(), buffers.data());
+        if (ret < 0) {
+            return ret;
+        }
     }
-    delete[] buffer;
+
+    LOGF("BLT: %u blocks written", count);
+    metaBlocksWritten += count;
+    metaUpdates++;
+    bltDirty.clear();
     return EXIT_SUCCESS;
 }
 
-/// @brief Read BLT from container file and update local BLT
+/// @brief Mark the FAT block containing an entry as modified.
 ///
-/// \return ERRNO on failure, 0 on success
-int MyOnDiskFS::readBlt() {
-    LOGM();
+/// \param index Index of the modified FAT entry.
+void MyOnDiskFS::markFatDirty(int index) {
+    fatDirty.insert(index / fatEntriesPerBlock);
+}
 
-    char *buffer = new char[BLOCK_SIZE];
-    char *ptr;
+/// @brief Describe a byte range of a file as buffers of the container file.
+///
+/// Each run of consecutive blocks becomes one file descriptor buffer. Dirty cached blocks of the range are written to
+/// the container first; with discard, the blocks are also removed from the block cache, because the caller is about to
+/// overwrite them in the container. The range must lie within the blocks of the file. Must be called with the file
+/// lock held.
+/// \param index Index of the FAT entry.
+/// \param offset Starting position in the file.
+/// \param size Number of bytes.
+/// \param discard Remove the blocks from the block cache.
+/// \param [out] bufp Buffer vector allocated with malloc().
+/// \return 0 on success, -ERRNO on failure.
+int MyOnDiskFS::getContainerBufvec(int index, off_t offset, size_t size, bool discard, struct fuse_bufvec **bufp) {
+    const uint32_t *blockList = getBlockMap(index);
+    off_t end = offset + size;
+    int64_t firstBlock = offset / layout.blockSize;
+    int64_t lastBlock = size > 0 ? (end - 1) / layout.blockSize : firstBlock - 1;
+
+    int runs = 1;
+    for (int64_t b = firstBlock; b < lastBlock; b++) {
+        if (blockList[b + 1] != blockList[b] + 1) {
+            runs++;
+        }
+    }
 
-    for (int blockNr = 0; blockNr < BLT_BLOCKS; ++blockNr) {
+    struct fuse_bufvec *bufvec = (struct fuse_bufvec *) malloc(sizeof(struct fuse_bufvec) +
+                                                                (runs - 1) * sizeof(struct fuse_buf));
+    if (bufvec == NULL) {
+        return -ENOMEM;
+    }
+    memset(bufvec, 0, sizeof(struct fuse_bufvec));
+    if (size == 0) {
+        bufvec->count = 1;
+        bufvec->buf[0].fd = -1;
+        *bufp = bufvec;
+        return 0;
+    }
 
-        ptr = buffer;
-        blockDevice->read(blockNr + FAT_BLOCKS, buffer);
+    off_t pos = offset;
+    for (int64_t b = firstBlock; b <= lastBlock; b++) {
+        int64_t runStart = b;
+        while (b < lastBlock && blockList[b + 1] == blockList[b] + 1) {
+            b++;
+        }
 
-        for (int i = 0; i < BLT_ENTRIES_PER_BLOCK; ++i) {
+        int ret = blockCache->writeOut(blockList[runStart], b - runStart + 1, discard);
+        if (ret < 0) {
+            free(bufvec);
+            return ret;
+        }
+
+        off_t runEnd = std::min(end, (off_t) (b + 1) * layout.blockSize);
+        struct fuse_buf &fb = bufvec->buf[bufvec->count++];
+        fb.size = runEnd - pos;
+        fb.flags = (enum fuse_buf_flags) (FUSE_BUF_IS_FD | FUSE_BUF_FD_SEEK | FUSE_BUF_FD_RETRY);
+        fb.mem = NULL;
+        fb.fd = blockDevice->getFd();
+        fb.pos = (off_t) blockList[runStart] * layout.blockSize + pos % layout.blockSize;
+        pos = runEnd;
+    }
+
+    *bufp = bufvec;
+    return 0;
+}
+
+/// @brief Update the access time of a file after a read, according to the atime mount option.
+///
+/// The FAT is written lazily. Must be called with fatLock held.
+/// \param index Index of the FAT entry.
+void MyOnDiskFS::touchAccessTime(int index) {
+    fatEntry &e = fat[index];
+    int systemTime = time(0);
+
+    if (atimeMode == ATIME_NONE || e.accessTime == systemTime) {
+        return;
+    }
+    if (atimeMode == ATIME_RELATIME && e.accessTime > e.modTime && e.accessTime > e.changeTime &&
+        systemTime - e.accessTime < RELATIME_INTERVAL_S) {
+        return;
+    }
 
-            memcpy(&blt[(blockNr * BLT_ENTRIES_PER_BLOCK) + i], ptr, 2);
-            ptr += 2;
+    e.accessTime = systemTime;
+    markFatDirty(index);
+    writeFatLazy();
+}
+
+/// @brief Update the modification and change time of a file after a write.
+///
+/// The FAT is written lazily. Must be called with fatLock held.
+/// \param index Index of the FAT entry.
+void MyOnDiskFS::touchModTime(int index) {
+    fatEntry &e = fat[index];
+    int systemTime = time(0);
+
+    if (e.modTime == systemTime && e.changeTime == systemTime) {
+        return;
+    }
+
+    e.modTime = systemTime;
+    e.changeTime = systemTime;
+    markFatDirty(index);
+    writeFatLazy();
+}
+
+/// @brief Set a BLT entry and mark its block as modified.
+///
+/// With a journal, freed blocks are only handed out again once the transaction freeing them is committed, see
+/// releasePendingFrees(). Otherwise a crash could leave the block with the old file and the data of the new one.
+/// \param block Index of the BLT entry.
+/// \param value New value of the entry.
+void MyOnDiskFS::setBltEntry(uint32_t block, uint32_t value) {
+    if (blt[block] == value) {
+        return;
+    }
+
+    // Keep free block bitmap in sync
+    uint64_t bit = (uint64_t) 1 << (block % 64);
+    if (blt[block] == BLT_FREE) {
+        freeBitmap[block / 64] &= ~bit;
+        freeBlockCount--;
+    } else if (value == BLT_FREE && journal != nullptr) {
+        pendingFrees.push_back(std::make_pair(journal->getRunningSequence(), block));
+    } else if (value == BLT_FREE) {
+        freeBitmap[block / 64] |= bit;
+        freeBlockCount++;
+    }
+
+    blt[block] = value;
+    bltDirty.insert(block / bltEntriesPerBlock);
+}
+
+/// @brief Make blocks freed by committed transactions available for allocation.
+///
+/// Must be called with allocLock held.
+void MyOnDiskFS::releasePendingFrees() {
+    if (pendingFrees.empty()) {
+        return;
+    }
+
+    uint64_t committed = journal->getCommittedSequence();
+    size_t kept = 0;
+    for (const auto &pending: pendingFrees) {
+        uint32_t block = pending.second;
+        if (pending.first > committed) {
+            pendingFrees[kept++] = pending;
+        } else if (blt[block] == BLT_FREE) {
+            freeBitmap[block / 64] |= (uint64_t) 1 << (block % 64);
+            freeBlockCount++;
         }
     }
-    delete[] buffer;
-    return EXIT_SUCCESS;
+    pendingFrees.resize(kept);
 }
 
-/// @brief Write current Fat to Containerfile
+/// @brief Set the size of a file.
 ///
-/// \return ERRNO on failure, 0 on success
-int MyOnDiskFS::writeBlt() {
-    LOGM();
+/// Frees or allocates blocks as needed, see fuseTruncate(). Must be called with the lock of the file held for writing.
+/// \param [in] index FAT index of the file.
+/// \param [in] newSize New size of the file.
+/// \return 0 on success, -ERRNO on failure.
+int MyOnDiskFS::truncateFile(int index, off_t newSize) {
+    // CASE: We don't need to change size at all
+    if (newSize == fat[index].size) {
+        return 0;
+    }
 
-    char *buffer = new char[BLOCK_SIZE];
-    char *ptr;
+    // Get number of Blocks needed
+    auto nrBlocks = (newSize + layout.blockSize - 1) / layout.blockSize;
+    uint32_t startBlock = fat[index].startBlock;
 
-    for (int blockNo = 0; blockNo < BLT_BLOCKS; blockNo++) {
+    // CASE: Need to shrink size
+    if (newSize < fat[index].size) {
 
-        // (Re)set Pointer to the same already allocated buffer
-        ptr = buffer;
+        // Check if we can free some blocks
+        if (fat[index].nrBlocks > nrBlocks) {
+            std::lock_guard<std::mutex> allocGuard(allocLock);
+
+            const uint32_t *blockList = getBlockMap(index);
 
-        for (int i = 0; i < BLT_ENTRIES_PER_BLOCK; i++) {
+            // Set new EOF block
+            if (nrBlocks > 0) {
+                setBltEntry(blockList[nrBlocks - 1], BLT_EOF);
+            }
 
-            memcpy(ptr, &blt[(blockNo * BLT_ENTRIES_PER_BLOCK) + i], 2);
-            ptr += 2;
+            // Free remaining blocks
+            for (uint32_t i = nrBlocks; i < fat[index].nrBlocks; ++i) {
+                setBltEntry(blockList[i], BLT_FREE);
+            }
 
+            // Save changes to BLT (FAT changes saved later)
+            blockMaps[index].resize(nrBlocks);
+            writeBlt();
         }
-        // BLT is located AFTER FAT, so we offset by total FAT Blocks
-        blockDevice->write(blockNo + FAT_BLOCKS, buffer);
     }
-    delete[] buffer;
-    return EXIT_SUCCESS;
+
+    // CASE: Need to enlarge file
+    if (newSize > fat[index].size) {
+
+        // Check if we need more blocks
+        if (nrBlocks > fat[index].nrBlocks) {
+
+            // The block count of a file is limited to 16 bit in version 1 and 32 bit in version 2
+            if (nrBlocks > (layout.version == FORMAT_VERSION_1 ? 0xFFFF : 0xFFFFFFFF)) {
+                return -EFBIG;
+            }
+
+            std::lock_guard<std::mutex> allocGuard(allocLock);
+
+            // Check space before modifying the BLT. Blocks freed by uncommitted transactions stay reserved: committing
+            // here would wait for the handle of this very operation.
+            releasePendingFrees();
+            if (nrBlocks - fat[index].nrBlocks > freeBlockCount) {
+                return -ENOSPC;
+            }
+
+            std::vector<uint32_t> &blockList = blockMaps[index];
+            uint32_t wanted = nrBlocks - fat[index].nrBlocks;
+            uint32_t start, length;
+            blockList.reserve(nrBlocks);
+
+            // catch if file has no startBlock yet
+            if (blockList.empty()) {
+                allocateExtent(0, wanted, start, length);
+                startBlock = start;
+                setBltEntry(start, BLT_EOF);
+                blockList.push_back(start);     // Since we just allocated the first one
+                wanted--;
+            }
+
+            // Address "iterator", starts at the end of blockList
+            uint32_t currentAddress = blockList.back();
+
+            // Allocate new blocks in extents, preferably right behind the last block
+            while (wanted > 0) {
+                allocateExtent(currentAddress + 1, wanted, start, length);
+                for (uint32_t b = start; b < start + length; b++) {
+                    setBltEntry(currentAddress, b);     // Set last EOF to new free block
+                    currentAddress = b;                 // Get new EOF
+                    setBltEntry(currentAddress, BLT_EOF);   // Set current EOF
+                    blockList.push_back(b);
+                }
+                wanted -= length;
+            }
+
+            // Save changes to BLT (FAT changes saved later)
+            writeBlt();
+        }
+    }
+
+    std::lock_guard<std::mutex> fatGuard(fatLock);
+    fat[index].startBlock = startBlock;
+    fat[index].nrBlocks = blockMaps[index].size();
+    fat[index].size = newSize;
+
+    int systemTime = time(0);
+    fat[index].modTime = systemTime;
+    fat[index].changeTime = systemTime;
+    markFatDirty(index);
+    writeFat();
+
+    return 0;
+}
+
+/// @brief Fill the meta data of a file.
+///
+/// Takes fatLock.
+/// \param index [in] FAT index of the file
+/// \param statbuf [out] Meta data of the file
+void MyOnDiskFS::statFile(int index, struct stat *statbuf) {
+    std::lock_guard<std::mutex> fatGuard(fatLock);
+
+    // Fill statbuf with relevant data
+    statbuf->st_uid = fat[index].uid;
+    statbuf->st_gid = fat[index].groupId;
+    statbuf->st_atime = fat[index].accessTime;
+    statbuf->st_mtime = fat[index].modTime;
+    statbuf->st_ctime = fat[index].changeTime;
+    statbuf->st_mode = fat[index].mode;
+    statbuf->st_nlink = 1; // weil wir eine Datei sind und kein Verzeichnis
+    statbuf->st_size = fat[index].size;
+}
+
+/// @brief Read from a file, see fuseRead().
+///
+/// Must be called with the lock of the file held.
+/// \return Number of bytes read, -ERRNO on failure
+int MyOnDiskFS::readFile(int index, char *buf, size_t size, off_t offset) {
+    // Make sure we don't read more than the file
+    if (offset >= fat[index].size || size == 0) {
+        return 0;
+    }
+    if (offset + (off_t) size > fat[index].size) {
+        LOG("Tried to read more than file...");
+        size = fat[index].size - offset;
+    }
+
+    // Collect all blocks touched by the request. Fully covered blocks are read directly into buf, the partially
+    // covered first and last block go through a bounce buffer.
+    off_t end = offset + size;
+    uint32_t firstBlock = offset / layout.blockSize;
+    int count = (end + layout.blockSize - 1) / layout.blockSize - firstBlock;
+
+    uint32_t blockNos[count];
+    char *buffers[count];
+    char bounce[2][layout.blockSize];
+    const uint32_t *blockList = getBlockMap(index);
+
+    for (int i = 0; i < count; i++) {
+        off_t blockStart = (off_t) (firstBlock + i) * layout.blockSize;
+        blockNos[i] = blockList[firstBlock + i];
+        if (blockStart < offset || blockStart + layout.blockSize > end) {
+            buffers[i] = bounce[i == 0 ? 0 : 1];
+        } else {
+            buffers[i] = buf + (blockStart - offset);
+        }
+    }
+
+    int ret = blockCache->readVec(count, blockNos, buffers);
+    if (ret < 0) { return ret; }
+
+    // Copy partially covered blocks
+    if (buffers[0] == bounce[0]) {
+        off_t firstEnd = std::min(end, (off_t) (firstBlock + 1) * layout.blockSize);
+        memcpy(buf, bounce[0] + offset % layout.blockSize, firstEnd - offset);
+    }
+    if (count > 1 && buffers[count - 1] == bounce[1]) {
+        off_t lastStart = (off_t) (firstBlock + count - 1) * layout.blockSize;
+        memcpy(buf + (lastStart - offset), bounce[1], end - lastStart);
+    }
+
+    std::lock_guard<std::mutex> fatGuard(fatLock);
+    touchAccessTime(index);
+
+    return (int) size;
+}
+
+/// @brief Prefetch the blocks following a read if the open file is read sequentially.
+///
+/// A read is sequential if it starts where the previous read of the same open file ended. Each sequential read doubles
+/// the readahead window, up to maxReadaheadBlocks; a random read halves it and prefetches nothing. Once less than half
+/// of the window is prefetched ahead of the read, the blocks up to the end of the window are handed to the readahead
+/// thread, so the device reads overlap with the next requests. Must be called with the lock of the file held.
+/// \param [in] index FAT index of the file.
+/// \param [in] fileInfo File handle set by fuseOpen, may be null.
+/// \param [in] offset Start of the read.
+/// \param [in] size Number of bytes read.
+void MyOnDiskFS::readahead(int index, struct fuse_file_info *fileInfo, off_t offset, size_t size) {
+    if (maxReadaheadBlocks == 0 || fileInfo == nullptr || fileInfo->fh == 0) {
+        return;
+    }
+    OpenFile *file = (OpenFile *) fileInfo->fh;
+
+    uint32_t requestStart = offset / layout.blockSize;
+    uint32_t requestEnd = (offset + size + layout.blockSize - 1) / layout.blockSize;
+    uint32_t first, last;
+    {
+        std::lock_guard<std::mutex> guard(file->readaheadLock);
+        bool sequential = offset == file->nextOffset;
+        file->nextOffset = offset + size;
+
+        if (!sequential) {
+            file->window /= 2;
+            file->prefetchedEnd = requestEnd;
+            return;
+        }
+
+        file->window = std::min(std::max(file->window * 2, (requestEnd - requestStart) * 2), maxReadaheadBlocks);
+        if (file->prefetchedEnd >= requestEnd + file->window / 2) {
+            return;
+        }
+
+        first = std::max(file->prefetchedEnd, requestEnd);
+        last = std::min(requestEnd + file->window, fat[index].nrBlocks);
+        if (first >= last) {
+            return;
+        }
+        file->prefetchedEnd = last;
+    }
+
+    const uint32_t *blockList = getBlockMap(index);
+    {
+        std::lock_guard<std::mutex> queueGuard(readaheadQueueLock);
+        if (readaheadQueue.size() >= READAHEAD_QUEUE_LENGTH) {
+            return;
+        }
+        readaheadQueue.emplace_back(blockList + first, blockList + last);
+    }
+    readaheadCond.notify_one();
+}
+
+/// @brief Body of the readahead thread, prefetches the block lists queued by readahead().
+void MyOnDiskFS::readaheadLoop() {
+    std::unique_lock<std::mutex> lock(readaheadQueueLock);
+    while (true) {
+        readaheadCond.wait(lock, [this] { return readaheadStopping || !readaheadQueue.empty(); });
+        if (readaheadStopping) {
+            break;
+        }
+
+        std::vector<uint32_t> blockNos;
+        blockNos.swap(readaheadQueue.front());
+        readaheadQueue.pop_front();
+
+        lock.unlock();
+        int ret = blockCache->prefetch(blockNos.size(), blockNos.data());
+        if (ret < 0) {
+            LOGF("Readahead of %zu blocks failed with error %d", blockNos.size(), ret);
+        }
+        lock.lock();
+    }
+}
+
+/// @brief Stop the readahead thread, dropping pending prefetches.
+void MyOnDiskFS::stopReadahead() {
+    {
+        std::lock_guard<std::mutex> queueGuard(readaheadQueueLock);
+        readaheadStopping = true;
+        readaheadQueue.clear();
+    }
+    readaheadCond.notify_one();
+
+    if (readaheadThread.joinable()) {
+        readaheadThread.join();
+    }
+}
+
+/// @brief Write to a file, see fuseWrite().
+///
+/// Must be called with the lock of the file held for writing.
+/// \return Number of bytes written, -ERRNO on failure
+int MyOnDiskFS::writeFile(int index, const char *buf, size_t size, off_t offset) {
+    if (size == 0) {
+        return 0;
+    }
+
+    // Enlarge file if necessary
+    if (size + offset > fat[index].size) {
+        int ret = truncateFile(index, size + offset);
+        if (ret < 0) { return ret; }
+    }
+
+    // Collect all blocks touched by the request. Fully covered blocks are written directly from buf, the partially
+    // covered first and last block are read into a bounce buffer and merged first.
+    off_t end = offset + size;
+    uint32_t firstBlock = offset / layout.blockSize;
+    int count = (end + layout.blockSize - 1) / layout.blockSize - firstBlock;
+
+    uint32_t blockNos[count];
+    const char *buffers[count];
+    char bounce[2][layout.blockSize];
+    uint32_t partialBlockNos[2];
+    char *partialBuffers[2];
+    int partialCount = 0;
+    const uint32_t *blockList = getBlockMap(index);
+
+    for (int i = 0; i < count; i++) {
+        off_t blockStart = (off_t) (firstBlock + i) * layout.blockSize;
+        blockNos[i] = blockList[firstBlock + i];
+        if (blockStart < offset || blockStart + layout.blockSize > end) {
+            char *b = bounce[i == 0 ? 0 : 1];
+            partialBlockNos[partialCount] = blockNos[i];
+            partialBuffers[partialCount++] = b;
+            buffers[i] = b;
+        } else {
+            buffers[i] = buf + (blockStart - offset);
+        }
+    }
+
+    // Read data in case we write on block only partially
+    if (partialCount > 0) {
+        int ret = blockCache->readVec(partialCount, partialBlockNos, partialBuffers);
+        if (ret < 0) { return ret; }
+    }
+    if (buffers[0] == bounce[0]) {
+        off_t firstEnd = std::min(end, (off_t) (firstBlock + 1) * layout.blockSize);
+        memcpy(bounce[0] + offset % layout.blockSize, buf, firstEnd - offset);
+    }
+    if (count > 1 && buffers[count - 1] == bounce[1]) {
+        off_t lastStart = (off_t) (firstBlock + count - 1) * layout.blockSize;
+        memcpy(bounce[1], buf + (lastStart - offset), end - lastStart);
+    }
+
+    int ret = blockCache->writeVec(count, blockNos, buffers);
+    if (ret < 0) { return ret; }
+
+    // The size was already extended and written by truncateFile(), only the timestamps change here
+    std::lock_guard<std::mutex> fatGuard(fatLock);
+    touchModTime(index);
+
+    return (int) size;
 }
 
 /// @brief Find file in fat array.
-/// Note that path must include leading '/'.F
+/// Note that path must include leading '/'.
 /// \param path [in] Filename of file to return
 /// \return Index of file if found, -ERRNO otherwise
 int MyOnDiskFS::getFileIndex(const char *path) {
-    for (int i = 0; i < 64; i++) {
-        if (strcmp(fat[i].filename, path + 1) == 0) {
-            return i;
+    int *index = fileIndex.find(path + 1);
+    return index != nullptr ? *index : -ENOENT;
+}
+
+/// @brief Find a file and lock it.
+///
+/// The FAT index is taken from the handle if possible, otherwise the file is looked up by name.
+/// \param path [in] Name of the file, used if there is no valid handle
+/// \param fileInfo [in] Handle set by fuseOpen(), may be nullptr
+/// \param exclusive [in] Lock the file for writing instead of reading
+/// \return Index of the file, locked by the caller until it calls fileLocks[index].unlock(), -ERRNO on failure
+int MyOnDiskFS::lockFile(const char *path, struct fuse_file_info *fileInfo, bool exclusive) {
+    if (fileInfo != nullptr && fileInfo->fh != 0) {
+        OpenFile *file = (OpenFile *) fileInfo->fh;
+        int index = file->index;
+        if (index >= 0) {
+            exclusive ? fileLocks[index].lockWrite() : fileLocks[index].lockRead();
+
+            // The handle is detached with the file locked, so it is still valid if it was not detached by now
+            if (file->index == index) {
+                return index;
+            }
+            fileLocks[index].unlock();
+        }
+    }
+
+    ReadGuard metaGuard(metaLock);
+    int index = getFileIndex(path);
+    if (index >= 0) {
+        exclusive ? fileLocks[index].lockWrite() : fileLocks[index].lockRead();
+    }
+    return index;
+}
+
+/// @brief Lock a file given by its id.
+///
+/// \param id [in] Id returned by fuseLookupId()
+/// \param exclusive [in] Lock the file for writing instead of reading
+/// \return Index of the file, locked by the caller until it calls fileLocks[index].unlock(), -ENOENT if the file was
+/// deleted
+int MyOnDiskFS::lockFileId(int64_t id, bool exclusive) {
+    uint32_t index = (uint32_t) (id & 0xffffffff);
+    if (id < 0 || index >= layout.fatEntries) {
+        return -ENOENT;
+    }
+
+    // The generation changes with the file lock held when the file is deleted
+    exclusive ? fileLocks[index].lockWrite() : fileLocks[index].lockRead();
+    if (fatGeneration[index] != (uint32_t) (id >> 32)) {
+        fileLocks[index].unlock();
+        return -ENOENT;
+    }
+    return index;
+}
+
+/// @brief Return the physical blocks of a file.
+///
+/// The block map of each file is built once when the file system is mounted and kept up to date by truncateFile()
+/// and removeFile(), so no BLT chain needs to be followed during I/O. Must be called with the lock of the file or
+/// allocLock held.
+/// \param index [in] FAT index of the file
+/// \return Physical block numbers of all blocks of the file
+const uint32_t *MyOnDiskFS::getBlockMap(int index) {
+    return blockMaps[index].data();
+}
+
+/// @brief Build the block maps of all files by following their BLT chains.
+void MyOnDiskFS::buildBlockMaps() {
+    for (uint32_t index = 0; index < layout.fatEntries; index++) {
+        std::vector<uint32_t> &map = blockMaps[index];
+        map.clear();
+        if (fat[index].filename[0] == 0 || fat[index].nrBlocks == 0) {
+            continue;
+        }
+
+        map.reserve(fat[index].nrBlocks);
+        map.push_back(fat[index].startBlock);
+        while (map.size() < fat[index].nrBlocks) {
+            map.push_back(blt[map.back()]);
+        }
+    }
+}
+
+/// @brief Delete a file and free its blocks.
+///
+/// Must be called with metaLock and the lock of the file held for writing.
+/// \param [in] index FAT index of the file.
+void MyOnDiskFS::removeFile(int index) {
+    // Get number of block-list of file
+    uint32_t nrBlocks = fat[index].nrBlocks;
+
+    {
+        std::lock_guard<std::mutex> allocGuard(allocLock);
+        if (nrBlocks > 0) {
+            const uint32_t *blockList = getBlockMap(index);
+
+            // Set blocks as free in BLT
+            for (uint32_t i = 0; i < nrBlocks; i++) {
+                setBltEntry(blockList[i], BLT_FREE);
+            }
+            writeBlt();
         }
+        blockMaps[index].clear();
     }
-    return -ENOENT;
+
+    // Handles of the file must not reach a file created later in the same FAT entry
+    {
+        std::lock_guard<std::mutex> openFilesGuard(openFilesLock);
+        for (OpenFile *file: openFiles) {
+            if (file->index == index) {
+                file->index = -1;
+            }
+        }
+    }
+
+    // Create empty fatEntry
+    fatEntry empty = fatEntry();
+    for (char &i: empty.filename) { i = 0; }
+    empty.uid = getuid();
+    empty.groupId = getgid();
+    empty.mode = 0;
+    empty.accessTime = 0;
+    empty.modTime = 0;
+    empty.changeTime = 0;
+    empty.startBlock = 0;
+    empty.nrBlocks = 0;
+    empty.size = 0;
+
+    // Delete FAT Entry, ids of the file become invalid
+    fileIndex.erase(fat[index].filename);
+    freeFatEntries.push_back(index);
+    fatGeneration[index] = (fatGeneration[index] + 1) & 0x7fffffff;
+
+    std::lock_guard<std::mutex> fatGuard(fatLock);
+    fat[index] = empty;
+    markFatDirty(index);
+    writeFat();
 }
 
-int MyOnDiskFS::findFreeBlock(unsigned short &freeBlock) {
-    for (int i = 0; i < TOTAL_BLT_ENTRIES; i++) {
+/// @brief Rebuild the file name index and the list of free FAT entries from the fat array.
+void MyOnDiskFS::buildFileIndex() {
+    fileIndex.clear();
+    freeFatEntries.clear();
+
+    // Free entries are pushed in reverse order, so the lowest index is used first
+    for (int i = (int) layout.fatEntries - 1; i >= 0; i--) {
+        if (fat[i].filename[0] == 0) {
+            freeFatEntries.push_back(i);
+        } else {
+            fileIndex.insert(fat[i].filename, i);
+        }
+    }
+}
+
+/// @brief Allocate a run of consecutive free blocks.
+///
+/// If the goal block is free, the run starting there is used, so a file grows in place. Otherwise the first free run
+/// that holds all wanted blocks is chosen, or the largest free run if none is big enough. The search starts behind the
+/// last extent allocated this way and wraps around (next fit). Runs are measured only up to the number of blocks
+/// wanted, so the search stops at the first run that fits without walking it to its end.
+///
+/// If the goal block was taken by another file, the new extent starts in the middle of the free run rather than at its
+/// start, leaving room for the other file to grow as well. Two files growing alternately then share the free space in
+/// a few large extents instead of interleaving chunk by chunk. The blocks are not marked as used, the caller must do so
+/// with setBltEntry().
+/// \param goal [in] Preferred first block, e.g. the block after the last block of a file, 0 for none
+/// \param wanted [in] Number of blocks wanted
+/// \param start [out] First block of the run
+/// \param length [out] Number of blocks in the run, between 1 and wanted
+/// \return 0 on success, -ENOSPC if no block is free
+int MyOnDiskFS::allocateExtent(uint32_t goal, uint32_t wanted, uint32_t &start, uint32_t &length) {
+    if (freeBlockCount == 0 || wanted == 0) {
+        return -ENOSPC;
+    }
+
+    if (goal > 0 && goal < layout.totalBlocks && (freeBitmap[goal / 64] >> (goal % 64) & 1)) {
+        start = goal;
+        length = freeRunLength(goal, wanted);
+        return EXIT_SUCCESS;
+    }
+
+    uint32_t bestStart = 0, bestLength = 0;
+    uint64_t pos = allocCursor;
+    const uint64_t end = (uint64_t) allocCursor + layout.totalBlocks;
+    while (pos < end) {
+        // Skip to next free block, never past the end of the container within a word
+        uint32_t b = pos % layout.totalBlocks;
+        uint64_t bits = freeBitmap[b / 64] & (~(uint64_t) 0 << (b % 64));
+        if (bits == 0) {
+            pos += std::min<uint32_t>(64 - b % 64, layout.totalBlocks - b);
+            continue;
+        }
+        uint32_t skip = __builtin_ctzll(bits) - b % 64;
+        pos += skip;
+        b += skip;
+
+        uint32_t run = freeRunLength(b, wanted);
+        if (run > bestLength) {
+            bestStart = b;
+            bestLength = run;
+            if (run == wanted) {
+                break;
+            }
+        }
+        pos += run;
+    }
+
+    start = bestStart;
+    length = bestLength;
+    if (goal > 0 && length == wanted) {
+        uint32_t run = freeRunLength(start, layout.totalBlocks);
+        start += (run - wanted) / 2;
+    }
+    allocCursor = (start + length) % layout.totalBlocks;
+    return EXIT_SUCCESS;
+}
+
+/// @brief Count free blocks starting at a block, 64 blocks at a time.
+///
+/// \param start [in] First block
+/// \param max [in] Stop counting at max blocks
+/// \return Number of consecutive free blocks, at most max
+uint32_t MyOnDiskFS::freeRunLength(uint32_t start, uint32_t max) {
+    uint32_t length = 0;
+    while (length < max && (uint64_t) start + length < layout.totalBlocks) {
+        uint32_t b = start + length;
+        uint32_t remaining = 64 - b % 64;
+        uint64_t used = ~freeBitmap[b / 64] >> (b % 64);
+        uint32_t run = used == 0 ? remaining : std::min<uint32_t>(__builtin_ctzll(used), remaining);
+        length += run;
+        if (run < remaining) {
+            break;
+        }
+    }
+    return std::min(length, max);
+}
+
+/// @brief Rebuild the free block bitmap and counter from the BLT.
+void MyOnDiskFS::buildFreeBitmap() {
+    std::fill(freeBitmap.begin(), freeBitmap.end(), 0);
+    freeBlockCount = 0;
+    allocCursor = 0;
+
+    for (uint32_t i = 0; i < layout.totalBlocks; i++) {
         if (blt[i] == BLT_FREE) {
-            freeBlock = i;
-            return EXIT_SUCCESS;
+            freeBitmap[i / 64] |= (uint64_t) 1 << (i % 64);
+            freeBlockCount++;
         }
     }
-    return -ENOSPC;
 }
 
 
@@ -0,0 +1,62 @@
+//
+//  pagepool.cpp
+//  myfs
+//
+
+#include <cstdlib>
+#include <cstring>
+
+#include "pagepool.h"
+
+PagePool::PagePool() : used(0) {
+}
+
+PagePool::~PagePool() {
+    for (char *arena: arenas) {
+        free(arena);
+    }
+}
+
+char *PagePool::allocate() {
+    char *page;
+    {
+        std::lock_guard<std::mutex> guard(lock);
+
+        if (freePages.empty()) {
+            char *arena = (char *) malloc((size_t) MEM_PAGES_PER_ARENA * MEM_PAGE_SIZE);
+            if (arena == nullptr) {
+                return nullptr;
+            }
+            arenas.push_back(arena);
+
+            // Hand out the pages in address order
+            for (int i = MEM_PAGES_PER_ARENA - 1; i >= 0; i--) {
+                freePages.push_back(arena + (size_t) i * MEM_PAGE_SIZE);
+            }
+        }
+
+        page = freePages.back();
+        freePages.pop_back();
+        used++;
+    }
+
+    // Released pages may hold data of another file
+    memset(page, 0, MEM_PAGE_SIZE);
+    return page;
+}
+
+void PagePool::release(char *page) {
+    std::lock_guard<std::mutex> guard(lock);
+    freePages.push_back(page);
+    used--;
+}
+
+size_t PagePool::getUsed() {
+    std::lock_guard<std::mutex> guard(lock);
+    return used;
+}
+
+size_t PagePool::getFree() {
+    std::lock_guard<std::mutex> guard(lock);
+    return freePages.size();
+}
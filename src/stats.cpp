@@ -0,0 +1,194 @@
+//
+//  stats.cpp
+//  myfs
+//
+
+#include <cmath>
+#include <cstdio>
+
+#include "stats.h"
+
+static const char *OP_NAMES[OP_COUNT] = {
+        "getattr", "readlink", "mknod", "mkdir", "unlink", "rmdir", "symlink", "rename", "link", "chmod", "chown",
+        "truncate", "utime", "open", "read", "write", "read_buf", "write_buf", "statfs", "flush", "release", "fsync",
+        "setxattr", "getxattr", "listxattr", "removexattr", "opendir", "readdir", "releasedir", "fsyncdir",
+        "ftruncate", "create", "lookup", "forget", "setattr"
+};
+
+// Quantiles reported for each operation
+static const double QUANTILES[] = {0.5, 0.9, 0.99, 0.999};
+
+const int LatencyHistogram::SUB_BUCKET_BITS;
+const int LatencyHistogram::SUB_BUCKETS;
+const int LatencyHistogram::BUCKETS;
+
+LatencyHistogram::LatencyHistogram() : count(0), sum(0), max(0) {
+    for (auto &c: counts) {
+        c.store(0, std::memory_order_relaxed);
+    }
+}
+
+void LatencyHistogram::record(uint64_t ns) {
+    counts[bucketOf(ns)].fetch_add(1, std::memory_order_relaxed);
+    count.fetch_add(1, std::memory_order_relaxed);
+    sum.fetch_add(ns, std::memory_order_relaxed);
+
+    uint64_t oldMax = max.load(std::memory_order_relaxed);
+    while (ns > oldMax && !max.compare_exchange_weak(oldMax, ns, std::memory_order_relaxed)) {
+    }
+}
+
+uint64_t LatencyHistogram::getCount() const {
+    return count.load(std::memory_order_relaxed);
+}
+
+uint64_t LatencyHistogram::getSum() const {
+    return sum.load(std::memory_order_relaxed);
+}
+
+uint64_t LatencyHistogram::getMax() const {
+    return max.load(std::memory_order_relaxed);
+}
+
+uint64_t LatencyHistogram::getQuantile(double q) const {
+    // Bucket counts and total may be slightly out of sync while other threads record, the total is recomputed
+    uint64_t total = 0;
+    for (const auto &c: counts) {
+        total += c.load(std::memory_order_relaxed);
+    }
+    if (total == 0) {
+        return 0;
+    }
+
+    uint64_t target = (uint64_t) std::ceil(q * total);
+    target = target < 1 ? 1 : target;
+    uint64_t seen = 0;
+    for (int b = 0; b < BUCKETS; b++) {
+        seen += counts[b].load(std::memory_order_relaxed);
+        if (seen >= target) {
+            uint64_t bound = bucketUpperBound(b);
+            return bound < getMax() ? bound : getMax();
+        }
+    }
+    return getMax();
+}
+
+/// @brief Return the bucket of a value. Values below SUB_BUCKETS have a bucket of their own, larger values share a
+/// bucket with the values that agree in the highest SUB_BUCKET_BITS + 1 bits.
+int LatencyHistogram::bucketOf(uint64_t value) {
+    if (value < SUB_BUCKETS) {
+        return (int) value;
+    }
+    int magnitude = 63 - __builtin_clzll(value);
+    int shift = magnitude - SUB_BUCKET_BITS;
+    return (shift + 1) * SUB_BUCKETS + (int) ((value >> shift) - SUB_BUCKETS);
+}
+
+/// @brief Return the largest value that falls into a bucket.
+uint64_t LatencyHistogram::bucketUpperBound(int bucket) {
+    if (bucket < SUB_BUCKETS) {
+        return bucket;
+    }
+    int shift = bucket / SUB_BUCKETS - 1;
+    uint64_t lower = (uint64_t) (SUB_BUCKETS + bucket % SUB_BUCKETS) << shift;
+    return lower + ((uint64_t) 1 << shift) - 1;
+}
+
+OpStats::OpStats() {
+    for (int op = 0; op < OP_COUNT; op++) {
+        errors[op].store(0, std::memory_order_relaxed);
+        bytes[op].store(0, std::memory_order_relaxed);
+    }
+}
+
+void OpStats::record(int op, uint64_t ns, int ret, uint64_t bytes) {
+    latency[op].record(ns);
+    if (ret < 0) {
+        errors[op].fetch_add(1, std::memory_order_relaxed);
+    }
+    if (bytes > 0) {
+        this->bytes[op].fetch_add(bytes, std::memory_order_relaxed);
+    }
+}
+
+const LatencyHistogram &OpStats::getHistogram(int op) const {
+    return latency[op];
+}
+
+uint64_t OpStats::getErrors(int op) const {
+    return errors[op].load(std::memory_order_relaxed);
+}
+
+uint64_t OpStats::getBytes(int op) const {
+    return bytes[op].load(std::memory_order_relaxed);
+}
+
+const char *OpStats::opName(int op) {
+    return OP_NAMES[op];
+}
+
+void appendMetric(std::string &out, const char *name, const char *labels, uint64_t value) {
+    char line[256];
+    snprintf(line, sizeof(line), "%s%s%s%s %llu\n", name, *labels ? "{" : "", labels, *labels ? "}" : "",
+             (unsigned long long) value);
+    out += line;
+}
+
+void appendMetric(std::string &out, const char *name, const char *labels, double value) {
+    char line[256];
+    snprintf(line, sizeof(line), "%s%s%s%s %.9g\n", name, *labels ? "{" : "", labels, *labels ? "}" : "", value);
+    out += line;
+}
+
+/// Operations that were never called are left out.
+void OpStats::format(std::string &out) const {
+    char labels[64];
+
+    out += "# HELP myfs_ops_total Operations served.\n# TYPE myfs_ops_total counter\n";
+    for (int op = 0; op < OP_COUNT; op++) {
+        if (latency[op].getCount() > 0) {
+            snprintf(labels, sizeof(labels), "op=\"%s\"", OP_NAMES[op]);
+            appendMetric(out, "myfs_ops_total", labels, latency[op].getCount());
+        }
+    }
+
+    out += "# HELP myfs_op_errors_total Operations that returned an error.\n# TYPE myfs_op_errors_total counter\n";
+    for (int op = 0; op < OP_COUNT; op++) {
+        if (latency[op].getCount() > 0) {
+            snprintf(labels, sizeof(labels), "op=\"%s\"", OP_NAMES[op]);
+            appendMetric(out, "myfs_op_errors_total", labels, getErrors(op));
+        }
+    }
+
+    out += "# HELP myfs_op_bytes_total Bytes transferred.\n# TYPE myfs_op_bytes_total counter\n";
+    for (int op = 0; op < OP_COUNT; op++) {
+        if (getBytes(op) > 0) {
+            snprintf(labels, sizeof(labels), "op=\"%s\"", OP_NAMES[op]);
+            appendMetric(out, "myfs_op_bytes_total", labels, getBytes(op));
+        }
+    }
+
+    out += "# HELP myfs_op_latency_seconds Time to serve an operation.\n# TYPE myfs_op_latency_seconds summary\n";
+    for (int op = 0; op < OP_COUNT; op++) {
+        const LatencyHistogram &h = latency[op];
+        if (h.getCount() == 0) {
+            continue;
+        }
+        for (double q: QUANTILES) {
+            snprintf(labels, sizeof(labels), "op=\"%s\",quantile=\"%g\"", OP_NAMES[op], q);
+            appendMetric(out, "myfs_op_latency_seconds", labels, h.getQuantile(q) * 1e-9);
+        }
+        snprintf(labels, sizeof(labels), "op=\"%s\"", OP_NAMES[op]);
+        appendMetric(out, "myfs_op_latency_seconds_sum", labels, h.getSum() * 1e-9);
+        appendMetric(out, "myfs_op_latency_seconds_count", labels, h.getCount());
+    }
+
+    out += "# HELP myfs_op_latency_max_seconds Longest time to serve an operation.\n"
+           "# TYPE myfs_op_latency_max_seconds gauge\n";
+    for (int op = 0; op < OP_COUNT; op++) {
+        if (latency[op].getCount() > 0) {
+            snprintf(labels, sizeof(labels), "op=\"%s\"", OP_NAMES[op]);
+            appendMetric(out, "myfs_op_latency_max_seconds", labels, latency[op].getMax() * 1e-9);
+        }
+    }
+}
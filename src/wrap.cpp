@@ -15,6 +15,11 @@
 #include "myinmemoryfs.h"
 #include "myondiskfs.h"
 
+// Each wrapper counts the operation in MyFS::opStats and serves the statistics file, which is read-only.
+#define TIMED(op) MyFS *fs = MyFS::Instance(); OpTimer timer(fs->opStats, op)
+#define STATS_FILE_READ_ONLY(path) if (MyFS::isStatsFile(path)) { return timer.done(-EACCES); }
+#define STATS_FILE_EXISTS(path) if (MyFS::isStatsFile(path)) { return timer.done(-EEXIST); }
+
 void setInstance(int onDisk) {
     if(onDisk) {
         MyOnDiskFS::SetInstance();
@@ -24,108 +29,191 @@ void setInstance(int onDisk) {
 }
 
 int wrap_getattr(const char *path, struct stat *statbuf) {
-    return MyFS::Instance()->fuseGetattr(path, statbuf);
+    TIMED(OP_GETATTR);
+    if (MyFS::isStatsFile(path)) {
+        return timer.done(fs->statsGetattr(statbuf));
+    }
+    return timer.done(fs->fuseGetattr(path, statbuf));
 }
 
 int wrap_readlink(const char *path, char *link, size_t size) {
-    return MyFS::Instance()->fuseReadlink(path, link, size);
+    TIMED(OP_READLINK);
+    return timer.done(fs->fuseReadlink(path, link, size));
 }
 
 int wrap_mknod(const char *path, mode_t mode, dev_t dev) {
-    return MyFS::Instance()->fuseMknod(path, mode, dev);
+    TIMED(OP_MKNOD);
+    STATS_FILE_EXISTS(path);
+    return timer.done(fs->fuseMknod(path, mode, dev));
 }
 int wrap_mkdir(const char *path, mode_t mode) {
-    return MyFS::Instance()->fuseMkdir(path, mode);
+    TIMED(OP_MKDIR);
+    STATS_FILE_EXISTS(path);
+    return timer.done(fs->fuseMkdir(path, mode));
 }
 int wrap_unlink(const char *path) {
-    return MyFS::Instance()->fuseUnlink(path);
+    TIMED(OP_UNLINK);
+    STATS_FILE_READ_ONLY(path);
+    return timer.done(fs->fuseUnlink(path));
 }
 int wrap_rmdir(const char *path) {
-    return MyFS::Instance()->fuseRmdir(path);
+    TIMED(OP_RMDIR);
+    return timer.done(fs->fuseRmdir(path));
 }
 int wrap_symlink(const char *path, const char *link) {
-    return MyFS::Instance()->fuseSymlink(path, link);
+    TIMED(OP_SYMLINK);
+    STATS_FILE_EXISTS(link);
+    return timer.done(fs->fuseSymlink(path, link));
 }
 int wrap_rename(const char *path, const char *newpath) {
-    return MyFS::Instance()->fuseRename(path, newpath);
+    TIMED(OP_RENAME);
+    STATS_FILE_READ_ONLY(path);
+    STATS_FILE_READ_ONLY(newpath);
+    return timer.done(fs->fuseRename(path, newpath));
 }
 int wrap_link(const char *path, const char *newpath) {
-    return MyFS::Instance()->fuseLink(path, newpath);
+    TIMED(OP_LINK);
+    STATS_FILE_EXISTS(newpath);
+    return timer.done(fs->fuseLink(path, newpath));
 }
 int wrap_chmod(const char *path, mode_t mode) {
-    return MyFS::Instance()->fuseChmod(path, mode);
+    TIMED(OP_CHMOD);
+    STATS_FILE_READ_ONLY(path);
+    return timer.done(fs->fuseChmod(path, mode));
 }
 int wrap_chown(const char *path, uid_t uid, gid_t gid) {
-    return MyFS::Instance()->fuseChown(path, uid, gid);
+    TIMED(OP_CHOWN);
+    STATS_FILE_READ_ONLY(path);
+    return timer.done(fs->fuseChown(path, uid, gid));
 }
 int wrap_truncate(const char *path, off_t newSize) {
-    return MyFS::Instance()->fuseTruncate(path, newSize);
+    TIMED(OP_TRUNCATE);
+    STATS_FILE_READ_ONLY(path);
+    return timer.done(fs->fuseTruncate(path, newSize));
 }
 int wrap_utime(const char *path, struct utimbuf *ubuf) {
-    return MyFS::Instance()->fuseUtime(path, ubuf);
+    TIMED(OP_UTIME);
+    STATS_FILE_READ_ONLY(path);
+    return timer.done(fs->fuseUtime(path, ubuf));
 }
 int wrap_open(const char *path, struct fuse_file_info *fileInfo) {
-    return MyFS::Instance()->fuseOpen(path, fileInfo);
+    TIMED(OP_OPEN);
+    if (MyFS::isStatsFile(path)) {
+        return timer.done(fs->statsOpen(fileInfo));
+    }
+    return timer.done(fs->fuseOpen(path, fileInfo));
 }
 int wrap_read(const char *path, char *buf, size_t size, off_t offset, struct fuse_file_info *fileInfo) {
-    return MyFS::Instance()->fuseRead(path, buf, size, offset, fileInfo);
+    TIMED(OP_READ);
+    int ret = MyFS::isStatsFile(path) ? fs->statsRead(buf, size, offset, fileInfo)
+                                      : fs->fuseRead(path, buf, size, offset, fileInfo);
+    return timer.done(ret, ret > 0 ? ret : 0);
 }
 int wrap_write(const char *path, const char *buf, size_t size, off_t offset, struct fuse_file_info *fileInfo) {
-    return MyFS::Instance()->fuseWrite(path, buf, size, offset, fileInfo);
+    TIMED(OP_WRITE);
+    STATS_FILE_READ_ONLY(path);
+    int ret = fs->fuseWrite(path, buf, size, offset, fileInfo);
+    return timer.done(ret, ret > 0 ? ret : 0);
+}
+int wrap_read_buf(const char *path, struct fuse_bufvec **bufp, size_t size, off_t offset, struct fuse_file_info *fileInfo) {
+    TIMED(OP_READ_BUF);
+    int ret = MyFS::isStatsFile(path) ? fs->statsReadBuf(bufp, size, offset, fileInfo)
+                                      : fs->fuseReadBuf(path, bufp, size, offset, fileInfo);
+    return timer.done(ret, ret == 0 ? fuse_buf_size(*bufp) : 0);
+}
+int wrap_write_buf(const char *path, struct fuse_bufvec *buf, off_t offset, struct fuse_file_info *fileInfo) {
+    TIMED(OP_WRITE_BUF);
+    STATS_FILE_READ_ONLY(path);
+    int ret = fs->fuseWriteBuf(path, buf, offset, fileInfo);
+    return timer.done(ret, ret > 0 ? ret : 0);
 }
 int wrap_statfs(const char *path, struct statvfs *statInfo) {
-    return MyFS::Instance()->fuseStatfs(path, statInfo);
+    TIMED(OP_STATFS);
+    return timer.done(fs->fuseStatfs(path, statInfo));
 }
 int wrap_flush(const char *path, struct fuse_file_info *fileInfo) {
-    return MyFS::Instance()->fuseFlush(path, fileInfo);
+    TIMED(OP_FLUSH);
+    if (MyFS::isStatsFile(path)) {
+        return timer.done(0);
+    }
+    return timer.done(fs->fuseFlush(path, fileInfo));
 }
 int wrap_release(const char *path, struct fuse_file_info *fileInfo) {
-    return MyFS::Instance()->fuseRelease(path, fileInfo);
+    TIMED(OP_RELEASE);
+    if (MyFS::isStatsFile(path)) {
+        return timer.done(fs->statsRelease(fileInfo));
+    }
+    return timer.done(fs->fuseRelease(path, fileInfo));
 }
 int wrap_fsync(const char *path, int datasync, struct fuse_file_info *fi) {
-    return MyFS::Instance()->fuseFsync(path, datasync, fi);
+    TIMED(OP_FSYNC);
+    if (MyFS::isStatsFile(path)) {
+        return timer.done(0);
+    }
+    return timer.done(fs->fuseFsync(path, datasync, fi));
 }
 #ifdef __APPLE__
 int wrap_setxattr(const char *path, const char *name, const char *value, size_t size, int flags, uint32_t x) {
-    return MyFS::Instance()->fuseSetxattr(path, name, value, size, flags, x);
+    TIMED(OP_SETXATTR);
+    STATS_FILE_READ_ONLY(path);
+    return timer.done(fs->fuseSetxattr(path, name, value, size, flags, x));
 }
 int wrap_getxattr(const char *path, const char *name, char *value, size_t size, uint x) {
-    return MyFS::Instance()->fuseGetxattr(path, name, value, size, x);
+    TIMED(OP_GETXATTR);
+    return timer.done(fs->fuseGetxattr(path, name, value, size, x));
 }
 #else
 int wrap_setxattr(const char *path, const char *name, const char *value, size_t size, int flags) {
-    return MyFS::Instance()->fuseSetxattr(path, name, value, size, flags);
+    TIMED(OP_SETXATTR);
+    STATS_FILE_READ_ONLY(path);
+    return timer.done(fs->fuseSetxattr(path, name, value, size, flags));
 }
 int wrap_getxattr(const char *path, const char *name, char *value, size_t size) {
-    return MyFS::Instance()->fuseGetxattr(path, name, value, size);
+    TIMED(OP_GETXATTR);
+    return timer.done(fs->fuseGetxattr(path, name, value, size));
 }
 #endif
 void* wrap_init(struct fuse_conn_info *conn) {
     return MyFS::Instance()->fuseInit(conn);
 }
 int wrap_listxattr(const char *path, char *list, size_t size) {
-    return MyFS::Instance()->fuseListxattr(path, list, size);
+    TIMED(OP_LISTXATTR);
+    return timer.done(fs->fuseListxattr(path, list, size));
 }
 int wrap_removexattr(const char *path, const char *name) {
-    return MyFS::Instance()->fuseRemovexattr(path, name);
+    TIMED(OP_REMOVEXATTR);
+    STATS_FILE_READ_ONLY(path);
+    return timer.done(fs->fuseRemovexattr(path, name));
 }
 int wrap_opendir(const char *path, struct fuse_file_info *fileInfo) {
-    return MyFS::Instance()->fuseOpendir(path, fileInfo);
+    TIMED(OP_OPENDIR);
+    return timer.done(fs->fuseOpendir(path, fileInfo));
 }
 int wrap_readdir(const char *path, void *buf, fuse_fill_dir_t filler, off_t offset, struct fuse_file_info *fileInfo) {
-    return MyFS::Instance()->fuseReaddir(path, buf, filler, offset, fileInfo);
+    TIMED(OP_READDIR);
+    int ret = fs->fuseReaddir(path, buf, filler, offset, fileInfo);
+    if (ret >= 0 && strcmp(path, "/") == 0) {
+        filler(buf, STATS_FILE_NAME, NULL, 0);
+    }
+    return timer.done(ret);
 }
 int wrap_releasedir(const char *path, struct fuse_file_info *fileInfo) {
-    return MyFS::Instance()->fuseReleasedir(path, fileInfo);
+    TIMED(OP_RELEASEDIR);
+    return timer.done(fs->fuseReleasedir(path, fileInfo));
 }
 int wrap_fsyncdir(const char *path, int datasync, struct fuse_file_info *fileInfo) {
-    return MyFS::Instance()->fuseFsyncdir(path, datasync, fileInfo);
+    TIMED(OP_FSYNCDIR);
+    return timer.done(fs->fuseFsyncdir(path, datasync, fileInfo));
 }
 int wrap_ftruncate(const char *path, off_t offset, struct fuse_file_info *fileInfo) {
-    return MyFS::Instance()->fuseTruncate(path, offset, fileInfo);
+    TIMED(OP_FTRUNCATE);
+    STATS_FILE_READ_ONLY(path);
+    return timer.done(fs->fuseTruncate(path, offset, fileInfo));
 }
 int wrap_create(const char *path, mode_t mode, struct fuse_file_info *fi) {
-    return MyFS::Instance()->fuseCreate(path, mode, fi);
+    TIMED(OP_CREATE);
+    STATS_FILE_EXISTS(path);
+    return timer.done(fs->fuseCreate(path, mode, fi));
 }
 void wrap_destroy(void *userdata) {
     MyFS::Instance()->fuseDestroy();
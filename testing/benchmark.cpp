@@ -0,0 +1,371 @@
+//
+//  benchmark.cpp
+//  testing
+//
+//  In-process benchmarks of the file system operations without FUSE and the kernel in between. Results are printed
+//  as JSON, one object per workload and request size, to be compared between revisions.
+//
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <string>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "myfs-info.h"
+#include "myinmemoryfs.h"
+#include "myondiskfs.h"
+#include "stats.h"
+
+#define DEFAULT_CONTAINER "/tmp/benchmark.bin"
+#define DEFAULT_FILE_SIZE "8M"
+#define DEFAULT_REQUEST_SIZES "4K,64K,1M"
+#define DEFAULT_BLOCK_SIZES "512"
+#define DEFAULT_WORKLOADS "seqwrite,seqread,randwrite,randread,create,stat"
+#define DEFAULT_META_OPS 10000
+
+#define FILENAME "/bench"
+
+// Number of different names used by the create workload, well below the number of directory entries
+#define CREATE_NAMES 32
+
+struct BenchConfig {
+    std::vector<std::string> fsTypes;
+    std::vector<std::string> workloads;
+    std::vector<size_t> requestSizes;
+    std::vector<std::string> blockSizes;   // block sizes of new containers, one run of the ondisk file system each
+    size_t fileSize;
+    int metaOps;
+    MyFsInfo info;
+};
+
+struct BenchResult {
+    std::string fsType;
+    std::string workload;
+    size_t blockSize;       // 0 for the in-memory file system
+    size_t requestSize;     // 0 for workloads without data transfer
+    uint64_t ops;
+    uint64_t bytes;
+    double seconds;
+    LatencyHistogram latency;
+};
+
+/// @brief Measures the time of single operations and of the whole workload.
+class BenchClock {
+public:
+    BenchClock(BenchResult &result) : result(result), begin(std::chrono::steady_clock::now()) {
+    }
+
+    /// @brief Record an operation started at start, abort on errors.
+    void record(std::chrono::steady_clock::time_point start, int ret, const char *what) {
+        std::chrono::nanoseconds elapsed = std::chrono::steady_clock::now() - start;
+        if (ret < 0) {
+            fprintf(stderr, "%s %s failed: %s\n", result.workload.c_str(), what, strerror(-ret));
+            exit(EXIT_FAILURE);
+        }
+        result.latency.record(elapsed.count());
+        result.ops++;
+        result.bytes += ret;
+    }
+
+    void finish() {
+        std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - begin;
+        result.seconds = elapsed.count();
+    }
+
+private:
+    BenchResult &result;
+    std::chrono::steady_clock::time_point begin;
+};
+
+static std::vector<std::string> splitList(const char *list) {
+    std::vector<std::string> items;
+    std::string item;
+    for (const char *c = list; ; c++) {
+        if (*c == ',' || *c == '\0') {
+            if (!item.empty()) {
+                items.push_back(item);
+            }
+            item.clear();
+            if (*c == '\0') {
+                break;
+            }
+        } else {
+            item += *c;
+        }
+    }
+    return items;
+}
+
+static void check(int ret, const char *what) {
+    if (ret < 0) {
+        fprintf(stderr, "%s failed: %s\n", what, strerror(-ret));
+        exit(EXIT_FAILURE);
+    }
+}
+
+/// @brief Create the benchmark file with the given size, unless it already exists with that size.
+static void prepareFile(MyFS *fs, size_t fileSize, std::vector<char> &buf) {
+    struct stat st;
+    if (fs->fuseGetattr(FILENAME, &st) == 0 && (size_t) st.st_size == fileSize) {
+        return;
+    }
+    fs->fuseUnlink(FILENAME);
+    check(fs->fuseMknod(FILENAME, S_IFREG | 0644, 0), "mknod");
+
+    struct fuse_file_info fi;
+    memset(&fi, 0, sizeof(fi));
+    fi.flags = O_WRONLY;
+    check(fs->fuseOpen(FILENAME, &fi), "open");
+    for (size_t off = 0; off < fileSize; off += buf.size()) {
+        size_t size = std::min(buf.size(), fileSize - off);
+        check(fs->fuseWrite(FILENAME, buf.data(), size, off, &fi), "write");
+    }
+    check(fs->fuseRelease(FILENAME, &fi), "release");
+}
+
+/// @brief Read or write the whole benchmark file with requests of the given size, in order or at random aligned
+/// offsets. The file is opened and released within the measured time, so write-back flushes are included.
+static void runTransfer(MyFS *fs, const BenchConfig &config, BenchResult &result, bool write, bool random,
+                        std::vector<char> &buf) {
+    size_t size = result.requestSize;
+    size_t nrRequests = config.fileSize / size;
+    std::vector<off_t> offsets(nrRequests);
+    for (size_t i = 0; i < nrRequests; i++) {
+        offsets[i] = (off_t) (i * size);
+    }
+    if (random) {
+        std::mt19937_64 rng(42);
+        std::shuffle(offsets.begin(), offsets.end(), rng);
+    }
+
+    if (write && !random) {
+        fs->fuseUnlink(FILENAME);
+        check(fs->fuseMknod(FILENAME, S_IFREG | 0644, 0), "mknod");
+    } else {
+        prepareFile(fs, config.fileSize, buf);
+    }
+
+    struct fuse_file_info fi;
+    memset(&fi, 0, sizeof(fi));
+    fi.flags = write ? O_WRONLY : O_RDONLY;
+
+    BenchClock clock(result);
+    check(fs->fuseOpen(FILENAME, &fi), "open");
+    for (off_t offset: offsets) {
+        auto start = std::chrono::steady_clock::now();
+        if (write) {
+            clock.record(start, fs->fuseWrite(FILENAME, buf.data(), size, offset, &fi), "write");
+        } else {
+            clock.record(start, fs->fuseRead(FILENAME, buf.data(), size, offset, &fi), "read");
+        }
+    }
+    check(fs->fuseRelease(FILENAME, &fi), "release");
+    clock.finish();
+}
+
+/// @brief Create and immediately delete files, each create and each unlink counts as one operation.
+static void runCreate(MyFS *fs, const BenchConfig &config, BenchResult &result) {
+    char name[32];
+    BenchClock clock(result);
+    for (int i = 0; i < config.metaOps; i++) {
+        snprintf(name, sizeof(name), "/create%d", i % CREATE_NAMES);
+        auto start = std::chrono::steady_clock::now();
+        clock.record(start, fs->fuseMknod(name, S_IFREG | 0644, 0), "mknod");
+        start = std::chrono::steady_clock::now();
+        clock.record(start, fs->fuseUnlink(name), "unlink");
+    }
+    clock.finish();
+    // Creates and unlinks transfer no data
+    result.bytes = 0;
+}
+
+/// @brief Get the attributes of the benchmark file.
+static void runStat(MyFS *fs, const BenchConfig &config, BenchResult &result, std::vector<char> &buf) {
+    prepareFile(fs, config.fileSize, buf);
+
+    struct stat st;
+    BenchClock clock(result);
+    for (int i = 0; i < config.metaOps; i++) {
+        auto start = std::chrono::steady_clock::now();
+        clock.record(start, fs->fuseGetattr(FILENAME, &st), "getattr");
+    }
+    clock.finish();
+    result.bytes = 0;
+}
+
+static void printResult(const BenchResult &result, bool last) {
+    double seconds = result.seconds > 0 ? result.seconds : 1e-9;
+    printf("  {\"fs\": \"%s\", \"workload\": \"%s\", \"block_size\": %zu, \"request_size\": %zu, \"ops\": %llu, "
+           "\"seconds\": %.6f, \"ops_per_s\": %.1f, \"mb_per_s\": %.2f, \"p50_us\": %.3f, \"p99_us\": %.3f, "
+           "\"max_us\": %.3f}%s\n",
+           result.fsType.c_str(), result.workload.c_str(), result.blockSize, result.requestSize,
+           (unsigned long long) result.ops,
+           result.seconds, result.ops / seconds, result.bytes / seconds / (1024 * 1024),
+           result.latency.getQuantile(0.5) * 1e-3, result.latency.getQuantile(0.99) * 1e-3,
+           result.latency.getMax() * 1e-3, last ? "" : ",");
+}
+
+static void runFileSystem(const std::string &fsType, size_t blockSize, BenchConfig &config,
+                          std::vector<BenchResult *> &results) {
+    MyFS *fs;
+    if (fsType == "ondisk") {
+        remove(config.info.contFile);
+        fs = new MyOnDiskFS();
+    } else {
+        fs = new MyInMemoryFS();
+    }
+    check(fs->setup(&config.info), "setup");
+
+    size_t maxRequest = 0;
+    for (size_t size: config.requestSizes) {
+        maxRequest = std::max(maxRequest, size);
+    }
+    std::vector<char> buf(maxRequest);
+    for (size_t i = 0; i < buf.size(); i++) {
+        buf[i] = (char) ('a' + i % 26);
+    }
+
+    for (const std::string &workload: config.workloads) {
+        bool transfer = workload == "seqwrite" || workload == "seqread" || workload == "randwrite" ||
+                workload == "randread";
+        std::vector<size_t> sizes = transfer ? config.requestSizes : std::vector<size_t>(1, 0);
+
+        for (size_t size: sizes) {
+            BenchResult *result = new BenchResult();
+            result->fsType = fsType;
+            result->workload = workload;
+            result->blockSize = blockSize;
+            result->requestSize = size;
+            result->ops = 0;
+            result->bytes = 0;
+            result->seconds = 0;
+
+            if (transfer) {
+                runTransfer(fs, config, *result, workload.find("write") != std::string::npos,
+                            workload.compare(0, 4, "rand") == 0, buf);
+            } else if (workload == "create") {
+                runCreate(fs, config, *result);
+            } else if (workload == "stat") {
+                runStat(fs, config, *result, buf);
+            } else {
+                fprintf(stderr, "Unknown workload %s\n", workload.c_str());
+                exit(EXIT_FAILURE);
+            }
+            results.push_back(result);
+        }
+    }
+
+    fs->fuseDestroy();
+    delete fs;
+    if (fsType == "ondisk") {
+        remove(config.info.contFile);
+    }
+}
+
+static void usage(const char *name) {
+    fprintf(stderr, "Usage: %s [options]\n"
+                    "  -f <fs,...>        file systems: ondisk, inmemory (default both)\n"
+                    "  -w <workload,...>  %s\n"
+                    "  -r <size,...>      request sizes of the transfer workloads (default %s)\n"
+                    "  -s <size>          size of the benchmark file (default %s)\n"
+                    "  -B <size,...>      block sizes of the ondisk container (default %s)\n"
+                    "  -n <count>         operations of the create and stat workloads (default %d)\n"
+                    "  -c <file>          container file (default %s)\n"
+                    "  -e <engine>        I/O engine: sync, uring, threads, auto, mmap\n"
+                    "  -C <size>          block cache size\n"
+                    "  -b                 write-back block cache\n"
+                    "  -l <file>          log file (default no logging)\n",
+            name, DEFAULT_WORKLOADS, DEFAULT_REQUEST_SIZES, DEFAULT_FILE_SIZE, DEFAULT_BLOCK_SIZES, DEFAULT_META_OPS,
+            DEFAULT_CONTAINER);
+    exit(EXIT_FAILURE);
+}
+
+static long long parseSizeOption(const char *str, const char *name) {
+    long long size = MyFS::parseSize(str);
+    if (size <= 0) {
+        fprintf(stderr, "Invalid %s %s\n", name, str);
+        exit(EXIT_FAILURE);
+    }
+    return size;
+}
+
+int main(int argc, char *argv[]) {
+    BenchConfig config;
+    memset(&config.info, 0, sizeof(config.info));
+    config.info.contFile = (char *) DEFAULT_CONTAINER;
+    config.info.logFile = (char *) "/dev/null";
+    config.info.logLevel = (char *) "none";
+    config.fsTypes = splitList("ondisk,inmemory");
+    config.workloads = splitList(DEFAULT_WORKLOADS);
+    config.blockSizes = splitList(DEFAULT_BLOCK_SIZES);
+    config.fileSize = parseSizeOption(DEFAULT_FILE_SIZE, "file size");
+    config.metaOps = DEFAULT_META_OPS;
+    const char *requestSizes = DEFAULT_REQUEST_SIZES;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "f:w:r:s:B:n:c:e:C:bl:h")) != -1) {
+        switch (opt) {
+            case 'f': config.fsTypes = splitList(optarg); break;
+            case 'w': config.workloads = splitList(optarg); break;
+            case 'r': requestSizes = optarg; break;
+            case 's': config.fileSize = parseSizeOption(optarg, "file size"); break;
+            case 'B': config.blockSizes = splitList(optarg); break;
+            case 'n': config.metaOps = atoi(optarg); break;
+            case 'c': config.info.contFile = optarg; break;
+            case 'e': config.info.ioEngine = optarg; break;
+            case 'C': config.info.cacheSize = optarg; break;
+            case 'b': config.info.writeBack = 1; break;
+            case 'l': config.info.logFile = optarg; config.info.logLevel = (char *) "debug"; break;
+            default: usage(argv[0]);
+        }
+    }
+    for (const std::string &size: splitList(requestSizes)) {
+        config.requestSizes.push_back(parseSizeOption(size.c_str(), "request size"));
+        if (config.requestSizes.back() > config.fileSize) {
+            fprintf(stderr, "Request size %s is larger than the file\n", size.c_str());
+            exit(EXIT_FAILURE);
+        }
+    }
+    for (const std::string &fsType: config.fsTypes) {
+        if (fsType != "ondisk" && fsType != "inmemory") {
+            fprintf(stderr, "Unknown file system %s\n", fsType.c_str());
+            usage(argv[0]);
+        }
+    }
+    for (const std::string &blockSize: config.blockSizes) {
+        long long size = parseSizeOption(blockSize.c_str(), "block size");
+        if (size < MIN_BLOCK_SIZE || size > MAX_BLOCK_SIZE || (size & (size - 1)) != 0) {
+            fprintf(stderr, "Invalid block size %s\n", blockSize.c_str());
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    std::vector<BenchResult *> results;
+    for (const std::string &fsType: config.fsTypes) {
+        if (fsType != "ondisk") {
+            runFileSystem(fsType, 0, config, results);
+            continue;
+        }
+        for (const std::string &blockSize: config.blockSizes) {
+            config.info.blockSize = (char *) blockSize.c_str();
+            runFileSystem(fsType, parseSizeOption(blockSize.c_str(), "block size"), config, results);
+        }
+    }
+
+    printf("[\n");
+    for (size_t i = 0; i < results.size(); i++) {
+        printResult(*results[i], i + 1 == results.size());
+        delete results[i];
+    }
+    printf("]\n");
+
+    return EXIT_SUCCESS;
+}
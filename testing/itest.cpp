@@ -3,6 +3,7 @@
 // Copyright © 2017-2020 Oliver Waldhorst. All rights reserved.
 //
 
+#include <chrono>
 #include <cstdio>
 #include <unistd.h>
 #include <fcntl.h>
@@ -490,6 +491,57 @@ TEST_CASE("T-1.10", "[Part_1]") {
     REQUIRE(unlink(FILENAME) >= 0);
 }
 
+// Throughput of the T-1.10 workload with different request sizes and of repeated stat calls. Hidden by default, run it
+// explicitly with "integrationtests [benchmark]" inside mounts with different options (e.g. with and without
+// -o maxwrite=4K, -o kernelcache) to compare them.
+TEST_CASE("B-1.10", "[.][benchmark]") {
+    printf("Benchmark 1.10: Throughput for a very large file\n");
+
+    const size_t chunkSizes[] = {4096, 128 * 1024, LARGE_SIZE};
+
+    char *r = new char[LARGE_SIZE];
+    char *w = new char[LARGE_SIZE];
+    gen_random(w, LARGE_SIZE);
+
+    for (size_t chunkSize: chunkSizes) {
+        unlink(FILENAME);
+
+        int fd = open(FILENAME, O_EXCL | O_RDWR | O_CREAT, 0666);
+        REQUIRE(fd >= 0);
+        auto start = std::chrono::steady_clock::now();
+        for (size_t off = 0; off < LARGE_SIZE; off += chunkSize) {
+            REQUIRE(write(fd, w + off, chunkSize) == (ssize_t) chunkSize);
+        }
+        REQUIRE(close(fd) >= 0);
+        std::chrono::duration<double> writeTime = std::chrono::steady_clock::now() - start;
+
+        fd = open(FILENAME, O_RDONLY);
+        REQUIRE(fd >= 0);
+        start = std::chrono::steady_clock::now();
+        for (size_t off = 0; off < LARGE_SIZE; off += chunkSize) {
+            REQUIRE(read(fd, r + off, chunkSize) == (ssize_t) chunkSize);
+        }
+        REQUIRE(close(fd) >= 0);
+        std::chrono::duration<double> readTime = std::chrono::steady_clock::now() - start;
+        REQUIRE(memcmp(r, w, LARGE_SIZE) == 0);
+
+        printf("  %8zu byte requests: write %7.1f MB/s, read %7.1f MB/s\n", chunkSize,
+               LARGE_SIZE / writeTime.count() / (1024 * 1024), LARGE_SIZE / readTime.count() / (1024 * 1024));
+    }
+
+    struct stat st;
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < 10000; i++) {
+        REQUIRE(stat(FILENAME, &st) == 0);
+    }
+    std::chrono::duration<double> statTime = std::chrono::steady_clock::now() - start;
+    printf("  stat: %.1f us per call\n", statTime.count() * 1e6 / 10000);
+
+    REQUIRE(unlink(FILENAME) >= 0);
+    delete[] r;
+    delete[] w;
+}
+
 
 /* =============================================================
  * =================== Test cases for Part 2 ===================
@@ -0,0 +1,191 @@
+//
+//  utest-blockcache.cpp
+//  testing
+//
+
+#include "../catch/catch.hpp"
+
+#include <stdio.h>
+#include <string.h>
+
+#include "tools.hpp"
+
+#include "blockdevice.h"
+#include "blockcache.h"
+
+#define BC_PATH "/tmp/bc.bin"
+#define NUM_TESTBLOCKS 256
+#define BLOCK_SIZE 512
+
+TEST_CASE( "BC_READ_WRITE", "[blockcache]" ) {
+
+    remove(BC_PATH);
+
+    BlockDevice bd(BLOCK_SIZE);
+    REQUIRE(bd.create(BC_PATH) == 0);
+
+    char* w= new char[BLOCK_SIZE * NUM_TESTBLOCKS];
+    gen_random(w, BLOCK_SIZE * NUM_TESTBLOCKS);
+    char* r= new char[BLOCK_SIZE * NUM_TESTBLOCKS];
+    memset(r, 0, BLOCK_SIZE * NUM_TESTBLOCKS);
+
+    SECTION("cached blocks are served from memory") {
+        BlockCache bc(&bd, BLOCK_SIZE, NUM_TESTBLOCKS);
+
+        REQUIRE(bd.writeBlocks(0, NUM_TESTBLOCKS, w) == 0);
+
+        REQUIRE(bc.readBlocks(0, NUM_TESTBLOCKS, r) == 0);
+        REQUIRE(memcmp(w, r, BLOCK_SIZE * NUM_TESTBLOCKS) == 0);
+        REQUIRE(bc.getStats().misses == NUM_TESTBLOCKS);
+        REQUIRE(bc.getStats().hits == 0);
+
+        memset(r, 0, BLOCK_SIZE * NUM_TESTBLOCKS);
+        REQUIRE(bc.readBlocks(0, NUM_TESTBLOCKS, r) == 0);
+        REQUIRE(memcmp(w, r, BLOCK_SIZE * NUM_TESTBLOCKS) == 0);
+        REQUIRE(bc.getStats().hits == NUM_TESTBLOCKS);
+        REQUIRE(bc.getStats().evictions == 0);
+    }
+
+    SECTION("writes go to device and cache") {
+        BlockCache bc(&bd, BLOCK_SIZE, NUM_TESTBLOCKS / 2);
+
+        REQUIRE(bc.writeBlocks(0, NUM_TESTBLOCKS, w) == 0);
+        REQUIRE(bc.getStats().evictions == NUM_TESTBLOCKS / 2);
+
+        REQUIRE(bd.readBlocks(0, NUM_TESTBLOCKS, r) == 0);
+        REQUIRE(memcmp(w, r, BLOCK_SIZE * NUM_TESTBLOCKS) == 0);
+
+        memset(r, 0, BLOCK_SIZE * NUM_TESTBLOCKS);
+        for(int b= NUM_TESTBLOCKS - 1; b >= 0; b--) {
+            REQUIRE(bc.read(b, r + b * BLOCK_SIZE) == 0);
+        }
+        REQUIRE(memcmp(w, r, BLOCK_SIZE * NUM_TESTBLOCKS) == 0);
+        REQUIRE(bc.getStats().hits == NUM_TESTBLOCKS / 2);
+    }
+
+    SECTION("frequently used blocks survive a scan") {
+        BlockCache bc(&bd, BLOCK_SIZE, 16);
+
+        REQUIRE(bd.writeBlocks(0, NUM_TESTBLOCKS, w) == 0);
+
+        // access blocks 0-3 twice, so they become protected
+        for(int i= 0; i < 2; i++) {
+            REQUIRE(bc.readBlocks(0, 4, r) == 0);
+        }
+
+        // scan over all other blocks
+        REQUIRE(bc.readBlocks(4, NUM_TESTBLOCKS - 4, r) == 0);
+
+        uint64_t hits= bc.getStats().hits;
+        REQUIRE(bc.readBlocks(0, 4, r) == 0);
+        REQUIRE(bc.getStats().hits == hits + 4);
+        REQUIRE(memcmp(w, r, BLOCK_SIZE * 4) == 0);
+    }
+
+    SECTION("prefetched blocks are served from memory, but do not count as used") {
+        BlockCache bc(&bd, BLOCK_SIZE, 16);
+
+        REQUIRE(bd.writeBlocks(0, NUM_TESTBLOCKS, w) == 0);
+
+        // access blocks 0-3 twice, so they become protected
+        for(int i= 0; i < 2; i++) {
+            REQUIRE(bc.readBlocks(0, 4, r) == 0);
+        }
+
+        uint32_t blockNos[8]= {4, 5, 6, 7, 0, 1, 2, 3};
+        REQUIRE(bc.prefetch(8, blockNos) == 0);
+        REQUIRE(bc.getStats().prefetched == 4);
+
+        uint64_t misses= bc.getStats().misses;
+        REQUIRE(bc.readBlocks(4, 4, r) == 0);
+        REQUIRE(memcmp(w + 4 * BLOCK_SIZE, r, BLOCK_SIZE * 4) == 0);
+        REQUIRE(bc.getStats().misses == misses);
+        REQUIRE(bc.getStats().prefetchHits == 4);
+
+        // a prefetched scan read once does not displace the protected blocks
+        for(uint32_t b= 8; b < NUM_TESTBLOCKS; b += 8) {
+            for(uint32_t i= 0; i < 8; i++) {
+                blockNos[i]= b + i;
+            }
+            REQUIRE(bc.prefetch(8, blockNos) == 0);
+            REQUIRE(bc.readBlocks(b, 8, r) == 0);
+        }
+
+        uint64_t hits= bc.getStats().hits;
+        REQUIRE(bc.readBlocks(0, 4, r) == 0);
+        REQUIRE(bc.getStats().hits == hits + 4);
+        REQUIRE(memcmp(w, r, BLOCK_SIZE * 4) == 0);
+    }
+
+    SECTION("write-back buffers blocks until flush") {
+        BlockCache bc(&bd, BLOCK_SIZE, 64);
+        bc.enableWriteBack(16 * BLOCK_SIZE, 60000);
+
+        REQUIRE(bc.writeBlocks(0, 4, w) == 0);
+
+        // device still empty, cache returns new data
+        REQUIRE(bd.readBlocks(0, 4, r) == 0);
+        for(int i= 0; i < 4 * BLOCK_SIZE; i++) {
+            REQUIRE(r[i] == 0);
+        }
+        REQUIRE(bc.readBlocks(0, 4, r) == 0);
+        REQUIRE(memcmp(w, r, BLOCK_SIZE * 4) == 0);
+        REQUIRE(bc.getStats().flushedBlocks == 0);
+
+        REQUIRE(bc.flush() == 0);
+        REQUIRE(bc.getStats().flushedBlocks == 4);
+        REQUIRE(bd.readBlocks(0, 4, r) == 0);
+        REQUIRE(memcmp(w, r, BLOCK_SIZE * 4) == 0);
+    }
+
+    SECTION("write-back respects the dirty limit") {
+        BlockCache bc(&bd, BLOCK_SIZE, 32);
+        bc.enableWriteBack(8 * BLOCK_SIZE, 60000);
+
+        for(int b= 0; b < NUM_TESTBLOCKS; b++) {
+            REQUIRE(bc.write(b, w + b * BLOCK_SIZE) == 0);
+        }
+        REQUIRE(bc.getStats().flushedBlocks >= NUM_TESTBLOCKS - 8);
+
+        REQUIRE(bc.readBlocks(0, NUM_TESTBLOCKS, r) == 0);
+        REQUIRE(memcmp(w, r, BLOCK_SIZE * NUM_TESTBLOCKS) == 0);
+
+        REQUIRE(bc.flush() == 0);
+        memset(r, 0, BLOCK_SIZE * NUM_TESTBLOCKS);
+        REQUIRE(bd.readBlocks(0, NUM_TESTBLOCKS, r) == 0);
+        REQUIRE(memcmp(w, r, BLOCK_SIZE * NUM_TESTBLOCKS) == 0);
+    }
+
+    SECTION("write-back writes blocks through when all cached blocks are dirty") {
+        BlockCache bc(&bd, BLOCK_SIZE, 8);
+        bc.enableWriteBack(4 * BLOCK_SIZE, 60000);
+
+        // one call dirties more blocks than the cache holds
+        REQUIRE(bc.writeBlocks(0, 16, w) == 0);
+        REQUIRE(bd.readBlocks(8, 8, r) == 0);
+        REQUIRE(memcmp(w + 8 * BLOCK_SIZE, r, BLOCK_SIZE * 8) == 0);
+
+        REQUIRE(bc.readBlocks(0, 16, r) == 0);
+        REQUIRE(memcmp(w, r, BLOCK_SIZE * 16) == 0);
+
+        REQUIRE(bc.flush() == 0);
+        memset(r, 0, BLOCK_SIZE * 16);
+        REQUIRE(bd.readBlocks(0, 16, r) == 0);
+        REQUIRE(memcmp(w, r, BLOCK_SIZE * 16) == 0);
+    }
+
+    SECTION("disabled cache") {
+        BlockCache bc(&bd, BLOCK_SIZE, 0);
+
+        REQUIRE(bc.writeBlocks(0, NUM_TESTBLOCKS, w) == 0);
+        REQUIRE(bc.readBlocks(0, NUM_TESTBLOCKS, r) == 0);
+        REQUIRE(memcmp(w, r, BLOCK_SIZE * NUM_TESTBLOCKS) == 0);
+        REQUIRE(bc.getStats().hits == 0);
+    }
+
+    delete [] r;
+    delete [] w;
+
+    REQUIRE(bd.close() == 0);
+    remove(BC_PATH);
+}
@@ -10,10 +10,13 @@
 
 #include <stdio.h>
 #include <string.h>
+#include <unistd.h>
 
 #include "tools.hpp"
 
 #include "blockdevice.h"
+#include "asyncblockdevice.h"
+#include "mappedblockdevice.h"
 
 #define BD_PATH "/tmp/bd.bin"
 #define NUM_TESTBLOCKS 1024
@@ -21,6 +24,8 @@
 
 // Declarations of helper functions
 void bdWriteRead(BlockDevice *bd, int noBlocks= 1);
+void bdWriteReadRun(BlockDevice *bd, int noBlocks);
+void bdWriteReadVec(BlockDevice *bd, int noBlocks);
 
 TEST_CASE( "BD_CREATE_WRITE_READ_NEW_FILE", "[blockdevice]" ) {
     
@@ -82,6 +87,133 @@ TEST_CASE( "BD_OPEN_NON-EXISTING_FILE", "[blockdevice]" ) {
     REQUIRE(bd.open(BD_PATH) < 0);
 }
 
+TEST_CASE( "BD_MULTI_BLOCK_WRITE_READ", "[blockdevice]" ) {
+
+    remove(BD_PATH);
+
+    BlockDevice bd(BLOCK_SIZE);
+    REQUIRE(bd.create(BD_PATH) == 0);
+
+    SECTION("write and read a run of blocks") {
+        bdWriteReadRun(&bd, NUM_TESTBLOCKS);
+    }
+
+    SECTION("scatter/gather blocks") {
+        bdWriteReadVec(&bd, NUM_TESTBLOCKS);
+    }
+
+    SECTION("read beyond end of container") {
+        char* r= new char[BD_BLOCK_SIZE * 4];
+        memset(r, 0xff, BD_BLOCK_SIZE * 4);
+        REQUIRE(bd.readBlocks(NUM_TESTBLOCKS, 4, r) == 0);
+        for(int i= 0; i < BD_BLOCK_SIZE * 4; i++) {
+            REQUIRE(r[i] == 0);
+        }
+        delete [] r;
+    }
+
+    REQUIRE(bd.close() == 0);
+    remove(BD_PATH);
+}
+
+TEST_CASE( "BD_ASYNC_WRITE_READ", "[blockdevice]" ) {
+
+    remove(BD_PATH);
+
+    AsyncBlockDevice::Engine engine = GENERATE(AsyncBlockDevice::ENGINE_AUTO, AsyncBlockDevice::ENGINE_THREADS);
+    AsyncBlockDevice bd(BLOCK_SIZE, engine, 8);
+    REQUIRE(bd.create(BD_PATH) == 0);
+
+    if (engine == AsyncBlockDevice::ENGINE_THREADS) {
+        REQUIRE(bd.getEngine() == AsyncBlockDevice::ENGINE_THREADS);
+    }
+
+    SECTION("scatter/gather blocks") {
+        bdWriteReadVec(&bd, NUM_TESTBLOCKS);
+    }
+
+    SECTION("batched requests") {
+        char* r= new char[BD_BLOCK_SIZE * NUM_TESTBLOCKS];
+        memset(r, 0, BD_BLOCK_SIZE * NUM_TESTBLOCKS);
+
+        char* w= new char[BD_BLOCK_SIZE * NUM_TESTBLOCKS];
+        gen_random(w, BD_BLOCK_SIZE * NUM_TESTBLOCKS);
+
+        // more requests than queue entries
+        for(int b= 0; b < NUM_TESTBLOCKS; b += 4) {
+            REQUIRE(bd.queueWrite(b, 4, w + b*BD_BLOCK_SIZE) == 0);
+        }
+        REQUIRE(bd.submit() >= 0);
+        REQUIRE(bd.complete() == 0);
+
+        for(int b= 0; b < NUM_TESTBLOCKS; b++) {
+            REQUIRE(bd.queueRead(b, 1, r + b*BD_BLOCK_SIZE) == 0);
+        }
+        REQUIRE(bd.complete() == 0);
+
+        REQUIRE(memcmp(w, r, BD_BLOCK_SIZE * NUM_TESTBLOCKS) == 0);
+
+        delete [] r;
+        delete [] w;
+    }
+
+    REQUIRE(bd.close() == 0);
+    remove(BD_PATH);
+}
+
+TEST_CASE( "BD_MMAP_WRITE_READ", "[blockdevice]" ) {
+
+    remove(BD_PATH);
+
+    MappedBlockDevice bd(BLOCK_SIZE);
+    REQUIRE(bd.create(BD_PATH) == 0);
+
+    SECTION("single blocks grow the container") {
+        bdWriteRead(&bd, NUM_TESTBLOCKS);
+    }
+
+    SECTION("write and read a run of blocks") {
+        bdWriteReadRun(&bd, NUM_TESTBLOCKS);
+    }
+
+    SECTION("scatter/gather blocks") {
+        bdWriteReadVec(&bd, NUM_TESTBLOCKS);
+    }
+
+    SECTION("read beyond end of container") {
+        char* r= new char[BD_BLOCK_SIZE * 4];
+        memset(r, 0xff, BD_BLOCK_SIZE * 4);
+        REQUIRE(bd.readBlocks(NUM_TESTBLOCKS, 4, r) == 0);
+        for(int i= 0; i < BD_BLOCK_SIZE * 4; i++) {
+            REQUIRE(r[i] == 0);
+        }
+        delete [] r;
+    }
+
+    SECTION("mapping and file descriptor see the same data") {
+        char* w= new char[BD_BLOCK_SIZE];
+        char* r= new char[BD_BLOCK_SIZE];
+        gen_random(w, BD_BLOCK_SIZE);
+
+        REQUIRE(bd.write(0, w) == 0);
+        REQUIRE(bd.sync() == 0);
+        REQUIRE(pread(bd.getFd(), r, BD_BLOCK_SIZE, 0) == BD_BLOCK_SIZE);
+        REQUIRE(memcmp(w, r, BD_BLOCK_SIZE) == 0);
+
+        // behind the end of the mapping
+        memset(r, 0, BD_BLOCK_SIZE);
+        REQUIRE(pwrite(bd.getFd(), w, BD_BLOCK_SIZE, 8 * BD_BLOCK_SIZE) == BD_BLOCK_SIZE);
+        REQUIRE(bd.read(8, r) == 0);
+        REQUIRE(memcmp(w, r, BD_BLOCK_SIZE) == 0);
+
+        delete [] r;
+        delete [] w;
+    }
+
+    REQUIRE(bd.close() == 0);
+    remove(BD_PATH);
+}
+
 // ***
 // *** Helper functions
 // ***
@@ -108,3 +240,65 @@ void bdWriteRead(BlockDevice *bd, int noBlocks) {
     delete [] r;
     delete [] w;
 }
+
+void bdWriteReadRun(BlockDevice *bd, int noBlocks) {
+    char* r= new char[BD_BLOCK_SIZE * noBlocks];
+    memset(r, 0, BD_BLOCK_SIZE * noBlocks);
+
+    char* w= new char[BD_BLOCK_SIZE * noBlocks];
+    gen_random(w, BD_BLOCK_SIZE * noBlocks);
+
+    // write all blocks at once
+    REQUIRE(bd->writeBlocks(0, noBlocks, w) == 0);
+
+    // read single blocks
+    for(int b= 0; b < noBlocks; b++) {
+        REQUIRE(bd->read(b, r + b*BD_BLOCK_SIZE) == 0);
+    }
+    REQUIRE(memcmp(w, r, BD_BLOCK_SIZE * noBlocks) == 0);
+
+    // read all blocks at once
+    memset(r, 0, BD_BLOCK_SIZE * noBlocks);
+    REQUIRE(bd->readBlocks(0, noBlocks, r) == 0);
+    REQUIRE(memcmp(w, r, BD_BLOCK_SIZE * noBlocks) == 0);
+
+    delete [] r;
+    delete [] w;
+}
+
+void bdWriteReadVec(BlockDevice *bd, int noBlocks) {
+    char* r= new char[BD_BLOCK_SIZE * noBlocks];
+    memset(r, 0, BD_BLOCK_SIZE * noBlocks);
+
+    char* w= new char[BD_BLOCK_SIZE * noBlocks];
+    gen_random(w, BD_BLOCK_SIZE * noBlocks);
+
+    // block list with contiguous runs and jumps, buffers in reverse order
+    uint32_t *blockNos= new uint32_t[noBlocks];
+    const char **wBuffers= new const char*[noBlocks];
+    char **rBuffers= new char*[noBlocks];
+    for(int i= 0; i < noBlocks; i++) {
+        blockNos[i]= (i / 8) * 16 + i % 8;
+        wBuffers[i]= w + (noBlocks - i - 1) * BD_BLOCK_SIZE;
+        rBuffers[i]= r + (noBlocks - i - 1) * BD_BLOCK_SIZE;
+    }
+
+    REQUIRE(bd->writeVec(noBlocks, blockNos, wBuffers) == 0);
+
+    // compare with single block reads
+    char* b= new char[BD_BLOCK_SIZE];
+    for(int i= 0; i < noBlocks; i++) {
+        REQUIRE(bd->read(blockNos[i], b) == 0);
+        REQUIRE(memcmp(b, wBuffers[i], BD_BLOCK_SIZE) == 0);
+    }
+
+    REQUIRE(bd->readVec(noBlocks, blockNos, rBuffers) == 0);
+    REQUIRE(memcmp(w, r, BD_BLOCK_SIZE * noBlocks) == 0);
+
+    delete [] b;
+    delete [] blockNos;
+    delete [] wBuffers;
+    delete [] rBuffers;
+    delete [] r;
+    delete [] w;
+}
@@ -0,0 +1,181 @@
+//
+//  utest-concurrency.cpp
+//  testing
+//
+
+#include "../catch/catch.hpp"
+
+#include <chrono>
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "tools.hpp"
+
+#include "myfs-info.h"
+#include "myondiskfs.h"
+#include "myinmemoryfs.h"
+
+#define MT_PATH "/tmp/mt.bin"
+#define MT_FILE_SIZE (256 * 1024)
+#define MT_CHUNK_SIZE 4096
+#define MT_ROUNDS 4
+#define MT_TIMED_ROUNDS 128
+
+// Each thread fills its own file chunk by chunk and reads it back, while the other threads do the same. With churn
+// set, the calling thread creates, renames and deletes other files meanwhile. Returns the elapsed time in ms.
+template<class FS>
+double mtWriteReadFiles(FS *fs, int nrThreads, int nrFiles, int rounds, bool churn) {
+    std::vector<std::thread> threads;
+    std::vector<int> failures(nrThreads, 0);
+
+    auto start = std::chrono::steady_clock::now();
+
+    for (int t = 0; t < nrThreads; t++) {
+        threads.emplace_back([fs, t, nrThreads, nrFiles, rounds, &failures]() {
+            char w[MT_CHUNK_SIZE];
+            char r[MT_CHUNK_SIZE];
+
+            for (int f = t; f < nrFiles; f += nrThreads) {
+                std::string name = "/file" + std::to_string(f);
+                struct fuse_file_info fi;
+                memset(&fi, 0, sizeof(fi));
+
+                if (fs->fuseOpen(name.c_str(), &fi) != 0) {
+                    failures[t]++;
+                    continue;
+                }
+                for (int round = 0; round < rounds; round++) {
+                    for (off_t off = 0; off < MT_FILE_SIZE; off += MT_CHUNK_SIZE) {
+                        memset(w, (char) (f + off / MT_CHUNK_SIZE + round), MT_CHUNK_SIZE);
+                        if (fs->fuseWrite(name.c_str(), w, MT_CHUNK_SIZE, off, &fi) != MT_CHUNK_SIZE) {
+                            failures[t]++;
+                        }
+                    }
+                    for (off_t off = 0; off < MT_FILE_SIZE; off += MT_CHUNK_SIZE) {
+                        memset(w, (char) (f + off / MT_CHUNK_SIZE + round), MT_CHUNK_SIZE);
+                        if (fs->fuseRead(name.c_str(), r, MT_CHUNK_SIZE, off, &fi) != MT_CHUNK_SIZE ||
+                            memcmp(w, r, MT_CHUNK_SIZE) != 0) {
+                            failures[t]++;
+                        }
+                    }
+                }
+                fs->fuseRelease(name.c_str(), &fi);
+            }
+        });
+    }
+
+    // Concurrent metadata operations on other files
+    for (int i = 0; churn && i < 200; i++) {
+        std::string name = "/tmp" + std::to_string(i % 8);
+        struct stat st;
+        fs->fuseMknod(name.c_str(), S_IFREG | 0644, 0);
+        fs->fuseGetattr(name.c_str(), &st);
+        fs->fuseTruncate(name.c_str(), (i % 5) * 1000);
+        fs->fuseRename(name.c_str(), (name + "r").c_str());
+        fs->fuseUnlink((name + "r").c_str());
+    }
+
+    for (auto &thread: threads) {
+        thread.join();
+    }
+
+    std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - start;
+
+    for (int t = 0; t < nrThreads; t++) {
+        REQUIRE(failures[t] == 0);
+    }
+    return elapsed.count();
+}
+
+template<class FS>
+void mtCreateFiles(FS *fs, int nrFiles) {
+    for (int f = 0; f < nrFiles; f++) {
+        std::string name = "/file" + std::to_string(f);
+        REQUIRE(fs->fuseMknod(name.c_str(), S_IFREG | 0644, 0) == 0);
+    }
+}
+
+// Times the same reads and writes with 1 and with 4 threads. 4 threads must be faster if there are cores to run them.
+template<class FS>
+void mtCheckScaling(FS *fs, const char *name, int nrFiles) {
+    double single = mtWriteReadFiles(fs, 1, nrFiles, MT_TIMED_ROUNDS, false);
+    double parallel = mtWriteReadFiles(fs, 4, nrFiles, MT_TIMED_ROUNDS, false);
+    WARN(name << ": 1 thread " << single << " ms, 4 threads " << parallel << " ms");
+
+    if (std::thread::hardware_concurrency() >= 4) {
+        REQUIRE(parallel < single);
+    }
+}
+
+TEST_CASE( "MT_ONDISK_PARALLEL_FILES", "[concurrency]" ) {
+    const int nrFiles = 8;
+
+    remove(MT_PATH);
+
+    MyFsInfo info;
+    memset(&info, 0, sizeof(info));
+    info.contFile = (char *) MT_PATH;
+    info.logFile = (char *) "/dev/null";
+    info.cacheSize = (char *) "1M";
+    info.writeBack = GENERATE(0, 1);
+
+    MyOnDiskFS *fs = new MyOnDiskFS();
+    REQUIRE(fs->setup(&info) == 0);
+    mtCreateFiles(fs, nrFiles);
+
+    mtCheckScaling(fs, "on-disk", nrFiles);
+
+    // Reads and writes stay correct while other files are created and deleted
+    mtWriteReadFiles(fs, 4, nrFiles, MT_ROUNDS, true);
+
+    // Contents survive a remount
+    fs->fuseDestroy();
+    delete fs;
+    fs = new MyOnDiskFS();
+    REQUIRE(fs->setup(&info) == 0);
+
+    char r[MT_CHUNK_SIZE];
+    char w[MT_CHUNK_SIZE];
+    for (int f = 0; f < nrFiles; f++) {
+        std::string name = "/file" + std::to_string(f);
+        struct stat st;
+        REQUIRE(fs->fuseGetattr(name.c_str(), &st) == 0);
+        REQUIRE(st.st_size == MT_FILE_SIZE);
+        REQUIRE(fs->fuseRead(name.c_str(), r, MT_CHUNK_SIZE, 0, nullptr) == MT_CHUNK_SIZE);
+        memset(w, (char) (f + MT_ROUNDS - 1), MT_CHUNK_SIZE);
+        REQUIRE(memcmp(r, w, MT_CHUNK_SIZE) == 0);
+    }
+
+    // No blocks were lost by concurrent allocations
+    struct statvfs sv;
+    REQUIRE(fs->fuseStatfs("/", &sv) == 0);
+    REQUIRE(sv.f_bfree == sv.f_blocks - nrFiles * (MT_FILE_SIZE / BLOCK_SIZE));
+
+    fs->fuseDestroy();
+    delete fs;
+    remove(MT_PATH);
+}
+
+TEST_CASE( "MT_INMEMORY_PARALLEL_FILES", "[concurrency]" ) {
+    const int nrFiles = 8;
+
+    MyFsInfo info;
+    memset(&info, 0, sizeof(info));
+    info.logFile = (char *) "/dev/null";
+
+    MyInMemoryFS *fs = new MyInMemoryFS();
+    REQUIRE(fs->setup(&info) == 0);
+    mtCreateFiles(fs, nrFiles);
+
+    mtCheckScaling(fs, "in-memory", nrFiles);
+
+    // Reads and writes stay correct while other files are created and deleted
+    mtWriteReadFiles(fs, 4, nrFiles, MT_ROUNDS, true);
+
+    fs->fuseDestroy();
+    delete fs;
+}
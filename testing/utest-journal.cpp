@@ -0,0 +1,222 @@
+//
+//  utest-journal.cpp
+//  testing
+//
+
+#include "../catch/catch.hpp"
+
+#include <stdio.h>
+#include <string.h>
+#include <sys/statvfs.h>
+
+#include "tools.hpp"
+
+#include "blockdevice.h"
+#include "blockcache.h"
+#include "journal.h"
+#include "myfs-info.h"
+#include "myondiskfs.h"
+
+#define JOURNAL_PATH "/tmp/journal.bin"
+#define JOURNAL_FS_PATH "/tmp/journal-fs.bin"
+#define JOURNAL_TEST_START 64
+#define JOURNAL_TEST_LENGTH 32
+
+static void writeImage(Journal &journal, uint32_t blockNo, char fill) {
+    char block[BD_BLOCK_SIZE];
+    memset(block, fill, BD_BLOCK_SIZE);
+    const char *buffers[1] = {block};
+    journal.log(1, &blockNo, buffers);
+}
+
+static char readFirstByte(BlockDevice &bd, uint32_t blockNo) {
+    char block[BD_BLOCK_SIZE];
+    REQUIRE(bd.read(blockNo, block) == 0);
+    return block[0];
+}
+
+TEST_CASE( "JOURNAL_RECOVERY", "[journal]" ) {
+    remove(JOURNAL_PATH);
+
+    BlockDevice bd(BD_BLOCK_SIZE);
+    REQUIRE(bd.create(JOURNAL_PATH) == 0);
+    BlockCache bc(&bd, BD_BLOCK_SIZE, 16);
+
+    {
+        Journal journal(&bc, &bd, BD_BLOCK_SIZE, JOURNAL_TEST_START, JOURNAL_TEST_LENGTH);
+        REQUIRE(journal.recover() == -ENOENT);
+        REQUIRE(journal.format() == 0);
+
+        // Committed transactions do not touch the home locations
+        writeImage(journal, 1, 'a');
+        writeImage(journal, 2, 'b');
+        REQUIRE(journal.commit(false) == 0);
+        writeImage(journal, 1, 'c');
+        REQUIRE(journal.commit(false) == 0);
+        REQUIRE(journal.getCommittedSequence() == 2);
+        REQUIRE(readFirstByte(bd, 1) == 0);
+
+        // Not committed, lost in the crash
+        writeImage(journal, 3, 'd');
+    }
+
+    SECTION("committed transactions are replayed in order") {
+        Journal journal(&bc, &bd, BD_BLOCK_SIZE, JOURNAL_TEST_START, JOURNAL_TEST_LENGTH);
+        REQUIRE(journal.recover() == 2);
+        REQUIRE(readFirstByte(bd, 1) == 'c');
+        REQUIRE(readFirstByte(bd, 2) == 'b');
+        REQUIRE(readFirstByte(bd, 3) == 0);
+
+        // Replayed transactions are not replayed again, new ones continue the sequence
+        writeImage(journal, 2, 'e');
+        REQUIRE(journal.commit(false) == 0);
+        REQUIRE(journal.getCommittedSequence() == 3);
+
+        Journal again(&bc, &bd, BD_BLOCK_SIZE, JOURNAL_TEST_START, JOURNAL_TEST_LENGTH);
+        REQUIRE(again.recover() == 1);
+        REQUIRE(readFirstByte(bd, 2) == 'e');
+    }
+
+    SECTION("a torn transaction is ignored") {
+        // Second transaction: descriptor, one image and the commit block at log positions 3 to 5
+        char zero[BD_BLOCK_SIZE];
+        memset(zero, 0, BD_BLOCK_SIZE);
+        REQUIRE(bd.write(JOURNAL_TEST_START + 1 + 5, zero) == 0);
+
+        Journal journal(&bc, &bd, BD_BLOCK_SIZE, JOURNAL_TEST_START, JOURNAL_TEST_LENGTH);
+        REQUIRE(journal.recover() == 1);
+        REQUIRE(readFirstByte(bd, 1) == 'a');
+        REQUIRE(readFirstByte(bd, 2) == 'b');
+    }
+
+    remove(JOURNAL_PATH);
+}
+
+TEST_CASE( "JOURNAL_WRAP_AROUND", "[journal]" ) {
+    remove(JOURNAL_PATH);
+
+    BlockDevice bd(BD_BLOCK_SIZE);
+    REQUIRE(bd.create(JOURNAL_PATH) == 0);
+    BlockCache bc(&bd, BD_BLOCK_SIZE, 16);
+
+    {
+        Journal journal(&bc, &bd, BD_BLOCK_SIZE, JOURNAL_TEST_START, JOURNAL_TEST_LENGTH);
+        REQUIRE(journal.format() == 0);
+
+        // Each transaction takes 4 log blocks, the log is checkpointed when it runs full
+        for (int i = 0; i < 40; i++) {
+            writeImage(journal, i % 8, 'A' + i % 26);
+            writeImage(journal, 8 + i % 8, 'a' + i % 26);
+            REQUIRE(journal.commit(false) == 0);
+        }
+        REQUIRE(journal.getStats().commits == 40);
+        REQUIRE(journal.getStats().checkpoints > 0);
+    }
+
+    Journal journal(&bc, &bd, BD_BLOCK_SIZE, JOURNAL_TEST_START, JOURNAL_TEST_LENGTH);
+    REQUIRE(journal.recover() >= 0);
+    for (int i = 32; i < 40; i++) {
+        REQUIRE(readFirstByte(bd, i % 8) == 'A' + i % 26);
+        REQUIRE(readFirstByte(bd, 8 + i % 8) == 'a' + i % 26);
+    }
+
+    remove(JOURNAL_PATH);
+}
+
+TEST_CASE( "JOURNAL_ONDISK_CRASH", "[journal]" ) {
+    remove(JOURNAL_FS_PATH);
+
+    MyFsInfo info;
+    memset(&info, 0, sizeof(info));
+    info.contFile = (char *) JOURNAL_FS_PATH;
+    info.logFile = (char *) "/dev/null";
+
+    MyOnDiskFS *fs = new MyOnDiskFS();
+    REQUIRE(fs->setup(&info) == 0);
+    REQUIRE(fs->journal != nullptr);
+
+    const size_t size = 40 * BLOCK_SIZE;
+    char *w = new char[size];
+    char *r = new char[size];
+    gen_random(w, size);
+
+    // Many operations share one commit
+    uint64_t commits = fs->journal->getStats().commits;
+    REQUIRE(fs->fuseMknod("/keep", S_IFREG | 0644, 0) == 0);
+    REQUIRE(fs->fuseWrite("/keep", w, size, 0, nullptr) == (int) size);
+    REQUIRE(fs->fuseMknod("/gone", S_IFREG | 0644, 0) == 0);
+    REQUIRE(fs->fuseWrite("/gone", w, size, 0, nullptr) == (int) size);
+    REQUIRE(fs->fuseTruncate("/keep", size / 2) == 0);
+    REQUIRE(fs->fuseUnlink("/gone") == 0);
+    REQUIRE(fs->fuseFlush("/keep", nullptr) == 0);
+    REQUIRE(fs->journal->getStats().commits == commits + 1);
+
+    // Blocks of the deleted file are free, but not used again before the commit
+    struct statvfs st;
+    REQUIRE(fs->fuseStatfs("/", &st) == 0);
+    REQUIRE(st.f_bfree == st.f_blocks - size / 2 / BLOCK_SIZE);
+
+    // Lost with the crash
+    REQUIRE(fs->fuseMknod("/late", S_IFREG | 0644, 0) == 0);
+
+    // Crash: no fuseDestroy(), nothing was checkpointed
+    delete fs;
+    fs = new MyOnDiskFS();
+    REQUIRE(fs->setup(&info) == 0);
+
+    struct stat sb;
+    REQUIRE(fs->fuseGetattr("/keep", &sb) == 0);
+    REQUIRE(sb.st_size == (off_t) size / 2);
+    REQUIRE(fs->fuseGetattr("/gone", &sb) == -ENOENT);
+    REQUIRE(fs->fuseGetattr("/late", &sb) == -ENOENT);
+    REQUIRE(fs->fuseRead("/keep", r, size, 0, nullptr) == (int) size / 2);
+    REQUIRE(memcmp(r, w, size / 2) == 0);
+
+    // No block leaked or used twice
+    REQUIRE(fs->fuseStatfs("/", &st) == 0);
+    REQUIRE(st.f_bfree == st.f_blocks - size / 2 / BLOCK_SIZE);
+
+    delete[] w;
+    delete[] r;
+    fs->fuseDestroy();
+    delete fs;
+    remove(JOURNAL_FS_PATH);
+}
+
+TEST_CASE( "JOURNAL_ONDISK_PENDING_FREES", "[journal]" ) {
+    remove(JOURNAL_FS_PATH);
+
+    MyFsInfo info;
+    memset(&info, 0, sizeof(info));
+    info.contFile = (char *) JOURNAL_FS_PATH;
+    info.logFile = (char *) "/dev/null";
+    info.containerSize = (char *) "4M";
+
+    MyOnDiskFS *fs = new MyOnDiskFS();
+    REQUIRE(fs->setup(&info) == 0);
+
+    struct statvfs st;
+    REQUIRE(fs->fuseStatfs("/", &st) == 0);
+    const size_t size = st.f_bfree * BLOCK_SIZE;
+    char *w = new char[size];
+    gen_random(w, size);
+
+    REQUIRE(fs->fuseMknod("/old", S_IFREG | 0644, 0) == 0);
+    REQUIRE(fs->fuseWrite("/old", w, size, 0, nullptr) == (int) size);
+    REQUIRE(fs->journal->commit(false) == 0);
+
+    // The blocks of the deleted file are only handed out again once the deletion is committed
+    REQUIRE(fs->fuseUnlink("/old") == 0);
+    REQUIRE(fs->fuseMknod("/new", S_IFREG | 0644, 0) == 0);
+    REQUIRE(fs->fuseWrite("/new", w, size, 0, nullptr) == -ENOSPC);
+    REQUIRE(fs->journal->commit(false) == 0);
+    REQUIRE(fs->fuseWrite("/new", w, size, 0, nullptr) == (int) size);
+
+    REQUIRE(fs->fuseStatfs("/", &st) == 0);
+    REQUIRE(st.f_bfree == 0);
+
+    delete[] w;
+    fs->fuseDestroy();
+    delete fs;
+    remove(JOURNAL_FS_PATH);
+}
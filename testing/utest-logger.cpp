@@ -0,0 +1,141 @@
+//
+//  utest-logger.cpp
+//  testing
+//
+
+#include "../catch/catch.hpp"
+
+#include <stdio.h>
+#include <string.h>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "logger.h"
+
+#define LOG_PATH "/tmp/logger.log"
+
+static std::vector<std::string> readLines(const char *path) {
+    std::vector<std::string> lines;
+    FILE *f = fopen(path, "r");
+    REQUIRE(f != nullptr);
+    char buf[1024];
+    while (fgets(buf, sizeof(buf), f) != nullptr) {
+        lines.push_back(buf);
+    }
+    fclose(f);
+    return lines;
+}
+
+TEST_CASE( "LOGGER_FORMAT", "[logger]" ) {
+    FILE *f = fopen(LOG_PATH, "w+");
+    REQUIRE(f != nullptr);
+
+    Logger logger;
+    logger.start(f, LOG_DEBUG);
+
+    char name[] = "file";
+    logger.logMethod("myfs.cpp", 42, "fuseRead");
+    logger.logReturn("fuseRead", -2);
+    logger.log("plain text");
+    logger.log("%s has %d blocks, %5.2f%% used", name, 7, 12.5);
+    name[0] = 'X';  // strings are copied when the record is logged
+    logger.log("%llu bytes at 0x%lx, %u files, %c", (unsigned long long) 1 << 40, 255ul, 3u, 'z');
+    logger.log("%s and %s", (const char *) nullptr, "");
+    logger.log("%d", "not a number");
+    logger.stop();
+    fclose(f);
+
+    std::vector<std::string> lines = readLines(LOG_PATH);
+    REQUIRE(lines.size() == 7);
+    REQUIRE(lines[0] == "myfs.cpp:42:fuseRead()\n");
+    REQUIRE(lines[1] == "fuseRead() returned -2\n");
+    REQUIRE(lines[2] == "\tplain text\n");
+    REQUIRE(lines[3] == "\tfile has 7 blocks, 12.50% used\n");
+    REQUIRE(lines[4] == "\t1099511627776 bytes at 0xff, 3 files, z\n");
+    REQUIRE(lines[5] == "\t(null) and \n");
+    REQUIRE(lines[6] == "\t<bad format>\n");
+    remove(LOG_PATH);
+}
+
+TEST_CASE( "LOGGER_LONG_STRINGS", "[logger]" ) {
+    FILE *f = fopen(LOG_PATH, "w+");
+    REQUIRE(f != nullptr);
+
+    Logger logger;
+    logger.start(f, LOG_DEBUG);
+    std::string longName(1000, 'a');
+    logger.log("%s|%s|%s", longName.c_str(), "b", "c");
+    logger.stop();
+    fclose(f);
+
+    // Strings are truncated to the record, later strings end up empty
+    std::vector<std::string> lines = readLines(LOG_PATH);
+    REQUIRE(lines.size() == 1);
+    REQUIRE(lines[0].size() < LOG_RECORD_SIZE);
+    REQUIRE(lines[0].substr(0, 11) == "\taaaaaaaaaa");
+    REQUIRE(lines[0].substr(lines[0].size() - 3) == "||\n");
+    remove(LOG_PATH);
+}
+
+TEST_CASE( "LOGGER_LEVELS", "[logger]" ) {
+    REQUIRE(Logger::parseLevel("none") == LOG_NONE);
+    REQUIRE(Logger::parseLevel("INFO") == LOG_INFO);
+    REQUIRE(Logger::parseLevel("debug") == LOG_DEBUG);
+    REQUIRE(Logger::parseLevel("verbose") == -1);
+
+    Logger logger;
+    REQUIRE_FALSE(logger.enabled(LOG_INFO));
+
+    FILE *f = fopen(LOG_PATH, "w+");
+    REQUIRE(f != nullptr);
+    logger.start(f, LOG_INFO);
+    REQUIRE(logger.enabled(LOG_INFO));
+    REQUIRE_FALSE(logger.enabled(LOG_DEBUG));
+    logger.stop();
+    REQUIRE_FALSE(logger.enabled(LOG_INFO));
+    fclose(f);
+    remove(LOG_PATH);
+}
+
+TEST_CASE( "LOGGER_THREADS", "[logger]" ) {
+    const int nrThreads = 4;
+    const int nrRecords = 20000;
+
+    FILE *f = fopen(LOG_PATH, "w+");
+    REQUIRE(f != nullptr);
+
+    Logger logger;
+    logger.start(f, LOG_DEBUG);
+
+    std::vector<std::thread> threads;
+    for (int t = 0; t < nrThreads; t++) {
+        threads.emplace_back([&logger, t]() {
+            for (int i = 0; i < nrRecords; i++) {
+                logger.log("thread %d record %d", t, i);
+                if (i % 512 == 0) {
+                    // Give the drain thread a chance, so only few records are dropped
+                    std::this_thread::yield();
+                }
+            }
+        });
+    }
+    for (auto &thread: threads) {
+        thread.join();
+    }
+    logger.stop();
+    fclose(f);
+
+    // Every record is either written or counted as dropped, and each thread's records stay in order
+    std::vector<std::string> lines = readLines(LOG_PATH);
+    REQUIRE(lines.size() + logger.getDropped() == (size_t) nrThreads * nrRecords);
+
+    std::vector<int> last(nrThreads, -1);
+    for (const std::string &line: lines) {
+        int t, i;
+        REQUIRE(sscanf(line.c_str(), "\tthread %d record %d", &t, &i) == 2);
+        REQUIRE(i > last[t]);
+        last[t] = i;
+    }
+    remove(LOG_PATH);
+}
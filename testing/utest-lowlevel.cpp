@@ -0,0 +1,173 @@
+//
+//  utest-lowlevel.cpp
+//  testing
+//
+
+#include "../catch/catch.hpp"
+
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "tools.hpp"
+
+#include "lowlevel.h"
+#include "myfs-info.h"
+#include "myondiskfs.h"
+#include "myinmemoryfs.h"
+
+#define LL_PATH "/tmp/lowlevel.bin"
+
+TEST_CASE( "LL_INODE_TABLE", "[lowlevel]" ) {
+    InodeTable table;
+
+    fuse_ino_t a = table.lookup("a", 10);
+    fuse_ino_t b = table.lookup("b", 11);
+    REQUIRE(a > FUSE_ROOT_ID);
+    REQUIRE(b != a);
+    REQUIRE(table.findName("a") == a);
+    REQUIRE(table.find(a)->id == 10);
+
+    SECTION("lookups of the same file share the inode") {
+        REQUIRE(table.lookup("a", 10) == a);
+        REQUIRE(table.find(a)->nlookup == 2);
+
+        table.forget(a, 1);
+        REQUIRE(table.find(a) != nullptr);
+        table.forget(a, 1);
+        REQUIRE(table.find(a) == nullptr);
+        REQUIRE(table.findName("a") == 0);
+        REQUIRE(table.size() == 1);
+    }
+
+    SECTION("deleted files keep their inode until it is forgotten") {
+        table.remove("a");
+        REQUIRE(table.findName("a") == 0);
+        REQUIRE(table.find(a) != nullptr);
+        REQUIRE(table.find(a)->id < 0);
+
+        // A new file with the same name gets a new inode number
+        fuse_ino_t c = table.lookup("a", 12);
+        REQUIRE(c != a);
+        REQUIRE(c != b);
+
+        table.forget(a, 1);
+        REQUIRE(table.find(a) == nullptr);
+        REQUIRE(table.findName("a") == c);
+    }
+
+    SECTION("rename moves the inode and replaces the target") {
+        table.rename("a", "b");
+        REQUIRE(table.findName("a") == 0);
+        REQUIRE(table.findName("b") == a);
+        REQUIRE(table.find(a)->name == "b");
+        REQUIRE(table.find(b)->id < 0);
+    }
+
+    SECTION("a reused name with a different file id gets a new inode") {
+        fuse_ino_t c = table.lookup("a", 20);
+        REQUIRE(c != a);
+        REQUIRE(table.find(a)->id < 0);
+        REQUIRE(table.findName("a") == c);
+    }
+}
+
+// File ids stay valid across renames and become stale when the file is deleted, even if a new file takes its place
+template<class FS>
+void checkFileIds(FS *fs) {
+    char w[BLOCK_SIZE];
+    char r[BLOCK_SIZE];
+    struct stat st;
+    memset(w, 'x', BLOCK_SIZE);
+
+    REQUIRE(fs->fuseLookupId("/file") == -ENOENT);
+    REQUIRE(fs->fuseMknod("/file", S_IFREG | 0644, 0) == 0);
+    int64_t id = fs->fuseLookupId("/file");
+    REQUIRE(id >= 0);
+
+    REQUIRE(fs->fuseWriteId(id, w, BLOCK_SIZE, 0, nullptr) == BLOCK_SIZE);
+    REQUIRE(fs->fuseGetattrId(id, &st) == 0);
+    REQUIRE(st.st_size == BLOCK_SIZE);
+    REQUIRE(fs->fuseReadId(id, r, BLOCK_SIZE, 0, nullptr) == BLOCK_SIZE);
+    REQUIRE(memcmp(r, w, BLOCK_SIZE) == 0);
+
+    REQUIRE(fs->fuseRename("/file", "/renamed") == 0);
+    REQUIRE(fs->fuseLookupId("/renamed") == id);
+    REQUIRE(fs->fuseReadId(id, r, BLOCK_SIZE, 0, nullptr) == BLOCK_SIZE);
+
+    REQUIRE(fs->fuseUnlink("/renamed") == 0);
+    REQUIRE(fs->fuseMknod("/file", S_IFREG | 0644, 0) == 0);
+    REQUIRE(fs->fuseLookupId("/file") != id);
+    REQUIRE(fs->fuseGetattrId(id, &st) == -ENOENT);
+    REQUIRE(fs->fuseReadId(id, r, BLOCK_SIZE, 0, nullptr) == -ENOENT);
+    REQUIRE(fs->fuseWriteId(id, w, BLOCK_SIZE, 0, nullptr) == -ENOENT);
+    REQUIRE(fs->fuseGetattrId(-1, &st) == -ENOENT);
+}
+
+TEST_CASE( "LL_FILE_IDS", "[lowlevel]" ) {
+    MyFsInfo info;
+    memset(&info, 0, sizeof(info));
+    info.logFile = (char *) "/dev/null";
+
+    SECTION("on disk") {
+        remove(LL_PATH);
+        info.contFile = (char *) LL_PATH;
+
+        MyOnDiskFS *fs = new MyOnDiskFS();
+        REQUIRE(fs->setup(&info) == 0);
+        checkFileIds(fs);
+        fs->fuseDestroy();
+        delete fs;
+        remove(LL_PATH);
+    }
+
+    SECTION("in memory") {
+        MyInMemoryFS *fs = new MyInMemoryFS();
+        REQUIRE(fs->setup(&info) == 0);
+        checkFileIds(fs);
+        fs->fuseDestroy();
+        delete fs;
+    }
+}
+
+// The low-level front end passes NULL as path to flush, fsync and release once an open file was deleted
+template<class FS>
+void checkReleaseDeleted(FS *fs) {
+    struct fuse_file_info fi;
+    memset(&fi, 0, sizeof(fi));
+
+    REQUIRE(fs->fuseMknod("/file", S_IFREG | 0644, 0) == 0);
+    REQUIRE(fs->fuseOpen("/file", &fi) == 0);
+    REQUIRE(fs->fuseUnlink("/file") == 0);
+
+    REQUIRE(fs->fuseFlush(NULL, &fi) == 0);
+    REQUIRE(fs->fuseFsync(NULL, 0, &fi) == 0);
+    REQUIRE(fs->fuseRelease(NULL, &fi) == 0);
+}
+
+TEST_CASE( "LL_RELEASE_DELETED", "[lowlevel]" ) {
+    MyFsInfo info;
+    memset(&info, 0, sizeof(info));
+    info.logFile = (char *) "/dev/null";
+
+    SECTION("on disk") {
+        remove(LL_PATH);
+        info.contFile = (char *) LL_PATH;
+
+        MyOnDiskFS *fs = new MyOnDiskFS();
+        REQUIRE(fs->setup(&info) == 0);
+        checkReleaseDeleted(fs);
+        REQUIRE(fs->openFiles.empty());
+        fs->fuseDestroy();
+        delete fs;
+        remove(LL_PATH);
+    }
+
+    SECTION("in memory") {
+        MyInMemoryFS *fs = new MyInMemoryFS();
+        REQUIRE(fs->setup(&info) == 0);
+        checkReleaseDeleted(fs);
+        fs->fuseDestroy();
+        delete fs;
+    }
+}
@@ -8,7 +8,953 @@
 
 #include "../catch/catch.hpp"
 
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/statvfs.h>
+
 #include "tools.hpp"
 #include "myfs.h"
+#include "myfs-info.h"
+#include "myinmemoryfs.h"
+#include "myondiskfs.h"
+
+#define DIRTY_PATH "/tmp/dirty.bin"
+#define FREE_PATH "/tmp/free.bin"
+#define MAPS_PATH "/tmp/maps.bin"
+#define TS_PATH "/tmp/timestamps.bin"
+#define FORMAT_PATH "/tmp/format.bin"
+#define FAT_ORDER_PATH "/tmp/fatorder.bin"
+#define EXTENT_PATH "/tmp/extents.bin"
 
 // TODO: Implement your helper functions here!
+
+// Mount a container without FUSE
+MyOnDiskFS *mountOnDisk(MyFsInfo *info) {
+    MyOnDiskFS *fs = new MyOnDiskFS();
+    REQUIRE(fs->setup(info) == 0);
+    return fs;
+}
+
+// Mount the container at path with default options
+MyOnDiskFS *mountOnDisk(const char *path) {
+    MyFsInfo info;
+    memset(&info, 0, sizeof(info));
+    info.contFile = (char *) path;
+    info.logFile = (char *) "/dev/null";
+    return mountOnDisk(&info);
+}
+
+// Mount a new, empty container at path
+MyOnDiskFS *createOnDisk(const char *path) {
+    remove(path);
+    return mountOnDisk(path);
+}
+
+// The free block counter and bitmap agree with the BLT, blocks freed by uncommitted transactions count as used
+static void checkFreeBlocks(MyOnDiskFS *fs) {
+    uint32_t free = 0, usedInBitmap = 0;
+    for (uint32_t b = 0; b < fs->layout.totalBlocks; b++) {
+        if (fs->blt[b] == BLT_FREE) {
+            free++;
+        } else if (fs->freeBitmap[b / 64] >> (b % 64) & 1) {
+            usedInBitmap++;
+        }
+    }
+    REQUIRE(usedInBitmap == 0);
+    REQUIRE(fs->freeBlockCount + fs->pendingFrees.size() == free);
+
+    uint32_t bits = 0;
+    for (uint64_t word: fs->freeBitmap) {
+        bits += __builtin_popcountll(word);
+    }
+    REQUIRE(bits == fs->freeBlockCount);
+}
+
+// The cached block map of a file is the chain of its blocks in the BLT
+static void checkBlockMap(MyOnDiskFS *fs, int index) {
+    const uint32_t *blockList = fs->getBlockMap(index);
+    uint32_t nrBlocks = fs->fat[index].nrBlocks;
+    uint32_t b = fs->fat[index].startBlock;
+    uint32_t mismatches = 0;
+    for (uint32_t i = 0; i < nrBlocks; i++) {
+        if (blockList[i] != b) {
+            mismatches++;
+        }
+        b = fs->blt[b];
+    }
+    REQUIRE(mismatches == 0);
+    if (nrBlocks > 0) {
+        REQUIRE(fs->blt[blockList[nrBlocks - 1]] == BLT_EOF);
+    }
+}
+
+// Number of runs of consecutive blocks in the block map of a file
+static int countExtents(MyOnDiskFS *fs, const char *path) {
+    int index = fs->getFileIndex(path);
+    REQUIRE(index >= 0);
+    const uint32_t *blockList = fs->getBlockMap(index);
+    int extents = 0;
+    for (uint32_t i = 0; i < fs->fat[index].nrBlocks; i++) {
+        if (i == 0 || blockList[i] != blockList[i - 1] + 1) {
+            extents++;
+        }
+    }
+    return extents;
+}
+
+TEST_CASE( "MYFS_DIRTY_METADATA", "[myfs]" ) {
+    MyOnDiskFS *fs = createOnDisk(DIRTY_PATH);
+    REQUIRE(fs->fuseMknod("/file", S_IFREG | 0644, 0) == 0);
+
+    // Allocating or freeing a single block writes one BLT block and the FAT block of the file
+    uint64_t before = fs->metaBlocksWritten;
+    REQUIRE(fs->fuseTruncate("/file", BLOCK_SIZE) == 0);
+    REQUIRE(fs->metaBlocksWritten - before == 2);
+
+    before = fs->metaBlocksWritten;
+    REQUIRE(fs->fuseTruncate("/file", 2 * BLOCK_SIZE) == 0);
+    REQUIRE(fs->metaBlocksWritten - before == 2);
+
+    before = fs->metaBlocksWritten;
+    REQUIRE(fs->fuseTruncate("/file", BLOCK_SIZE) == 0);
+    REQUIRE(fs->metaBlocksWritten - before == 2);
+
+    fs->fuseDestroy();
+    delete fs;
+    remove(DIRTY_PATH);
+}
+
+TEST_CASE( "MYFS_FREE_BLOCKS", "[myfs]" ) {
+    MyOnDiskFS *fs = createOnDisk(FREE_PATH);
+    checkFreeBlocks(fs);
+
+    const size_t size = 100 * BLOCK_SIZE;
+    char *w = new char[size];
+    gen_random(w, size);
+
+    char name[16];
+    for (int i = 0; i < 10; i++) {
+        sprintf(name, "/f%d", i);
+        REQUIRE(fs->fuseMknod(name, S_IFREG | 0644, 0) == 0);
+        REQUIRE(fs->fuseWrite(name, w, size / (i + 1), 0, nullptr) == (int) (size / (i + 1)));
+    }
+    checkFreeBlocks(fs);
+
+    for (int i = 0; i < 10; i += 2) {
+        sprintf(name, "/f%d", i);
+        REQUIRE(fs->fuseTruncate(name, size / 3) == 0);
+    }
+    checkFreeBlocks(fs);
+
+    for (int i = 0; i < 10; i += 3) {
+        sprintf(name, "/f%d", i);
+        REQUIRE(fs->fuseUnlink(name) == 0);
+    }
+    checkFreeBlocks(fs);
+
+    // Freed blocks become available with the commit
+    REQUIRE(fs->journal->commit(false) == 0);
+    REQUIRE(fs->fuseTruncate("/f1", size * 2) == 0);
+    checkFreeBlocks(fs);
+    REQUIRE(fs->pendingFrees.empty());
+
+    struct statvfs st;
+    REQUIRE(fs->fuseStatfs("/", &st) == 0);
+    uint32_t free = st.f_bfree;
+    fs->fuseDestroy();
+    delete fs;
+
+    // The counter rebuilt from the BLT after remounting is the same
+    fs = mountOnDisk(FREE_PATH);
+    checkFreeBlocks(fs);
+    REQUIRE(fs->fuseStatfs("/", &st) == 0);
+    REQUIRE(st.f_bfree == free);
+
+    delete[] w;
+    fs->fuseDestroy();
+    delete fs;
+    remove(FREE_PATH);
+}
+
+TEST_CASE( "MYFS_BLOCK_MAPS", "[myfs]" ) {
+    MyOnDiskFS *fs = createOnDisk(MAPS_PATH);
+    const size_t size = 64 * BLOCK_SIZE;
+    char *w = new char[size];
+    char *r = new char[size];
+    gen_random(w, size);
+
+    struct fuse_file_info fi;
+    memset(&fi, 0, sizeof(fi));
+    REQUIRE(fs->fuseMknod("/file", S_IFREG | 0644, 0) == 0);
+    REQUIRE(fs->fuseMknod("/other", S_IFREG | 0644, 0) == 0);
+    REQUIRE(fs->fuseOpen("/file", &fi) == 0);
+    int index = fs->getFileIndex("/file");
+
+    REQUIRE(fs->fuseWrite("/file", w, size, 0, &fi) == (int) size);
+    checkBlockMap(fs, index);
+
+    // Shrink while another file grows
+    REQUIRE(fs->fuseTruncate("/file", size / 4, &fi) == 0);
+    REQUIRE(fs->fuseWrite("/other", w, size, 0, nullptr) == (int) size);
+    checkBlockMap(fs, index);
+    REQUIRE(fs->fuseRead("/file", r, size, 0, &fi) == (int) size / 4);
+    REQUIRE(memcmp(r, w, size / 4) == 0);
+
+    // Regrow through the handle
+    REQUIRE(fs->fuseWrite("/file", w + size / 4, size - size / 4, size / 4, &fi) == (int) (size - size / 4));
+    checkBlockMap(fs, index);
+    REQUIRE(fs->fuseRead("/file", r, size, 0, &fi) == (int) size);
+    REQUIRE(memcmp(r, w, size) == 0);
+    checkBlockMap(fs, fs->getFileIndex("/other"));
+
+    // After unlinking, the handle does not reach a new file in the same FAT entry
+    REQUIRE(fs->fuseUnlink("/file") == 0);
+    REQUIRE(fs->fat[index].nrBlocks == 0);
+    REQUIRE(fs->blockMaps[index].empty());
+    REQUIRE(fs->fuseMknod("/new", S_IFREG | 0644, 0) == 0);
+    REQUIRE(fs->getFileIndex("/new") == index);
+    REQUIRE(fs->fuseWrite("/new", w, BLOCK_SIZE, 0, nullptr) == BLOCK_SIZE);
+    checkBlockMap(fs, index);
+    REQUIRE(fs->fuseRead("/file", r, size, 0, &fi) == -ENOENT);
+    REQUIRE(fs->fuseRelease("/file", &fi) == 0);
+
+    delete[] w;
+    delete[] r;
+    fs->fuseDestroy();
+    delete fs;
+    remove(MAPS_PATH);
+}
+
+TEST_CASE( "MYFS_LAZY_TIMESTAMPS", "[myfs]" ) {
+    remove(TS_PATH);
+
+    MyFsInfo info;
+    memset(&info, 0, sizeof(info));
+    info.contFile = (char *) TS_PATH;
+    info.logFile = (char *) "/dev/null";
+    info.atimeMode = ATIME_STRICT;
+
+    MyOnDiskFS *fs = mountOnDisk(&info);
+    char buf[BLOCK_SIZE];
+    memset(buf, 'x', BLOCK_SIZE);
+    REQUIRE(fs->fuseMknod("/file", S_IFREG | 0644, 0) == 0);
+    REQUIRE(fs->fuseWrite("/file", buf, BLOCK_SIZE, 0, nullptr) == BLOCK_SIZE);
+
+    SECTION("stat, open and read do not write the FAT") {
+        uint64_t updates = fs->metaUpdates;
+
+        struct stat st;
+        struct fuse_file_info fi;
+        memset(&fi, 0, sizeof(fi));
+        for (int i = 0; i < 100; i++) {
+            REQUIRE(fs->fuseGetattr("/file", &st) == 0);
+        }
+        REQUIRE(fs->fuseOpen("/file", &fi) == 0);
+        REQUIRE(fs->fuseRead("/file", buf, BLOCK_SIZE, 0, &fi) == BLOCK_SIZE);
+        REQUIRE(fs->fuseRelease("/file", &fi) == 0);
+
+        REQUIRE(fs->metaUpdates == updates);
+    }
+
+    SECTION("pending timestamps are written on flush") {
+        int index = fs->getFileIndex("/file");
+        fs->fat[index].accessTime = 1000;
+        fs->fat[index].modTime = 1000;
+        fs->fat[index].changeTime = 1000;
+
+        REQUIRE(fs->fuseRead("/file", buf, BLOCK_SIZE, 0, nullptr) == BLOCK_SIZE);
+        int accessTime = fs->fat[index].accessTime;
+        REQUIRE(accessTime > 1000);
+        REQUIRE(fs->fuseWrite("/file", buf, BLOCK_SIZE, 0, nullptr) == BLOCK_SIZE);
+        int modTime = fs->fat[index].modTime;
+        REQUIRE(modTime > 1000);
+
+        REQUIRE(fs->fuseFlush("/file", nullptr) == 0);
+        delete fs;
+
+        // Remount without fuseDestroy(), so only flushed data is seen
+        fs = mountOnDisk(&info);
+        struct stat st;
+        REQUIRE(fs->fuseGetattr("/file", &st) == 0);
+        REQUIRE(st.st_atime == accessTime);
+        REQUIRE(st.st_mtime == modTime);
+        REQUIRE(st.st_ctime == modTime);
+    }
+
+    fs->fuseDestroy();
+    delete fs;
+    remove(TS_PATH);
+}
+
+TEST_CASE( "MYFS_ATIME_MODES", "[myfs]" ) {
+    remove(TS_PATH);
+
+    MyFsInfo info;
+    memset(&info, 0, sizeof(info));
+    info.contFile = (char *) TS_PATH;
+    info.logFile = (char *) "/dev/null";
+
+    char buf[BLOCK_SIZE];
+    memset(buf, 'x', BLOCK_SIZE);
+    int now = time(0);
+
+    SECTION("noatime") {
+        info.atimeMode = ATIME_NONE;
+        MyOnDiskFS *fs = mountOnDisk(&info);
+        REQUIRE(fs->fuseMknod("/file", S_IFREG | 0644, 0) == 0);
+        REQUIRE(fs->fuseWrite("/file", buf, BLOCK_SIZE, 0, nullptr) == BLOCK_SIZE);
+        int index = fs->getFileIndex("/file");
+
+        fs->fat[index].accessTime = 1000;
+        REQUIRE(fs->fuseRead("/file", buf, BLOCK_SIZE, 0, nullptr) == BLOCK_SIZE);
+        REQUIRE(fs->fat[index].accessTime == 1000);
+
+        fs->fuseDestroy();
+        delete fs;
+    }
+
+    SECTION("strictatime") {
+        info.atimeMode = ATIME_STRICT;
+        MyOnDiskFS *fs = mountOnDisk(&info);
+        REQUIRE(fs->fuseMknod("/file", S_IFREG | 0644, 0) == 0);
+        REQUIRE(fs->fuseWrite("/file", buf, BLOCK_SIZE, 0, nullptr) == BLOCK_SIZE);
+        int index = fs->getFileIndex("/file");
+
+        fs->fat[index].accessTime = now + 1000;
+        REQUIRE(fs->fuseRead("/file", buf, BLOCK_SIZE, 0, nullptr) == BLOCK_SIZE);
+        REQUIRE(fs->fat[index].accessTime <= (int) time(0));
+
+        fs->fuseDestroy();
+        delete fs;
+    }
+
+    SECTION("relatime") {
+        info.atimeMode = ATIME_RELATIME;
+        MyOnDiskFS *fs = mountOnDisk(&info);
+        REQUIRE(fs->fuseMknod("/file", S_IFREG | 0644, 0) == 0);
+        REQUIRE(fs->fuseWrite("/file", buf, BLOCK_SIZE, 0, nullptr) == BLOCK_SIZE);
+        int index = fs->getFileIndex("/file");
+        fs->fat[index].modTime = now - 100;
+        fs->fat[index].changeTime = now - 100;
+
+        // Accessed after the last change: no update
+        fs->fat[index].accessTime = now - 50;
+        REQUIRE(fs->fuseRead("/file", buf, BLOCK_SIZE, 0, nullptr) == BLOCK_SIZE);
+        REQUIRE(fs->fat[index].accessTime == now - 50);
+
+        // Changed after the last access: update
+        fs->fat[index].accessTime = now - 200;
+        REQUIRE(fs->fuseRead("/file", buf, BLOCK_SIZE, 0, nullptr) == BLOCK_SIZE);
+        REQUIRE(fs->fat[index].accessTime >= now);
+
+        // Last access more than a day ago: update
+        fs->fat[index].modTime = now - 3 * RELATIME_INTERVAL_S;
+        fs->fat[index].changeTime = now - 3 * RELATIME_INTERVAL_S;
+        fs->fat[index].accessTime = now - 2 * RELATIME_INTERVAL_S;
+        REQUIRE(fs->fuseRead("/file", buf, BLOCK_SIZE, 0, nullptr) == BLOCK_SIZE);
+        REQUIRE(fs->fat[index].accessTime >= now);
+
+        fs->fuseDestroy();
+        delete fs;
+    }
+
+    remove(TS_PATH);
+}
+
+// Copy the content of a buffer vector returned by fuseReadBuf() into memory
+size_t copyBufvec(struct fuse_bufvec *src, char *buf, size_t size) {
+    struct fuse_bufvec dst;
+    memset(&dst, 0, sizeof(dst));
+    dst.count = 1;
+    dst.buf[0].size = size;
+    dst.buf[0].mem = buf;
+    dst.buf[0].fd = -1;
+    ssize_t copied = fuse_buf_copy(&dst, src, (enum fuse_buf_copy_flags) 0);
+    return copied < 0 ? 0 : copied;
+}
+
+TEST_CASE( "MYFS_ZERO_COPY", "[myfs]" ) {
+    const size_t fileSize = 256 * 1024;
+
+    remove(TS_PATH);
+
+    MyFsInfo info;
+    memset(&info, 0, sizeof(info));
+    info.contFile = (char *) TS_PATH;
+    info.logFile = (char *) "/dev/null";
+    info.writeBack = GENERATE(0, 1);
+
+    MyOnDiskFS *fs = mountOnDisk(&info);
+    char *model = new char[fileSize];
+    char *r = new char[fileSize];
+    gen_random(model, fileSize);
+
+    // Interleave two files, so their blocks are not contiguous
+    REQUIRE(fs->fuseMknod("/file", S_IFREG | 0644, 0) == 0);
+    REQUIRE(fs->fuseMknod("/other", S_IFREG | 0644, 0) == 0);
+    for (size_t off = 0; off < fileSize; off += 8192) {
+        REQUIRE(fs->fuseWrite("/file", model + off, 8192, off, nullptr) == 8192);
+        REQUIRE(fs->fuseWrite("/other", model, 1000, off, nullptr) == 1000);
+    }
+
+    SECTION("read buffers show cached data") {
+        struct fuse_bufvec *bufvec;
+        REQUIRE(fs->fuseReadBuf("/file", &bufvec, 100000, 1234, nullptr) == 0);
+        REQUIRE(fuse_buf_size(bufvec) == 100000);
+        REQUIRE(bufvec->count > 1);
+        REQUIRE((bufvec->buf[0].flags & FUSE_BUF_IS_FD) != 0);
+        REQUIRE(copyBufvec(bufvec, r, 100000) == 100000);
+        REQUIRE(memcmp(r, model + 1234, 100000) == 0);
+        free(bufvec);
+
+        // Small and past-the-end requests go through memory
+        REQUIRE(fs->fuseReadBuf("/file", &bufvec, 100, 50, nullptr) == 0);
+        REQUIRE((bufvec->buf[0].flags & FUSE_BUF_IS_FD) == 0);
+        REQUIRE(copyBufvec(bufvec, r, 100) == 100);
+        REQUIRE(memcmp(r, model + 50, 100) == 0);
+        free(bufvec->buf[0].mem);
+        free(bufvec);
+
+        REQUIRE(fs->fuseReadBuf("/file", &bufvec, 100000, fileSize - 1000, nullptr) == 0);
+        REQUIRE(fuse_buf_size(bufvec) == 1000);
+        free(bufvec);
+    }
+
+    SECTION("a short copy does not enlarge the file") {
+        // The source file ends after 20000 of the announced 100000 bytes
+        const char *srcPath = "/tmp/short-src.bin";
+        FILE *f = fopen(srcPath, "w+");
+        REQUIRE(f != nullptr);
+        REQUIRE(fwrite(model, 1, 20000, f) == 20000);
+        fflush(f);
+
+        struct fuse_bufvec src;
+        memset(&src, 0, sizeof(src));
+        src.count = 1;
+        src.buf[0].size = 100000;
+        src.buf[0].flags = (enum fuse_buf_flags) (FUSE_BUF_IS_FD | FUSE_BUF_FD_SEEK);
+        src.buf[0].fd = fileno(f);
+        src.buf[0].pos = 0;
+        REQUIRE(fs->fuseWriteBuf("/file", &src, fileSize, nullptr) == 20000);
+        fclose(f);
+        remove(srcPath);
+
+        struct stat st;
+        REQUIRE(fs->fuseGetattr("/file", &st) == 0);
+        REQUIRE(st.st_size == (off_t) fileSize + 20000);
+        REQUIRE(fs->fuseRead("/file", r, 20000, fileSize, nullptr) == 20000);
+        REQUIRE(memcmp(r, model, 20000) == 0);
+    }
+
+    SECTION("several threads get memory buffers") {
+        fs->fuseDestroy();
+        delete fs;
+        info.multiThreaded = 1;
+        fs = mountOnDisk(&info);
+
+        struct fuse_bufvec *bufvec;
+        REQUIRE(fs->fuseReadBuf("/file", &bufvec, 100000, 1234, nullptr) == 0);
+        REQUIRE(bufvec->count == 1);
+        REQUIRE((bufvec->buf[0].flags & FUSE_BUF_IS_FD) == 0);
+        REQUIRE(copyBufvec(bufvec, r, 100000) == 100000);
+        REQUIRE(memcmp(r, model + 1234, 100000) == 0);
+        free(bufvec->buf[0].mem);
+        free(bufvec);
+    }
+
+    SECTION("written buffers replace cached data") {
+        char *w = new char[100000];
+        gen_random(w, 100000);
+        memcpy(model + 5000, w, 100000);
+
+        struct fuse_bufvec src;
+        memset(&src, 0, sizeof(src));
+        src.count = 1;
+        src.buf[0].size = 100000;
+        src.buf[0].mem = w;
+        src.buf[0].fd = -1;
+        REQUIRE(fs->fuseWriteBuf("/file", &src, 5000, nullptr) == 100000);
+
+        // Extend the file
+        src.idx = 0;
+        src.off = 0;
+        REQUIRE(fs->fuseWriteBuf("/file", &src, fileSize, nullptr) == 100000);
+
+        REQUIRE(fs->fuseRead("/file", r, fileSize, 0, nullptr) == (int) fileSize);
+        REQUIRE(memcmp(r, model, fileSize) == 0);
+        REQUIRE(fs->fuseRead("/file", r, 100000, fileSize, nullptr) == 100000);
+        REQUIRE(memcmp(r, w, 100000) == 0);
+
+        // Contents survive a remount
+        fs->fuseDestroy();
+        delete fs;
+        fs = mountOnDisk(&info);
+        REQUIRE(fs->fuseRead("/file", r, fileSize, 0, nullptr) == (int) fileSize);
+        REQUIRE(memcmp(r, model, fileSize) == 0);
+        REQUIRE(fs->fuseRead("/other", r, 1000, 8192, nullptr) == 1000);
+        REQUIRE(memcmp(r, model, 1000) == 0);
+        delete[] w;
+    }
+
+    fs->fuseDestroy();
+    delete fs;
+    delete[] model;
+    delete[] r;
+    remove(TS_PATH);
+}
+
+static uint64_t getMetric(MyOnDiskFS *fs, const char *name) {
+    std::string text;
+    fs->formatStats(text);
+    size_t pos = text.find("\n" + std::string(name) + " ");
+    REQUIRE(pos != std::string::npos);
+    return strtoull(text.c_str() + pos + strlen(name) + 2, nullptr, 10);
+}
+
+TEST_CASE( "MYFS_READAHEAD", "[myfs]" ) {
+    const size_t fileSize = 1024 * 1024;
+    const size_t requestSize = 4096;
+
+    remove(TS_PATH);
+
+    MyFsInfo info;
+    memset(&info, 0, sizeof(info));
+    info.contFile = (char *) TS_PATH;
+    info.logFile = (char *) "/dev/null";
+    info.writeBack = GENERATE(0, 1);
+
+    MyOnDiskFS *fs = mountOnDisk(&info);
+    REQUIRE(fs->maxReadaheadBlocks > 0);
+    char *model = new char[fileSize];
+    char *r = new char[fileSize];
+    gen_random(model, fileSize);
+
+    // Interleave two files, so their blocks are not contiguous
+    REQUIRE(fs->fuseMknod("/file", S_IFREG | 0644, 0) == 0);
+    REQUIRE(fs->fuseMknod("/other", S_IFREG | 0644, 0) == 0);
+    for (size_t off = 0; off < fileSize; off += 65536) {
+        REQUIRE(fs->fuseWrite("/file", model + off, 65536, off, nullptr) == 65536);
+        REQUIRE(fs->fuseWrite("/other", model, 1000, off, nullptr) == 1000);
+    }
+
+    // Start with an empty cache
+    fs->fuseDestroy();
+    delete fs;
+    fs = mountOnDisk(&info);
+
+    struct fuse_file_info fi;
+    memset(&fi, 0, sizeof(fi));
+    REQUIRE(fs->fuseOpen("/file", &fi) == 0);
+    OpenFile *file = (OpenFile *) fi.fh;
+
+    // The first read prefetches the blocks behind it
+    REQUIRE(fs->fuseRead("/file", r, requestSize, 0, &fi) == (int) requestSize);
+    for (int i = 0; i < 100 && getMetric(fs, "myfs_cache_prefetched_blocks_total") == 0; i++) {
+        usleep(10000);
+    }
+    REQUIRE(getMetric(fs, "myfs_cache_prefetched_blocks_total") > 0);
+
+    // Sequential reads use them and grow the window to its maximum
+    for (size_t off = requestSize; off < fileSize; off += requestSize) {
+        REQUIRE(fs->fuseRead("/file", r + off, requestSize, off, &fi) == (int) requestSize);
+    }
+    REQUIRE(memcmp(r, model, fileSize) == 0);
+    REQUIRE(getMetric(fs, "myfs_cache_prefetch_hits_total") > 0);
+    REQUIRE(file->window == fs->maxReadaheadBlocks);
+    REQUIRE(file->prefetchedEnd == fileSize / BLOCK_SIZE);
+
+    // Random reads shrink it until nothing is prefetched
+    for (int i = 0; i < 16; i++) {
+        off_t off = fileSize - (i + 1) * 65536 + 100;
+        REQUIRE(fs->fuseRead("/file", r, requestSize, off, &fi) == (int) requestSize);
+        REQUIRE(memcmp(r, model + off, requestSize) == 0);
+    }
+    REQUIRE(file->window == 0);
+
+    // Without a file handle, reads are not tracked
+    REQUIRE(fs->fuseRead("/file", r, fileSize, 0, nullptr) == (int) fileSize);
+    REQUIRE(memcmp(r, model, fileSize) == 0);
+
+    REQUIRE(fs->fuseRelease("/file", &fi) == 0);
+
+    fs->fuseDestroy();
+    delete fs;
+    delete[] model;
+    delete[] r;
+    remove(TS_PATH);
+}
+
+TEST_CASE( "MYFS_MEMORY_PAGES", "[myfs]" ) {
+    MyFsInfo info;
+    memset(&info, 0, sizeof(info));
+    info.logFile = (char *) "/dev/null";
+
+    MyInMemoryFS *fs = new MyInMemoryFS();
+    REQUIRE(fs->setup(&info) == 0);
+
+    const size_t fileSize = 10 * MEM_PAGE_SIZE + 123;
+    char *w = new char[fileSize];
+    char *r = new char[fileSize];
+    gen_random(w, fileSize);
+
+    // Append in odd pieces that straddle page boundaries
+    REQUIRE(fs->fuseMknod("/a", S_IFREG | 0644, 0) == 0);
+    for (size_t off = 0; off < fileSize; off += 1000) {
+        size_t n = std::min((size_t) 1000, fileSize - off);
+        REQUIRE(fs->fuseWrite("/a", w + off, n, off, nullptr) == (int) n);
+    }
+    REQUIRE(fs->pagePool.getUsed() == 11);
+    REQUIRE(fs->fuseRead("/a", r, fileSize, 0, nullptr) == (int) fileSize);
+    REQUIRE(memcmp(r, w, fileSize) == 0);
+
+    SECTION("truncated and extended files read zeros in the gap") {
+        REQUIRE(fs->fuseTruncate("/a", 100) == 0);
+        REQUIRE(fs->pagePool.getUsed() == 1);
+        REQUIRE(fs->fuseTruncate("/a", 2 * MEM_PAGE_SIZE) == 0);
+        REQUIRE(fs->fuseRead("/a", r, fileSize, 0, nullptr) == 2 * MEM_PAGE_SIZE);
+        REQUIRE(memcmp(r, w, 100) == 0);
+        for (size_t i = 100; i < 2 * MEM_PAGE_SIZE; i++) {
+            REQUIRE(r[i] == 0);
+        }
+    }
+
+    SECTION("pages of deleted files are reused and cleared") {
+        REQUIRE(fs->fuseUnlink("/a") == 0);
+        REQUIRE(fs->pagePool.getUsed() == 0);
+        REQUIRE(fs->pagePool.getFree() == MEM_PAGES_PER_ARENA);
+
+        REQUIRE(fs->fuseMknod("/b", S_IFREG | 0644, 0) == 0);
+        REQUIRE(fs->fuseWrite("/b", "x", 1, 3 * MEM_PAGE_SIZE, nullptr) == 1);
+        REQUIRE(fs->pagePool.getFree() == MEM_PAGES_PER_ARENA - 4);
+        REQUIRE(fs->fuseRead("/b", r, fileSize, 0, nullptr) == 3 * MEM_PAGE_SIZE + 1);
+        for (size_t i = 0; i < 3 * MEM_PAGE_SIZE; i++) {
+            REQUIRE(r[i] == 0);
+        }
+        REQUIRE(r[3 * MEM_PAGE_SIZE] == 'x');
+    }
+
+    delete[] w;
+    delete[] r;
+    fs->fuseDestroy();
+    delete fs;
+}
+
+TEST_CASE( "MYFS_FORMAT_V2", "[myfs]" ) {
+    remove(FORMAT_PATH);
+
+    MyFsInfo info;
+    memset(&info, 0, sizeof(info));
+    info.contFile = (char *) FORMAT_PATH;
+    info.logFile = (char *) "/dev/null";
+    info.containerSize = (char *) "64M";
+
+    MyOnDiskFS *fs = mountOnDisk(&info);
+    REQUIRE(fs->layout.version == FORMAT_VERSION_2);
+    REQUIRE(fs->layout.totalBlocks == 64 * 1024 * 1024 / BLOCK_SIZE);
+    REQUIRE(fs->layout.fatEntries == 64 * 1024 * 1024 / BYTES_PER_FAT_ENTRY);
+    REQUIRE(fs->layout.journalBlocks >= Journal::minLength(BLOCK_SIZE, fs->layout.fatBlocks + fs->layout.bltBlocks));
+
+    struct statvfs st;
+    REQUIRE(fs->fuseStatfs("/", &st) == 0);
+    REQUIRE(st.f_files == fs->layout.fatEntries);
+    REQUIRE(st.f_bfree == st.f_blocks);
+
+    // More blocks than 16 bit block numbers can address
+    const size_t size = 40 * 1024 * 1024;
+    char *w = new char[size];
+    char *r = new char[size];
+    gen_random(w, size);
+    REQUIRE(fs->fuseMknod("/big", S_IFREG | 0644, 0) == 0);
+    REQUIRE(fs->fuseWrite("/big", w, size, 0, nullptr) == (int) size);
+
+    // More files than a version 1 FAT holds
+    char name[16];
+    for (int i = 0; i < 100; i++) {
+        sprintf(name, "/f%d", i);
+        REQUIRE(fs->fuseMknod(name, S_IFREG | 0644, 0) == 0);
+    }
+
+    fs->fuseDestroy();
+    delete fs;
+
+    // The superblock is stored little endian
+    unsigned char sbBytes[16];
+    FILE *cont = fopen(FORMAT_PATH, "rb");
+    REQUIRE(cont != nullptr);
+    REQUIRE(fread(sbBytes, 1, sizeof(sbBytes), cont) == sizeof(sbBytes));
+    fclose(cont);
+    const unsigned char sbImage[16] = {0, 'M', 'Y', 'F', 'S', 'S', 'B', '2', 2, 0, 0, 0, 0x00, 0x02, 0, 0};
+    REQUIRE(memcmp(sbBytes, sbImage, sizeof(sbImage)) == 0);
+
+    fs = mountOnDisk(&info);
+    REQUIRE(fs->layout.version == FORMAT_VERSION_2);
+    int index = fs->getFileIndex("/big");
+    REQUIRE(index >= 0);
+    REQUIRE(fs->fat[index].nrBlocks == size / BLOCK_SIZE);
+    REQUIRE(fs->getBlockMap(index)[size / BLOCK_SIZE - 1] > 0xFFFF);
+    REQUIRE(fs->fuseRead("/big", r, size, 0, nullptr) == (int) size);
+    REQUIRE(memcmp(r, w, size) == 0);
+    REQUIRE(fs->fuseGetattr("/f99", (struct stat *) r) == 0);
+
+    REQUIRE(fs->fuseStatfs("/", &st) == 0);
+    REQUIRE(st.f_ffree == st.f_files - 101);
+    REQUIRE(st.f_bfree == st.f_blocks - size / BLOCK_SIZE);
+
+
+    delete[] w;
+    delete[] r;
+    fs->fuseDestroy();
+    delete fs;
+
+    // A transaction dirtying more BLT blocks than the default journal holds still goes through the log
+    remove(FORMAT_PATH);
+    info.containerSize = (char *) "256M";
+    fs = mountOnDisk(&info);
+    REQUIRE(fs->fuseMknod("/big", S_IFREG | 0644, 0) == 0);
+    REQUIRE(fs->journal->commit(false) == 0);
+    Journal::Stats before = fs->journal->getStats();
+    REQUIRE(fs->fuseTruncate("/big", 200 * 1024 * 1024) == 0);
+    REQUIRE(fs->journal->commit(false) == 0);
+    REQUIRE(fs->journal->getStats().blocksWritten - before.blocksWritten > (uint64_t) JOURNAL_BLOCKS);
+    fs->fuseDestroy();
+    delete fs;
+
+    // Too small for the metadata
+    remove(FORMAT_PATH);
+    info.containerSize = (char *) "1M";
+    fs = new MyOnDiskFS();
+    REQUIRE(fs->setup(&info) == -EINVAL);
+    delete fs;
+    remove(FORMAT_PATH);
+}
+
+TEST_CASE( "MYFS_BLOCK_SIZE", "[myfs]" ) {
+    remove(FORMAT_PATH);
+
+    MyFsInfo info;
+    memset(&info, 0, sizeof(info));
+    info.contFile = (char *) FORMAT_PATH;
+    info.logFile = (char *) "/dev/null";
+    info.blockSize = (char *) "64K";
+
+    MyOnDiskFS *fs = mountOnDisk(&info);
+    REQUIRE(fs->layout.blockSize == 64 * 1024);
+
+    struct statvfs st;
+    REQUIRE(fs->fuseStatfs("/", &st) == 0);
+    REQUIRE(st.f_bsize == 64 * 1024);
+    REQUIRE(st.f_blocks == fs->layout.totalBlocks - fs->layout.journalStart - fs->layout.journalBlocks);
+
+    // Requests that start and end within blocks
+    const size_t size = 300 * 1024 + 17;
+    char *w = new char[size];
+    char *r = new char[size];
+    gen_random(w, size);
+    REQUIRE(fs->fuseMknod("/file", S_IFREG | 0644, 0) == 0);
+    for (size_t off = 0; off < size; off += 10000) {
+        size_t n = std::min((size_t) 10000, size - off);
+        REQUIRE(fs->fuseWrite("/file", w + off, n, off, nullptr) == (int) n);
+    }
+    REQUIRE(fs->fuseStatfs("/", &st) == 0);
+    REQUIRE(st.f_bfree == st.f_blocks - 5);
+    fs->fuseDestroy();
+    delete fs;
+
+    // The block size is taken from the superblock, invalid block sizes for new containers are replaced by the default
+    info.blockSize = (char *) "3000";
+    fs = mountOnDisk(&info);
+    REQUIRE(fs->layout.blockSize == 64 * 1024);
+    REQUIRE(fs->fuseRead("/file", r, size, 0, nullptr) == (int) size);
+    REQUIRE(memcmp(r, w, size) == 0);
+    REQUIRE(fs->fuseRead("/file", r, 100, 65500, nullptr) == 100);
+    REQUIRE(memcmp(r, w + 65500, 100) == 0);
+    fs->fuseDestroy();
+    delete fs;
+
+    remove(FORMAT_PATH);
+    fs = mountOnDisk(&info);
+    REQUIRE(fs->layout.blockSize == BLOCK_SIZE);
+    fs->fuseDestroy();
+    delete fs;
+
+    delete[] w;
+    delete[] r;
+    remove(FORMAT_PATH);
+}
+
+TEST_CASE( "MYFS_FORMAT_V1", "[myfs]" ) {
+    remove(FORMAT_PATH);
+
+    // Version 1 container with the file "old" in blocks 300 and 301
+    {
+        BlockDevice bd(BD_BLOCK_SIZE);
+        REQUIRE(bd.create(FORMAT_PATH) == 0);
+
+        char block[BD_BLOCK_SIZE];
+        memset(block, 0, BD_BLOCK_SIZE);
+        int mode = S_IFREG | 0644, now = time(0);
+        unsigned short startBlock = 300, nrBlocks = 2;
+        int fileSize = 600;
+        strcpy(block, "old");
+        memcpy(block + 32, &mode, 4);
+        memcpy(block + 44, &now, 4);
+        memcpy(block + 48, &now, 4);
+        memcpy(block + 52, &now, 4);
+        memcpy(block + 56, &startBlock, 2);
+        memcpy(block + 58, &nrBlocks, 2);
+        memcpy(block + 60, &fileSize, 4);
+        REQUIRE(bd.write(0, block) == 0);
+
+        unsigned short *blt = new unsigned short[TOTAL_BLT_ENTRIES];
+        for (int i = 0; i < TOTAL_BLT_ENTRIES; i++) {
+            blt[i] = i < FAT_BLOCKS + BLT_BLOCKS ? BLT_RSV : BLT_FREE;
+        }
+        blt[300] = 301;
+        blt[301] = BLT_EOF;
+        REQUIRE(bd.writeBlocks(FAT_BLOCKS, BLT_BLOCKS, (char *) blt) == 0);
+        delete[] blt;
+
+        memset(block, 'a', BD_BLOCK_SIZE);
+        REQUIRE(bd.write(300, block) == 0);
+        memset(block, 'b', BD_BLOCK_SIZE);
+        REQUIRE(bd.write(301, block) == 0);
+    }
+
+    MyFsInfo info;
+    memset(&info, 0, sizeof(info));
+    info.contFile = (char *) FORMAT_PATH;
+    info.logFile = (char *) "/dev/null";
+
+    MyOnDiskFS *fs = mountOnDisk(&info);
+    REQUIRE(fs->layout.version == FORMAT_VERSION_1);
+    REQUIRE(fs->journal == nullptr);
+
+    char buf[1024];
+    REQUIRE(fs->fuseRead("/old", buf, sizeof(buf), 0, nullptr) == 600);
+    REQUIRE(buf[0] == 'a');
+    REQUIRE(buf[511] == 'a');
+    REQUIRE(buf[512] == 'b');
+    REQUIRE(buf[599] == 'b');
+
+    struct statvfs st;
+    REQUIRE(fs->fuseStatfs("/", &st) == 0);
+    REQUIRE(st.f_blocks == TOTAL_BLT_ENTRIES - FAT_BLOCKS - BLT_BLOCKS);
+    REQUIRE(st.f_bfree == st.f_blocks - 2);
+    REQUIRE(st.f_files == TOTAL_FAT_ENTRIES);
+
+    // The container keeps its format and file limit
+    memset(buf, 'c', sizeof(buf));
+    REQUIRE(fs->fuseMknod("/new", S_IFREG | 0644, 0) == 0);
+    REQUIRE(fs->fuseWrite("/new", buf, sizeof(buf), 0, nullptr) == sizeof(buf));
+    char name[16];
+    for (int i = 2; i < TOTAL_FAT_ENTRIES; i++) {
+        sprintf(name, "/f%d", i);
+        REQUIRE(fs->fuseMknod(name, S_IFREG | 0644, 0) == 0);
+    }
+    REQUIRE(fs->fuseMknod("/full", S_IFREG | 0644, 0) == -ENOSPC);
+    fs->fuseDestroy();
+    delete fs;
+
+    fs = mountOnDisk(&info);
+    REQUIRE(fs->layout.version == FORMAT_VERSION_1);
+    memset(buf, 0, sizeof(buf));
+    REQUIRE(fs->fuseRead("/new", buf, sizeof(buf), 0, nullptr) == sizeof(buf));
+    REQUIRE(buf[0] == 'c');
+    REQUIRE(buf[sizeof(buf) - 1] == 'c');
+    REQUIRE(fs->fuseRead("/old", buf, sizeof(buf), 0, nullptr) == 600);
+    REQUIRE(buf[599] == 'b');
+    REQUIRE(fs->fuseStatfs("/", &st) == 0);
+    REQUIRE(st.f_bfree == st.f_blocks - 4);
+    fs->fuseDestroy();
+    delete fs;
+
+    remove(FORMAT_PATH);
+}
+
+TEST_CASE( "MYFS_FAT_BYTE_ORDER", "[myfs]" ) {
+    MyOnDiskFS *fs = createOnDisk(FAT_ORDER_PATH);
+    REQUIRE(fs->layout.version == FORMAT_VERSION_2);
+
+    // Entry 1 of the first FAT block, as a version 2 container stores it
+    const unsigned char image[FAT_ENTRY_SIZE_V2] = {
+            'a', 'b', 'c', 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+            0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+            0x04, 0x03, 0x02, 0x01,                             // uid
+            0x08, 0x07, 0x06, 0x05,                             // groupId
+            0xa4, 0x81, 0x00, 0x00,                             // mode
+            0x44, 0x33, 0x22, 0x11,                             // accessTime
+            0xfe, 0xff, 0xff, 0xff,                             // modTime
+            0x0d, 0x0c, 0x0b, 0x0a,                             // changeTime
+            0xef, 0xcd, 0xab, 0x00,                             // startBlock
+            0x78, 0x56, 0x34, 0x12,                             // nrBlocks
+            0x89, 0x67, 0x45, 0x23, 0x01, 0x00, 0x00, 0x00};    // size
+
+    fatEntry e = fatEntry();
+    strcpy(e.filename, "abc");
+    e.uid = 0x01020304;
+    e.groupId = 0x05060708;
+    e.mode = S_IFREG | 0644;
+    e.accessTime = 0x11223344;
+    e.modTime = -2;
+    e.changeTime = 0x0a0b0c0d;
+    e.startBlock = 0xabcdef;
+    e.nrBlocks = 0x12345678;
+    e.size = 0x123456789LL;
+    fs->fat[1] = e;
+
+    std::vector<char> block(fs->layout.blockSize);
+    fs->encodeFatBlock(0, block.data());
+    REQUIRE(memcmp(block.data() + FAT_ENTRY_SIZE_V2, image, sizeof(image)) == 0);
+
+    // Decoding the image yields the entry again
+    fs->fat[1] = fatEntry();
+    fs->decodeFatBlock(0, block.data());
+    REQUIRE(strcmp(fs->fat[1].filename, "abc") == 0);
+    REQUIRE(fs->fat[1].uid == e.uid);
+    REQUIRE(fs->fat[1].groupId == e.groupId);
+    REQUIRE(fs->fat[1].mode == e.mode);
+    REQUIRE(fs->fat[1].accessTime == e.accessTime);
+    REQUIRE(fs->fat[1].modTime == e.modTime);
+    REQUIRE(fs->fat[1].changeTime == e.changeTime);
+    REQUIRE(fs->fat[1].startBlock == e.startBlock);
+    REQUIRE(fs->fat[1].nrBlocks == e.nrBlocks);
+    REQUIRE(fs->fat[1].size == e.size);
+
+    // The entry was never marked dirty, drop it before unmounting
+    fs->fat[1] = fatEntry();
+    fs->fuseDestroy();
+    delete fs;
+    remove(FAT_ORDER_PATH);
+}
+
+TEST_CASE( "MYFS_EXTENTS", "[myfs]" ) {
+    MyOnDiskFS *fs = createOnDisk(EXTENT_PATH);
+    REQUIRE(fs->fuseMknod("/a", S_IFREG | 0644, 0) == 0);
+    REQUIRE(fs->fuseMknod("/b", S_IFREG | 0644, 0) == 0);
+
+    // Appending to two files in turn does not interleave their blocks
+    const size_t chunk = 8 * BLOCK_SIZE;
+    const int rounds = 200;
+    char buf[chunk];
+    memset(buf, 'x', sizeof(buf));
+    for (int i = 0; i < rounds; i++) {
+        REQUIRE(fs->fuseWrite("/a", buf, chunk, (off_t) i * chunk, nullptr) == (int) chunk);
+        REQUIRE(fs->fuseWrite("/b", buf, chunk, (off_t) i * chunk, nullptr) == (int) chunk);
+    }
+    REQUIRE(countExtents(fs, "/a") <= 2);
+    REQUIRE(countExtents(fs, "/b") <= 2);
+
+    // Still true after remounting, the block maps are rebuilt from the BLT
+    fs->fuseDestroy();
+    delete fs;
+    fs = mountOnDisk(EXTENT_PATH);
+    REQUIRE(countExtents(fs, "/a") <= 2);
+    REQUIRE(countExtents(fs, "/b") <= 2);
+
+    fs->fuseDestroy();
+    delete fs;
+    remove(EXTENT_PATH);
+}
@@ -0,0 +1,76 @@
+//
+//  utest-nameindex.cpp
+//  testing
+//
+
+#include "../catch/catch.hpp"
+
+#include <stdio.h>
+#include <string.h>
+
+#include "nameindex.h"
+
+#define NUM_NAMES 1000
+
+TEST_CASE( "NI_INSERT_FIND_ERASE", "[nameindex]" ) {
+
+    NameIndex<int> index;
+    char names[NUM_NAMES][16];
+
+    for(int i= 0; i < NUM_NAMES; i++) {
+        snprintf(names[i], sizeof(names[i]), "file-%d", i);
+        REQUIRE(index.insert(names[i], i));
+    }
+    REQUIRE(index.size() == NUM_NAMES);
+
+    SECTION("all names are found") {
+        char name[16];
+        for(int i= 0; i < NUM_NAMES; i++) {
+            // look up with a different string of the same content
+            snprintf(name, sizeof(name), "file-%d", i);
+            int *value= index.find(name);
+            REQUIRE(value != nullptr);
+            REQUIRE(*value == i);
+        }
+        REQUIRE(index.find("file-") == nullptr);
+        REQUIRE(index.find("") == nullptr);
+    }
+
+    SECTION("duplicate names are rejected") {
+        char name[16]= "file-7";
+        REQUIRE_FALSE(index.insert(name, -1));
+        REQUIRE(*index.find("file-7") == 7);
+        REQUIRE(index.size() == NUM_NAMES);
+    }
+
+    SECTION("erased names are gone, others remain") {
+        for(int i= 0; i < NUM_NAMES; i += 2) {
+            REQUIRE(index.erase(names[i]));
+        }
+        REQUIRE_FALSE(index.erase(names[0]));
+        REQUIRE(index.size() == NUM_NAMES / 2);
+
+        for(int i= 0; i < NUM_NAMES; i++) {
+            int *value= index.find(names[i]);
+            if(i % 2 == 0) {
+                REQUIRE(value == nullptr);
+            } else {
+                REQUIRE(value != nullptr);
+                REQUIRE(*value == i);
+            }
+        }
+
+        // reinsert after delete reuses slots
+        for(int i= 0; i < NUM_NAMES; i += 2) {
+            REQUIRE(index.insert(names[i], i + NUM_NAMES));
+        }
+        REQUIRE(*index.find("file-4") == 4 + NUM_NAMES);
+        REQUIRE(index.size() == NUM_NAMES);
+    }
+
+    SECTION("clear") {
+        index.clear();
+        REQUIRE(index.size() == 0);
+        REQUIRE(index.find("file-1") == nullptr);
+    }
+}
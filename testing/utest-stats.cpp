@@ -0,0 +1,128 @@
+//
+//  utest-stats.cpp
+//  testing
+//
+
+#include "../catch/catch.hpp"
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <string>
+
+#include "tools.hpp"
+
+#include "myfs-info.h"
+#include "myondiskfs.h"
+#include "stats.h"
+
+#define STATS_PATH "/tmp/stats.bin"
+
+TEST_CASE( "STATS_HISTOGRAM_BUCKETS", "[stats]" ) {
+    // Small values are exact, larger ones within 1/16 of the value
+    for (uint64_t v = 0; v < 16; v++) {
+        REQUIRE(LatencyHistogram::bucketUpperBound(LatencyHistogram::bucketOf(v)) == v);
+    }
+    for (uint64_t v = 16; v < ((uint64_t) 1 << 62); v = v * 3 + 1) {
+        int b = LatencyHistogram::bucketOf(v);
+        REQUIRE(b < LatencyHistogram::BUCKETS);
+        uint64_t upper = LatencyHistogram::bucketUpperBound(b);
+        REQUIRE(upper >= v);
+        REQUIRE(upper - v <= v / 16);
+        REQUIRE(LatencyHistogram::bucketOf(upper) == b);
+        REQUIRE(LatencyHistogram::bucketOf(upper + 1) == b + 1);
+    }
+    REQUIRE(LatencyHistogram::bucketOf(UINT64_MAX) == LatencyHistogram::BUCKETS - 1);
+}
+
+TEST_CASE( "STATS_HISTOGRAM_QUANTILES", "[stats]" ) {
+    LatencyHistogram h;
+    REQUIRE(h.getQuantile(0.5) == 0);
+
+    for (uint64_t v = 1; v <= 1000; v++) {
+        h.record(v * 1000);
+    }
+    REQUIRE(h.getCount() == 1000);
+    REQUIRE(h.getMax() == 1000000);
+    REQUIRE(h.getSum() == 500500000);
+
+    uint64_t median = h.getQuantile(0.5);
+    REQUIRE(median >= 500000);
+    REQUIRE(median <= 500000 + 500000 / 16);
+    uint64_t p99 = h.getQuantile(0.99);
+    REQUIRE(p99 >= 990000);
+    REQUIRE(p99 <= 1000000);
+    REQUIRE(h.getQuantile(1.0) == 1000000);
+}
+
+TEST_CASE( "STATS_FORMAT", "[stats]" ) {
+    OpStats stats;
+    stats.record(OP_READ, 2000, 4096, 4096);
+    stats.record(OP_READ, 4000, -5, 0);
+    stats.record(OP_GETATTR, 100, 0, 0);
+
+    std::string text;
+    stats.format(text);
+    REQUIRE(text.find("myfs_ops_total{op=\"read\"} 2\n") != std::string::npos);
+    REQUIRE(text.find("myfs_op_errors_total{op=\"read\"} 1\n") != std::string::npos);
+    REQUIRE(text.find("myfs_op_bytes_total{op=\"read\"} 4096\n") != std::string::npos);
+    REQUIRE(text.find("myfs_op_latency_seconds_count{op=\"getattr\"} 1\n") != std::string::npos);
+    REQUIRE(text.find("myfs_op_latency_seconds{op=\"read\",quantile=\"0.99\"} 4e-06\n") != std::string::npos);
+    // Operations never called are left out
+    REQUIRE(text.find("op=\"write\"") == std::string::npos);
+}
+
+TEST_CASE( "STATS_FILE", "[stats]" ) {
+    remove(STATS_PATH);
+
+    MyFsInfo info;
+    memset(&info, 0, sizeof(info));
+    info.contFile = (char *) STATS_PATH;
+    info.logFile = (char *) "/dev/null";
+
+    MyOnDiskFS *fs = new MyOnDiskFS();
+    REQUIRE(fs->setup(&info) == 0);
+
+    char buf[BLOCK_SIZE];
+    memset(buf, 'x', BLOCK_SIZE);
+    REQUIRE(fs->fuseMknod("/file", S_IFREG | 0644, 0) == 0);
+    REQUIRE(fs->fuseWrite("/file", buf, BLOCK_SIZE, 0, nullptr) == BLOCK_SIZE);
+    fs->opStats.record(OP_WRITE, 1000, BLOCK_SIZE, BLOCK_SIZE);
+
+    REQUIRE(MyFS::isStatsFile("/" STATS_FILE_NAME));
+    REQUIRE_FALSE(MyFS::isStatsFile("/file"));
+
+    struct stat st;
+    REQUIRE(fs->statsGetattr(&st) == 0);
+    REQUIRE(S_ISREG(st.st_mode));
+    REQUIRE((st.st_mode & 0222) == 0);
+    REQUIRE(st.st_size > 0);
+
+    struct fuse_file_info fi;
+    memset(&fi, 0, sizeof(fi));
+    fi.flags = O_RDWR;
+    REQUIRE(fs->statsOpen(&fi) == -EACCES);
+    fi.flags = O_RDONLY;
+    REQUIRE(fs->statsOpen(&fi) == 0);
+    REQUIRE(fi.direct_io);
+
+    // Read the snapshot in small pieces
+    std::string text;
+    char part[100];
+    int n;
+    while ((n = fs->statsRead(part, sizeof(part), text.size(), &fi)) > 0) {
+        text.append(part, n);
+    }
+    REQUIRE(n == 0);
+    REQUIRE(fs->statsRelease(&fi) == 0);
+
+    REQUIRE(text.find("myfs_ops_total{op=\"write\"} 1\n") != std::string::npos);
+    REQUIRE(text.find("myfs_cache_hits_total ") != std::string::npos);
+    REQUIRE(text.find("myfs_device_written_blocks_total ") != std::string::npos);
+    REQUIRE(text.find("myfs_free_blocks ") != std::string::npos);
+    REQUIRE(text.find("myfs_log_dropped_total 0\n") != std::string::npos);
+
+    fs->fuseDestroy();
+    delete fs;
+    remove(STATS_PATH);
+}